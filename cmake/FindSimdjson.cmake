@@ -0,0 +1,25 @@
+#  SIMDJSON_FOUND - system has simdjson
+#  SIMDJSON_INCLUDE_DIRS - the simdjson include directory
+#  SIMDJSON_LIBRARIES - The libraries needed to use simdjson
+
+find_path(SIMDJSON_INCLUDE_DIRS
+	NAMES simdjson.h
+	PATH_SUFFIXES include
+)
+if(SIMDJSON_INCLUDE_DIRS)
+	set(HAVE_SIMDJSON_H 1)
+endif()
+
+if(SIMDJSON_USE_STATIC_LIBS)
+	find_library(SIMDJSON_LIBRARIES NAMES "libsimdjson.a")
+else()
+	find_library(SIMDJSON_LIBRARIES NAMES simdjson)
+endif()
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(Simdjson
+	DEFAULT_MSG
+	SIMDJSON_INCLUDE_DIRS SIMDJSON_LIBRARIES HAVE_SIMDJSON_H
+)
+
+mark_as_advanced(SIMDJSON_INCLUDE_DIRS SIMDJSON_LIBRARIES HAVE_SIMDJSON_H)
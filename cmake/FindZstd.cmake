@@ -0,0 +1,25 @@
+#  ZSTD_FOUND - system has zstd
+#  ZSTD_INCLUDE_DIRS - the zstd include directory
+#  ZSTD_LIBRARIES - The libraries needed to use zstd
+
+find_path(ZSTD_INCLUDE_DIRS
+	NAMES zstd.h
+	PATH_SUFFIXES include
+)
+if(ZSTD_INCLUDE_DIRS)
+	set(HAVE_ZSTD_H 1)
+endif()
+
+if(ZSTD_USE_STATIC_LIBS)
+	find_library(ZSTD_LIBRARIES NAMES "libzstd.a")
+else()
+	find_library(ZSTD_LIBRARIES NAMES zstd)
+endif()
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(Zstd
+	DEFAULT_MSG
+	ZSTD_INCLUDE_DIRS ZSTD_LIBRARIES HAVE_ZSTD_H
+)
+
+mark_as_advanced(ZSTD_INCLUDE_DIRS ZSTD_LIBRARIES HAVE_ZSTD_H)
@@ -24,25 +24,74 @@
 #include <dpp/export.h>
 #include <dpp/snowflake.h>
 #include <dpp/managed.h>
-#include <unordered_map>
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <memory>
 #include <mutex>
 #include <shared_mutex>
+#include <unordered_map>
+#include <utility>
 
 namespace dpp {
 
 extern DPP_EXPORT std::unordered_map<managed*, time_t> deletion_queue;
 extern DPP_EXPORT std::mutex deletion_mutex;
 
+/**
+ * @brief Queue an object for deletion by garbage_collection() once 60 seconds have passed.
+ *
+ * Queueing an object which is already queued restarts its 60 seconds.
+ *
+ * @note The caller must hold deletion_mutex.
+ * @param object object to delete
+ */
+void DPP_EXPORT queue_deletion(managed* object);
+
 /** forward declaration */
 class guild_member;
 
+/**
+ * @brief Each dpp::cache is split into 2^cache_stripe_bits stripes
+ */
+constexpr size_t cache_stripe_bits = 6;
+
+/**
+ * @brief Mix the bits of a snowflake to pick a cache stripe and slot.
+ *
+ * Snowflakes created close together differ mostly in their lowest and
+ * timestamp bits, so these are spread over the whole value first
+ * (the splitmix64 finaliser).
+ *
+ * @param id snowflake to hash
+ * @return uint64_t hash
+ */
+inline uint64_t cache_hash(uint64_t id) {
+	id ^= id >> 30;
+	id *= 0xbf58476d1ce4e5b9ULL;
+	id ^= id >> 27;
+	id *= 0x94d049bb133111ebULL;
+	id ^= id >> 31;
+	return id;
+}
+
 /**
  * @brief A cache object maintains a cache of dpp::managed objects.
- * 
+ *
  * This is for example users, channels or guilds. You may instantiate
  * your own caches, to contain any type derived from dpp::managed including
  * your own types.
- * 
+ *
+ * The cache is split into stripes by a hash of the snowflake id, each with
+ * its own lock, so threads storing different objects rarely wait for each
+ * other. cache::find() takes no lock at all, and is never held up by a
+ * thread storing or removing objects.
+ *
+ * cache::get() returns a reference counted handle instead, which keeps the
+ * object alive for as long as the handle exists. The library treats cached
+ * users, roles, channels and emojis as immutable: an update stores a new
+ * object in place of the old one, so a handle is a stable snapshot.
+ *
  * @note This class is critical to the operation of the library and therefore
  * designed with thread safety in mind.
  * @tparam T class type to store, which should be derived from dpp::managed.
@@ -50,40 +99,526 @@ class guild_member;
 template<class T> class cache {
 private:
 	/**
-	 * @brief Mutex to protect the cache
-	 * 
-	 * This is a shared mutex so reading is cheap.
+	 * @brief Number of stripes
+	 */
+	static constexpr size_t stripe_count = 1ULL << cache_stripe_bits;
+
+	/**
+	 * @brief Fewest slots in a stripe's table
+	 */
+	static constexpr size_t min_capacity = 16;
+
+	/**
+	 * @brief Key of an empty slot. Objects with this id can't be cached.
+	 */
+	static constexpr uint64_t empty_key = UINT64_MAX;
+
+	/**
+	 * @brief One slot of a stripe's table.
+	 *
+	 * Once a slot has a key it keeps it for the life of the table, and removing
+	 * an object only sets its value to nullptr. A lookup without a lock can
+	 * therefore never see a slot change to a different id.
+	 */
+	struct slot {
+		/**
+		 * @brief Id of the object, or empty_key
+		 */
+		std::atomic<uint64_t> key{empty_key};
+
+		/**
+		 * @brief The object, or nullptr if it was removed
+		 */
+		std::atomic<T*> value{nullptr};
+	};
+
+	/**
+	 * @brief Open addressing table of one stripe, at most half full.
+	 *
+	 * When a table is replaced it is queued for deletion just like a removed
+	 * object, so a lookup still reading it has 60 seconds to finish.
+	 */
+	struct table : public managed {
+		/**
+		 * @brief Number of slots minus one
+		 */
+		size_t mask;
+
+		/**
+		 * @brief Slots with a key, including those whose object was removed
+		 */
+		size_t used{0};
+
+		/**
+		 * @brief The slots
+		 */
+		slot* slots;
+
+		/**
+		 * @brief Construct an empty table
+		 * @param capacity number of slots, a power of two
+		 */
+		explicit table(size_t capacity) : mask(capacity - 1), slots(new slot[capacity]) {
+		}
+
+		/**
+		 * @brief Destroy the table. This does not delete the objects in it.
+		 */
+		~table() override {
+			delete[] slots;
+		}
+	};
+
+	/**
+	 * @brief One stripe of the cache, kept off the cache lines of its neighbours
+	 */
+	struct alignas(64) stripe {
+		/**
+		 * @brief Taken by threads changing the stripe, and by cache::get_mutex()
+		 */
+		std::shared_mutex mutex;
+
+		/**
+		 * @brief Current table, or nullptr if nothing was ever stored
+		 */
+		std::atomic<table*> index{nullptr};
+
+		/**
+		 * @brief Number of objects in the stripe
+		 */
+		std::atomic<size_t> live{0};
+
+		/**
+		 * @brief The cache's own handle to each object get() has been called for.
+		 * Its deleter queues the object for deletion once the cache and every
+		 * handle returned by get() have let go of it.
+		 */
+		std::unordered_map<T*, std::shared_ptr<T>> owners;
+	};
+
+	/**
+	 * @brief The stripes
+	 */
+	stripe stripes[stripe_count];
+
+	/**
+	 * @brief Stripe a hash belongs to
+	 * @param hash value of cache_hash()
+	 * @return stripe& the stripe
+	 */
+	stripe& stripe_for(uint64_t hash) {
+		return stripes[hash >> (64 - cache_stripe_bits)];
+	}
+
+	/**
+	 * @brief Find the slot for a key, or the empty slot where it would go.
+	 * The stripe must be locked.
+	 * @param t table to search
+	 * @param hash value of cache_hash() for the key
+	 * @param key id to find
+	 * @return slot& the slot
+	 */
+	static slot& probe(table* t, uint64_t hash, uint64_t key) {
+		for (size_t i = hash & t->mask;; i = (i + 1) & t->mask) {
+			uint64_t k = t->slots[i].key.load(std::memory_order_relaxed);
+			if (k == key || k == empty_key) {
+				return t->slots[i];
+			}
+		}
+	}
+
+	/**
+	 * @brief Replace a stripe's table with a new one sized for its objects
+	 * and room for more, leaving out removed slots. The stripe must be locked.
+	 * @param s stripe to rebuild
+	 * @param room number of objects about to be added
+	 */
+	void rebuild(stripe& s, size_t room) {
+		table* old = s.index.load(std::memory_order_relaxed);
+		size_t wanted = s.live.load(std::memory_order_relaxed) + room;
+		table* t = nullptr;
+		if (wanted) {
+			size_t capacity = min_capacity;
+			while (capacity < wanted * 4) {
+				capacity <<= 1;
+			}
+			t = new table(capacity);
+			for (size_t i = 0; old && i <= old->mask; ++i) {
+				T* v = old->slots[i].value.load(std::memory_order_relaxed);
+				if (v) {
+					uint64_t key = old->slots[i].key.load(std::memory_order_relaxed);
+					slot& n = probe(t, cache_hash(key), key);
+					n.value.store(v, std::memory_order_relaxed);
+					n.key.store(key, std::memory_order_relaxed);
+					t->used++;
+				}
+			}
+		}
+		/* Publishing the table also publishes everything stored in it above */
+		s.index.store(t, std::memory_order_release);
+		if (old) {
+			std::lock_guard<std::mutex> delete_lock(deletion_mutex);
+			queue_deletion(old);
+		}
+	}
+
+	/**
+	 * @brief Find an object in a stripe. The stripe must be locked.
+	 * @param s stripe to search
+	 * @param hash value of cache_hash() for the key
+	 * @param key id to find
+	 * @return T* the object, or nullptr
 	 */
-	std::shared_mutex cache_mutex;
+	static T* locked_find(stripe& s, uint64_t hash, uint64_t key) {
+		table* t = s.index.load(std::memory_order_relaxed);
+		if (!t) {
+			return nullptr;
+		}
+		slot& e = probe(t, hash, key);
+		return e.key.load(std::memory_order_relaxed) == key ? e.value.load(std::memory_order_relaxed) : nullptr;
+	}
 
 	/**
-	 * @brief Container of pointers to cached items
+	 * @brief Let go of an object which is no longer in the cache. It is queued for deletion
+	 * now, or if there are handles to it from get(), when the last of those goes.
+	 * The stripe must be locked.
+	 * @param s stripe the object was in
+	 * @param object object to let go of
 	 */
-	std::unordered_map<snowflake, T*>* cache_map;
+	static void retire(stripe& s, T* object) {
+		auto owner = s.owners.find(object);
+		if (owner != s.owners.end()) {
+			s.owners.erase(owner);
+		} else {
+			std::lock_guard<std::mutex> delete_lock(deletion_mutex);
+			queue_deletion(object);
+		}
+	}
+
+public:
+	/**
+	 * @brief The type returned by cache::get_mutex().
+	 *
+	 * Locking it locks every stripe of the cache, always in the same order, so
+	 * it can be used with std::shared_lock and std::unique_lock just like
+	 * std::shared_mutex.
+	 */
+	class mutex_type {
+		/**
+		 * @brief Cache whose stripes are locked
+		 */
+		cache* owner;
+
+	public:
+		/**
+		 * @brief Construct a mutex for a cache
+		 * @param c owning cache
+		 */
+		explicit mutex_type(cache* c) : owner(c) {
+		}
+
+		mutex_type(const mutex_type&) = delete;
+		mutex_type& operator=(const mutex_type&) = delete;
+
+		/**
+		 * @brief Lock every stripe exclusively
+		 */
+		void lock() {
+			for (auto& s : owner->stripes) {
+				s.mutex.lock();
+			}
+		}
+
+		/**
+		 * @brief Lock every stripe exclusively if none is locked
+		 * @return true if locked
+		 */
+		bool try_lock() {
+			for (size_t i = 0; i < stripe_count; ++i) {
+				if (!owner->stripes[i].mutex.try_lock()) {
+					while (i--) {
+						owner->stripes[i].mutex.unlock();
+					}
+					return false;
+				}
+			}
+			return true;
+		}
+
+		/**
+		 * @brief Unlock every stripe after lock()
+		 */
+		void unlock() {
+			for (auto& s : owner->stripes) {
+				s.mutex.unlock();
+			}
+		}
+
+		/**
+		 * @brief Lock every stripe for reading
+		 */
+		void lock_shared() {
+			for (auto& s : owner->stripes) {
+				s.mutex.lock_shared();
+			}
+		}
+
+		/**
+		 * @brief Lock every stripe for reading if none is locked exclusively
+		 * @return true if locked
+		 */
+		bool try_lock_shared() {
+			for (size_t i = 0; i < stripe_count; ++i) {
+				if (!owner->stripes[i].mutex.try_lock_shared()) {
+					while (i--) {
+						owner->stripes[i].mutex.unlock_shared();
+					}
+					return false;
+				}
+			}
+			return true;
+		}
+
+		/**
+		 * @brief Unlock every stripe after lock_shared()
+		 */
+		void unlock_shared() {
+			for (auto& s : owner->stripes) {
+				s.mutex.unlock_shared();
+			}
+		}
+	};
+
+	/**
+	 * @brief The type returned by cache::get_container().
+	 *
+	 * A read only view of every stripe, which iterates like a map of
+	 * snowflake to T* in no particular order.
+	 */
+	class container_type {
+		/**
+		 * @brief Cache being viewed
+		 */
+		cache* owner;
+
+	public:
+		/**
+		 * @brief Iterates the objects in the cache. Dereferences to a std::pair of id and object.
+		 */
+		class iterator {
+			/**
+			 * @brief Cache being iterated
+			 */
+			cache* owner;
+
+			/**
+			 * @brief Current stripe, or stripe_count at the end
+			 */
+			size_t stripe_index;
+
+			/**
+			 * @brief Current slot in the stripe's table
+			 */
+			size_t slot_index;
+
+			/**
+			 * @brief Id and object of the current slot
+			 */
+			std::pair<snowflake, T*> current;
+
+			/**
+			 * @brief Move forward to the first slot with an object, starting at the current one
+			 */
+			void settle() {
+				for (; stripe_index < stripe_count; ++stripe_index, slot_index = 0) {
+					table* t = owner->stripes[stripe_index].index.load(std::memory_order_acquire);
+					for (; t && slot_index <= t->mask; ++slot_index) {
+						T* v = t->slots[slot_index].value.load(std::memory_order_acquire);
+						if (v) {
+							current = {t->slots[slot_index].key.load(std::memory_order_relaxed), v};
+							return;
+						}
+					}
+				}
+				slot_index = 0;
+			}
+
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = std::pair<snowflake, T*>;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const value_type*;
+			using reference = const value_type&;
+
+			/**
+			 * @brief Construct an iterator at the first object at or after a position
+			 * @param c cache to iterate
+			 * @param stripe_at stripe to start at
+			 * @param slot_at slot to start at
+			 */
+			iterator(cache* c, size_t stripe_at, size_t slot_at = 0) : owner(c), stripe_index(stripe_at), slot_index(slot_at) {
+				settle();
+			}
+
+			/**
+			 * @brief The id and object
+			 * @return reference pair of id and object
+			 */
+			reference operator*() const {
+				return current;
+			}
+
+			/**
+			 * @brief The id and object
+			 * @return pointer pair of id and object
+			 */
+			pointer operator->() const {
+				return &current;
+			}
+
+			/**
+			 * @brief Move to the next object
+			 * @return iterator& this iterator
+			 */
+			iterator& operator++() {
+				++slot_index;
+				settle();
+				return *this;
+			}
+
+			/**
+			 * @brief Move to the next object
+			 * @return iterator the iterator before it moved
+			 */
+			iterator operator++(int) {
+				iterator before = *this;
+				++*this;
+				return before;
+			}
+
+			/**
+			 * @brief Compare positions
+			 * @return true if both iterators are at the same object
+			 */
+			bool operator==(const iterator& other) const {
+				return stripe_index == other.stripe_index && slot_index == other.slot_index;
+			}
+
+			/**
+			 * @brief Compare positions
+			 * @return true if the iterators are at different objects
+			 */
+			bool operator!=(const iterator& other) const {
+				return !(*this == other);
+			}
+		};
+
+		/**
+		 * @brief Construct a view of a cache
+		 * @param c cache to view
+		 */
+		explicit container_type(cache* c) : owner(c) {
+		}
+
+		container_type(const container_type&) = delete;
+		container_type& operator=(const container_type&) = delete;
+
+		/**
+		 * @brief Iterator at the first object
+		 * @return iterator
+		 */
+		iterator begin() const {
+			return iterator(owner, 0);
+		}
+
+		/**
+		 * @brief Iterator past the last object
+		 * @return iterator
+		 */
+		iterator end() const {
+			return iterator(owner, stripe_count);
+		}
+
+		/**
+		 * @brief Find an object by id
+		 * @param id id to find
+		 * @return iterator at the object, or end() if it is not in the cache
+		 */
+		iterator find(snowflake id) const {
+			uint64_t key = id;
+			uint64_t hash = cache_hash(key);
+			size_t stripe_index = hash >> (64 - cache_stripe_bits);
+			table* t = owner->stripes[stripe_index].index.load(std::memory_order_acquire);
+			if (t && key != empty_key) {
+				for (size_t i = hash & t->mask;; i = (i + 1) & t->mask) {
+					uint64_t k = t->slots[i].key.load(std::memory_order_acquire);
+					if (k == key) {
+						if (t->slots[i].value.load(std::memory_order_acquire)) {
+							return iterator(owner, stripe_index, i);
+						}
+						break;
+					}
+					if (k == empty_key) {
+						break;
+					}
+				}
+			}
+			return end();
+		}
+
+		/**
+		 * @brief Number of objects
+		 * @return size_t count
+		 */
+		size_t size() const {
+			return owner->count();
+		}
+
+		/**
+		 * @brief Check if there are no objects
+		 * @return true if empty
+		 */
+		bool empty() const {
+			return size() == 0;
+		}
+	};
+
+private:
+	/**
+	 * @brief Returned by get_mutex()
+	 */
+	mutex_type all_stripes{this};
+
+	/**
+	 * @brief Returned by get_container()
+	 */
+	container_type container{this};
+
 public:
 
 	/**
 	 * @brief Construct a new cache object.
-	 * 
+	 *
 	 * @note Caches must contain classes derived from dpp::managed.
 	 */
-	cache() {
-		cache_map = new std::unordered_map<snowflake, T*>;
-	}
+	cache() = default;
 
 	/**
 	 * @brief Destroy the cache object
-	 * 
-	 * @note This does not delete objects stored in the cache.
+	 *
+	 * @note This does not delete objects stored in the cache, except those which get()
+	 * was called for: they are queued for deletion once their last handle goes.
 	 */
 	~cache() {
-		std::unique_lock l(cache_mutex);
-		delete cache_map;			
+		std::unique_lock l(all_stripes);
+		for (auto& s : stripes) {
+			delete s.index.load(std::memory_order_relaxed);
+		}
 	}
 
 	/**
 	 * @brief Store an object in the cache. Passing a nullptr will have no effect.
-	 * 
+	 *
 	 * The object must be derived from dpp::managed and should be allocated on the heap.
 	 * Generally this is done via `new`. Once stored in the cache the lifetime of the stored
 	 * object is managed by the cache class unless the cache is deleted (at which point responsibility
@@ -91,176 +626,359 @@ public:
 	 * cache::remove() method is called by placing them into a garbage collection queue for deletion
 	 * within the next 60 seconds, which are then deleted in bulk for efficiency and to aid thread
 	 * safety.
-	 * 
+	 *
 	 * @note Adding an object to the cache with an ID which already exists replaces that entry.
 	 * The previously entered cache item is inserted into the garbage collection queue for deletion
 	 * similarly to if cache::remove() was called first.
-	 * 
+	 *
 	 * @param object object to store. Storing a pointer to the cache relinquishes ownership to the cache object.
 	 */
 	void store(T* object) {
-		if (!object) {
+		uint64_t key = object ? uint64_t(object->id) : empty_key;
+		if (key == empty_key) {
 			return;
 		}
-		std::unique_lock l(cache_mutex);
-		auto existing = cache_map->find(object->id);
-		if (existing == cache_map->end()) {
-			(*cache_map)[object->id] = object;
-		} else if (object != existing->second) {
-			/* Flag old pointer for deletion and replace */
-			std::lock_guard<std::mutex> delete_lock(deletion_mutex);
-			deletion_queue[existing->second] = time(nullptr);
-			(*cache_map)[object->id] = object;
+		uint64_t hash = cache_hash(key);
+		stripe& s = stripe_for(hash);
+		std::unique_lock l(s.mutex);
+		table* t = s.index.load(std::memory_order_relaxed);
+		if (t) {
+			slot& e = probe(t, hash, key);
+			if (e.key.load(std::memory_order_relaxed) == key) {
+				T* existing = e.value.load(std::memory_order_relaxed);
+				if (existing == object) {
+					return;
+				}
+				e.value.store(object, std::memory_order_release);
+				if (existing) {
+					/* Flag old pointer for deletion */
+					retire(s, existing);
+				} else {
+					s.live.fetch_add(1, std::memory_order_relaxed);
+				}
+				return;
+			}
+		}
+		if (!t || (t->used + 1) * 2 > t->mask + 1) {
+			rebuild(s, 1);
+			t = s.index.load(std::memory_order_relaxed);
 		}
+		/* The value goes in first, so a lookup that sees the key also sees the object */
+		slot& e = probe(t, hash, key);
+		e.value.store(object, std::memory_order_relaxed);
+		e.key.store(key, std::memory_order_release);
+		t->used++;
+		s.live.fetch_add(1, std::memory_order_relaxed);
 	}
 
 	/**
 	 * @brief Remove an object from the cache.
-	 * 
+	 *
 	 * @note The cache class takes ownership of the pointer, and calling this method will
 	 * cause deletion of the object within the next 60 seconds by means of a garbage
 	 * collection queue. This queue aids in efficiency by freeing memory in bulk, and
 	 * assists in thread safety by ensuring that all deletions can be locked and freed
 	 * at the same time.
-	 * 
+	 *
 	 * @param object object to remove. Passing a nullptr will have no effect.
 	 */
 	void remove(T* object) {
-		if (!object) {
+		uint64_t key = object ? uint64_t(object->id) : empty_key;
+		if (key == empty_key) {
+			return;
+		}
+		uint64_t hash = cache_hash(key);
+		stripe& s = stripe_for(hash);
+		std::unique_lock l(s.mutex);
+		table* t = s.index.load(std::memory_order_relaxed);
+		if (!t) {
 			return;
 		}
-		std::unique_lock l(cache_mutex);
-		std::lock_guard<std::mutex> delete_lock(deletion_mutex);
-		auto existing = cache_map->find(object->id);
-		if (existing != cache_map->end()) {
-			cache_map->erase(existing);
-			deletion_queue[object] = time(nullptr);
+		slot& e = probe(t, hash, key);
+		if (e.key.load(std::memory_order_relaxed) == key && e.value.load(std::memory_order_relaxed)) {
+			e.value.store(nullptr, std::memory_order_release);
+			s.live.fetch_sub(1, std::memory_order_relaxed);
+			retire(s, object);
 		}
 	}
 
 	/**
 	 * @brief Find an object in the cache by id.
-	 * 
+	 *
 	 * The cache is searched for the object. All dpp::managed objects have a snowflake id
-	 * (this is the only field dpp::managed actually has).
-	 * 
+	 * (this is the only field dpp::managed actually has). This takes no lock.
+	 *
 	 * @warning Do not hang onto objects returned by cache::find() indefinitely. They may be
 	 * deleted at a later date if cache::remove() is called. If persistence is required,
-	 * take a copy of the object after checking its pointer is non-null.
-	 * 
+	 * use cache::get(), or take a copy of the object after checking its pointer is non-null.
+	 *
 	 * @param id Object snowflake id to find
 	 * @return Found object or nullptr if the object with this id does not exist.
 	 */
 	T* find(snowflake id) {
-		std::shared_lock l(cache_mutex);
-		auto r = cache_map->find(id);
-		if (r != cache_map->end()) {
-			return r->second;
+		uint64_t key = id;
+		uint64_t hash = cache_hash(key);
+		table* t = stripe_for(hash).index.load(std::memory_order_acquire);
+		if (!t || key == empty_key) {
+			return nullptr;
+		}
+		for (size_t i = hash & t->mask;; i = (i + 1) & t->mask) {
+			uint64_t k = t->slots[i].key.load(std::memory_order_acquire);
+			if (k == key) {
+				return t->slots[i].value.load(std::memory_order_acquire);
+			}
+			if (k == empty_key) {
+				return nullptr;
+			}
 		}
-		return nullptr;
+	}
+
+	/**
+	 * @brief Get a handle to an object in the cache by id.
+	 *
+	 * Unlike cache::find(), the object stays valid for as long as the handle is held,
+	 * even after it is removed from the cache or replaced by a newer version. Users,
+	 * roles, channels and emojis are never changed in place once cached, so the handle
+	 * is a snapshot of the object as it was when get() was called. To see an update,
+	 * call get() again.
+	 *
+	 * @note Guilds are still updated in place. A handle keeps the guild alive, but its
+	 * lists must be read under its mutex; see dpp::guild::read.
+	 *
+	 * @param id Object snowflake id to find
+	 * @return Handle to the object, or an empty handle if the object with this id does not exist.
+	 */
+	std::shared_ptr<const T> get(snowflake id) {
+		uint64_t key = id;
+		if (key == empty_key) {
+			return nullptr;
+		}
+		uint64_t hash = cache_hash(key);
+		stripe& s = stripe_for(hash);
+		{
+			/* Most calls find the handle made by an earlier call */
+			std::shared_lock l(s.mutex);
+			T* object = locked_find(s, hash, key);
+			if (!object) {
+				return nullptr;
+			}
+			auto owner = s.owners.find(object);
+			if (owner != s.owners.end()) {
+				return owner->second;
+			}
+		}
+		std::unique_lock l(s.mutex);
+		T* object = locked_find(s, hash, key);
+		if (!object) {
+			return nullptr;
+		}
+		std::shared_ptr<T>& owner = s.owners[object];
+		if (!owner) {
+			owner = std::shared_ptr<T>(object, [](T* retired) {
+				/* Raw pointers from find() may still be in use, so delete it in the usual way */
+				std::lock_guard<std::mutex> delete_lock(deletion_mutex);
+				queue_deletion(retired);
+			});
+		}
+		return owner;
 	}
 
 	/**
 	 * @brief Return a count of the number of items in the cache.
-	 * 
+	 *
 	 * This is used by the library e.g. to count guilds, users, and roles
 	 * stored within caches.
 	 * get
 	 * @return uint64_t count of items in the cache
 	 */
 	uint64_t count() {
-		std::shared_lock l(cache_mutex);
-		return cache_map->size();
+		uint64_t total = 0;
+		for (auto& s : stripes) {
+			total += s.live.load(std::memory_order_relaxed);
+		}
+		return total;
 	}
 
-	/** 
+	/**
 	 * @brief Return the cache's locking mutex.
-	 * 
-	 * Use this whenever you manipulate or iterate raw elements in the cache!
-	 * 
+	 *
+	 * Use this whenever you iterate raw elements in the cache!
+	 *
 	 * @note If you are only reading from the cache's container, wrap this
 	 * mutex in `std::shared_lock`, else wrap it in a `std::unique_lock`.
 	 * Shared locks will allow for multiple readers whilst blocking writers,
 	 * and unique locks will allow only one writer whilst blocking readers
-	 * and writers.
-	 * 
+	 * and writers. Locking it locks every stripe, so keep it held briefly.
+	 *
 	 * **Example:**
-	 * 
+	 *
 	 * ```cpp
 	 * dpp::cache<guild>* c = dpp::get_guild_cache();
-	 * std::unordered_map<snowflake, guild*>& gc = c->get_container();
+	 * auto& gc = c->get_container();
 	 * std::shared_lock l(c->get_mutex()); // MUST LOCK HERE
 	 * for (auto g = gc.begin(); g != gc.end(); ++g) {
 	 *     dpp::guild* gp = (dpp::guild*)g->second;
 	 *     // Do something here with the guild* in 'gp'
 	 * }
-	 * ``` 
-	 * 
+	 * ```
+	 *
 	 * @return The mutex used to protect the container
 	 */
-	std::shared_mutex& get_mutex() {
-		return this->cache_mutex;			
+	mutex_type& get_mutex() {
+		return all_stripes;
 	}
 
 	/**
-	 * @brief Get the container unordered map
-	 * 
+	 * @brief Get the container
+	 *
 	 * @warning Be sure to use cache::get_mutex() correctly if you
-	 * manipulate or iterate the map returned by this method! If you do
+	 * iterate the container returned by this method! If you do
 	 * not, this is not thread safe and will cause crashes!
-	 * 
+	 *
 	 * @see cache::get_mutex
-	 * 
-	 * @return A reference to the cache's container map
+	 *
+	 * @return A read only view of the cache's stripes, which iterates like a map
 	 */
-	auto & get_container() {
-		return *(this->cache_map);		
+	container_type& get_container() {
+		return container;
 	}
 
 	/**
-	 * @brief "Rehash" a cache by reallocating the map and copying
+	 * @brief "Rehash" a cache by reallocating each stripe's table and copying
 	 * all elements into the new one.
-	 * 
-	 * Over a long running timeframe, unordered maps can grow in size
-	 * due to bucket allocation, this function frees that unused memory
-	 * to keep the maps in control over time. If this is an issue which
-	 * is apparent with your use of dpp::cache objects, you should periodically
-	 * call this method.
-	 * 
+	 *
+	 * Removing an object leaves its slot in use until the table is next
+	 * rebuilt. This rebuilds every table at the smallest size that fits, to
+	 * free that memory. If this is an issue which is apparent with your use
+	 * of dpp::cache objects, you should periodically call this method.
+	 *
 	 * @warning May be time consuming! This function is O(n) in relation to the
 	 * number of cached entries.
 	 */
 	void rehash() {
-		std::unique_lock l(cache_mutex);
-		std::unordered_map<snowflake, T*>* n = new std::unordered_map<snowflake, T*>;
-		n->reserve(cache_map->size());
-		for (auto t = cache_map->begin(); t != cache_map->end(); ++t) {
-			n->insert(*t);
-		}
-		delete cache_map;
-		cache_map = n;
+		for (auto& s : stripes) {
+			std::unique_lock l(s.mutex);
+			rebuild(s, 0);
+		}
+	}
+
+	/**
+	 * @brief Rebuild the tables of stripes which are empty, or using under an
+	 * eighth of their slots.
+	 *
+	 * Stripes are rebuilt one at a time, locking only that stripe, and a cache
+	 * whose size is steady is left alone entirely. This is what
+	 * garbage_collection() calls.
+	 *
+	 * @return true if any stripe was rebuilt
+	 */
+	bool shrink() {
+		bool shrunk = false;
+		for (auto& s : stripes) {
+			auto sparse = [&s]() {
+				table* t = s.index.load(std::memory_order_acquire);
+				size_t live = s.live.load(std::memory_order_relaxed);
+				return t && (live == 0 || (t->mask + 1 > min_capacity && live * 8 < t->mask + 1));
+			};
+			if (sparse()) {
+				std::unique_lock l(s.mutex);
+				if (sparse()) {
+					rebuild(s, 0);
+					shrunk = true;
+				}
+			}
+		}
+		return shrunk;
 	}
 
 	/**
 	 * @brief Get "real" size in RAM of the cached objects
-	 * 
+	 *
 	 * This does not include metadata used to maintain the unordered map itself.
-	 * 
+	 *
 	 * @return size_t size of cache in bytes
 	 */
 	size_t bytes() {
-		std::shared_lock l(cache_mutex);
-		return sizeof(*this) + (cache_map->bucket_count() * sizeof(size_t));
+		size_t total = sizeof(*this);
+		for (auto& s : stripes) {
+			std::shared_lock l(s.mutex);
+			table* t = s.index.load(std::memory_order_relaxed);
+			if (t) {
+				total += sizeof(table) + (t->mask + 1) * sizeof(slot);
+			}
+		}
+		return total;
 	}
 
 };
 
 /**
- * Run garbage collection across all caches removing deleted items
+ * @brief Statistics about cache garbage collection
+ * @see get_gc_stats
+ */
+struct DPP_EXPORT gc_stats {
+	/**
+	 * @brief Number of times garbage_collection() has run
+	 */
+	uint64_t runs{0};
+
+	/**
+	 * @brief Total objects deleted
+	 */
+	uint64_t objects_freed{0};
+
+	/**
+	 * @brief Objects waiting in the deletion queue
+	 */
+	uint64_t objects_pending{0};
+
+	/**
+	 * @brief Number of times a cache has been rehashed to release unused buckets
+	 */
+	uint64_t rehashes{0};
+
+	/**
+	 * @brief Wall time of the last run, in milliseconds
+	 */
+	double last_run_ms{0};
+
+	/**
+	 * @brief Total wall time of all runs, in milliseconds
+	 */
+	double total_run_ms{0};
+
+	/**
+	 * @brief Longest time the last run held the deletion queue or a cache
+	 * locked exclusively, in milliseconds. This is how long other threads
+	 * could have been kept waiting.
+	 */
+	double last_pause_ms{0};
+
+	/**
+	 * @brief Longest such pause of any run, in milliseconds
+	 */
+	double max_pause_ms{0};
+};
+
+/**
+ * @brief Run garbage collection across all caches removing deleted items
  * that have been deleted over 60 seconds ago.
+ *
+ * Each call does a small, bounded amount of work: expired objects are deleted
+ * in batches until a couple of milliseconds have passed, leaving the rest for
+ * the next call, and at most one of the global caches is rehashed, and then only
+ * if it has shrunk enough to be wasting memory. The library calls this once a
+ * second from the timer wheel of the first started cluster, off the socket engine
+ * threads, however many clusters the process has.
  */
 void DPP_EXPORT garbage_collection();
 
+/**
+ * @brief Get statistics about garbage collection so far
+ * @return gc_stats A copy of the statistics
+ */
+gc_stats DPP_EXPORT get_gc_stats();
+
 #define cache_decl(type, setter, getter, counter) /** Find an object in the cache by id. @return type* Pointer to the object or nullptr when it's not found */ DPP_EXPORT class type * setter (snowflake id); DPP_EXPORT cache<class type> * getter (); /** Get the amount of cached type objects. */ DPP_EXPORT uint64_t counter ();
 
 /* Declare major caches */
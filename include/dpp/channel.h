@@ -714,6 +714,8 @@ public:
 	 * dpp::channel::get_voice_members() instead for this.
 	 * @return A map of guild members keyed by user id.
 	 * @note If the guild this channel belongs to is not in the cache, the function will always return 0.
+	 * @note Locks the guild while building the map. The pointers point into dpp::guild::members and
+	 * are invalidated when members are added or removed, so prefer dpp::guild::read for cached guilds.
 	 */
 	std::map<snowflake, class guild_member*> get_members();
 
@@ -722,6 +724,7 @@ public:
 	 * The map is keyed by snowflake id of the user.
 	 * 
 	 * @return std::map<snowflake, voicestate> The voice members of the channel
+	 * @note Locks the guild
 	 */
 	std::map<snowflake, voicestate> get_voice_members();
 
@@ -38,6 +38,7 @@
 #include <dpp/auditlog.h>
 #include <dpp/queues.h>
 #include <dpp/cache.h>
+#include <dpp/flat_map.h>
 #include <dpp/intents.h>
 #include <dpp/discordevents.h>
 #include <dpp/sync.h>
@@ -115,7 +116,7 @@ class DPP_EXPORT cluster {
 	/**
 	 * @brief Active DM channels for the bot
 	 */
-	std::unordered_map<snowflake, snowflake> dm_channels;
+	flat_map<snowflake, snowflake> dm_channels;
 
 	/**
 	 * @brief Active shards on this cluster. Shard IDs may have gaps between if there
@@ -124,14 +125,21 @@ class DPP_EXPORT cluster {
 	shard_list shards;
 
 	/**
-	 * @brief List of all active registered timers
+	 * @brief Number of socket engine threads requested in the constructor, 0 for automatic
 	 */
-	timer_reg_t timer_list;
+	uint32_t socket_threads;
 
 	/**
-	 * @brief List of timers by time
+	 * @brief Socket engines servicing the shards, each running on its own thread.
+	 * Created by start() and destroyed by shutdown().
 	 */
-	timer_next_t next_timer;
+	std::vector<std::unique_ptr<socket_engine_base>> socket_engines;
+
+	/**
+	 * @brief Active timers, driven by the wheel's own thread so that they
+	 * tick whether or not any shards are connected
+	 */
+	timer_wheel timers;
 
 	/**
 	 * @brief Mutex to work with named_commands and synchronize read write access
@@ -166,16 +174,16 @@ class DPP_EXPORT cluster {
 #endif
 
 	/**
-	 * @brief Tick active timers
+	 * @brief Register this cluster for cache garbage collection. Collection is
+	 * process-wide, so only the first started cluster runs it, on its timer wheel.
 	 */
-	void tick_timers();
+	void start_garbage_collection();
 
 	/**
-	 * @brief Reschedule a timer for its next tick
-	 * 
-	 * @param t Timer to reschedule
+	 * @brief Deregister this cluster from cache garbage collection, handing the
+	 * collection timer on to another started cluster if this one was running it
 	 */
-	void timer_reschedule(timer_t* t);
+	void stop_garbage_collection();
 public:
 	/**
 	 * @brief Current bot token for all shards on this cluster and all commands sent via HTTP
@@ -229,6 +237,11 @@ public:
 	 */
 	websocket_protocol_t ws_mode;
 
+	/**
+	 * @brief Transport compression for all shards in the cluster
+	 */
+	websocket_compression_t ws_compression;
+
 	/**
 	 * @brief Condition variable notified when the cluster is terminating.
 	 */
@@ -251,9 +264,11 @@ public:
 	 * @param policy Set the caching policy for the cluster, either lazy (only cache users/members when they message the bot) or aggressive (request whole member lists on seeing new guilds too)
 	 * @param request_threads The number of threads to allocate for making HTTP requests to Discord. This defaults to 12. You can increase this at runtime via the object returned from get_rest().
 	 * @param request_threads_raw The number of threads to allocate for making HTTP requests to sites outside of Discord. This defaults to 1. You can increase this at runtime via the object returned from get_raw_rest().
+	 * @param socket_threads The number of socket engine threads which service every shard's websocket. Shards are spread evenly across them.
+	 * The default of 0 uses one thread per CPU core, but never more threads than this cluster has shards.
 	 * @throw dpp::exception Thrown on windows, if WinSock fails to initialise, or on any other system if a dpp::request_queue fails to construct
 	 */
-	cluster(const std::string& token, uint32_t intents = i_default_intents, uint32_t shards = 0, uint32_t cluster_id = 0, uint32_t maxclusters = 1, bool compressed = true, cache_policy_t policy = cache_policy::cpol_default, uint32_t request_threads = 12, uint32_t request_threads_raw = 1);
+	cluster(const std::string& token, uint32_t intents = i_default_intents, uint32_t shards = 0, uint32_t cluster_id = 0, uint32_t maxclusters = 1, bool compressed = true, cache_policy_t policy = cache_policy::cpol_default, uint32_t request_threads = 12, uint32_t request_threads_raw = 1, uint32_t socket_threads = 0);
 
 	/**
 	 * @brief dpp::cluster is non-copyable
@@ -286,6 +301,14 @@ public:
 	 */
 	void shutdown();
 
+	/**
+	 * @brief Get the socket engine a shard should run on. Shards are spread
+	 * round-robin over the cluster's socket engine threads.
+	 * @param shard_id Shard ID
+	 * @return socket engine, or nullptr if the cluster has not been started
+	 */
+	socket_engine_base* get_socket_engine(uint32_t shard_id);
+
 	/**
 	 * @brief Get the rest_queue object which handles HTTPS requests to Discord
 	 * @return request_queue* pointer to request_queue object
@@ -298,6 +321,14 @@ public:
 	 */
 	request_queue* get_raw_rest();
 
+	/**
+	 * @brief Get the combined counters of the keep-alive connection pools used by
+	 * both REST request queues: pool hits and misses, new connections (handshakes)
+	 * and currently idle connections.
+	 * @return connection pool counters
+	 */
+	connection_pool_stats get_connection_pool_stats();
+
 	/**
 	 * @brief Set the websocket protocol for all shards on this cluster.
 	 * You should call this method before cluster::start.
@@ -310,6 +341,19 @@ public:
 	 */
 	cluster& set_websocket_protocol(websocket_protocol_t mode);
 
+	/**
+	 * @brief Set the transport compression for all shards on this cluster.
+	 * You should call this method before cluster::start.
+	 * zstd-stream uses less CPU per message and less bandwidth than zlib-stream,
+	 * but needs D++ to have been built with libzstd.
+	 *
+	 * @param mode compression to use, wsc_none, wsc_zlib or wsc_zstd.
+	 * @return cluster& Reference to self for chaining.
+	 * @throw dpp::logic_exception If called after the cluster is started (this is not supported),
+	 * or if wsc_zstd is requested and D++ was built without zstd support
+	 */
+	cluster& set_websocket_compression(websocket_compression_t mode);
+
 	/**
 	 * @brief Set the audit log reason for the next REST call to be made.
 	 * This is set per-thread, so you must ensure that if you call this method, your request that
@@ -383,6 +427,16 @@ public:
 	 */
 	timer start_timer(timer_callback_t on_tick, uint64_t frequency, timer_callback_t on_stop = {});
 
+	/**
+	 * @brief Start a timer with millisecond resolution. Every `frequency`, the callback is called.
+	 *
+	 * @param on_tick The callback lambda to call for this timer when ticked
+	 * @param frequency How often to tick the timer, e.g. std::chrono::milliseconds(250)
+	 * @param on_stop The callback lambda to call for this timer when it is stopped
+	 * @return timer A handle to the timer, used to remove that timer later
+	 */
+	timer start_timer(timer_callback_t on_tick, std::chrono::milliseconds frequency, timer_callback_t on_stop = {});
+
 	/**
 	 * @brief Stop a ticking timer
 	 * 
@@ -392,6 +446,14 @@ public:
 	 */
 	bool stop_timer(timer t);
 
+	/**
+	 * @brief Get the timer wheel which drives this cluster's timers, for adding
+	 * one-shot timers or timers whose first tick differs from their interval
+	 *
+	 * @return timer_wheel& the cluster's timer wheel
+	 */
+	timer_wheel& get_timer_wheel();
+
 #ifdef DPP_CORO
 	/**
 	 * @brief Get an awaitable to wait a certain amount of seconds. Use the co_await keyword on its return value to suspend the coroutine until the timer ends
@@ -400,6 +462,14 @@ public:
 	 * @return async<timer> Object that can be co_await-ed to suspend the function for a certain time
 	 */
 	[[nodiscard]] async<timer> co_sleep(uint64_t seconds);
+
+	/**
+	 * @brief Get an awaitable to wait a certain number of milliseconds. Use the co_await keyword on its return value to suspend the coroutine until the timer ends
+	 *
+	 * @param duration How long to wait for
+	 * @return async<timer> Object that can be co_await-ed to suspend the function for a certain time
+	 */
+	[[nodiscard]] async<timer> co_sleep(std::chrono::milliseconds duration);
 #endif
 
 	/**
@@ -0,0 +1,281 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/export.h>
+#include <dpp/socket.h>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+
+namespace dpp {
+
+class openssl_connection;
+
+/**
+ * @brief An idle, connected socket and its TLS session, detached from the
+ * ssl_client which created it so that another ssl_client may adopt it
+ * without a new TCP and TLS handshake.
+ */
+struct DPP_EXPORT pooled_connection {
+	/**
+	 * @brief Connected socket
+	 */
+	dpp::socket sfd{INVALID_SOCKET};
+
+	/**
+	 * @brief TLS session, or nullptr for a plaintext connection
+	 */
+	openssl_connection* ssl{nullptr};
+
+	/**
+	 * @brief Cipher negotiated when the connection was made
+	 */
+	std::string cipher;
+
+	/**
+	 * @brief Time the connection was made, used to close it once it reaches the pool's maximum age
+	 */
+	time_t created{0};
+
+	/**
+	 * @brief Time the connection was returned to the pool
+	 */
+	time_t last_used{0};
+
+	/**
+	 * @brief Construct an empty pooled connection
+	 */
+	pooled_connection() = default;
+
+	/**
+	 * @brief Non-copyable, ownership of the socket is unique
+	 */
+	pooled_connection(const pooled_connection&) = delete;
+
+	/**
+	 * @brief Non-copyable, ownership of the socket is unique
+	 */
+	pooled_connection& operator=(const pooled_connection&) = delete;
+
+	/**
+	 * @brief Close the socket and free the TLS session, if still owned
+	 */
+	~pooled_connection();
+
+	/**
+	 * @brief Check the connection is still usable: the remote side has not
+	 * closed it, and there is no unread data or error pending on it.
+	 * @return true if the connection can be reused
+	 */
+	bool is_alive() const;
+};
+
+/**
+ * @brief Counters for a connection_pool. All values are totals since the pool
+ * was created, except idle, which is the current number of idle connections.
+ */
+struct DPP_EXPORT connection_pool_stats {
+	/**
+	 * @brief Requests which reused an idle connection
+	 */
+	uint64_t hits{0};
+
+	/**
+	 * @brief Requests which found no usable idle connection
+	 */
+	uint64_t misses{0};
+
+	/**
+	 * @brief New connections made, each costing a TCP (and usually TLS) handshake
+	 */
+	uint64_t handshakes{0};
+
+	/**
+	 * @brief Idle connections closed due to failed health checks, idle timeout,
+	 * maximum age or per-host limits
+	 */
+	uint64_t evictions{0};
+
+	/**
+	 * @brief Connections currently idle in the pool
+	 */
+	uint64_t idle{0};
+
+	/**
+	 * @brief Add another set of counters to this one
+	 * @param other counters to add
+	 * @return reference to self
+	 */
+	connection_pool_stats& operator+=(const connection_pool_stats& other);
+};
+
+/**
+ * @brief A pool of idle keep-alive HTTP(S) connections, keyed by scheme, host
+ * and port. Each dpp::request_queue owns one, shared by all of its request
+ * threads, so that a connection opened by one thread can be reused by any other.
+ *
+ * Connections are only ever used by one request at a time; a connection is
+ * removed from the pool while a request is in flight on it and returned once
+ * the response has been completely read.
+ */
+class DPP_EXPORT connection_pool {
+	/**
+	 * @brief Mutex for idle
+	 */
+	std::mutex pool_mutex;
+
+	/**
+	 * @brief Idle connections by key. The most recently used connection is
+	 * at the back, and is handed out first as it is the least likely to
+	 * have been closed by the server.
+	 */
+	std::unordered_map<std::string, std::vector<std::unique_ptr<pooled_connection>>> idle;
+
+	/**
+	 * @brief Maximum number of idle connections kept per host
+	 */
+	std::atomic<uint32_t> max_idle_per_host;
+
+	/**
+	 * @brief Seconds an idle connection is kept before it is closed
+	 */
+	std::atomic<time_t> idle_timeout;
+
+	/**
+	 * @brief Seconds after it was made that a connection is closed instead of reused, or 0 for no limit
+	 */
+	std::atomic<time_t> max_age;
+
+	/**
+	 * @brief Check whether an idle connection should be closed rather than kept
+	 * @param conn connection
+	 * @param now current time
+	 * @return true if it has been idle too long, is too old, or failed its health check
+	 */
+	bool expired(const pooled_connection& conn, time_t now) const;
+
+	/**
+	 * @brief Counter for hits
+	 */
+	std::atomic<uint64_t> hits{0};
+
+	/**
+	 * @brief Counter for misses
+	 */
+	std::atomic<uint64_t> misses{0};
+
+	/**
+	 * @brief Counter for handshakes
+	 */
+	std::atomic<uint64_t> handshakes{0};
+
+	/**
+	 * @brief Counter for evictions
+	 */
+	std::atomic<uint64_t> evictions{0};
+
+public:
+	/**
+	 * @brief Construct a connection pool
+	 * @param max_idle Maximum number of idle connections kept per host
+	 * @param timeout Seconds an idle connection is kept before it is closed
+	 * @param age Seconds after it was made that a connection is closed instead of reused, or 0 for no limit
+	 */
+	connection_pool(uint32_t max_idle = 8, time_t timeout = 60, time_t age = 600);
+
+	/**
+	 * @brief Build the key a connection is pooled under
+	 * @param hostname host name
+	 * @param port port number
+	 * @param plaintext true for a plaintext connection, false for TLS
+	 * @return pool key
+	 */
+	static std::string make_key(const std::string& hostname, const std::string& port, bool plaintext);
+
+	/**
+	 * @brief Take a healthy idle connection out of the pool. Any dead or expired
+	 * connections found for the same key are closed.
+	 * @param key pool key from make_key()
+	 * @return connection, or nullptr if there is none and a new one must be made
+	 */
+	std::unique_ptr<pooled_connection> acquire(const std::string& key);
+
+	/**
+	 * @brief Return a connection to the pool once a request has completed on it.
+	 * If the host already has the maximum number of idle connections, the
+	 * oldest is closed.
+	 * @param key pool key from make_key()
+	 * @param conn connection
+	 */
+	void release(const std::string& key, std::unique_ptr<pooled_connection> conn);
+
+	/**
+	 * @brief Record that a new connection had to be made
+	 */
+	void count_handshake();
+
+	/**
+	 * @brief Close idle connections which have expired or failed their health check.
+	 * Called once per second by the owning request_queue.
+	 */
+	void prune();
+
+	/**
+	 * @brief Close all idle connections
+	 */
+	void clear();
+
+	/**
+	 * @brief Set the maximum number of idle connections kept per host
+	 * @param max_idle new limit, 0 disables connection reuse
+	 * @return reference to self
+	 */
+	connection_pool& set_max_idle_per_host(uint32_t max_idle);
+
+	/**
+	 * @brief Set how long an idle connection is kept before it is closed
+	 * @param timeout timeout in seconds
+	 * @return reference to self
+	 */
+	connection_pool& set_idle_timeout(time_t timeout);
+
+	/**
+	 * @brief Set how long after it was made a connection is closed instead of reused,
+	 * so that connections are spread over a host's servers as its DNS changes
+	 * @param age maximum age in seconds, 0 for no limit
+	 * @return reference to self
+	 */
+	connection_pool& set_max_age(time_t age);
+
+	/**
+	 * @brief Get the pool's counters
+	 * @return counters
+	 */
+	connection_pool_stats get_stats();
+};
+
+}
@@ -0,0 +1,182 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/export.h>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <string_view>
+
+namespace dpp {
+
+/**
+ * @brief Counters for the transport decompression of one gateway connection.
+ * All values except arena_size are totals since the shard was created.
+ */
+struct DPP_EXPORT decompression_stats {
+	/**
+	 * @brief Compressed bytes received
+	 */
+	uint64_t bytes_in{0};
+
+	/**
+	 * @brief Bytes produced by decompression
+	 */
+	uint64_t bytes_out{0};
+
+	/**
+	 * @brief Complete messages decompressed
+	 */
+	uint64_t messages{0};
+
+	/**
+	 * @brief Time spent decompressing, in seconds
+	 */
+	double decompress_time{0};
+
+	/**
+	 * @brief Bytes currently allocated for the decompression arena
+	 */
+	size_t arena_size{0};
+};
+
+/**
+ * @brief Base class for gateway transport decompressors, see dpp::zlibcontext
+ * and dpp::zstdcontext.
+ *
+ * Each websocket frame is decompressed as it arrives, straight into an arena which
+ * is kept and reused for every message on the shard. The arena only grows when a
+ * message is larger than any before it, so after the first large GUILD_CREATE
+ * burst, decompression allocates nothing.
+ */
+class DPP_EXPORT stream_decompressor {
+	/**
+	 * @brief Counter for bytes_in
+	 */
+	std::atomic<uint64_t> bytes_in{0};
+
+	/**
+	 * @brief Counter for bytes_out
+	 */
+	std::atomic<uint64_t> bytes_out{0};
+
+	/**
+	 * @brief Counter for messages
+	 */
+	std::atomic<uint64_t> messages{0};
+
+	/**
+	 * @brief Time spent decompressing, in nanoseconds
+	 */
+	std::atomic<uint64_t> decompress_ns{0};
+
+	/**
+	 * @brief Capacity of the arena, readable from any thread
+	 */
+	std::atomic<size_t> arena_size{0};
+
+protected:
+	/**
+	 * @brief Decompressed message, reused for each message. Its size is the arena's
+	 * capacity, and only the first arena_used bytes hold the message. It is only
+	 * resized to grow, so its free space is never filled in before being written to.
+	 */
+	std::string arena;
+
+	/**
+	 * @brief Bytes of the arena holding the message so far
+	 */
+	size_t arena_used{0};
+
+	/**
+	 * @brief The least the arena is extended by when the decompressor needs more room
+	 */
+	static constexpr size_t min_arena_growth{16 * 1024};
+
+	/**
+	 * @brief Make sure there is room after the message in the arena for the decompressor
+	 * to write into, growing the arena only if there is not
+	 * @param compressed_size size of the compressed input, used to estimate the room needed
+	 * @return number of bytes of room at arena.data() + arena_used
+	 */
+	size_t grow_arena(size_t compressed_size);
+
+	/**
+	 * @brief Update the counters after a frame has been decompressed
+	 * @param compressed_size bytes of input
+	 * @param decompressed_size bytes of output
+	 * @param complete true if the frame completed a message
+	 * @param start time decompression of the frame started
+	 */
+	void record(size_t compressed_size, size_t decompressed_size, bool complete, std::chrono::steady_clock::time_point start);
+
+public:
+	/**
+	 * @brief Construct a decompressor with an empty arena
+	 */
+	stream_decompressor() = default;
+
+	/**
+	 * @brief Non-copyable
+	 */
+	stream_decompressor(const stream_decompressor&) = delete;
+
+	/**
+	 * @brief Non-copyable
+	 */
+	stream_decompressor& operator=(const stream_decompressor&) = delete;
+
+	/**
+	 * @brief Free the arena
+	 */
+	virtual ~stream_decompressor() = default;
+
+	/**
+	 * @brief Start a new stream, e.g. for a new connection. The arena and counters are kept.
+	 */
+	virtual void reset() = 0;
+
+	/**
+	 * @brief Decompress one websocket frame of the stream into the arena.
+	 * @param frame compressed frame
+	 * @return true if the frame completed a message, which can then be read
+	 * from message() until the next call
+	 * @throw dpp::connection_exception if the stream is corrupt
+	 */
+	virtual bool feed(std::string_view frame) = 0;
+
+	/**
+	 * @brief Get the last completed message
+	 * @return decompressed message, a view into the arena
+	 */
+	[[nodiscard]] std::string_view message() const;
+
+	/**
+	 * @brief Get the decompression counters
+	 * @return counters
+	 */
+	[[nodiscard]] decompression_stats get_stats() const;
+};
+
+}
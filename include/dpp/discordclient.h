@@ -27,6 +27,7 @@
 #include <vector>
 #include <dpp/json_fwd.h>
 #include <dpp/wsclient.h>
+#include <dpp/decompressor.h>
 #include <dpp/dispatcher.h>
 #include <dpp/event.h>
 #include <queue>
@@ -44,13 +45,6 @@ namespace dpp {
 // Forward declarations
 class cluster;
 
-/**
- * @brief This is an opaque class containing zlib library specific structures.
- * We define it this way so that the public facing D++ library doesn't require
- * the zlib headers be available to build against it.
- */
-class zlibcontext;
-
 /**
  * @brief Represents a connection to a voice channel.
  * A client can only connect to one voice channel per guild at a time, so these are stored in a map
@@ -146,6 +140,22 @@ public:
 	voiceconn& disconnect();
 };
 
+/**
+ * @brief An outbound payload waiting in the send queue of a dpp::discord_client
+ */
+struct DPP_EXPORT queued_gateway_message {
+	/**
+	 * @brief JSON or ETF payload, already serialised for the shard's protocol
+	 */
+	std::string payload;
+
+	/**
+	 * @brief While queued, a newer message with the same non-empty key replaces
+	 * this one's payload in place, e.g. "voice:<guild id>" for voice state updates
+	 */
+	std::string coalesce_key;
+};
+
 /** @brief Implements a discord client. Each discord_client connects to one shard and derives from a websocket client. */
 class DPP_EXPORT discord_client : public websocket_client
 {
@@ -189,46 +199,88 @@ private:
 	/**
 	 * @brief Queue of outbound messages
 	 */
-	std::deque<std::string> message_queue;
+	std::deque<queued_gateway_message> message_queue;
 
 	/**
-	 * @brief Thread this shard is executing on
+	 * @brief Times of the gateway sends made in the last minute, oldest first.
+	 * Guarded by queue_mutex.
 	 */
-	std::thread* runner;
+	std::deque<double> send_times;
 
 	/**
-	 * @brief Run shard loop under a thread.
-	 * Calls discord_client::run() from within a std::thread.
+	 * @brief True if send_queued() has been posted to the socket engine and has not run yet.
+	 * Guarded by queue_mutex.
 	 */
-	void thread_run();
+	bool send_scheduled;
 
 	/**
-	 * @brief If true, stream compression is enabled
+	 * @brief Drop send times older than the gateway rate limit window.
+	 * Call with queue_mutex held.
+	 * @param now Current time, from dpp::utility::time_f()
+	 * @return Number of sends still allowed in the window
 	 */
-	bool compressed;
+	size_t sends_remaining(double now);
+
+	/**
+	 * @brief Send as much of the message queue as the gateway rate limit allows.
+	 * Heartbeats may use the sends held in reserve, nothing else may. Anything left
+	 * waits for the window to move on, and is sent from one_second_timer().
+	 * Must be called on the socket engine thread.
+	 */
+	void send_queued();
+
+	/**
+	 * @brief Write a payload which does not go through the message queue, such as an
+	 * IDENTIFY or RESUME, counting it against the gateway rate limit
+	 * @param payload JSON or ETF payload
+	 */
+	void send_immediate(const std::string& payload);
 
 	/**
-	 * @brief ZLib decompression buffer
+	 * @brief Time of the next reconnection attempt, if disconnected
 	 */
-	unsigned char* decomp_buffer;
+	time_t reconnect_at;
 
 	/**
-	 * @brief Decompressed string
+	 * @brief True if an IDENTIFY is waiting for the cluster's identify rate limit
 	 */
-	std::string decompressed;
+	bool identify_pending;
 
 	/**
-	 * @brief This object contains the various zlib structs which
-	 * are not usable by the user of the library directly. They
-	 * are wrapped within this opaque object so that this header
-	 * file does not bring in a dependency on zlib.h.
+	 * @brief Send an IDENTIFY if the cluster-wide five second identify
+	 * spacing allows it, otherwise leave it pending for one_second_timer()
 	 */
-	zlibcontext* zlib;
+	void try_identify();
 
 	/**
-	 * @brief Total decompressed received bytes
+	 * @brief Attempt to reconnect a disconnected shard, called from one_second_timer()
+	 * on the socket engine thread
 	 */
-	uint64_t decompressed_total;
+	void reconnect();
+
+	/**
+	 * @brief Start an asynchronous connection to the gateway on a socket engine,
+	 * sending the websocket upgrade once the TLS handshake completes. On failure
+	 * another attempt is made from one_second_timer() five seconds later.
+	 * @param e Socket engine to connect on
+	 */
+	void connect_gateway(socket_engine_base* e);
+
+	/**
+	 * @brief If true, stream compression is enabled
+	 */
+	bool compressed;
+
+	/**
+	 * @brief Transport compression in use, if compressed is true
+	 */
+	websocket_compression_t compression;
+
+	/**
+	 * @brief Stream decompressor and its arena, or nullptr if
+	 * compression is not enabled
+	 */
+	stream_decompressor* decompressor;
 
 	/**
 	 * @brief Last connect time of cluster
@@ -255,17 +307,6 @@ private:
 	 */
 	std::string jsonobj_to_string(const nlohmann::json& json);
 
-	/**
-	 * @brief Initialise ZLib (websocket compression)
-	 * @throw dpp::exception if ZLib cannot be initialised
-	 */
-	void setup_zlib();
-
-	/**
-	 * @brief Shut down ZLib (websocket compression)
-	 */
-	void end_zlib();
-
 	/**
 	 * @brief Update the websocket hostname with the resume url
 	 * from the last READY event
@@ -276,6 +317,13 @@ private:
 	 * @brief Clean up resources
 	 */
 	void cleanup();
+
+protected:
+	/**
+	 * @brief Called by the socket engine when the connection drops, schedules a reconnection
+	 */
+	virtual void on_disconnect();
+
 public:
 	/**
 	 * @brief Owning cluster
@@ -304,7 +352,7 @@ public:
 	uint32_t max_shards;
 
 	/**
-	 * @brief Thread ID
+	 * @brief Thread ID of the socket engine thread this shard is running on
 	 */
 	std::thread::native_handle_type thread_id;
 
@@ -388,8 +436,10 @@ public:
 	 * @param event Event name, e.g. MESSAGE_CREATE
 	 * @param j JSON object for the event content
 	 * @param raw Raw JSON event string
+	 * @param etf_data In ETF mode, the event's undecoded "d" term. If the event's handler
+	 * can't read it directly it is decoded into j["d"] before the handler is called.
 	 */
-	virtual void handle_event(const std::string &event, json &j, const std::string &raw);
+	virtual void handle_event(const std::string &event, json &j, const std::string &raw, std::string_view etf_data = {});
 
 	/**
 	 * @brief Get the Guild Count for this shard
@@ -417,13 +467,18 @@ public:
 
 	/**
 	 * @brief Queue a message to be sent via the websocket
+	 *
+	 * Discord allows 120 gateway sends per 60 seconds. Queued messages are sent as soon as that
+	 * budget allows, keeping a few sends in reserve for heartbeats.
 	 * 
 	 * @param j The JSON data of the message to be sent
 	 * @param to_front If set to true, will place the message at the front of the queue not the back
 	 * (this is for urgent messages such as heartbeat, presence, so they can take precedence over
 	 * chunk requests etc)
+	 * @param coalesce_key If not empty and a message with the same key is still queued, that message
+	 * is replaced with this one instead of sending both, e.g. "members:<guild id>" for member chunk requests
 	 */
-	void queue_message(const std::string &j, bool to_front = false);
+	void queue_message(const std::string &j, bool to_front = false, const std::string &coalesce_key = "");
 
 	/**
 	 * @brief Clear the outbound message queue
@@ -438,6 +493,15 @@ public:
 	 */
 	size_t get_queue_size();
 
+	/**
+	 * @brief Get the number of queued messages which could be sent right now
+	 * without exceeding the gateway rate limit
+	 *
+	 * @return Sends remaining in the current 60 second window, excluding those
+	 * held in reserve for heartbeats
+	 */
+	size_t get_send_budget();
+
 	/**
 	 * @brief Returns true if the shard is connected
 	 * 
@@ -462,10 +526,12 @@ public:
 	 * @param intents Privileged intents to use, a bitmask of values from dpp::intents
 	 * @param compressed True if the received data will be gzip compressed
 	 * @param ws_protocol Websocket protocol to use for the connection, JSON or ETF
+	 * @param ws_compression Transport compression to use if compressed is true, zlib-stream or zstd-stream
 	 * 
 	 * @throws std::bad_alloc Passed up to the caller if any internal objects fail to allocate, after cleanup has completed
+	 * @throws dpp::logic_exception zstd-stream was requested, but D++ was built without zstd support
 	 */
-	discord_client(dpp::cluster* _cluster, uint32_t _shard_id, uint32_t _max_shards, const std::string &_token, uint32_t intents = 0, bool compressed = true, websocket_protocol_t ws_protocol = ws_json);
+	discord_client(dpp::cluster* _cluster, uint32_t _shard_id, uint32_t _max_shards, const std::string &_token, uint32_t intents = 0, bool compressed = true, websocket_protocol_t ws_protocol = ws_json, websocket_compression_t ws_compression = wsc_zlib);
 
 	/**
 	 * @brief Destroy the discord client object
@@ -478,13 +544,19 @@ public:
 	 */
 	uint64_t get_decompressed_bytes_in();
 
+	/**
+	 * @brief Get the transport decompression counters for this shard
+	 * @return counters, all zero if compression is not enabled
+	 */
+	decompression_stats get_decompression_stats();
+
 	/**
 	 * @brief Handle JSON from the websocket.
 	 * @param buffer The entire buffer content from the websocket client
 	 * @param opcode The type of frame, e.g. text or binary
 	 * @returns True if a frame has been handled
 	 */
-	virtual bool handle_frame(const std::string &buffer, ws_opcode opcode);
+	virtual bool handle_frame(std::string_view buffer, ws_opcode opcode);
 
 	/**
 	 * @brief Handle a websocket error.
@@ -493,9 +565,9 @@ public:
 	virtual void error(uint32_t errorcode);
 
 	/**
-	 * @brief Start and monitor I/O loop.
-	 * @note this is a blocking call and is usually executed within a
-	 * thread by whatever creates the object.
+	 * @brief Start I/O for this shard by connecting it on one of the cluster's
+	 * socket engines. Returns without waiting for the connection; the socket engine
+	 * thread handles connecting, reading, writing, heartbeats and reconnection from then on.
 	 */
 	void run();
 
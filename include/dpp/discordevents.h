@@ -196,6 +196,13 @@ bool DPP_EXPORT bool_not_null(const nlohmann::json* j, const char *keyname);
  */
 void DPP_EXPORT set_bool_not_null(const nlohmann::json* j, const char *keyname, bool &v);
 
+/**
+ * @brief Returns a time_t from an ISO8601 timestamp string, as sent by discord
+ * @param timedate timestamp string
+ * @return converted value, or epoch value of 0 if it could not be converted
+ */
+time_t DPP_EXPORT ts_from_string(std::string_view timedate);
+
 /**
  * @brief Returns a time_t from an ISO8601 timestamp field in a json value, if defined, else returns
  * epoch value of 0.
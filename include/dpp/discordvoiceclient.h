@@ -39,6 +39,7 @@
 #include <dpp/cluster.h>
 #include <dpp/discordevents.h>
 #include <dpp/socket.h>
+#include <dpp/flat_map.h>
 #include <queue>
 #include <thread>
 #include <deque>
@@ -195,7 +196,7 @@ struct dave_binary_header_t {
 	 * @brief Fill binary header from inbound buffer
 	 * @param buffer inbound websocket buffer
 	 */
-	dave_binary_header_t(const std::string& buffer);
+	dave_binary_header_t(std::string_view buffer);
 
 	/**
 	 * Get the data package from the packed binary frame, as a vector of uint8_t
@@ -556,7 +557,7 @@ class DPP_EXPORT discord_voice_client : public websocket_client
 	/**
 	 * @brief Maps receiving ssrc to user id
 	 */
-	std::unordered_map<uint32_t, snowflake> ssrc_map;
+	flat_map<uint32_t, snowflake> ssrc_map;
 
 	/**
 	 * @brief This is set to true if we have started sending audio.
@@ -908,7 +909,7 @@ public:
 	 * @return bool True if a frame has been handled
 	 * @throw dpp::exception If there was an error processing the frame, or connection to UDP socket failed
 	 */
-	virtual bool handle_frame(const std::string &buffer, ws_opcode opcode);
+	virtual bool handle_frame(std::string_view buffer, ws_opcode opcode);
 
 	/**
 	 * @brief Handle a websocket error.
@@ -1243,7 +1244,7 @@ public:
 	 *
 	 * @param data Websocket frame data
 	 */
-	void ready_for_transition(const std::string &data);
+	void ready_for_transition(std::string_view data);
 
 	/**
 	 * @brief Reset dave session, send voice_client_dave_mls_invalid_commit_welcome
@@ -32,32 +32,102 @@
 #include <string>
 #include <unordered_map>
 #include <cstring>
+#include <ctime>
+#include <memory>
+#include <vector>
+#include <functional>
 #include <dpp/socket.h>
 
 namespace dpp {
 
+	/**
+	 * @brief A single resolved address (an A or AAAA record) for a host.
+	 */
+	struct DPP_EXPORT dns_address {
+		/**
+		 * @brief Address family, AF_INET or AF_INET6
+		 */
+		int family{AF_INET};
+
+		/**
+		 * @brief Socket type, for ::socket()
+		 */
+		int socktype{SOCK_STREAM};
+
+		/**
+		 * @brief Protocol, for ::socket()
+		 */
+		int protocol{IPPROTO_TCP};
+
+		/**
+		 * @brief The address, with the port number of the lookup
+		 */
+		sockaddr_storage address{};
+
+		/**
+		 * @brief Length of the address held in address
+		 */
+		socklen_t length{0};
+
+		/**
+		 * @brief The address as a string
+		 */
+		std::string text;
+
+		/**
+		 * @brief Get the address with a different port number, for ::connect()
+		 * @param port Port number to connect to
+		 * @return sockaddr_storage holding the address and port
+		 */
+		[[nodiscard]] sockaddr_storage with_port(uint16_t port) const;
+
+		/**
+		 * @brief Allocate a socket file descriptor for this address
+		 * @return File descriptor ready for calling connect(), or INVALID_SOCKET
+		 * on failure.
+		 */
+		[[nodiscard]] socket make_connecting_socket() const;
+	};
+
 	/**
 	 * @brief Represents a cached DNS result.
 	 * Used by the ssl_client class to store cached copies of dns lookups.
+	 * Entries are immutable once cached and are handed out by shared pointer,
+	 * so an entry stays valid for as long as anyone holds it, even after the
+	 * cache has replaced it with a newer one.
 	 */
-	struct dns_cache_entry {
+	struct DPP_EXPORT dns_cache_entry {
 		/**
-		 * @brief Resolved address metadata
+		 * @brief Resolved address metadata of the preferred address
+		 * @note ai_addr, ai_canonname and ai_next are not valid. Use addresses for the address itself.
 		 */
 		addrinfo addr;
 
 		/**
-		 * @brief Resolved address as string.
+		 * @brief Preferred address as string.
 		 * The metadata is needed to know what type of address it is.
 		 * Do not do silly stuff like just looking to see if '.' is in it!
 		 */
 		std::string resolved_addr;
 
 		/**
-		 * @brief Time at which this cache entry is invalidated
+		 * @brief All addresses for the host, in order of preference. IPv4 addresses
+		 * come first, as Discord does not support IPv6. Addresses which have failed
+		 * to connect are moved to the back.
+		 */
+		std::vector<dns_address> addresses;
+
+		/**
+		 * @brief Time at which this cache entry is invalidated. From then on the
+		 * host is looked up again as if it were not cached.
 		 */
 		time_t expire_timestamp;
 
+		/**
+		 * @brief Time after which using this entry triggers a background refresh
+		 */
+		time_t refresh_timestamp;
+
 		/**
 		 * @brief Get address length
 		 * @return address length
@@ -69,6 +139,7 @@ namespace dpp {
 		 * for use when connecting with ::connect()
 		 * @param port Port number to connect to
 		 * @return address_t prefilled with the IP and port number
+		 * @note address_t is IPv4 only, use addresses directly to support IPv6
 		 */
 		[[nodiscard]] const address_t get_connecting_address(uint16_t port) const;
 
@@ -80,18 +151,76 @@ namespace dpp {
 		[[nodiscard]] socket make_connecting_socket() const;
 	};
 
+	/**
+	 * @brief A shared, immutable cached DNS result
+	 */
+	using dns_cache_entry_ptr = std::shared_ptr<const dns_cache_entry>;
+
 	/**
 	 * @brief Cache container type
 	 */
-	using dns_cache_t = std::unordered_map<std::string, dns_cache_entry*>;
+	using dns_cache_t = std::unordered_map<std::string, dns_cache_entry_ptr>;
+
+	/**
+	 * @brief A function which resolves a hostname, returning every address found.
+	 * The default uses getaddrinfo(). Replace it with set_dns_resolver(), e.g. to
+	 * use a stub resolver for testing.
+	 * @throw dpp::connection_exception On failure to resolve hostname
+	 */
+	using dns_resolver_t = std::function<std::vector<dns_address>(const std::string& hostname, const std::string& port)>;
+
+	/**
+	 * @brief Called when an asynchronous lookup completes
+	 * @param entry Cached result, or nullptr if the lookup failed
+	 * @param error Reason for the failure, if it failed
+	 */
+	using dns_callback_t = std::function<void(dns_cache_entry_ptr entry, const std::string& error)>;
 
 	/**
 	 * @brief Resolve a hostname to an addrinfo
-	 * 
+	 *
+	 * Cached entries are returned without blocking. Once an entry is due a refresh
+	 * it is still returned while a background refresh fetches a new result. A host
+	 * which is not in the cache, or whose entry has expired because refreshing it
+	 * failed, is resolved on the calling thread.
+	 *
 	 * @param hostname Hostname to resolve
 	 * @param port A port number or named service, e.g. "80"
-	 * @return dns_cache_entry* First IP address associated with the hostname DNS record
+	 * @return dns_cache_entry_ptr All IP addresses associated with the hostname DNS record
 	 * @throw dpp::connection_exception On failure to resolve hostname
 	 */
-	const dns_cache_entry* resolve_hostname(const std::string& hostname, const std::string& port);
+	DPP_EXPORT dns_cache_entry_ptr resolve_hostname(const std::string& hostname, const std::string& port);
+
+	/**
+	 * @brief Resolve a hostname without blocking.
+	 * If the host is cached, the callback is called immediately on the calling thread.
+	 * Otherwise it is called from the resolver thread once the lookup completes.
+	 * @param hostname Hostname to resolve
+	 * @param port A port number or named service, e.g. "80"
+	 * @param callback Completion callback, may be empty to just warm the cache
+	 */
+	DPP_EXPORT void resolve_hostname_async(const std::string& hostname, const std::string& port, const dns_callback_t& callback);
+
+	/**
+	 * @brief Report that connecting to one of a host's addresses failed. The address
+	 * is moved to the back of the host's list, so the next connection attempt fails
+	 * over to the next address.
+	 * @param hostname Hostname the address belongs to
+	 * @param address The address (dns_address::text) which failed
+	 */
+	DPP_EXPORT void dns_address_failed(const std::string& hostname, const std::string& address);
+
+	/**
+	 * @brief Replace the function used to resolve hostnames, and empty the cache
+	 * @param resolver New resolver, or an empty function to restore the default
+	 */
+	DPP_EXPORT void set_dns_resolver(const dns_resolver_t& resolver);
+
+	/**
+	 * @brief Set how long resolved hostnames are cached for. getaddrinfo() does not
+	 * expose record TTLs, so a fixed lifetime is used; entries are refreshed in the
+	 * background once 80% of it has passed. Defaults to one hour.
+	 * @param ttl Lifetime of a cache entry in seconds
+	 */
+	DPP_EXPORT void set_dns_cache_ttl(time_t ttl);
 }
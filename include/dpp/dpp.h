@@ -62,9 +62,14 @@
 #include <dpp/application.h>
 #include <dpp/scheduled_event.h>
 #include <dpp/discordclient.h>
+#include <dpp/zlibcontext.h>
+#include <dpp/zstdcontext.h>
+#include <dpp/jsonparser.h>
 #include <dpp/dispatcher.h>
 #include <dpp/cluster.h>
 #include <dpp/cache.h>
+#include <dpp/flat_map.h>
+#include <dpp/interned.h>
 #include <dpp/httpsclient.h>
 #include <dpp/queues.h>
 #include <dpp/commandhandler.h>
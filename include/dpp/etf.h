@@ -36,6 +36,8 @@
 #include <dpp/export.h>
 #include <dpp/snowflake.h>
 #include <dpp/json_fwd.h>
+#include <string>
+#include <string_view>
 
 namespace dpp {
 
@@ -694,7 +696,16 @@ public:
 	 * @return nlohmann::json JSON data for use in the library
 	 * @throw dpp::exception Malformed or otherwise invalid ETF content
 	 */
-	nlohmann::json parse(const std::string& in);
+	nlohmann::json parse(std::string_view in);
+
+	/**
+	 * @brief Convert a single ETF term, without a version header, to nlohmann::json
+	 *
+	 * @param term Raw binary ETF term, e.g. from etf_reader::read_term()
+	 * @return nlohmann::json JSON data for use in the library
+	 * @throw dpp::exception Malformed or otherwise invalid ETF content
+	 */
+	nlohmann::json parse_term(std::string_view term);
 
 	/**
 	 * @brief Create ETF binary data from nlohmann::json
@@ -708,4 +719,223 @@ public:
 	std::string build(const nlohmann::json& j);
 };
 
+/**
+ * @brief A pull reader for ETF data, which reads values in place in the order they
+ * appear without building an nlohmann::json tree. This is used by the hottest gateway
+ * events to fill objects directly from the wire format.
+ *
+ * Strings are returned as views into the buffer, which must outlive the reader.
+ * Like the *_not_null json helpers, the typed read functions are lenient: a value of the
+ * wrong type (including nil) is skipped and a default value is returned in its place.
+ */
+class DPP_EXPORT etf_reader {
+	/**
+	 * @brief Pointer to binary ETF data being read
+	 */
+	const uint8_t* data;
+
+	/**
+	 * @brief Size of binary data
+	 */
+	size_t size;
+
+	/**
+	 * @brief Current offset into binary data
+	 */
+	size_t offset;
+
+	/**
+	 * @brief Number of characters left to read from a string list (ett_string)
+	 * being read as a list; each is presented as an ett_smallint.
+	 */
+	uint16_t string_list_remaining;
+
+	/**
+	 * @brief Storage for map keys which are not strings, e.g. integers
+	 */
+	std::string key_buffer;
+
+	/**
+	 * @brief Read 8 bits of data from the buffer
+	 * @return uint8_t data retrieved
+	 * @throw dpp::parse_exception Data stream isn't long enough to fetch requested bits
+	 */
+	uint8_t read_8_bits();
+
+	/**
+	 * @brief Read 16 bits of data from the buffer
+	 * @return uint16_t data retrieved
+	 * @throw dpp::parse_exception Data stream isn't long enough to fetch requested bits
+	 */
+	uint16_t read_16_bits();
+
+	/**
+	 * @brief Read 32 bits of data from the buffer
+	 * @return uint32_t data retrieved
+	 * @throw dpp::parse_exception Data stream isn't long enough to fetch requested bits
+	 */
+	uint32_t read_32_bits();
+
+	/**
+	 * @brief Read 64 bits of data from the buffer
+	 * @return uint64_t data retrieved
+	 * @throw dpp::parse_exception Data stream isn't long enough to fetch requested bits
+	 */
+	uint64_t read_64_bits();
+
+	/**
+	 * @brief Read a run of bytes from the buffer
+	 * @param length number of bytes
+	 * @return std::string_view view of the bytes
+	 * @throw dpp::parse_exception Data stream isn't long enough
+	 */
+	std::string_view read_bytes(uint32_t length);
+
+	/**
+	 * @brief Read a big integer's digits, after its type tag and length
+	 * @param digits number of bytes of magnitude
+	 * @return int64_t value
+	 * @throw dpp::parse_exception Integer is larger than 8 bytes
+	 */
+	int64_t read_bigint(uint32_t digits);
+
+	/**
+	 * @brief Read a list or tuple header
+	 * @param has_tail set to true if the list has a tail which must be consumed
+	 * with read_list_tail() after its elements
+	 * @return uint32_t number of elements, or 0 if the value was not a list
+	 * (in which case it is skipped)
+	 */
+	uint32_t read_list_header(bool& has_tail);
+
+	/**
+	 * @brief Consume the tail of a list read with read_list_header()
+	 */
+	void read_list_tail();
+
+public:
+	/**
+	 * @brief Construct a reader over ETF data
+	 *
+	 * @param in ETF data, which must remain valid while the reader is in use
+	 * @param versioned true if the data starts with a version header, as a whole
+	 * websocket frame does; false for a single term, e.g. from read_term()
+	 * @throw dpp::parse_exception Incorrect ETF version
+	 */
+	etf_reader(std::string_view in, bool versioned = true);
+
+	/**
+	 * @brief Get the type of the next value without reading it
+	 * @return etf_token_type type of next value
+	 * @throw dpp::parse_exception At end of buffer
+	 */
+	etf_token_type peek() const;
+
+	/**
+	 * @brief Returns true if all data has been read
+	 * @return true if at end of buffer
+	 */
+	bool at_end() const;
+
+	/**
+	 * @brief Returns true if the next value is the nil or null atom
+	 * @return true if next value is null
+	 */
+	bool is_null() const;
+
+	/**
+	 * @brief Read a map header
+	 * @return uint32_t number of key/value pairs which follow, or 0 if the
+	 * value was not a map (in which case it is skipped)
+	 */
+	uint32_t read_map_header();
+
+	/**
+	 * @brief Read a map key. Keys which are integers are converted to strings.
+	 * @return std::string_view key, valid until the next call
+	 */
+	std::string_view read_key();
+
+	/**
+	 * @brief Read a string, binary or atom value
+	 * @return std::string_view value, or an empty view for null or a value of another type
+	 */
+	std::string_view read_string();
+
+	/**
+	 * @brief Read an integer value. Numeric strings are converted.
+	 * @return int64_t value, or 0 for null or a value of another type
+	 */
+	int64_t read_int();
+
+	/**
+	 * @brief Read a snowflake, which is usually sent as a string
+	 * @return snowflake value, or 0 for null or a value of another type
+	 */
+	snowflake read_snowflake();
+
+	/**
+	 * @brief Read a boolean value
+	 * @return bool value, or false for null or a value of another type
+	 */
+	bool read_bool();
+
+	/**
+	 * @brief Read a floating point value
+	 * @return double value, or 0 for null or a value of another type
+	 */
+	double read_double();
+
+	/**
+	 * @brief Skip over the next value, including anything nested within it
+	 * @throw dpp::parse_exception Malformed or unsupported ETF content
+	 */
+	void skip();
+
+	/**
+	 * @brief Skip over the next value, returning its raw bytes
+	 * @return std::string_view raw ETF term, which can be read later with a
+	 * new etf_reader (unversioned) or etf_parser::parse_term()
+	 */
+	std::string_view read_term();
+
+	/**
+	 * @brief Read the next value into an nlohmann::json tree, for values which
+	 * have no direct reader
+	 * @return nlohmann::json value
+	 */
+	nlohmann::json read_json();
+
+	/**
+	 * @brief Read a map, calling a function for each key. The function must read
+	 * or skip exactly one value, the value for that key.
+	 * A value of any other type is skipped.
+	 *
+	 * @param f function to call, taking a std::string_view key
+	 */
+	template <typename F> void read_map(F&& f) {
+		uint32_t pairs = read_map_header();
+		for (uint32_t i = 0; i < pairs; ++i) {
+			f(read_key());
+		}
+	}
+
+	/**
+	 * @brief Read a list or tuple, calling a function for each element. The function must
+	 * read or skip exactly one value. A value of any other type is skipped.
+	 *
+	 * @param f function to call, taking no parameters
+	 */
+	template <typename F> void read_list(F&& f) {
+		bool has_tail = false;
+		uint32_t elements = read_list_header(has_tail);
+		for (uint32_t i = 0; i < elements; ++i) {
+			f();
+		}
+		if (has_tail) {
+			read_list_tail();
+		}
+	}
+};
+
 }
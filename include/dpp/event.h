@@ -23,10 +23,19 @@
 #include <dpp/export.h>
 #include <dpp/snowflake.h>
 #include <dpp/json_fwd.h>
+#include <string_view>
 
 #define event_decl(x,wstype) /** @brief Internal event handler for wstype websocket events. Called for each websocket message of this type. @internal */ \
 	class x : public event { public: virtual void handle(class dpp::discord_client* client, nlohmann::json &j, const std::string &raw); };
 
+#define event_decl_etf(x,wstype) /** @brief Internal event handler for wstype websocket events, which can also read ETF directly. Called for each websocket message of this type. @internal */ \
+	class x : public event { public: virtual void handle(class dpp::discord_client* client, nlohmann::json &j, const std::string &raw); \
+	virtual bool handle_etf(class dpp::discord_client* client, dpp::etf_reader &d, const std::string &raw); };
+
+namespace dpp {
+	class etf_reader;
+}
+
 /**
  * @brief The events namespace holds the internal event handlers for each websocket event.
  * These are handled internally and also dispatched to the user code if the event is hooked.
@@ -45,13 +54,40 @@ public:
 	 * @param raw The raw event json
 	 */
 	virtual void handle(class discord_client* client, nlohmann::json &j, const std::string &raw) = 0;
+
+	/**
+	 * @brief Handle an ETF event directly from its wire format, without first decoding it
+	 * into nlohmann::json. Only the hottest events implement this.
+	 * @param client The creating shard
+	 * @param d Reader positioned at the event's "d" value
+	 * @param raw The raw event ETF
+	 * @return true if the event was handled, false if it must be decoded and passed to handle()
+	 * instead. An event returning false must not have read anything from d.
+	 */
+	virtual bool handle_etf(class discord_client* client, dpp::etf_reader &d, const std::string &raw) {
+		return false;
+	}
 };
 
 /* Internal logger */
 event_decl(logger,LOG);
 
 /* Guilds */
-event_decl(guild_create,GUILD_CREATE);
+/** @brief Internal event handler for GUILD_CREATE websocket events, which can also read ETF directly. Called for each websocket message of this type. @internal */
+class guild_create : public event {
+	/**
+	 * @brief Handle the event from either protocol
+	 * @param client The creating shard
+	 * @param d The json data of the event
+	 * @param raw The raw event
+	 * @param etf_members In ETF mode, the undecoded member list, read in place of d["members"]
+	 * @param etf_presences In ETF mode, the undecoded presence list, read in place of d["presences"]
+	 */
+	void handle_guild(class dpp::discord_client* client, nlohmann::json &d, const std::string &raw, std::string_view etf_members, std::string_view etf_presences);
+public:
+	virtual void handle(class dpp::discord_client* client, nlohmann::json &j, const std::string &raw);
+	virtual bool handle_etf(class dpp::discord_client* client, dpp::etf_reader &d, const std::string &raw);
+};
 event_decl(guild_update,GUILD_UPDATE);
 event_decl(guild_delete,GUILD_DELETE);
 event_decl(guild_ban_add,GUILD_BAN_ADD);
@@ -69,7 +105,7 @@ event_decl(stage_instance_delete,STAGE_INSTANCE_DELETE);
 /* Guild members */
 event_decl(guild_member_add,GUILD_MEMBER_ADD);
 event_decl(guild_member_remove,GUILD_MEMBER_REMOVE);
-event_decl(guild_members_chunk,GUILD_MEMBERS_CHUNK);
+event_decl_etf(guild_members_chunk,GUILD_MEMBERS_CHUNK);
 event_decl(guild_member_update,GUILD_MEMBERS_UPDATE);
 
 /* Guild roles */
@@ -96,7 +132,7 @@ event_decl(thread_member_update,THREAD_MEMBER_UPDATE);
 event_decl(thread_members_update,THREAD_MEMBERS_UPDATE);
 
 /* Messages */
-event_decl(message_create,MESSAGE_CREATE);
+event_decl_etf(message_create,MESSAGE_CREATE);
 event_decl(message_update,MESSAGE_UPDATE);
 event_decl(message_delete,MESSAGE_DELETE);
 event_decl(message_delete_bulk,MESSAGE_DELETE_BULK);
@@ -104,7 +140,7 @@ event_decl(message_poll_vote_add,MESSAGE_POLL_VOTE_ADD);
 event_decl(message_poll_vote_remove,MESSAGE_POLL_VOTE_REMOVE);
 
 /* Presence/typing */
-event_decl(presence_update,PRESENCE_UPDATE);
+event_decl_etf(presence_update,PRESENCE_UPDATE);
 event_decl(typing_start,TYPING_START);
 
 /* Users (outside of guild) */
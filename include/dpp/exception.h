@@ -103,6 +103,9 @@ enum exception_error_code {
 	err_icon_size = 35,
 	err_massive_audio = 36,
 	err_unknown = 37,
+	err_epoll = 38,
+	err_no_compression_support = 39,
+	err_no_json_parser = 40,
 	err_bad_request = 400,
 	err_unauthorized = 401,
 	err_payment_required = 402,
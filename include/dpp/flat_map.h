@@ -0,0 +1,728 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/export.h>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define DPP_FLAT_MAP_SSE2
+#endif
+#if defined(_MSC_VER) && !defined(__clang__)
+	#include <intrin.h>
+#endif
+
+namespace dpp {
+
+/**
+ * @brief Default hash of dpp::flat_map, for snowflakes and other integer keys.
+ *
+ * The low bits of a snowflake are a worker id and a counter which barely vary,
+ * while the timestamp above them does. A Fibonacci multiply carries every key bit
+ * into the high half of the product, and folding that back down gives the map
+ * well mixed low bits to pick a group with.
+ */
+struct flat_map_hash {
+	/**
+	 * @brief Hash a key
+	 * @param key key to hash
+	 * @return uint64_t hash
+	 */
+	uint64_t operator()(uint64_t key) const noexcept {
+		uint64_t h = key * 0x9e3779b97f4a7c15ULL;
+		return h ^ (h >> 32);
+	}
+};
+
+/**
+ * @brief A compact hash map for snowflakes and other integer keys.
+ *
+ * The key and value pairs are kept next to each other in one vector, in no
+ * particular order, rather than in a heap allocation per entry like
+ * std::unordered_map. They are found through an open addressing index of one
+ * control byte and a 32 bit position per slot, probed sixteen control bytes
+ * at a time (with SSE2 where it is available).
+ *
+ * It can be used in place of std::unordered_map with these differences:
+ *
+ * - Inserting may move every element, invalidating all iterators, pointers and
+ *   references to elements.
+ * - Erasing moves the last element into the erased one's place. erase() returns
+ *   an iterator to that position, so `it = map.erase(it)` loops visit every
+ *   element once, but other iterators to the last element are invalidated.
+ * - Keys are not const in value_type, but must not be changed through an iterator.
+ *
+ * @note This class is not thread safe.
+ * @tparam K Key type, convertible to uint64_t
+ * @tparam V Value type, which must be move assignable
+ * @tparam Hash Hash of a key
+ */
+template<class K, class V, class Hash = flat_map_hash> class flat_map {
+public:
+	/**
+	 * @brief Key type
+	 */
+	using key_type = K;
+
+	/**
+	 * @brief Value type
+	 */
+	using mapped_type = V;
+
+	/**
+	 * @brief A key and its value
+	 */
+	using value_type = std::pair<K, V>;
+
+	/**
+	 * @brief Size type
+	 */
+	using size_type = size_t;
+
+	/**
+	 * @brief Iterator over the key and value pairs
+	 */
+	using iterator = typename std::vector<value_type>::iterator;
+
+	/**
+	 * @brief Const iterator over the key and value pairs
+	 */
+	using const_iterator = typename std::vector<value_type>::const_iterator;
+
+private:
+	/**
+	 * @brief Control bytes in a group
+	 */
+	static constexpr size_t group_width = 16;
+
+	/**
+	 * @brief Control byte of a slot which has never been used since the index was built
+	 */
+	static constexpr int8_t ctrl_empty = -128;
+
+	/**
+	 * @brief Control byte of a slot whose element was erased
+	 */
+	static constexpr int8_t ctrl_deleted = -2;
+
+	/**
+	 * @brief Returned by locate() when a key is not in the map
+	 */
+	static constexpr size_t npos = SIZE_MAX;
+
+	/**
+	 * @brief Control bytes of sixteen slots, loaded together.
+	 *
+	 * A slot in use has the low seven bits of its key's hash, which is never
+	 * negative, so a free slot is one with the top bit set.
+	 */
+	struct alignas(16) group {
+		/**
+		 * @brief Control bytes
+		 */
+		int8_t ctrl[group_width];
+	};
+
+	/**
+	 * @brief Key and value pairs
+	 */
+	std::vector<value_type> values;
+
+	/**
+	 * @brief Control bytes of the index, or nullptr if it has not been built
+	 */
+	std::unique_ptr<group[]> groups;
+
+	/**
+	 * @brief Position in values of the element in each slot
+	 */
+	std::unique_ptr<uint32_t[]> positions;
+
+	/**
+	 * @brief Number of groups minus one
+	 */
+	size_t group_mask{0};
+
+	/**
+	 * @brief Number of slots marked ctrl_deleted
+	 */
+	size_t tombstones{0};
+
+	/**
+	 * @brief Hash function
+	 */
+	Hash hasher;
+
+	/**
+	 * @brief Bitmask of the control bytes in a group equal to a value
+	 * @param g group to search
+	 * @param b control byte to match
+	 * @return uint32_t bit n set if control byte n matches
+	 */
+	static uint32_t match(const group& g, int8_t b) {
+#ifdef DPP_FLAT_MAP_SSE2
+		__m128i ctrl = _mm_load_si128(reinterpret_cast<const __m128i*>(g.ctrl));
+		return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(b))));
+#else
+		uint32_t mask = 0;
+		for (size_t i = 0; i < group_width; ++i) {
+			mask |= static_cast<uint32_t>(g.ctrl[i] == b) << i;
+		}
+		return mask;
+#endif
+	}
+
+	/**
+	 * @brief Bitmask of the free (empty or deleted) slots in a group
+	 * @param g group to search
+	 * @return uint32_t bit n set if slot n is free
+	 */
+	static uint32_t match_free(const group& g) {
+#ifdef DPP_FLAT_MAP_SSE2
+		return static_cast<uint32_t>(_mm_movemask_epi8(_mm_load_si128(reinterpret_cast<const __m128i*>(g.ctrl))));
+#else
+		uint32_t mask = 0;
+		for (size_t i = 0; i < group_width; ++i) {
+			mask |= static_cast<uint32_t>(g.ctrl[i] < 0) << i;
+		}
+		return mask;
+#endif
+	}
+
+	/**
+	 * @brief Index of the lowest set bit
+	 * @param mask non zero bitmask
+	 * @return size_t bit index
+	 */
+	static size_t lowest_bit(uint32_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+		unsigned long i;
+		_BitScanForward(&i, mask);
+		return i;
+#else
+		return static_cast<size_t>(__builtin_ctz(mask));
+#endif
+	}
+
+	/**
+	 * @brief Control byte for a hash
+	 * @param h hash
+	 * @return int8_t control byte, 0 to 127
+	 */
+	static int8_t ctrl_for(uint64_t h) {
+		return static_cast<int8_t>(h & 0x7f);
+	}
+
+	/**
+	 * @brief Control byte of a slot
+	 * @param slot slot
+	 * @return int8_t& control byte
+	 */
+	int8_t& ctrl_at(size_t slot) const {
+		return groups[slot / group_width].ctrl[slot % group_width];
+	}
+
+	/**
+	 * @brief Number of slots in the index
+	 * @return size_t slots
+	 */
+	size_t slot_count() const {
+		return groups ? (group_mask + 1) * group_width : 0;
+	}
+
+	/**
+	 * @brief Find the slot of a key
+	 * @param key key to find
+	 * @param h hash of the key
+	 * @return size_t slot, or npos
+	 */
+	size_t locate(const K& key, uint64_t h) const {
+		if (!groups) {
+			return npos;
+		}
+		int8_t c = ctrl_for(h);
+		size_t g = (h >> 7) & group_mask;
+		for (size_t step = 1;; ++step) {
+			const group& grp = groups[g];
+			for (uint32_t m = match(grp, c); m; m &= m - 1) {
+				size_t slot = g * group_width + lowest_bit(m);
+				if (values[positions[slot]].first == key) {
+					return slot;
+				}
+			}
+			if (match(grp, ctrl_empty)) {
+				return npos;
+			}
+			/* Triangular steps visit every group when the group count is a power of two */
+			g = (g + step) & group_mask;
+		}
+	}
+
+	/**
+	 * @brief Find the first free slot on a hash's probe sequence
+	 * @param h hash
+	 * @return size_t slot
+	 */
+	size_t free_slot(uint64_t h) const {
+		size_t g = (h >> 7) & group_mask;
+		for (size_t step = 1;; ++step) {
+			uint32_t m = match_free(groups[g]);
+			if (m) {
+				return g * group_width + lowest_bit(m);
+			}
+			g = (g + step) & group_mask;
+		}
+	}
+
+	/**
+	 * @brief Rebuild the index with room for at least a number of elements,
+	 * at most seven eighths full.
+	 * @param count number of elements
+	 */
+	void rebuild(size_t count) {
+		size_t group_count = 1;
+		while (group_count * group_width * 7 < count * 8) {
+			group_count <<= 1;
+		}
+		groups.reset(new group[group_count]);
+		positions.reset(new uint32_t[group_count * group_width]);
+		group_mask = group_count - 1;
+		tombstones = 0;
+		for (size_t g = 0; g < group_count; ++g) {
+			for (auto& c : groups[g].ctrl) {
+				c = ctrl_empty;
+			}
+		}
+		for (size_t i = 0; i < values.size(); ++i) {
+			uint64_t h = hasher(values[i].first);
+			size_t slot = free_slot(h);
+			ctrl_at(slot) = ctrl_for(h);
+			positions[slot] = static_cast<uint32_t>(i);
+		}
+	}
+
+	/**
+	 * @brief Remove the element in a slot, moving the last element into its place
+	 * @param slot slot of the element
+	 * @return size_t position the element was at
+	 */
+	size_t erase_slot(size_t slot) {
+		size_t pos = positions[slot];
+		/* A group with an empty slot has never been full, so no probe has passed
+		 * through it and it can stay without a tombstone
+		 */
+		if (match(groups[slot / group_width], ctrl_empty)) {
+			ctrl_at(slot) = ctrl_empty;
+		} else {
+			ctrl_at(slot) = ctrl_deleted;
+			tombstones++;
+		}
+		size_t last = values.size() - 1;
+		if (pos != last) {
+			positions[locate(values[last].first, hasher(values[last].first))] = static_cast<uint32_t>(pos);
+			values[pos] = std::move(values[last]);
+		}
+		values.pop_back();
+		return pos;
+	}
+
+public:
+	/**
+	 * @brief Construct an empty map. Nothing is allocated until the first insert.
+	 */
+	flat_map() = default;
+
+	/**
+	 * @brief Copy a map
+	 * @param other map to copy
+	 */
+	flat_map(const flat_map& other) : values(other.values), hasher(other.hasher) {
+		if (!values.empty()) {
+			rebuild(values.size());
+		}
+	}
+
+	/**
+	 * @brief Move a map, leaving the other empty
+	 * @param other map to move
+	 */
+	flat_map(flat_map&& other) noexcept {
+		swap(other);
+	}
+
+	/**
+	 * @brief Copy a map
+	 * @param other map to copy
+	 * @return flat_map& this map
+	 */
+	flat_map& operator=(const flat_map& other) {
+		if (this != &other) {
+			flat_map copy(other);
+			swap(copy);
+		}
+		return *this;
+	}
+
+	/**
+	 * @brief Move a map, leaving the other empty
+	 * @param other map to move
+	 * @return flat_map& this map
+	 */
+	flat_map& operator=(flat_map&& other) noexcept {
+		if (this != &other) {
+			flat_map moved;
+			swap(moved);
+			swap(other);
+		}
+		return *this;
+	}
+
+	/**
+	 * @brief Construct a map from a list of pairs. Later duplicates of a key are ignored.
+	 * @param init pairs
+	 */
+	flat_map(std::initializer_list<value_type> init) {
+		reserve(init.size());
+		for (auto& v : init) {
+			insert(v);
+		}
+	}
+
+	/**
+	 * @brief Swap the contents of two maps
+	 * @param other map to swap with
+	 */
+	void swap(flat_map& other) noexcept {
+		using std::swap;
+		swap(values, other.values);
+		swap(groups, other.groups);
+		swap(positions, other.positions);
+		swap(group_mask, other.group_mask);
+		swap(tombstones, other.tombstones);
+		swap(hasher, other.hasher);
+	}
+
+	/**
+	 * @brief Iterator at the first element
+	 * @return iterator
+	 */
+	iterator begin() noexcept {
+		return values.begin();
+	}
+
+	/**
+	 * @brief Iterator past the last element
+	 * @return iterator
+	 */
+	iterator end() noexcept {
+		return values.end();
+	}
+
+	/**
+	 * @brief Iterator at the first element
+	 * @return const_iterator
+	 */
+	const_iterator begin() const noexcept {
+		return values.begin();
+	}
+
+	/**
+	 * @brief Iterator past the last element
+	 * @return const_iterator
+	 */
+	const_iterator end() const noexcept {
+		return values.end();
+	}
+
+	/**
+	 * @brief Iterator at the first element
+	 * @return const_iterator
+	 */
+	const_iterator cbegin() const noexcept {
+		return values.cbegin();
+	}
+
+	/**
+	 * @brief Iterator past the last element
+	 * @return const_iterator
+	 */
+	const_iterator cend() const noexcept {
+		return values.cend();
+	}
+
+	/**
+	 * @brief Number of elements
+	 * @return size_t size
+	 */
+	size_t size() const noexcept {
+		return values.size();
+	}
+
+	/**
+	 * @brief Check if the map is empty
+	 * @return true if there are no elements
+	 */
+	bool empty() const noexcept {
+		return values.empty();
+	}
+
+	/**
+	 * @brief Bytes allocated by the map, not counting anything the values allocate themselves
+	 * @return size_t bytes
+	 */
+	size_t bytes() const noexcept {
+		return sizeof(*this) + values.capacity() * sizeof(value_type) + slot_count() * (1 + sizeof(uint32_t));
+	}
+
+	/**
+	 * @brief Remove every element. Memory for the elements is kept for reuse, the index is freed.
+	 */
+	void clear() noexcept {
+		values.clear();
+		groups.reset();
+		positions.reset();
+		group_mask = 0;
+		tombstones = 0;
+	}
+
+	/**
+	 * @brief Make room for a number of elements without reallocating
+	 * @param count number of elements
+	 */
+	void reserve(size_t count) {
+		values.reserve(count);
+		if (count * 8 > slot_count() * 7) {
+			rebuild(count);
+		}
+	}
+
+	/**
+	 * @brief Find an element by key
+	 * @param key key to find
+	 * @return iterator at the element, or end()
+	 */
+	iterator find(const K& key) {
+		size_t slot = locate(key, hasher(key));
+		return slot == npos ? values.end() : values.begin() + positions[slot];
+	}
+
+	/**
+	 * @brief Find an element by key
+	 * @param key key to find
+	 * @return const_iterator at the element, or end()
+	 */
+	const_iterator find(const K& key) const {
+		size_t slot = locate(key, hasher(key));
+		return slot == npos ? values.end() : values.begin() + positions[slot];
+	}
+
+	/**
+	 * @brief Count elements with a key
+	 * @param key key to find
+	 * @return size_t 1 if the key is in the map, otherwise 0
+	 */
+	size_t count(const K& key) const {
+		return locate(key, hasher(key)) == npos ? 0 : 1;
+	}
+
+	/**
+	 * @brief Check if a key is in the map
+	 * @param key key to find
+	 * @return true if it is
+	 */
+	bool contains(const K& key) const {
+		return locate(key, hasher(key)) != npos;
+	}
+
+	/**
+	 * @brief Get the value of a key
+	 * @param key key to find
+	 * @return V& value
+	 * @throw std::out_of_range if the key is not in the map
+	 */
+	V& at(const K& key) {
+		size_t slot = locate(key, hasher(key));
+		if (slot == npos) {
+			throw std::out_of_range("flat_map::at");
+		}
+		return values[positions[slot]].second;
+	}
+
+	/**
+	 * @brief Get the value of a key
+	 * @param key key to find
+	 * @return const V& value
+	 * @throw std::out_of_range if the key is not in the map
+	 */
+	const V& at(const K& key) const {
+		size_t slot = locate(key, hasher(key));
+		if (slot == npos) {
+			throw std::out_of_range("flat_map::at");
+		}
+		return values[positions[slot]].second;
+	}
+
+	/**
+	 * @brief Insert a value constructed from arguments, if the key is not already in the map
+	 * @param key key to insert
+	 * @param args arguments to construct the value from
+	 * @return std::pair<iterator, bool> the element with the key, and true if it was inserted
+	 */
+	template<class... Args> std::pair<iterator, bool> try_emplace(const K& key, Args&&... args) {
+		uint64_t h = hasher(key);
+		size_t slot = locate(key, h);
+		if (slot != npos) {
+			return {values.begin() + positions[slot], false};
+		}
+		if ((values.size() + tombstones + 1) * 8 > slot_count() * 7) {
+			/* Leave some headroom, so erasing and inserting at the limit doesn't rebuild every time */
+			rebuild(values.size() + 1 + values.size() / 8);
+		}
+		values.emplace_back(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+		slot = free_slot(h);
+		if (ctrl_at(slot) == ctrl_deleted) {
+			tombstones--;
+		}
+		ctrl_at(slot) = ctrl_for(h);
+		positions[slot] = static_cast<uint32_t>(values.size() - 1);
+		return {values.end() - 1, true};
+	}
+
+	/**
+	 * @brief Insert a key and value, if the key is not already in the map
+	 * @param value key and value
+	 * @return std::pair<iterator, bool> the element with the key, and true if it was inserted
+	 */
+	std::pair<iterator, bool> insert(const value_type& value) {
+		return try_emplace(value.first, value.second);
+	}
+
+	/**
+	 * @brief Insert a key and value, if the key is not already in the map
+	 * @param value key and value
+	 * @return std::pair<iterator, bool> the element with the key, and true if it was inserted
+	 */
+	std::pair<iterator, bool> insert(value_type&& value) {
+		return try_emplace(value.first, std::move(value.second));
+	}
+
+	/**
+	 * @brief Insert a key and value constructed from arguments, if the key is not already in the map
+	 * @param args arguments to construct a value_type from
+	 * @return std::pair<iterator, bool> the element with the key, and true if it was inserted
+	 */
+	template<class... Args> std::pair<iterator, bool> emplace(Args&&... args) {
+		value_type value(std::forward<Args>(args)...);
+		return try_emplace(value.first, std::move(value.second));
+	}
+
+	/**
+	 * @brief Insert a key and value, or replace the value if the key is already in the map
+	 * @param key key
+	 * @param value value
+	 * @return std::pair<iterator, bool> the element with the key, and true if it was inserted
+	 */
+	template<class M> std::pair<iterator, bool> insert_or_assign(const K& key, M&& value) {
+		auto r = try_emplace(key, std::forward<M>(value));
+		if (!r.second) {
+			r.first->second = std::forward<M>(value);
+		}
+		return r;
+	}
+
+	/**
+	 * @brief Get the value of a key, inserting a default constructed one if it is not in the map
+	 * @param key key
+	 * @return V& value
+	 */
+	V& operator[](const K& key) {
+		return try_emplace(key).first->second;
+	}
+
+	/**
+	 * @brief Erase an element
+	 * @param pos iterator at the element
+	 * @return iterator at the element moved into its place, or end()
+	 */
+	iterator erase(const_iterator pos) {
+		size_t slot = locate(pos->first, hasher(pos->first));
+		return values.begin() + erase_slot(slot);
+	}
+
+	/**
+	 * @brief Erase an element
+	 * @param pos iterator at the element
+	 * @return iterator at the element moved into its place, or end()
+	 */
+	iterator erase(iterator pos) {
+		return erase(const_iterator(pos));
+	}
+
+	/**
+	 * @brief Erase an element by key
+	 * @param key key to erase
+	 * @return size_t 1 if an element was erased, otherwise 0
+	 */
+	size_t erase(const K& key) {
+		size_t slot = locate(key, hasher(key));
+		if (slot == npos) {
+			return 0;
+		}
+		erase_slot(slot);
+		return 1;
+	}
+
+	/**
+	 * @brief Compare two maps
+	 * @param other map to compare with
+	 * @return true if both have the same keys with equal values
+	 */
+	bool operator==(const flat_map& other) const {
+		if (size() != other.size()) {
+			return false;
+		}
+		for (auto& [key, value] : values) {
+			auto i = other.find(key);
+			if (i == other.end() || !(i->second == value)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Compare two maps
+	 * @param other map to compare with
+	 * @return true if they differ
+	 */
+	bool operator!=(const flat_map& other) const {
+		return !(*this == other);
+	}
+};
+
+}
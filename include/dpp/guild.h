@@ -27,13 +27,17 @@
 #include <dpp/utility.h>
 #include <dpp/voicestate.h>
 #include <dpp/permissions.h>
+#include <dpp/flat_map.h>
+#include <dpp/interned.h>
 #include <string>
 #include <unordered_map>
+#include <shared_mutex>
 #include <dpp/json_interface.h>
 
 namespace dpp {
 
 class channel;
+class etf_reader;
 
 /* Note from Archie: I'd like to move this soon (dpp::guild::region) and allow users to use a region enum.
  * This would make it easier for people to be able to alter a channel region without having to get the text right.
@@ -417,16 +421,17 @@ protected:
 
 protected:
 	/**
-	 * @brief Nickname.
+	 * @brief Nickname. Shared with every other member with the same nickname.
 	 *
-	 * @note Empty string if they don't have a nickname on this guild
+	 * @note Empty if they don't have a nickname on this guild
 	 */
-	std::string nickname;
+	interned<std::string> nickname;
 
 	/**
-	 * @brief List of roles this user has on this guild
+	 * @brief List of roles this user has on this guild. Shared with every other member
+	 * with the same list, as most members of large guilds have one of a few.
 	 */
-	std::vector<snowflake> roles;
+	interned<std::vector<snowflake>, snowflake_list_hash> roles;
 
 	/**
 	 * @brief A set of flags built from the bitmask defined by dpp::guild_member_flags
@@ -480,6 +485,16 @@ public:
 	 */
 	guild_member& fill_from_json(nlohmann::json* j, snowflake g_id, snowflake u_id);
 
+	/**
+	 * @brief Fill this object directly from an ETF member object, without decoding it to json.
+	 * The user id is taken from the member's user object.
+	 * @param r The reader, positioned at the member object
+	 * @param g_id The guild id to associate the member with
+	 * @param user If not nullptr, receives the member's user object, for filling a dpp::user
+	 * @return Reference to self for call chaining
+	 */
+	guild_member& fill_from_etf(etf_reader& r, snowflake g_id, nlohmann::json* user = nullptr);
+
 	/**
 	 * @brief Returns true if the user is in time-out (communication disabled)
 	 * 
@@ -595,6 +610,8 @@ public:
 	 * @brief Get the roles
 	 * 
 	 * @return std::vector<dpp::snowflake> roles
+	 * @note The list is shared with other members, and the reference stays valid until this
+	 * member's roles are changed or the member is destroyed.
 	 */
 	const std::vector<dpp::snowflake>& get_roles() const;
 
@@ -988,17 +1005,56 @@ enum guild_afk_timeout_t : uint8_t {
 };
 
 /**
- * @brief Guild members container
+ * @brief Guild members container.
+ * @note Erasing a member moves the last member into its place, so erasing invalidates
+ * iterators to the last member as well as the erased one. Inserting may invalidate all iterators.
  */
-typedef std::unordered_map<snowflake, guild_member> members_container;
+typedef flat_map<snowflake, guild_member> members_container;
+
+/**
+ * @brief A std::shared_mutex which can be copied and assigned along with the guild holding it.
+ * The copy is a new, unlocked mutex: lock state is never copied.
+ */
+class guild_mutex : public std::shared_mutex {
+public:
+	/**
+	 * @brief Construct an unlocked mutex
+	 */
+	guild_mutex() = default;
+
+	/**
+	 * @brief Construct a new unlocked mutex in place of a copy
+	 */
+	guild_mutex(const guild_mutex&) noexcept : std::shared_mutex() {
+	}
+
+	/**
+	 * @brief Keep this mutex as it is in place of an assignment
+	 * @return guild_mutex& this mutex
+	 */
+	guild_mutex& operator=(const guild_mutex&) noexcept {
+		return *this;
+	}
+};
 
 /**
  * @brief Represents a guild on Discord (AKA a server)
+ *
+ * @note The roles, channels, threads, emojis, voice_members and members of a cached guild are
+ * changed by the shards as events arrive. The library holds the guild's mutex exclusively while
+ * it changes them, so to read them safely from your own threads use dpp::guild::read, or to change
+ * them use dpp::guild::write. Each guild has its own mutex, so different guilds never wait on
+ * each other.
  */
 class DPP_EXPORT guild : public managed, public json_interface<guild> {
 protected:
 	friend struct json_interface<guild>;
 
+	/**
+	 * @brief Protects roles, channels, threads, emojis, voice_members and members
+	 */
+	mutable guild_mutex lists_mutex;
+
 	/** Read class values from json object
 	 * @param j A json object to read from
 	 * @return A reference to self
@@ -1216,6 +1272,47 @@ public:
 	 */
 	virtual ~guild() = default;
 
+	/**
+	 * @brief Get the mutex which protects roles, channels, threads, emojis, voice_members and members.
+	 * Hold it shared to read them, or exclusively to change them.
+	 * @return std::shared_mutex& mutex
+	 */
+	std::shared_mutex& get_mutex() const;
+
+	/**
+	 * @brief Call a function with the guild while holding its mutex shared.
+	 * Other readers run at the same time; changes made by the library wait until it returns.
+	 *
+	 * To take a consistent copy of the guild, return it from the function:
+	 * @code{.cpp}
+	 * dpp::guild snapshot = g->read([](const dpp::guild& g) { return g; });
+	 * @endcode
+	 *
+	 * @warning Don't keep references, pointers or iterators into the guild past the end of
+	 * the function, and don't call methods which take the mutex themselves (those documented
+	 * as locking the guild) from inside it.
+	 * @param f function taking a const dpp::guild&
+	 * @return the value returned by f
+	 */
+	template<class F> auto read(F&& f) const {
+		std::shared_lock lock(lists_mutex);
+		return f(*this);
+	}
+
+	/**
+	 * @brief Call a function with the guild while holding its mutex exclusively.
+	 * Use this to change roles, channels, threads, emojis, voice_members or members of a cached guild.
+	 *
+	 * @warning Don't call methods which take the mutex themselves (those documented as locking the
+	 * guild) from inside the function.
+	 * @param f function taking a dpp::guild&
+	 * @return the value returned by f
+	 */
+	template<class F> auto write(F&& f) {
+		std::unique_lock lock(lists_mutex);
+		return f(*this);
+	}
+
 	/** Read class values from json object
 	 * @param shard originating shard
 	 * @param j A json object to read from
@@ -1236,6 +1333,7 @@ public:
 	 *
 	 * @warning The method will search for the guild member in the cache by the users id.
 	 * If the guild member is not in cache, the method will always return 0.
+	 * It locks the guild to do so, so call the dpp::guild_member overload from inside dpp::guild::read.
 	 */
 	permission base_permissions(const class user* user) const;
 
@@ -1264,6 +1362,7 @@ public:
 	 *
 	 * @warning The method will search for the guild member in the cache by the users id.
 	 * If the guild member is not in cache, the method will always return 0.
+	 * It locks the guild to do so, so call the dpp::guild_member overload from inside dpp::guild::read.
 	 */
 	permission permission_overwrites(const uint64_t base_permissions, const user* user, const channel* channel) const;
 
@@ -1279,6 +1378,7 @@ public:
 
 	/**
 	 * @brief Rehash members map
+	 * @note Locks the guild exclusively
 	 */
 	void rehash_members();
 
@@ -1294,6 +1394,7 @@ public:
 	 * @note This is NOT a synchronous blocking call! The bot isn't instantly ready to send or listen for audio,
 	 * as we have to wait for the connection to the voice server to be established!
 	 * e.g. wait for dpp::cluster::on_voice_ready event, and then send the audio within that event.
+	 * @note Locks the guild
 	 */
 	bool connect_member_voice(snowflake user_id, bool self_mute = false, bool self_deaf = false, bool dave = false);
 
@@ -2045,6 +2146,7 @@ typedef std::unordered_map<snowflake, guild_member> guild_member_map;
  *
  * @throw dpp::cache_exception if the guild or guild_member is not found in the cache
  * @return guild_member the cached object, if found
+ * @note Locks the guild
  */
 guild_member DPP_EXPORT find_guild_member(const snowflake guild_id, const snowflake user_id);
 
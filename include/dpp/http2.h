@@ -0,0 +1,932 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/export.h>
+#include <dpp/httpsclient.h>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace dpp {
+
+/**
+ * @brief A header field as it is carried by HPACK: a lowercase name and its value
+ */
+typedef std::pair<std::string, std::string> hpack_field;
+
+/**
+ * @brief An HPACK (RFC 7541) header table: the static table, followed by a
+ * dynamic table of recently sent fields, newest first.
+ */
+class DPP_EXPORT hpack_table {
+	/**
+	 * @brief Dynamic table entries, newest at the front
+	 */
+	std::deque<hpack_field> entries;
+
+	/**
+	 * @brief Size of the dynamic table, as counted by HPACK (name + value + 32 per entry)
+	 */
+	size_t size;
+
+	/**
+	 * @brief Largest size the dynamic table may grow to
+	 */
+	size_t max_size;
+
+	/**
+	 * @brief Drop the oldest entries until the table fits within a size
+	 * @param limit size to fit within
+	 */
+	void evict(size_t limit);
+
+public:
+	/**
+	 * @brief Number of entries in the static table
+	 */
+	static constexpr size_t static_entries = 61;
+
+	/**
+	 * @brief Construct a header table
+	 * @param table_size Largest size of the dynamic table
+	 */
+	hpack_table(size_t table_size = 4096);
+
+	/**
+	 * @brief Add a field to the dynamic table, evicting old entries to make room.
+	 * A field larger than the whole table empties it and is not added.
+	 * @param name field name
+	 * @param value field value
+	 */
+	void add(std::string_view name, std::string_view value);
+
+	/**
+	 * @brief Get a field by its HPACK index
+	 * @param index index, starting at 1 for the static table, dynamic entries following it
+	 * @return field, or nullptr if the index is out of range
+	 */
+	const hpack_field* get(size_t index) const;
+
+	/**
+	 * @brief Find a field
+	 * @param name field name
+	 * @param value field value
+	 * @param exact set to true if both name and value matched, false if only the name did
+	 * @return index of the field, or 0 if there is no entry with the name
+	 */
+	size_t find(std::string_view name, std::string_view value, bool& exact) const;
+
+	/**
+	 * @brief Change the largest size of the dynamic table, evicting entries if it shrinks
+	 * @param table_size new size
+	 */
+	void set_max_size(size_t table_size);
+
+	/**
+	 * @brief Get the largest size of the dynamic table
+	 * @return size
+	 */
+	size_t get_max_size() const;
+
+	/**
+	 * @brief Get the current size of the dynamic table
+	 * @return size
+	 */
+	size_t get_size() const;
+};
+
+/**
+ * @brief Compresses header fields into HPACK header blocks. Fields seen before are
+ * sent as an index into the table, so that headers repeated on every request, such
+ * as the bot token and user agent, cost a byte or two after the first time.
+ */
+class DPP_EXPORT hpack_encoder {
+	/**
+	 * @brief Header table, kept in step with the peer's decoder
+	 */
+	hpack_table table;
+
+	/**
+	 * @brief True if a change of table size is to be announced at the start of the next header block
+	 */
+	bool size_update;
+
+	/**
+	 * @brief Append a string literal, Huffman coded if that makes it shorter
+	 * @param out output
+	 * @param s string
+	 */
+	static void append_string(std::string& out, std::string_view s);
+
+public:
+	/**
+	 * @brief Construct an encoder with the default 4096 byte table
+	 */
+	hpack_encoder();
+
+	/**
+	 * @brief Set the table size the peer's decoder allows (SETTINGS_HEADER_TABLE_SIZE).
+	 * The change is announced at the start of the next header block.
+	 * @param table_size size in bytes
+	 */
+	void set_max_table_size(size_t table_size);
+
+	/**
+	 * @brief Encode a header block
+	 * @param fields fields to encode, names in lowercase
+	 * @return header block
+	 */
+	std::string encode(const std::vector<hpack_field>& fields);
+
+	/**
+	 * @brief Append an HPACK integer with an N-bit prefix
+	 * @param out output
+	 * @param value value
+	 * @param prefix_bits number of bits of the first byte used by the value
+	 * @param flags the bits of the first byte above the prefix
+	 */
+	static void append_integer(std::string& out, uint64_t value, uint8_t prefix_bits, uint8_t flags);
+
+	/**
+	 * @brief Huffman code a string with the HPACK code
+	 * @param s string
+	 * @return coded string
+	 */
+	static std::string huffman_encode(std::string_view s);
+};
+
+/**
+ * @brief Decompresses HPACK header blocks
+ */
+class DPP_EXPORT hpack_decoder {
+	/**
+	 * @brief Header table, kept in step with the peer's encoder
+	 */
+	hpack_table table;
+
+	/**
+	 * @brief Largest table size the peer may ask for, which is the size we advertise
+	 */
+	size_t max_allowed;
+
+	/**
+	 * @brief Read an HPACK string literal
+	 * @param block header block
+	 * @param pos position in block, advanced past the string
+	 * @param out string read
+	 * @return false if the block is malformed
+	 */
+	static bool read_string(std::string_view block, size_t& pos, std::string& out);
+
+public:
+	/**
+	 * @brief Construct a decoder
+	 * @param table_size table size advertised to the peer
+	 */
+	hpack_decoder(size_t table_size = 4096);
+
+	/**
+	 * @brief Decode a header block, updating the table
+	 * @param block header block
+	 * @param fields decoded fields are appended to this
+	 * @return false if the block is malformed, which is a connection error
+	 */
+	bool decode(std::string_view block, std::vector<hpack_field>& fields);
+
+	/**
+	 * @brief Read an HPACK integer with an N-bit prefix
+	 * @param block header block
+	 * @param pos position in block, advanced past the integer
+	 * @param prefix_bits number of bits of the first byte used by the value
+	 * @param value value read
+	 * @return false if the block is malformed
+	 */
+	static bool read_integer(std::string_view block, size_t& pos, uint8_t prefix_bits, uint64_t& value);
+
+	/**
+	 * @brief Decode a Huffman coded string
+	 * @param s coded string
+	 * @param out decoded string is appended to this
+	 * @return false if the string is malformed
+	 */
+	static bool huffman_decode(std::string_view s, std::string& out);
+};
+
+class http2_connection;
+class http2_stream;
+
+/**
+ * @brief Called on the socket engine's thread when an HTTP/2 stream completes, fails or is cancelled
+ */
+typedef std::function<void(http2_stream* stream)> http2_completion_t;
+
+/**
+ * @brief A single request and its response, carried on a stream of a shared
+ * HTTP/2 connection. Streams are created by the caller, submitted to a
+ * http2_pool, and completed on the pool's socket engine.
+ *
+ * The response accessors match those of https_client, so a response can be
+ * read the same way whichever protocol carried it.
+ */
+class DPP_EXPORT http2_stream {
+	friend class http2_connection;
+	friend class http2_pool;
+
+	/**
+	 * @brief Connection carrying the stream, set once it is submitted
+	 */
+	http2_connection* connection;
+
+	/**
+	 * @brief Stream identifier, 0 until the request headers have been sent
+	 */
+	uint32_t id;
+
+	/**
+	 * @brief Bytes we may still send on this stream before the peer opens its window
+	 */
+	int64_t send_window;
+
+	/**
+	 * @brief Bytes of the request body sent
+	 */
+	uint64_t body_sent;
+
+	/**
+	 * @brief Response body bytes received since we last opened the stream's window
+	 */
+	uint32_t unacknowledged;
+
+	/**
+	 * @brief True once the response headers (not an informational 1xx response) have been received
+	 */
+	bool headers_received;
+
+	/**
+	 * @brief True once completion has been called
+	 */
+	bool finished;
+
+	/**
+	 * @brief Response status
+	 */
+	uint16_t status;
+
+	/**
+	 * @brief Response headers, names in lowercase
+	 */
+	http_headers response_headers;
+
+	/**
+	 * @brief Response body, if there is no body sink
+	 */
+	std::string content;
+
+	/**
+	 * @brief Decodes a gzip or deflate encoded response body as it arrives
+	 */
+	http_body_decoder decoder;
+
+	/**
+	 * @brief Length of the request body
+	 */
+	uint64_t body_length() const;
+
+	/**
+	 * @brief Detach the stream from its connection and call its completion, once
+	 */
+	void finish();
+
+public:
+	/**
+	 * @brief Request method, e.g. GET
+	 */
+	std::string method;
+
+	/**
+	 * @brief Host name, sent as :authority and used to pick a connection
+	 */
+	std::string hostname;
+
+	/**
+	 * @brief Port to connect to
+	 */
+	uint16_t port;
+
+	/**
+	 * @brief True for HTTP/2 over plain TCP with prior knowledge (h2c), rather than over TLS
+	 */
+	bool plaintext;
+
+	/**
+	 * @brief Request path including any query string
+	 */
+	std::string path;
+
+	/**
+	 * @brief Request headers. Names are sent in lowercase; headers which only apply
+	 * to HTTP/1.1, such as Connection and Host, are not sent.
+	 */
+	http_headers headers;
+
+	/**
+	 * @brief Request body, if there is no body source
+	 */
+	std::string body;
+
+	/**
+	 * @brief Request body source and response body sink, if the bodies are streamed
+	 */
+	https_streaming streaming;
+
+	/**
+	 * @brief Seconds to wait for the response, from when the stream is submitted
+	 */
+	uint16_t request_timeout;
+
+	/**
+	 * @brief When the response is due, set when the stream is submitted
+	 */
+	time_t deadline;
+
+	/**
+	 * @brief Called once the stream completes
+	 */
+	http2_completion_t completion;
+
+	/**
+	 * @brief True if the response did not arrive before the deadline
+	 */
+	bool timed_out;
+
+	/**
+	 * @brief True if the stream was cancelled
+	 */
+	bool aborted;
+
+	/**
+	 * @brief True if the request failed without the server having processed it, so that
+	 * it is safe to send again: the connection could not negotiate HTTP/2, the server
+	 * refused the stream, or it went away before reaching it.
+	 */
+	bool retry;
+
+	/**
+	 * @brief Construct a stream
+	 */
+	http2_stream();
+
+	/**
+	 * @brief Get a response header
+	 * @param header_name header name, in any case
+	 * @return header value, or empty string if there is no such header
+	 */
+	const std::string get_header(std::string header_name) const;
+
+	/**
+	 * @brief Get all response headers
+	 * @return headers, names in lowercase
+	 */
+	const std::multimap<std::string, std::string> get_headers() const;
+
+	/**
+	 * @brief Get the response body
+	 * @return body, empty if it was given to a body sink
+	 */
+	const std::string get_content() const;
+
+	/**
+	 * @brief Get the response status
+	 * @return HTTP status, or 0 if no response was received
+	 */
+	uint16_t get_status() const;
+
+	/**
+	 * @brief Get the number of response body bytes received, before decoding
+	 * @return length
+	 */
+	uint64_t get_received_length() const;
+
+	/**
+	 * @brief Get the number of response body bytes after any content encoding was decoded
+	 * @return length
+	 */
+	uint64_t get_decoded_length() const;
+
+	/**
+	 * @brief Get the stream identifier
+	 * @return identifier, or 0 if the request was never sent
+	 */
+	uint32_t get_id() const;
+};
+
+/**
+ * @brief An HTTP/2 (RFC 9113) client connection, carrying many concurrent requests
+ * as streams. Over TLS, HTTP/2 is negotiated with ALPN; if the server chooses
+ * HTTP/1.1 instead, the connection fails with every stream marked for retry.
+ *
+ * Runs on a socket engine, and all of its methods must be called on the engine's
+ * thread. Created and owned by a http2_pool.
+ */
+class DPP_EXPORT http2_connection : public ssl_client {
+	/**
+	 * @brief Pool which owns this connection
+	 */
+	class http2_pool* owner;
+
+	/**
+	 * @brief Open streams by identifier
+	 */
+	std::map<uint32_t, std::shared_ptr<http2_stream>> streams;
+
+	/**
+	 * @brief Streams waiting to be opened, for the connection to be made, or for a
+	 * stream slot under the peer's concurrency limit
+	 */
+	std::deque<std::shared_ptr<http2_stream>> pending;
+
+	/**
+	 * @brief Header compression for requests
+	 */
+	hpack_encoder encoder;
+
+	/**
+	 * @brief Header decompression for responses
+	 */
+	hpack_decoder decoder;
+
+	/**
+	 * @brief True once the connection is made and the preface is sent
+	 */
+	bool ready;
+
+	/**
+	 * @brief True once the connection has failed or closed; no more streams can use it
+	 */
+	bool closed;
+
+	/**
+	 * @brief True once the server has sent GOAWAY, or stream identifiers have run out; no new streams may be opened
+	 */
+	bool going_away;
+
+	/**
+	 * @brief True while handle_buffer() is reading frames from the buffer, which must not be closed under it
+	 */
+	bool parsing;
+
+	/**
+	 * @brief Identifier for the next stream we open
+	 */
+	uint32_t next_stream_id;
+
+	/**
+	 * @brief Bytes we may still send on the connection before the peer opens its window
+	 */
+	int64_t send_window;
+
+	/**
+	 * @brief Initial send window of new streams (SETTINGS_INITIAL_WINDOW_SIZE)
+	 */
+	int64_t peer_initial_window;
+
+	/**
+	 * @brief Largest frame payload the peer accepts (SETTINGS_MAX_FRAME_SIZE)
+	 */
+	uint32_t peer_max_frame;
+
+	/**
+	 * @brief Most streams the peer allows open at once (SETTINGS_MAX_CONCURRENT_STREAMS)
+	 */
+	uint32_t peer_max_streams;
+
+	/**
+	 * @brief Response body bytes received since we last opened the connection's window
+	 */
+	uint32_t unacknowledged;
+
+	/**
+	 * @brief Stream whose header block is being continued, or 0
+	 */
+	uint32_t continuation_stream;
+
+	/**
+	 * @brief True if the header block being continued ends its stream
+	 */
+	bool continuation_end_stream;
+
+	/**
+	 * @brief Header block being continued with CONTINUATION frames
+	 */
+	std::string header_block;
+
+	/**
+	 * @brief Frames to be written by the next flush()
+	 */
+	std::string out;
+
+	/**
+	 * @brief Time the last stream on the connection finished
+	 */
+	time_t idle_since;
+
+	/**
+	 * @brief Most streams open at once on this connection
+	 */
+	size_t peak_streams;
+
+	/**
+	 * @brief Append a frame to out
+	 * @param type frame type
+	 * @param flags frame flags
+	 * @param stream_id stream identifier, 0 for the connection
+	 * @param payload frame payload
+	 */
+	void frame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload);
+
+	/**
+	 * @brief Write out to the socket
+	 */
+	void flush();
+
+	/**
+	 * @brief Open pending streams while the peer's concurrency limit allows
+	 */
+	void open_streams();
+
+	/**
+	 * @brief Send the request headers of a stream, opening it
+	 * @param s stream
+	 */
+	void send_headers(const std::shared_ptr<http2_stream>& s);
+
+	/**
+	 * @brief Send as much of each request body as flow control allows, a few
+	 * frames at a time so that memory use stays the same however large the body
+	 */
+	void send_bodies();
+
+	/**
+	 * @brief Send the next part of a stream's body, as flow control allows
+	 * @param s stream
+	 * @param budget bytes which may be sent, reduced by the number sent
+	 * @return false if the body source failed, and the stream was reset
+	 */
+	bool send_body(http2_stream& s, size_t& budget);
+
+	/**
+	 * @brief Handle a complete frame from the peer
+	 * @param type frame type
+	 * @param flags frame flags
+	 * @param stream_id stream identifier
+	 * @param payload frame payload
+	 * @return false on a connection error, after which the connection is closed
+	 */
+	bool handle_frame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload);
+
+	/**
+	 * @brief Handle a complete header block
+	 * @param stream_id stream identifier
+	 * @param block header block
+	 * @param end_stream true if the stream ends with the block
+	 * @return false on a connection error
+	 */
+	bool handle_headers(uint32_t stream_id, std::string_view block, bool end_stream);
+
+	/**
+	 * @brief Handle a SETTINGS frame
+	 * @param flags frame flags
+	 * @param payload frame payload
+	 * @return false on a connection error
+	 */
+	bool handle_settings(uint8_t flags, std::string_view payload);
+
+	/**
+	 * @brief Complete a stream, removing it from the connection
+	 * @param stream_id stream identifier
+	 */
+	void complete(uint32_t stream_id);
+
+	/**
+	 * @brief Reset a stream and fail it
+	 * @param stream_id stream identifier
+	 * @param error_code HTTP/2 error code sent to the peer
+	 */
+	void reset(uint32_t stream_id, uint32_t error_code);
+
+	/**
+	 * @brief End the connection with GOAWAY, failing every stream
+	 * @param error_code HTTP/2 error code sent to the peer
+	 * @param reason reason to log
+	 */
+	void connection_error(uint32_t error_code, const std::string& reason);
+
+	/**
+	 * @brief Close the connection, failing every stream still on it
+	 * @param retry_pending true if streams not yet opened may be sent again
+	 */
+	void shut_down(bool retry_pending);
+
+	/**
+	 * @brief Called once the TCP and TLS connection is made
+	 * @param success true if it was made
+	 * @param error reason it failed
+	 */
+	void connected(bool success, const std::string& error);
+
+protected:
+	/**
+	 * @brief Called when the socket closes
+	 */
+	void on_disconnect() override;
+
+	/**
+	 * @brief Called when everything queued has been written, to send more of the request bodies
+	 */
+	void on_write_drained() override;
+
+public:
+	/**
+	 * @brief Construct a connection and start connecting it on a socket engine
+	 * @param e socket engine to run on
+	 * @param pool pool which owns the connection
+	 * @param hostname host name
+	 * @param port port
+	 * @param plaintext true for h2c with prior knowledge, rather than TLS
+	 */
+	http2_connection(socket_engine_base* e, class http2_pool* pool, const std::string& hostname, uint16_t port, bool plaintext);
+
+	/**
+	 * @brief Destroy the connection. Must be called on the engine's thread.
+	 */
+	virtual ~http2_connection();
+
+	/**
+	 * @brief Add a stream to the connection, opening it as soon as the peer allows
+	 * @param s stream
+	 */
+	void submit(const std::shared_ptr<http2_stream>& s);
+
+	/**
+	 * @brief Cancel a stream, resetting it if it is open
+	 * @param s stream
+	 */
+	void cancel(const std::shared_ptr<http2_stream>& s);
+
+	/**
+	 * @brief Handle received data, a frame at a time
+	 * @param buffer received data, from which complete frames are removed
+	 * @return false if the connection should close
+	 */
+	bool handle_buffer(std::string& buffer) override;
+
+	/**
+	 * @brief Time out streams and close the connection once it has been idle for a while
+	 */
+	void one_second_timer() override;
+
+	/**
+	 * @brief Get the number of streams on the connection, open or waiting to open
+	 * @return number of streams
+	 */
+	size_t get_load() const;
+
+	/**
+	 * @brief Get the number of streams the peer allows open at once
+	 * @return limit
+	 */
+	uint32_t get_max_streams() const;
+
+	/**
+	 * @brief Get the most streams open at once on the connection
+	 * @return number of streams
+	 */
+	size_t get_peak_streams() const;
+
+	/**
+	 * @brief Check if new streams may be added
+	 * @return true unless the connection has closed or the server is going away
+	 */
+	bool is_accepting() const;
+
+	/**
+	 * @brief Check if the connection has closed, and can be removed from its pool
+	 * @return true if closed
+	 */
+	bool is_closed() const;
+};
+
+/**
+ * @brief Counters for a http2_pool
+ */
+struct DPP_EXPORT http2_pool_stats {
+	/**
+	 * @brief Connections opened since the pool was created
+	 */
+	uint64_t connections_opened{0};
+
+	/**
+	 * @brief Connections currently open
+	 */
+	uint64_t connections{0};
+
+	/**
+	 * @brief Streams submitted since the pool was created
+	 */
+	uint64_t streams{0};
+
+	/**
+	 * @brief Most streams open at once on any one connection
+	 */
+	uint64_t peak_streams{0};
+};
+
+/**
+ * @brief HTTP/2 connections shared by every request of a dpp::request_queue. Requests
+ * to the same host are multiplexed as streams over a few connections, up to a
+ * per-host connection limit, rather than each having a connection of its own.
+ *
+ * Hosts which do not negotiate HTTP/2 are remembered, so that their requests can
+ * be made with HTTP/1.1 instead.
+ */
+class DPP_EXPORT http2_pool {
+	friend class http2_connection;
+
+	/**
+	 * @brief Socket engine running every connection of the pool
+	 */
+	socket_engine_base* engine;
+
+	/**
+	 * @brief Connections by key, only used on the engine's thread
+	 */
+	std::unordered_map<std::string, std::vector<std::unique_ptr<http2_connection>>> connections;
+
+	/**
+	 * @brief Mutex for http1_hosts
+	 */
+	mutable std::mutex hosts_mutex;
+
+	/**
+	 * @brief Keys of hosts which did not negotiate HTTP/2
+	 */
+	std::unordered_set<std::string> http1_hosts;
+
+	/**
+	 * @brief Most connections made to each host
+	 */
+	std::atomic<uint32_t> max_connections_per_host;
+
+	/**
+	 * @brief Counter for connections_opened
+	 */
+	std::atomic<uint64_t> connections_opened{0};
+
+	/**
+	 * @brief Count of open connections
+	 */
+	std::atomic<uint64_t> open_connections{0};
+
+	/**
+	 * @brief Counter for streams
+	 */
+	std::atomic<uint64_t> streams{0};
+
+	/**
+	 * @brief Most streams open at once on any one connection
+	 */
+	std::atomic<uint64_t> peak_streams{0};
+
+	/**
+	 * @brief Ticker removing closed connections
+	 */
+	uint64_t ticker_id;
+
+	/**
+	 * @brief Pick a connection for a stream, or make a new one. Runs on the engine's thread.
+	 * @param s stream
+	 */
+	void dispatch(const std::shared_ptr<http2_stream>& s);
+
+	/**
+	 * @brief Remember that a host does not negotiate HTTP/2
+	 * @param key pool key
+	 */
+	void set_http1(const std::string& key);
+
+	/**
+	 * @brief Remove closed connections. Runs on the engine's thread.
+	 */
+	void prune();
+
+	/**
+	 * @brief Called when a connection closes
+	 */
+	void connection_closed();
+
+	/**
+	 * @brief Update peak_streams
+	 * @param open_streams streams open on a connection
+	 */
+	void record_peak(size_t open_streams);
+
+public:
+	/**
+	 * @brief Construct a pool
+	 * @param e socket engine to run connections on
+	 * @param max_connections most connections made to each host
+	 */
+	http2_pool(socket_engine_base* e, uint32_t max_connections = 4);
+
+	/**
+	 * @brief Close every connection, failing their streams
+	 */
+	~http2_pool();
+
+	/**
+	 * @brief Non-copyable
+	 */
+	http2_pool(const http2_pool&) = delete;
+
+	/**
+	 * @brief Non-copyable
+	 */
+	http2_pool& operator=(const http2_pool&) = delete;
+
+	/**
+	 * @brief Make a pool key for a host
+	 * @param hostname host name
+	 * @param port port
+	 * @param plaintext true for h2c
+	 * @return key
+	 */
+	static std::string make_key(const std::string& hostname, uint16_t port, bool plaintext);
+
+	/**
+	 * @brief Submit a stream. May be called from any thread; the stream is started
+	 * on the engine's thread, and its completion is called there.
+	 * @param s stream
+	 */
+	void submit(const std::shared_ptr<http2_stream>& s);
+
+	/**
+	 * @brief Cancel a stream. May be called from any thread.
+	 * Its completion is called with aborted set, unless it has already completed.
+	 * @param s stream
+	 */
+	void cancel(const std::shared_ptr<http2_stream>& s);
+
+	/**
+	 * @brief Check if a host is known not to negotiate HTTP/2
+	 * @param hostname host name
+	 * @param port port
+	 * @param plaintext true for h2c
+	 * @return true if requests to the host should use HTTP/1.1
+	 */
+	bool is_http1(const std::string& hostname, uint16_t port, bool plaintext) const;
+
+	/**
+	 * @brief Set the most connections made to each host. Further streams share the
+	 * least busy connection, waiting for a slot if it is at the server's stream limit.
+	 * @param max_connections limit, at least 1
+	 * @return reference to self
+	 */
+	http2_pool& set_max_connections_per_host(uint32_t max_connections);
+
+	/**
+	 * @brief Get the pool's counters
+	 * @return counters
+	 */
+	http2_pool_stats get_stats() const;
+};
+
+}
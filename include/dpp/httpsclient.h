@@ -29,6 +29,12 @@
 #include <dpp/sslclient.h>
 #include <dpp/version.h>
 #include <dpp/stringops.h>
+#include <string_view>
+#include <functional>
+#include <deque>
+
+/* Defined by zlib.h, which we don't want to make a dependency of the public headers */
+struct z_stream_s;
 
 namespace dpp {
 
@@ -103,6 +109,115 @@ struct multipart_content {
 	std::string mimetype;
 };
 
+/**
+ * @brief Supplies a request body a piece at a time, called whenever the connection
+ * has sent everything it was given so far.
+ * @param buffer Where to write the next piece
+ * @param max Most bytes which may be written
+ * @return Number of bytes written, or 0 at the end of the body
+ */
+typedef std::function<size_t(char* buffer, size_t max)> https_body_source;
+
+/**
+ * @brief Receives the response body a piece at a time, after content decoding,
+ * as it arrives. The piece is only valid during the call.
+ */
+typedef std::function<void(std::string_view piece)> https_body_sink;
+
+/**
+ * @brief Streaming options for a https_client request
+ */
+struct https_streaming {
+	/**
+	 * @brief If set, the request body is read from this as it is sent, instead
+	 * of being passed whole to the constructor
+	 */
+	https_body_source source;
+
+	/**
+	 * @brief Length of the body the source supplies, sent as Content-Length
+	 */
+	uint64_t source_length{0};
+
+	/**
+	 * @brief If set, the response body is passed to this as it arrives and
+	 * is not kept, so https_client::get_content() is empty
+	 */
+	https_body_sink sink;
+};
+
+/**
+ * @brief A multipart mime body as a list of pieces, which refer to the file contents
+ * it was built from rather than copying them. See https_client::stream_multipart().
+ */
+struct DPP_EXPORT multipart_stream {
+	/**
+	 * @brief Boundaries and part headers, which segments refer to. A deque, so that
+	 * adding a piece does not move the others.
+	 */
+	std::deque<std::string> parts;
+
+	/**
+	 * @brief The body, in order
+	 */
+	std::vector<std::string_view> segments;
+
+	/**
+	 * @brief Total length of the body
+	 */
+	uint64_t length{0};
+
+	/**
+	 * @brief MIME type
+	 */
+	std::string mimetype;
+
+	/**
+	 * @brief Construct an empty stream
+	 */
+	multipart_stream() = default;
+
+	/**
+	 * @brief Non-copyable, as segments refer into parts
+	 */
+	multipart_stream(const multipart_stream&) = delete;
+
+	/**
+	 * @brief Non-copyable, as segments refer into parts
+	 */
+	multipart_stream& operator=(const multipart_stream&) = delete;
+
+	/**
+	 * @brief Movable, as moving the deque does not move the parts
+	 */
+	multipart_stream(multipart_stream&&) = default;
+
+	/**
+	 * @brief Movable, as moving the deque does not move the parts
+	 */
+	multipart_stream& operator=(multipart_stream&&) = default;
+
+	/**
+	 * @brief Add a boundary or part header
+	 * @param part text to add
+	 */
+	void add_part(std::string part);
+
+	/**
+	 * @brief Add content the body refers to without copying it
+	 * @param content content, which must outlive the stream
+	 */
+	void add_content(std::string_view content);
+
+	/**
+	 * @brief Get a source which supplies the body from the start. Each call
+	 * returns a new source, so that the body can be sent more than once.
+	 * The stream must outlive the source.
+	 * @return body source
+	 */
+	https_body_source source() const;
+};
+
 /**
  * @brief Represents a HTTP scheme, hostname and port
  * split into parts for easy use in https_client.
@@ -130,6 +245,97 @@ struct http_connect_info {
 	uint16_t port;
 };
 
+/**
+ * @brief Decodes a response body with a gzip or deflate Content-Encoding as it
+ * arrives, a piece at a time. Bodies with no encoding are passed through.
+ */
+class DPP_EXPORT http_body_decoder {
+	/**
+	 * @brief Zlib stream, or nullptr if the body is not encoded
+	 */
+	z_stream_s* decoder;
+
+	/**
+	 * @brief True if the Content-Encoding is deflate. Servers send it either
+	 * zlib-wrapped or raw, which is told apart by the first two bytes.
+	 */
+	bool deflate_encoded;
+
+	/**
+	 * @brief Number of bytes of the body received, before decoding.
+	 * This is what Content-Length counts.
+	 */
+	uint64_t received;
+
+	/**
+	 * @brief Number of bytes of the body after decoding, whether kept or sunk
+	 */
+	uint64_t decoded;
+
+	/**
+	 * @brief Decoded content waiting to be passed to a sink, reused for each piece
+	 */
+	std::string piece;
+
+public:
+	/**
+	 * @brief Construct a decoder which passes content through until started
+	 */
+	http_body_decoder();
+
+	/**
+	 * @brief Free the zlib stream
+	 */
+	~http_body_decoder();
+
+	/**
+	 * @brief Non-copyable, the zlib stream is owned
+	 */
+	http_body_decoder(const http_body_decoder&) = delete;
+
+	/**
+	 * @brief Non-copyable, the zlib stream is owned
+	 */
+	http_body_decoder& operator=(const http_body_decoder&) = delete;
+
+	/**
+	 * @brief Start decoding, if the encoding is gzip or deflate. Any other
+	 * encoding, which was not asked for, is passed through as is.
+	 * @param content_encoding value of the Content-Encoding header
+	 * @return false if the decoder could not be created
+	 */
+	bool start(const std::string& content_encoding);
+
+	/**
+	 * @brief Add received content, decoding it if the body is encoded
+	 * @param data Content as received
+	 * @param body Decoded content is appended to this, if there is no sink
+	 * @param sink Receives the decoded content instead of body, if set
+	 * @return false if the content could not be decoded
+	 */
+	bool append(std::string_view data, std::string& body, const https_body_sink& sink);
+
+	/**
+	 * @brief Get the number of bytes received, before decoding
+	 * @return size in bytes
+	 */
+	uint64_t get_received_length() const;
+
+	/**
+	 * @brief Get the number of bytes after decoding
+	 * @return size in bytes
+	 */
+	uint64_t get_decoded_length() const;
+};
+
+class https_client;
+
+/**
+ * @brief Called on the socket engine thread when an asynchronous request
+ * made by https_client has finished, successfully or not
+ */
+typedef std::function<void(https_client* client)> https_client_completion_t;
+
 /**
  * @brief Implements a HTTPS socket client based on the SSL client.
  * @note plaintext HTTP without SSL is also supported via a "downgrade" setting
@@ -156,10 +362,36 @@ class DPP_EXPORT https_client : public ssl_client {
 	std::string request_body;
 
 	/**
-	 * @brief The response body, e.g. file content or JSON
+	 * @brief The response body, e.g. file content or JSON, after content decoding
 	 */
 	std::string body;
 
+	/**
+	 * @brief Supplies the request body as it is sent, if not in request_body
+	 */
+	https_body_source body_source;
+
+	/**
+	 * @brief Length of the body body_source supplies
+	 */
+	uint64_t body_source_length;
+
+	/**
+	 * @brief Bytes of the body taken from body_source so far
+	 */
+	uint64_t body_source_sent;
+
+	/**
+	 * @brief Receives the response body as it arrives, if it is not to be kept in body
+	 */
+	https_body_sink body_sink;
+
+	/**
+	 * @brief Decodes the body as it arrives, if it has a Content-Encoding
+	 */
+	http_body_decoder content_decoder;
+
+
 	/**
 	 * @brief The reported length of the content. If this is
 	 * UULONG_MAX, then no length was reported by the server.
@@ -209,6 +441,13 @@ class DPP_EXPORT https_client : public ssl_client {
 	 */
 	std::multimap<std::string, std::string> response_headers;
 
+
+	/**
+	 * @brief Queue the next piece of the body from body_source
+	 * @return false if the body has all been queued, or the source failed
+	 */
+	bool write_source_piece();
+
 	/**
 	 * @brief Handle input buffer
 	 * 
@@ -217,6 +456,32 @@ class DPP_EXPORT https_client : public ssl_client {
 	 */
 	bool do_buffer(std::string& buffer);
 
+	/**
+	 * @brief Called when an asynchronous request finishes, empty for a blocking request
+	 */
+	https_client_completion_t completion;
+
+	/**
+	 * @brief True once completion has been called
+	 */
+	bool finished;
+
+	/**
+	 * @brief Build the request line, headers and body to send
+	 * @return request text
+	 */
+	std::string build_request() const;
+
+	/**
+	 * @brief Start an asynchronous request on the socket engine's thread
+	 */
+	void start_async();
+
+	/**
+	 * @brief Call the completion for an asynchronous request, if it has not already been called
+	 */
+	void finish();
+
 protected:
 	/**
 	 * @brief Start the connection
@@ -229,11 +494,28 @@ protected:
 	 */
 	http_state get_state();
 
+	/**
+	 * @brief Called when the connection is lost or the response has been read,
+	 * finishes an asynchronous request
+	 */
+	void on_disconnect() override;
+
+	/**
+	 * @brief Called when the connection has sent everything queued, to queue
+	 * the next piece of a streamed request body
+	 */
+	void on_write_drained() override;
+
 public:
 	/**
 	 * @brief If true the response timed out while waiting
 	 */
 	bool timed_out;	
+
+	/**
+	 * @brief If true the request was stopped early with abort()
+	 */
+	bool aborted;
 	
 	/**
 	 * @brief Connect to a specific HTTP(S) server and complete a request.
@@ -244,7 +526,7 @@ public:
 	 * 
 	 * @note This is a blocking call. It starts a loop which runs non-blocking
 	 * functions within it, but does not return until the request completes.
-	 * See queues.cpp for how to make this asynchronous.
+	 * Use the constructor which takes a socket engine to make a request asynchronously.
 	 * 
 	 * @param hostname Hostname to connect to
 	 * @param port Port number to connect to, usually 443 for SSL and 80 for plaintext
@@ -255,13 +537,49 @@ public:
 	 * @param plaintext_connection Set to true to make the connection plaintext (turns off SSL)
 	 * @param request_timeout How many seconds before the connection is considered failed if not finished
 	 * @param protocol Request HTTP protocol (default: 1.1)
+	 * @param connections Connection pool to reuse a keep-alive connection from, and to return the
+	 * connection to once the response has been read. If nullptr, a new connection is made and closed.
+	 * @param streaming Request body source and response body sink, to use instead of req_body and get_content()
+	 */
+        https_client(const std::string &hostname, uint16_t port = 443, const std::string &urlpath = "/", const std::string &verb = "GET", const std::string &req_body = "", const http_headers& extra_headers = {}, bool plaintext_connection = false, uint16_t request_timeout = 5, const std::string &protocol = "1.1", connection_pool* connections = nullptr, const https_streaming& streaming = {});
+
+	/**
+	 * @brief Start a HTTP(S) request without blocking.
+	 *
+	 * The constructor returns at once. The connection, or a pooled connection,
+	 * is driven by the given socket engine, and completion is called on the
+	 * engine's thread once the response has been read, the request has timed
+	 * out, or it has failed. The object must outlive the call to completion.
+	 *
+	 * @param e Socket engine to make the request on
+	 * @param hostname Hostname to connect to
+	 * @param port Port number to connect to, usually 443 for SSL and 80 for plaintext
+	 * @param urlpath path part of URL, e.g. "/api"
+	 * @param verb Request verb, e.g. GET or POST
+	 * @param req_body Request body
+	 * @param extra_headers Additional request headers
+	 * @param plaintext_connection Set to true to make the connection plaintext (turns off SSL)
+	 * @param request_timeout How many seconds before the request is considered failed if not finished
+	 * @param protocol Request HTTP protocol
+	 * @param connections Connection pool to reuse a keep-alive connection from, or nullptr
+	 * @param done Called once, on the socket engine thread, when the request has finished
+	 * @param streaming Request body source and response body sink, to use instead of req_body
+	 * and get_content(). Both are called on the socket engine thread.
+	 */
+	https_client(socket_engine_base* e, const std::string &hostname, uint16_t port, const std::string &urlpath, const std::string &verb, const std::string &req_body, const http_headers& extra_headers, bool plaintext_connection, uint16_t request_timeout, const std::string &protocol, connection_pool* connections, const https_client_completion_t& done, const https_streaming& streaming = {});
+
+	/**
+	 * @brief Destroy the https client object. An asynchronous request is detached
+	 * from its socket engine first, so no further callbacks are made.
 	 */
-        https_client(const std::string &hostname, uint16_t port = 443, const std::string &urlpath = "/", const std::string &verb = "GET", const std::string &req_body = "", const http_headers& extra_headers = {}, bool plaintext_connection = false, uint16_t request_timeout = 5, const std::string &protocol = "1.1");
+        virtual ~https_client();
 
 	/**
-	 * @brief Destroy the https client object
+	 * @brief Abandon an asynchronous request which is still in progress. The
+	 * connection is closed and the completion is called with no response.
+	 * Must be called on the socket engine thread.
 	 */
-        virtual ~https_client() = default;
+	void abort();
 
 	/**
 	 * @brief Build a multipart content from a set of files and some json
@@ -274,6 +592,44 @@ public:
 	 */
 	static multipart_content build_multipart(const std::string &json, const std::vector<std::string>& filenames = {}, const std::vector<std::string>& contents = {}, const std::vector<std::string>& mimetypes = {});
 
+	/**
+	 * @brief Build a multipart content from a set of files and some json, as a stream
+	 * which refers to the json and file contents rather than copying them
+	 *
+	 * @param json The json content, which must outlive the stream
+	 * @param filenames File names of files to send
+	 * @param contents Contents of each of the files to send, which must outlive the stream
+	 * @param mimetypes MIME types of each of the files to send
+	 * @return multipart mime stream and headers
+	 */
+	static multipart_stream stream_multipart(const std::string &json, const std::vector<std::string>& filenames = {}, const std::vector<std::string>& contents = {}, const std::vector<std::string>& mimetypes = {});
+
+	/**
+	 * @brief Get a source which reads a request body from a file as it is sent
+	 * @param filename File to read
+	 * @param length Set to the length of the file
+	 * @return body source
+	 * @throw dpp::file_exception if the file cannot be opened
+	 */
+	static https_body_source file_source(const std::string& filename, uint64_t& length);
+
+	/**
+	 * @brief Get a sink which writes a response body to a file as it arrives
+	 * @param filename File to create or truncate
+	 * @return body sink
+	 * @throw dpp::file_exception if the file cannot be opened
+	 */
+	static https_body_sink file_sink(const std::string& filename);
+
+	/**
+	 * @brief Compress a request body with gzip, to send with a
+	 * "Content-Encoding: gzip" header to servers which accept it
+	 * @param data Body to compress
+	 * @return gzip data
+	 * @throw dpp::connection_exception if zlib cannot compress
+	 */
+	static std::string gzip(std::string_view data);
+
 	/**
 	 * @brief Processes incoming data from the SSL socket input buffer.
 	 * 
@@ -327,12 +683,31 @@ public:
 	const std::multimap<std::string, std::string> get_headers() const;
  
 	/**
-	 * @brief Get the response content
+	 * @brief Get the response content. Requests are sent with "Accept-Encoding: gzip, deflate"
+	 * unless they set Accept-Encoding themselves, and an encoded response is decoded as
+	 * it arrives, so this is always the decoded content. The Content-Encoding and
+	 * Content-Length response headers are left as the server sent them.
 	 * 
 	 * @return response content
 	 */
 	const std::string get_content() const;
 
+	/**
+	 * @brief Get the size of the response content as received, before
+	 * content decoding. The same as get_content().size() if it was not encoded.
+	 *
+	 * @return size in bytes
+	 */
+	uint64_t get_received_length() const;
+
+	/**
+	 * @brief Get the size of the response content after content decoding, including
+	 * any passed to a body sink rather than kept
+	 *
+	 * @return size in bytes
+	 */
+	uint64_t get_decoded_length() const;
+
 	/**
 	 * @brief Get the response HTTP status, e.g.
 	 * 200 for OK, 404 for not found, 429 for rate limited.
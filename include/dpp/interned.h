@@ -0,0 +1,323 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/export.h>
+#include <dpp/snowflake.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace dpp {
+
+/**
+ * @brief Hash of a list of snowflakes, for dpp::interned
+ */
+struct snowflake_list_hash {
+	/**
+	 * @brief Hash a list of snowflakes
+	 * @param list list to hash
+	 * @return size_t hash
+	 */
+	size_t operator()(const std::vector<snowflake>& list) const noexcept {
+		uint64_t h = list.size();
+		for (uint64_t id : list) {
+			h = (h ^ id) * 0x9e3779b97f4a7c15ULL;
+			h ^= h >> 29;
+		}
+		return static_cast<size_t>(h);
+	}
+};
+
+/**
+ * @brief A handle to an immutable value, shared by every handle made from an equal value.
+ *
+ * Values are kept once each in a global pool and reference counted, and are freed
+ * when the last handle to them goes. A handle is one pointer, an empty value takes
+ * no memory besides that, and copying a handle only increments a counter. This suits
+ * values repeated across a great many objects, such as the role lists and nicknames
+ * of guild members.
+ *
+ * @note Handles can be created, copied and destroyed from any thread.
+ * @tparam T Value type. Must have empty(), and operator== to compare values.
+ * @tparam Hash Hash of a value
+ */
+template<class T, class Hash = std::hash<T>> class interned {
+	/**
+	 * @brief Number of separately locked parts of the pool
+	 */
+	static constexpr size_t pool_stripes = 16;
+
+	class pool;
+
+	/**
+	 * @brief A pooled value
+	 */
+	struct node {
+		/**
+		 * @brief Number of handles to the value
+		 */
+		std::atomic<uint32_t> refs{1};
+
+		/**
+		 * @brief Hash of the value
+		 */
+		size_t hash;
+
+		/**
+		 * @brief Pool the node is in. A module which has its own copy of the
+		 * pool (such as a DLL on Windows) still returns the node to this one.
+		 */
+		pool* owner;
+
+		/**
+		 * @brief The value
+		 */
+		const T data;
+
+		/**
+		 * @brief Construct a node for a value, with one handle
+		 * @param h hash of the value
+		 * @param p pool the node is in
+		 * @param value the value
+		 */
+		node(size_t h, pool* p, const T& value) : hash(h), owner(p), data(value) {
+		}
+	};
+
+	/**
+	 * @brief The values in use, grouped by hash
+	 */
+	class pool {
+		/**
+		 * @brief One separately locked part of the pool
+		 */
+		struct stripe {
+			/**
+			 * @brief Protects nodes, and the final release of a node
+			 */
+			std::mutex mutex;
+
+			/**
+			 * @brief Nodes by hash
+			 */
+			std::unordered_multimap<size_t, node*> nodes;
+		};
+
+		/**
+		 * @brief The stripes, chosen by hash
+		 */
+		stripe stripes[pool_stripes];
+
+	public:
+		/**
+		 * @brief Get a node for a value with one more handle, adding it if it is not in the pool
+		 * @param value value to find
+		 * @return node* node
+		 */
+		node* acquire(const T& value) {
+			size_t h = Hash{}(value);
+			stripe& s = stripes[h % pool_stripes];
+			std::lock_guard lock(s.mutex);
+			auto [i, end] = s.nodes.equal_range(h);
+			for (; i != end; ++i) {
+				if (i->second->data == value) {
+					i->second->refs.fetch_add(1, std::memory_order_relaxed);
+					return i->second;
+				}
+			}
+			node* n = new node(h, this, value);
+			s.nodes.emplace(h, n);
+			return n;
+		}
+
+		/**
+		 * @brief Drop a handle to a node, freeing it if that was the last one
+		 * @param n node
+		 */
+		void release(node* n) {
+			uint32_t refs = n->refs.load(std::memory_order_relaxed);
+			while (refs > 1) {
+				if (n->refs.compare_exchange_weak(refs, refs - 1, std::memory_order_acq_rel)) {
+					return;
+				}
+			}
+			/* Possibly the last handle. acquire() can only hand out this node again with the
+			 * stripe locked, so decide under the lock whether it really was the last.
+			 */
+			stripe& s = stripes[n->hash % pool_stripes];
+			{
+				std::lock_guard lock(s.mutex);
+				if (n->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+					return;
+				}
+				auto [i, end] = s.nodes.equal_range(n->hash);
+				for (; i != end; ++i) {
+					if (i->second == n) {
+						s.nodes.erase(i);
+						break;
+					}
+				}
+			}
+			delete n;
+		}
+
+		/**
+		 * @brief Number of distinct values in the pool
+		 * @return size_t count
+		 */
+		size_t size() {
+			size_t total = 0;
+			for (auto& s : stripes) {
+				std::lock_guard lock(s.mutex);
+				total += s.nodes.size();
+			}
+			return total;
+		}
+	};
+
+	/**
+	 * @brief The pool all handles of this type share
+	 * @return pool& pool
+	 */
+	static pool& values() {
+		/* Never destroyed, as handles in static objects may outlive it */
+		static pool* p = new pool();
+		return *p;
+	}
+
+	/**
+	 * @brief Pooled value, or nullptr for an empty value
+	 */
+	node* value{nullptr};
+
+public:
+	/**
+	 * @brief Construct an empty value
+	 */
+	interned() noexcept = default;
+
+	/**
+	 * @brief Construct a handle to a value
+	 * @param v value
+	 */
+	interned(const T& v) : value(v.empty() ? nullptr : values().acquire(v)) {
+	}
+
+	/**
+	 * @brief Copy a handle
+	 * @param other handle to copy
+	 */
+	interned(const interned& other) noexcept : value(other.value) {
+		if (value) {
+			value->refs.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	/**
+	 * @brief Move a handle, leaving the other empty
+	 * @param other handle to move
+	 */
+	interned(interned&& other) noexcept : value(other.value) {
+		other.value = nullptr;
+	}
+
+	/**
+	 * @brief Copy a handle
+	 * @param other handle to copy
+	 * @return interned& this handle
+	 */
+	interned& operator=(const interned& other) noexcept {
+		if (value != other.value) {
+			interned copy(other);
+			std::swap(value, copy.value);
+		}
+		return *this;
+	}
+
+	/**
+	 * @brief Move a handle, leaving the other empty
+	 * @param other handle to move
+	 * @return interned& this handle
+	 */
+	interned& operator=(interned&& other) noexcept {
+		std::swap(value, other.value);
+		return *this;
+	}
+
+	/**
+	 * @brief Drop the handle
+	 */
+	~interned() {
+		if (value) {
+			value->owner->release(value);
+		}
+	}
+
+	/**
+	 * @brief Get the value
+	 * @return const T& value, which lives as long as this handle does
+	 */
+	const T& get() const noexcept {
+		static const T empty_value{};
+		return value ? value->data : empty_value;
+	}
+
+	/**
+	 * @brief Check if the value is empty
+	 * @return true if empty
+	 */
+	bool empty() const noexcept {
+		return !value;
+	}
+
+	/**
+	 * @brief Compare values. Equal values always share a node, so this compares pointers.
+	 * @param other handle to compare with
+	 * @return true if the values are equal
+	 */
+	bool operator==(const interned& other) const noexcept {
+		return value == other.value;
+	}
+
+	/**
+	 * @brief Compare values
+	 * @param other handle to compare with
+	 * @return true if the values differ
+	 */
+	bool operator!=(const interned& other) const noexcept {
+		return value != other.value;
+	}
+
+	/**
+	 * @brief Number of distinct non-empty values currently interned of this type
+	 * @return size_t count
+	 */
+	static size_t pool_size() {
+		return values().size();
+	}
+};
+
+}
@@ -0,0 +1,98 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/export.h>
+#include <dpp/json.h>
+#include <cstdint>
+#include <string_view>
+
+namespace dpp {
+
+/**
+ * @brief Parsers which can turn JSON text received from Discord into a dpp::json
+ * tree. Whichever is chosen, the result is identical, so every from_json,
+ * fill_from_json and *_not_null helper works the same with all of them.
+ */
+enum json_parser_backend : uint8_t {
+	/**
+	 * @brief The bundled nlohmann::json parser. Always available.
+	 */
+	jpb_nlohmann = 0,
+
+	/**
+	 * @brief simdjson. The text is validated and tokenised with SIMD instructions
+	 * into a reusable per-thread tape, and the dpp::json tree is built from the tape.
+	 * Only available if D++ was built with simdjson support, and is then the default.
+	 */
+	jpb_simdjson = 1,
+};
+
+/**
+ * @brief Parse JSON text with the selected backend.
+ *
+ * If the selected backend cannot represent a document (for example, an integer
+ * too large for 64 bits), it is parsed again with nlohmann::json, so the result
+ * is always the same as nlohmann::json::parse() would return.
+ *
+ * @param text JSON text
+ * @return parsed JSON
+ * @throw nlohmann::json::exception if the text is not valid JSON
+ */
+json DPP_EXPORT parse_json(std::string_view text);
+
+/**
+ * @brief Parse JSON text with a specific backend, regardless of the one selected
+ * with set_json_parser().
+ *
+ * @param text JSON text
+ * @param backend backend to use
+ * @return parsed JSON
+ * @throw dpp::logic_exception if the backend is not available in this build
+ * @throw nlohmann::json::exception if the text is not valid JSON
+ */
+json DPP_EXPORT parse_json(std::string_view text, json_parser_backend backend);
+
+/**
+ * @brief Select the backend used by parse_json() for all gateway events and
+ * REST responses, process wide.
+ *
+ * @param backend backend to use
+ * @throw dpp::logic_exception if the backend is not available in this build
+ */
+void DPP_EXPORT set_json_parser(json_parser_backend backend);
+
+/**
+ * @brief Get the backend used by parse_json()
+ *
+ * @return current backend
+ */
+json_parser_backend DPP_EXPORT get_json_parser();
+
+/**
+ * @brief Check if a backend was compiled into this build of D++
+ *
+ * @param backend backend to check
+ * @return true if the backend can be selected
+ */
+bool DPP_EXPORT json_parser_available(json_parser_backend backend);
+
+}
@@ -2080,6 +2080,15 @@ protected:
 		return fill_from_json(j, {cp_aggressive, cp_aggressive, cp_aggressive});
 	}
 
+	/** Read the nested objects (author, member, embeds etc.) from a json object.
+	 * This is everything except the plain values, which are read separately by
+	 * fill_from_json() and fill_from_etf().
+	 * @param d A json object to read from
+	 * @param cp Cache policy for user records
+	 * @return A reference to self
+	 */
+	message& fill_objects_from_json(nlohmann::json* d, cache_policy_t cp);
+
 	/** Build a JSON from this object.
 	 * @param with_id True if an ID is to be included in the JSON
 	 * @return JSON
@@ -2439,6 +2448,14 @@ public:
 	 */
 	message& fill_from_json(nlohmann::json* j, cache_policy_t cp);
 
+	/** Fill this object directly from an ETF message object. Plain values are read in
+	 * place, and only the nested objects are decoded to json.
+	 * @param r The reader, positioned at the message object
+	 * @param cp Cache policy for user records, whether or not we cache users when a message is received
+	 * @return A reference to self
+	 */
+	message& fill_from_etf(class etf_reader& r, cache_policy_t cp);
+
 	/** Build JSON from this object.
 	 * @param with_id True if the ID is to be included in the built JSON
 	 * @param is_interaction_response Set to true if this message is intended to be included in an interaction response.
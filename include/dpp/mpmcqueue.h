@@ -0,0 +1,179 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/export.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace dpp {
+
+/**
+ * @brief A bounded, lock-free, multiple producer multiple consumer queue.
+ *
+ * Each slot of a fixed ring has a sequence number which tells producers and consumers
+ * whether it is free to write or ready to read, so the only shared writes are one
+ * compare-and-swap on the head or tail per operation. Neither push nor pop ever waits
+ * on a lock; a full queue fails the push, and an empty queue fails the pop.
+ *
+ * @tparam T Element type. Must be default constructible and move assignable.
+ */
+template <typename T> class mpmc_queue {
+	/**
+	 * @brief A slot in the ring
+	 */
+	struct cell {
+		/**
+		 * @brief Equal to the position when the slot is free to write at that position,
+		 * and to the position plus one when it holds a value to read.
+		 */
+		std::atomic<size_t> sequence;
+
+		/**
+		 * @brief Value
+		 */
+		T data;
+	};
+
+	/**
+	 * @brief Ring of slots, a power of two in size
+	 */
+	std::unique_ptr<cell[]> buffer;
+
+	/**
+	 * @brief Size of the ring minus one, to wrap positions
+	 */
+	size_t mask;
+
+	/**
+	 * @brief Next position to write. On its own cache line, as producers and consumers
+	 * update the two positions independently.
+	 */
+	alignas(64) std::atomic<size_t> enqueue_pos;
+
+	/**
+	 * @brief Next position to read
+	 */
+	alignas(64) std::atomic<size_t> dequeue_pos;
+
+public:
+	/**
+	 * @brief Construct a queue
+	 * @param capacity Number of elements it can hold, rounded up to a power of two
+	 */
+	explicit mpmc_queue(size_t capacity) : mask(0), enqueue_pos(0), dequeue_pos(0) {
+		size_t size = 2;
+		while (size < capacity) {
+			size <<= 1;
+		}
+		buffer = std::make_unique<cell[]>(size);
+		mask = size - 1;
+		for (size_t i = 0; i < size; ++i) {
+			buffer[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	/**
+	 * @brief Non-copyable
+	 */
+	mpmc_queue(const mpmc_queue&) = delete;
+
+	/**
+	 * @brief Non-copyable
+	 */
+	mpmc_queue& operator=(const mpmc_queue&) = delete;
+
+	/**
+	 * @brief Add a value to the tail of the queue
+	 * @param value Value, moved from only if the push succeeds
+	 * @return false if the queue is full
+	 */
+	bool try_push(T& value) {
+		size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+		for (;;) {
+			cell& c = buffer[pos & mask];
+			size_t seq = c.sequence.load(std::memory_order_acquire);
+			intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if (diff == 0) {
+				if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					c.data = std::move(value);
+					c.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (diff < 0) {
+				/* The slot still holds a value from one lap ago */
+				return false;
+			} else {
+				pos = enqueue_pos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	/**
+	 * @brief Take the value at the head of the queue
+	 * @param value Set to the value
+	 * @return false if the queue is empty
+	 */
+	bool try_pop(T& value) {
+		size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+		for (;;) {
+			cell& c = buffer[pos & mask];
+			size_t seq = c.sequence.load(std::memory_order_acquire);
+			intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+			if (diff == 0) {
+				if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					value = std::move(c.data);
+					c.data = T();
+					c.sequence.store(pos + mask + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = dequeue_pos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	/**
+	 * @brief Get an estimate of the number of values in the queue. Exact only
+	 * when no other thread is pushing or popping.
+	 * @return number of values
+	 */
+	size_t size_approx() const {
+		size_t head = dequeue_pos.load(std::memory_order_relaxed);
+		size_t tail = enqueue_pos.load(std::memory_order_relaxed);
+		return tail > head ? tail - head : 0;
+	}
+
+	/**
+	 * @brief Get the number of values the queue can hold
+	 * @return capacity
+	 */
+	size_t capacity() const {
+		return mask + 1;
+	}
+};
+
+}
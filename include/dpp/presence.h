@@ -553,6 +553,13 @@ public:
 	/** Destructor */
 	~presence();
 
+	/**
+	 * @brief Fill this object directly from an ETF presence object, without decoding it to json
+	 * @param r The reader, positioned at the presence object
+	 * @return A reference to self
+	 */
+	presence& fill_from_etf(class etf_reader& r);
+
 	/**
 	 * @brief The users status on desktop
 	 * @return The user's status on desktop
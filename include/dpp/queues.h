@@ -21,6 +21,10 @@
  ************************************************************************************/
 #pragma once
 #include <dpp/export.h>
+#include <dpp/connectionpool.h>
+#include <dpp/mpmcqueue.h>
+#include <dpp/httpsclient.h>
+#include <dpp/http2.h>
 #include <unordered_map>
 #include <string>
 #include <queue>
@@ -31,9 +35,15 @@
 #include <functional>
 #include <condition_variable>
 #include <atomic>
+#include <deque>
+#include <chrono>
+#include <mutex>
+#include <memory>
 
 namespace dpp {
 
+class socket_engine_base;
+
 /**
  * @brief Error values. Most of these are currently unused in https_client.
  */
@@ -102,6 +112,16 @@ enum http_error {
 	 * @brief Compression error.
 	 */
 	h_compression,
+
+	/**
+	 * @brief Request was cancelled with http_request::cancel().
+	 */
+	h_cancelled,
+
+	/**
+	 * @brief Request did not complete before its http_request::deadline.
+	 */
+	h_deadline,
 };
 
 /**
@@ -151,6 +171,16 @@ struct DPP_EXPORT http_request_completion_t {
 	 */
 	uint64_t ratelimit_retry_after = 0;
 
+	/**
+	 * @brief Ratelimit reset after, to the millisecond (milliseconds).
+	 */
+	uint64_t ratelimit_reset_after_ms = 0;
+
+	/**
+	 * @brief Ratelimit retry after, to the millisecond (milliseconds).
+	 */
+	uint64_t ratelimit_retry_after_ms = 0;
+
 	/**
 	 * @brief True if this request has caused us to be globally rate limited.
 	 */
@@ -171,8 +201,10 @@ struct DPP_EXPORT http_request_completion_t {
  * @brief Results of HTTP requests are called back to these std::function types.
  *
  * @note Returned http_completion_events are called ASYNCHRONOUSLY in your
- * code which means they execute in a separate thread. The completion events
- * arrive in order.
+ * code which means they execute in a separate thread. With more than one
+ * completion thread (the default is two, see request_queue) several callbacks
+ * may run at the same time, and callbacks may run in a different order to the
+ * one their requests completed in. Callbacks which share state must lock it.
  */
 typedef std::function<void(const http_request_completion_t&)> http_completion_event;
 
@@ -206,6 +238,155 @@ enum http_method {
 	m_delete
 };
 
+/**
+ * @brief Scheduling class of a REST request. Each request thread always starts waiting
+ * requests of a higher priority first, and keeps part of its capacity, and of the
+ * global rate limit, free for higher priorities, so that bulk work never holds up
+ * a request which has to be answered in time.
+ */
+enum http_priority : uint8_t {
+	/**
+	 * @brief Interaction responses and followups, which must be made within 3 seconds.
+	 */
+	hp_interaction = 0,
+
+	/**
+	 * @brief Everything else.
+	 */
+	hp_normal = 1,
+
+	/**
+	 * @brief Bulk and background work, e.g. member pruning, audit log paging and
+	 * message history.
+	 */
+	hp_bulk = 2,
+};
+
+/**
+ * @brief Time requests of one priority spent queued before being started.
+ */
+struct DPP_EXPORT queue_wait_stats {
+	/**
+	 * @brief Number of requests started
+	 */
+	uint64_t requests{0};
+
+	/**
+	 * @brief Total seconds waited
+	 */
+	double total_wait{0};
+
+	/**
+	 * @brief Longest wait in seconds
+	 */
+	double max_wait{0};
+
+	/**
+	 * @brief Get the average wait
+	 * @return average wait in seconds, or 0 if no requests were started
+	 */
+	double average_wait() const;
+};
+
+/**
+ * @brief Body bytes sent and received by the requests to one route, and how
+ * many were saved by compressing them.
+ */
+struct DPP_EXPORT transfer_stats {
+	/**
+	 * @brief Number of responses received
+	 */
+	uint64_t responses{0};
+
+	/**
+	 * @brief Response body bytes received, before content decoding
+	 */
+	uint64_t received{0};
+
+	/**
+	 * @brief Response body bytes after content decoding
+	 */
+	uint64_t decoded{0};
+
+	/**
+	 * @brief Number of request bodies sent compressed, see http_request::compress_request
+	 */
+	uint64_t compressed_requests{0};
+
+	/**
+	 * @brief Bytes of request bodies sent compressed, as sent
+	 */
+	uint64_t sent{0};
+
+	/**
+	 * @brief Bytes of the same request bodies before compression
+	 */
+	uint64_t uncompressed{0};
+
+	/**
+	 * @brief Get the number of bytes compression kept off the wire, in both directions
+	 * @return bytes saved. Negative if compressing small responses cost more than it saved.
+	 */
+	int64_t bytes_saved() const;
+};
+
+/**
+ * @brief The rate limit identity of a REST request. Discord shares each rate limit
+ * bucket between one or more routes, and scopes it by the route's major parameter,
+ * so that e.g. sending messages to two channels uses two separate limits.
+ */
+struct DPP_EXPORT rest_route {
+	/**
+	 * @brief HTTP method and path template, with IDs and other minor parameters
+	 * replaced by placeholders, e.g. "PATCH /channels/:major/messages/:id".
+	 * For requests not going to Discord, this is the whole url.
+	 */
+	std::string route;
+
+	/**
+	 * @brief Major parameter, e.g. "channels/81384788765712384", or empty if
+	 * the route has none.
+	 */
+	std::string major;
+
+	/**
+	 * @brief True if the request counts towards Discord's global rate limit.
+	 * Interaction responses and requests not going to Discord do not.
+	 */
+	bool global{true};
+
+	/**
+	 * @brief Default priority of requests on this route: hp_interaction for
+	 * interaction callbacks, hp_bulk for routes which page through or act on many
+	 * objects, and otherwise hp_normal.
+	 */
+	http_priority priority{hp_normal};
+
+	/**
+	 * @brief Work out the route of a Discord API path
+	 * @param method HTTP method
+	 * @param path Path, e.g. "/api/v10/channels/81384788765712384/messages?limit=50"
+	 * @return route
+	 */
+	static rest_route from_path(http_method method, std::string_view path);
+};
+
+/**
+ * @brief A request in progress on a request_queue's socket engine: either a
+ * HTTP/1.1 client of its own, or a stream on a shared HTTP/2 connection.
+ */
+struct DPP_EXPORT http_transfer {
+	/**
+	 * @brief HTTP/1.1 client making the request, or nullptr
+	 */
+	std::shared_ptr<https_client> client;
+
+	/**
+	 * @brief HTTP/2 stream carrying the request, or nullptr
+	 */
+	std::shared_ptr<http2_stream> stream;
+};
+
 /**
  * @brief A HTTP request.
  * 
@@ -231,6 +412,58 @@ class DPP_EXPORT http_request {
 	 * @brief True for requests that are not going to discord (rate limits code skipped).
 	 */
 	bool non_discord;
+
+	/**
+	 * @brief True once cancel() has been called.
+	 */
+	std::atomic<bool> cancelled;
+
+	/**
+	 * @brief Request queue the request was posted to, woken by cancel().
+	 */
+	class request_queue* processor;
+
+	/**
+	 * @brief Required so request_queue can set processor.
+	 */
+	friend class request_queue;
+
+	/**
+	 * @brief Required so in_thread can complete requests which were never run.
+	 */
+	friend class in_thread;
+
+	/**
+	 * @brief When the request was posted to a request thread
+	 */
+	std::chrono::steady_clock::time_point queued_at;
+
+	/**
+	 * @brief Host, path, headers and body of the request as sent, defined in queues.cpp
+	 */
+	struct target;
+
+	/**
+	 * @brief Request bodies smaller than this are not worth compressing
+	 */
+	static constexpr size_t compress_threshold = 1024;
+
+	/**
+	 * @brief Add the body sizes of a finished request to the request queue's transfer_stats
+	 * @tparam response https_client or http2_stream
+	 * @param processor request queue, or nullptr
+	 * @param t the request as sent
+	 * @param res client or stream which made the request
+	 */
+	template <typename response> void record_transfer(class request_queue* processor, const target& t, const response& res) const;
+
+	/**
+	 * @brief Work out where and what to send, shared by run() and run_async()
+	 * @param processor request queue, or nullptr
+	 * @param owner creating cluster
+	 * @param t Filled with the request to send
+	 */
+	void prepare(class request_queue* processor, class cluster* owner, target& t) const;
 public:
 	/**
 	 * @brief Endpoint name
@@ -290,7 +523,8 @@ public:
 	bool waiting;
 
 	/**
-	 * @brief HTTP protocol.
+	 * @brief HTTP protocol. "2" sends the request over HTTP/2 when it is made by
+	 * a request_queue, whether or not request_queue::set_http2() is enabled.
 	 */
 	std::string protocol;
 
@@ -361,13 +595,102 @@ public:
 	 */
 	http_request_completion_t run(class cluster* owner);
 
+	/**
+	 * @brief Execute the HTTP request and mark the request complete.
+	 * @param processor request queue running the request, whose connection pool is used
+	 * to reuse keep-alive connections. If nullptr, a new connection is made for the request.
+	 * @param owner creating cluster
+	 */
+	http_request_completion_t run(class request_queue* processor, class cluster* owner);
+
+	/**
+	 * @brief Start the HTTP request on the request queue's socket engine, and return
+	 * without waiting for the response. The request is sent over HTTP/2 if the queue
+	 * or the request's protocol asks for it and the server supports it, otherwise HTTP/1.1.
+	 * @param processor request queue running the request, whose socket engine and
+	 * connection pools are used
+	 * @param owner creating cluster
+	 * @param done Called once on the socket engine thread when the request has finished
+	 * or failed, with its result. Must not block.
+	 * @return client or stream making the request. A client may be stopped early with
+	 * https_client::abort() on the socket engine thread, and a stream with
+	 * http2_pool::cancel(). Both are nullptr if the request failed to start, in which
+	 * case done has already been called.
+	 */
+	http_transfer run_async(class request_queue* processor, class cluster* owner, const std::function<void(http_request_completion_t)>& done);
+
 	/** @brief Returns true if the request is complete */
 	bool is_completed();
+
+	/**
+	 * @brief Get the rate limit route of this request
+	 * @return route
+	 */
+	rest_route get_route() const;
+
+	/**
+	 * @brief When the request must have completed by. If it is still waiting in
+	 * the queue, or waiting for its response, at this time, it is abandoned and
+	 * completes with h_deadline. The default, a zero time point, means no deadline,
+	 * other than the cluster's request_timeout for the response.
+	 */
+	std::chrono::steady_clock::time_point deadline;
+
+	/**
+	 * @brief Scheduling priority, by default the route's priority, see rest_route::priority.
+	 * Interaction followups, which use webhook routes, are set to hp_interaction by the cluster.
+	 * Must be set before the request is posted to a request_queue.
+	 */
+	http_priority priority;
+
+	/**
+	 * @brief Send the request body compressed with gzip and "Content-Encoding: gzip",
+	 * if it is at least 1KB and compression makes it smaller. Only set this for servers
+	 * which accept compressed request bodies; Discord does not. Responses are decoded
+	 * whether or not this is set, see https_client::get_content(). Not applied to a
+	 * body_source, and attachments are copied into one body to be compressed.
+	 */
+	bool compress_request{false};
+
+	/**
+	 * @brief If set, the request body is read from this as it is sent, instead of from
+	 * postdata, so that a large upload is never held in memory whole. Called on the request
+	 * queue's socket engine thread. Set body_source_length too. A request with a body source
+	 * is always made on a new connection, as its body can't be sent a second time.
+	 * See https_client::file_source().
+	 */
+	https_body_source body_source;
+
+	/**
+	 * @brief Length of the body body_source supplies
+	 */
+	uint64_t body_source_length{0};
+
+	/**
+	 * @brief If set, the response body is passed to this as it arrives, on the request
+	 * queue's socket engine thread, and http_request_completion_t::body is left empty.
+	 * See https_client::file_sink().
+	 */
+	https_body_sink body_sink;
+
+	/**
+	 * @brief Cancel the request. If it is still waiting in the queue or waiting for its
+	 * response, it is abandoned and completes with h_cancelled. Thread safe, but only
+	 * valid until the request's completion callback has been called.
+	 */
+	void cancel();
+
+	/**
+	 * @brief Returns true if cancel() has been called
+	 * @return true if cancelled
+	 */
+	bool is_cancelled() const;
 };
 
 /**
- * @brief A rate limit bucket. The library builds one of these for
- * each endpoint.
+ * @brief A rate limit bucket. The library builds one of these for each
+ * bucket Discord reports, scoped by major parameter, and for each route
+ * which has not yet reported its bucket.
  */
 struct DPP_EXPORT bucket_t {
 	/**
@@ -394,16 +717,29 @@ struct DPP_EXPORT bucket_t {
 	 * @brief Timestamp this buckets counters were updated.
 	 */
 	time_t timestamp;
+
+	/**
+	 * @brief When the bucket's limit resets, to the millisecond.
+	 * Requests for the bucket are held until then once remaining reaches zero.
+	 */
+	std::chrono::steady_clock::time_point reset_at;
 };
 
 
 /**
  * @brief Represents a thread in the thread pool handling requests to HTTP(S) servers.
  * There are several of these, the total defined by a constant in queues.cpp, and each
- * one will always receive requests for the same rate limit bucket based on its endpoint
- * portion of the url. This makes rate limit handling reliable and easy to manage.
- * Each of these also has its own mutex, so that requests are less likely to block while
- * waiting for internal containers to be usable.
+ * one will always receive requests for the same major parameter (see dpp::rest_route),
+ * and so for the same rate limit buckets. This makes rate limit handling reliable and
+ * easy to manage. Each of these also has its own mutex, so that requests are less likely
+ * to block while waiting for internal containers to be usable.
+ *
+ * Requests are queued per route and major parameter. A queue whose bucket is exhausted
+ * is held until the bucket resets, without holding up any other queue on the thread.
+ *
+ * The thread only schedules requests. They are made without blocking on the request
+ * queue's socket engine, so each thread may have many requests in flight at once, and
+ * a slow response or upload only holds up requests in its own rate limit bucket.
  */
 class DPP_EXPORT in_thread {
 private:
@@ -425,7 +761,7 @@ private:
 	/**
 	 * @brief Inbound queue mutex thread safety.
 	 */
-	std::shared_mutex in_mutex;
+	std::mutex in_mutex;
 
 	/**
 	 * @brief Inbound queue thread.
@@ -438,14 +774,142 @@ private:
 	std::condition_variable in_ready;
 
 	/**
-	 * @brief Rate-limit bucket counters.
+	 * @brief True when a request has been posted or the thread is terminating,
+	 * and the thread should look at its queues again.
+	 */
+	bool woken;
+
+	/**
+	 * @brief Rate-limit bucket counters, by bucket key (see request_queue::bucket_key()).
+	 * Only touched by the thread itself.
+	 */
+	std::unordered_map<std::string, bucket_t> buckets;
+
+	/**
+	 * @brief Queues of requests to be made, by route and major parameter, in posting order.
+	 * Empty queues are removed.
+	 */
+	std::map<std::string, std::deque<std::unique_ptr<http_request>>> requests_in;
+
+	/**
+	 * @brief A request which has been started and has not yet completed
+	 */
+	struct in_flight_request {
+		/**
+		 * @brief The request
+		 */
+		std::unique_ptr<http_request> request;
+
+		/**
+		 * @brief Client or stream making the request
+		 */
+		http_transfer transfer;
+
+		/**
+		 * @brief Route of the request
+		 */
+		rest_route route;
+
+		/**
+		 * @brief Key of the queue it was taken from
+		 */
+		std::string queue_key;
+
+		/**
+		 * @brief Key of the bucket it counts against
+		 */
+		std::string bucket_key;
+
+		/**
+		 * @brief True if the bucket was known when the request was started
+		 */
+		bool bucket_known{false};
+
+		/**
+		 * @brief h_cancelled or h_deadline if it has been aborted, otherwise h_success
+		 */
+		http_error aborted{h_success};
+	};
+
+	/**
+	 * @brief Most requests one thread has in flight at once
+	 */
+	static constexpr size_t max_in_flight = 64;
+
+	/**
+	 * @brief Get how many requests may be in flight on the thread for a new request
+	 * of the given priority to be started. Lower priorities leave room for higher ones.
+	 * @param priority Request priority
+	 * @return in flight limit
+	 */
+	static size_t in_flight_limit(http_priority priority);
+
+	/**
+	 * @brief Requests in flight, by request.
+	 * Only touched by the thread itself.
+	 */
+	std::unordered_map<http_request*, in_flight_request> in_flight;
+
+	/**
+	 * @brief Number of requests in flight by bucket key, which count against
+	 * the bucket's remaining requests. Only touched by the thread itself.
+	 */
+	std::unordered_map<std::string, uint64_t> bucket_in_flight;
+
+	/**
+	 * @brief Number of requests in flight by queue key. Only touched by the thread itself.
+	 */
+	std::unordered_map<std::string, uint64_t> queue_in_flight;
+
+	/**
+	 * @brief Number of requests in flight whose bucket was not known when they were
+	 * started, by major parameter. Any of them may turn out to share a bucket with
+	 * another route of the same major parameter, so they count against all of them.
+	 * Only touched by the thread itself.
+	 */
+	std::unordered_map<std::string, uint64_t> unknown_in_flight;
+
+	/**
+	 * @brief Results of requests which have finished on the socket engine, waiting
+	 * to be handled by the thread. Guarded by in_mutex.
+	 */
+	std::vector<std::pair<http_request*, http_request_completion_t>> finished;
+
+	/**
+	 * @brief Record the rate limit state returned with a response
+	 * @param route Route of the request
+	 * @param rv Response
+	 */
+	void update_bucket(const rest_route& route, const http_request_completion_t& rv);
+
+	/**
+	 * @brief Handle the results of finished requests
+	 * @return true if there were any
+	 */
+	bool collect_finished();
+
+	/**
+	 * @brief Complete queued requests which have been cancelled or passed their deadline,
+	 * and abort any in flight
+	 * @param now Current time
+	 * @param next Set to the earliest deadline still to come, if sooner
 	 */
-	std::map<std::string, bucket_t> buckets;
+	void expire(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::time_point& next);
 
 	/**
-	 * @brief Queue of requests to be made. Sorted by http_request::endpoint.
+	 * @brief Start as many queued requests as their buckets and the global limit allow
+	 * @param now Current time
+	 * @param next Set to when a held request may next be started, if sooner
+	 * @return true if any were started
 	 */
-	std::vector<std::unique_ptr<http_request>> requests_in;
+	bool start_requests(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::time_point& next);
+
+	/**
+	 * @brief Hand a completed request to the request queue's callback thread
+	 * @param request Request
+	 * @param rv Result
+	 */
+	void complete(std::unique_ptr<http_request> request, const http_request_completion_t& rv);
 
 	/**
 	 * @brief Inbound queue thread loop.
@@ -481,6 +945,11 @@ public:
 	 * been executed.
 	 */
 	void post_request(std::unique_ptr<http_request> req);
+
+	/**
+	 * @brief Wake the thread, so that it looks at its queues again
+	 */
+	void wake();
 };
 
 /**
@@ -506,31 +975,41 @@ protected:
 	 */
 	friend class in_thread;
 
+	/**
+	 * @brief Required so http_request can wake the request threads when cancelled
+	 */
+	friend class http_request;
+
 	/**
 	 * @brief The cluster that owns this request_queue
 	 */
 	class cluster* creator;
 
 	/**
-	 * @brief Outbound queue mutex thread safety
+	 * @brief Mutex for responses_overflow, and for out_ready
 	 */
-	std::shared_mutex out_mutex;
+	std::mutex out_mutex;
 
 	/**
-	 * @brief Outbound queue thread
-	 * Note that although there are many 'in queues', which handle the HTTP requests,
-	 * there is only ever one 'out queue' which dispatches the results to the caller.
-	 * This is to simplify thread management in bots that use the library, as less mutexing
-	 * and thread safety boilerplate is required.
+	 * @brief Completion threads, which call the callbacks of completed requests.
+	 * Completions are handed out to whichever thread is free, so a slow callback
+	 * only holds up the thread it runs on. Callbacks for different requests may
+	 * therefore run concurrently, as event handlers already do.
 	 */
-	std::thread* out_thread;
+	std::vector<std::thread> out_threads;
 
 	/**
 	 * @brief Outbound queue condition.
-	 * Signalled when there are requests completed to call callbacks for.
+	 * Signalled when there are requests completed to call callbacks for and a
+	 * completion thread is asleep.
 	 */
 	std::condition_variable out_ready;
 
+	/**
+	 * @brief Number of completion threads waiting on out_ready
+	 */
+	std::atomic<uint32_t> out_sleeping;
+
 	/**
 	 * @brief A completed request. Contains both the request and the response
 	 */
@@ -547,71 +1026,117 @@ protected:
 	};
 
 	/**
-	 * @brief Completed requests queue
+	 * @brief Completed requests queue. Request threads push to it and completion
+	 * threads pop from it without taking a lock.
+	 */
+	mpmc_queue<completed_request> responses_out;
+
+	/**
+	 * @brief Completed requests which did not fit in responses_out. Guarded by out_mutex.
+	 */
+	std::queue<completed_request> responses_overflow;
+
+	/**
+	 * @brief Socket engine running the I/O of every request made by the request threads.
+	 * Declared before requests_in so that it outlives the request threads.
+	 */
+	std::unique_ptr<socket_engine_base> io_engine;
+
+	/**
+	 * @brief Idle keep-alive connections shared by all request threads.
+	 * Declared before requests_in so that it outlives the request threads.
+	 */
+	connection_pool connections;
+
+	/**
+	 * @brief HTTP/2 connections shared by all request threads, created with io_engine.
+	 * Declared before requests_in so that it outlives the request threads.
 	 */
-	std::queue<completed_request> responses_out;
+	std::unique_ptr<http2_pool> http2;
 
 	/**
 	 * @brief A vector of inbound request threads forming a pool.
 	 * There are a set number of these defined by a constant in queues.cpp. A request is always placed
-	 * on the same element in this vector, based upon its url, so that two conditions are satisfied:
+	 * on the same element in this vector, based upon its major parameter, so that two conditions are satisfied:
 	 * 1) Any requests for the same ratelimit bucket are handled by the same thread in the pool so that
 	 * they do not create unnecessary 429 errors,
-	 * 2) Requests for different endpoints go into different buckets, so that they may be requested in parallel
+	 * 2) Requests for different major parameters may be requested in parallel
 	 * A global ratelimit event pauses all threads in the pool. These are few and far between.
 	 */
 	std::vector<std::unique_ptr<in_thread>> requests_in;
 
 	/**
-	 * @brief A request queued for deletion in the queue.
+	 * @brief Set to true if the threads should terminate
 	 */
-	struct queued_deleting_request {
-		/**
-		 * @brief Time to delete the request
-		 */
-		time_t time_to_delete;
+	std::atomic<bool> terminating;
 
-		/**
-		 * @brief The request to delete
-		 */
-		completed_request request;
+	/**
+	 * @brief Mutex for route_buckets
+	 */
+	std::shared_mutex route_mutex;
 
-		/**
-		 * @brief Comparator for sorting purposes
-		 * @param other Other queued request to compare the deletion time with
-		 * @return bool Whether this request comes before another in strict ordering
-		 */
-		bool operator<(const queued_deleting_request& other) const noexcept;
+	/**
+	 * @brief Bucket hash Discord reported for each route (see rest_route::route).
+	 * Shared by all request threads, so a bucket found for one major parameter
+	 * is known for every other.
+	 */
+	std::unordered_map<std::string, std::string> route_buckets;
 
-		/**
-		 * @brief Comparator for sorting purposes
-		 * @param time Time to compare with
-		 * @return bool Whether this request's deletion time is lower than the time given, for strict ordering
-		 */
-		bool operator<(time_t time) const noexcept;
-	};
+	/**
+	 * @brief Mutex for the global rate limiter
+	 */
+	std::mutex global_mutex;
 
 	/**
-	 * @brief Completed requests to delete. Sorted by deletion time
+	 * @brief Requests per second allowed by the global rate limiter, or 0 for no limit
 	 */
-	std::vector<queued_deleting_request> responses_to_delete;
+	uint32_t global_limit;
 
 	/**
-	 * @brief Set to true if the threads should terminate
+	 * @brief Requests which may be made right now without exceeding global_limit
 	 */
-	std::atomic<bool> terminating;
+	double global_tokens;
 
 	/**
-	 * @brief True if globally rate limited - makes the entire request thread wait
+	 * @brief When global_tokens was last topped up
 	 */
-	bool globally_ratelimited;
+	std::chrono::steady_clock::time_point global_refilled;
 
 	/**
-	 * @brief How many seconds we are globally rate limited for
-	 *
-	 * @note Only if globally_ratelimited is true.
+	 * @brief When a global rate limit reported by Discord ends, as a count of
+	 * std::chrono::steady_clock ticks. Every thread holds its requests until then.
 	 */
-	uint64_t globally_limited_for;
+	std::atomic<std::chrono::steady_clock::rep> globally_limited_until;
+
+	/**
+	 * @brief Mutex for wait_stats
+	 */
+	std::mutex wait_mutex;
+
+	/**
+	 * @brief Queue wait times, indexed by http_priority
+	 */
+	queue_wait_stats wait_stats[hp_bulk + 1];
+
+	/**
+	 * @brief Mutex for transfers
+	 */
+	std::mutex transfer_mutex;
+
+	/**
+	 * @brief Body sizes of Discord REST requests, by route (see rest_route::route)
+	 */
+	std::unordered_map<std::string, transfer_stats> transfers;
+
+	/**
+	 * @brief True if Discord REST requests are sent over HTTP/2
+	 */
+	std::atomic<bool> http2_enabled;
+
+	/**
+	 * @brief Scheme and host Discord REST requests are sent to
+	 */
+	std::string base_url;
 
 	/**
 	 * @brief Number of request threads in the thread pool
@@ -619,9 +1144,77 @@ protected:
 	uint32_t in_thread_pool_size;
 
 	/**
-	 * @brief Outbound queue thread loop
+	 * @brief Most completed requests a completion thread takes from responses_out at once
+	 */
+	static constexpr size_t completion_batch = 32;
+
+	/**
+	 * @brief Completion thread loop
+	 * @param index Thread index, used in the thread name
+	 */
+	void out_loop(uint32_t index);
+
+	/**
+	 * @brief Take up to completion_batch completed requests
+	 * @param batch Completed requests are appended to this
+	 * @return true if any were taken
+	 */
+	bool take_completed(std::vector<completed_request>& batch);
+
+	/**
+	 * @brief Hand a completed request to the completion threads
+	 * @param completed Completed request
+	 */
+	void push_completed(completed_request completed);
+
+	/**
+	 * @brief Get the key of the bucket a route is limited by: the bucket hash Discord
+	 * reported for the route if known, otherwise the route itself, plus the major parameter.
+	 * @param route Route of a request
+	 * @return bucket key
+	 */
+	std::string bucket_key(const rest_route& route);
+
+	/**
+	 * @brief Record the bucket hash Discord reported for a route
+	 * @param route Route of a request
+	 * @param bucket Value of the X-RateLimit-Bucket header
+	 */
+	void learn_bucket(const rest_route& route, const std::string& bucket);
+
+	/**
+	 * @brief Take one request's worth of the global rate limit
+	 * @param now Current time
+	 * @param retry_at Set to when to try again, if the limit has been reached
+	 * @return true if the request may be made now
+	 */
+	bool take_global(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::time_point& retry_at, http_priority priority);
+
+	/**
+	 * @brief Record how long a request waited in its queue before being started
+	 * @param priority Request priority
+	 * @param wait Seconds waited
+	 */
+	void record_wait(http_priority priority, double wait);
+
+	/**
+	 * @brief Add the body sizes of a finished request to its route's transfer_stats
+	 * @param route Route, see rest_route::route
+	 * @param transfer Body sizes of the one request
+	 */
+	void record_transfer(const std::string& route, const transfer_stats& transfer);
+
+	/**
+	 * @brief Hold all requests counting towards the global rate limit until the given time,
+	 * after Discord reported we have hit it.
+	 * @param until When the global rate limit ends
+	 */
+	void set_globally_limited(std::chrono::steady_clock::time_point until);
+
+	/**
+	 * @brief Wake all request threads, e.g. when a request has been cancelled
 	 */
-	void out_loop();
+	void wake();
 public:
 
 	/**
@@ -629,9 +1222,12 @@ public:
 	 * @param owner The creating cluster.
 	 * @param request_threads The number of http request threads to allocate to the threadpool.
 	 * By default eight threads are allocated.
+	 * @param completion_threads The number of threads which call the callbacks of completed
+	 * requests, and parse their bodies. By default two threads are allocated. With more than
+	 * one, callbacks may run at the same time and out of order; pass 1 to run them one at a time.
 	 * Side effects: Creates threads for the queue
 	 */
-	request_queue(class cluster* owner, uint32_t request_threads = 8);
+	request_queue(class cluster* owner, uint32_t request_threads = 8, uint32_t completion_threads = 2);
 
 	/**
 	 * @brief Add more request threads to the library at runtime.
@@ -649,6 +1245,20 @@ public:
 	 */
 	uint32_t get_request_thread_count() const;
 
+	/**
+	 * @brief Add more completion threads at runtime, so that more callbacks of completed
+	 * requests may run at once. It is not possible to scale down at runtime.
+	 * @param completion_threads Number of threads to add
+	 * @return reference to self
+	 */
+	request_queue& add_completion_threads(uint32_t completion_threads);
+
+	/**
+	 * @brief Get the completion thread count
+	 * @return uint32_t number of completion threads that are active
+	 */
+	uint32_t get_completion_thread_count() const;
+
 	/**
 	 * @brief Destroy the request queue object.
 	 * Side effects: Joins and deletes queue threads
@@ -657,8 +1267,9 @@ public:
 
 	/**
 	 * @brief Put a http_request into the request queue.
-	 * @note Will use a simple hash function to determine which of the 'in queues' to place
-	 * this request onto.
+	 * @note Will use a simple hash function of the request's major parameter (see dpp::rest_route)
+	 * to determine which of the 'in queues' to place this request onto. A request with no major
+	 * parameter is placed by its rate limit bucket, or by its route until the bucket is known.
 	 * @param req request to add
 	 * @return reference to self
 	 */
@@ -669,6 +1280,83 @@ public:
 	 * @return true if globally rate limited
 	 */
 	bool is_globally_ratelimited() const;
+
+	/**
+	 * @brief Set how many requests per second may be made to Discord, across all request
+	 * threads, before any are held back. This keeps the bot under Discord's global rate
+	 * limit rather than waiting to be told it has exceeded it. Interaction responses
+	 * are not counted. The default is 50, Discord's limit for most bots.
+	 * @param requests_per_second Requests per second, or 0 to disable the limit
+	 * @return reference to self
+	 */
+	request_queue& set_global_rate_limit(uint32_t requests_per_second);
+
+	/**
+	 * @brief Set the scheme and host that Discord REST requests are sent to, instead of
+	 * dpp::DISCORD_HOST, e.g. to route them through a REST proxy. Set this before making
+	 * any requests.
+	 * @param url Scheme, host and optional port, e.g. "http://127.0.0.1:8080"
+	 * @return reference to self
+	 */
+	request_queue& set_base_url(const std::string& url);
+
+	/**
+	 * @brief Get the scheme and host that Discord REST requests are sent to
+	 * @return base url
+	 */
+	const std::string& get_base_url() const;
+
+	/**
+	 * @brief Get the socket engine which the queue's requests are made on
+	 * @return socket engine
+	 */
+	socket_engine_base* get_socket_engine();
+
+	/**
+	 * @brief Get how long requests of one priority have waited to be started
+	 * since the queue was created.
+	 * @param priority Priority
+	 * @return wait statistics
+	 */
+	queue_wait_stats get_queue_wait_stats(http_priority priority);
+
+	/**
+	 * @brief Get the body bytes sent and received for Discord REST requests, and how many
+	 * compression saved, by route (see rest_route::route), since the queue was created.
+	 * Requests to other sites are not counted.
+	 * @return transfer statistics by route
+	 */
+	std::map<std::string, transfer_stats> get_transfer_stats();
+
+	/**
+	 * @brief Get the pool of keep-alive connections used by this queue's request threads.
+	 * Use this to tune the pool's limits or read its counters.
+	 * @return connection pool
+	 */
+	connection_pool& get_connection_pool();
+
+	/**
+	 * @brief Send Discord REST requests over HTTP/2, multiplexed over a few connections
+	 * rather than one connection per request in flight. Requests to other hosts use
+	 * HTTP/2 only if their protocol is "2". A host which does not negotiate HTTP/2
+	 * is sent HTTP/1.1 requests instead. Requests with a body_source always use HTTP/1.1.
+	 * @param enabled true to use HTTP/2
+	 * @return reference to self
+	 */
+	request_queue& set_http2(bool enabled);
+
+	/**
+	 * @brief Check if Discord REST requests are sent over HTTP/2
+	 * @return true if HTTP/2 is enabled
+	 */
+	bool is_http2_enabled() const;
+
+	/**
+	 * @brief Get the pool of HTTP/2 connections used by this queue's request threads.
+	 * Use this to tune the per-host connection limit or read its counters.
+	 * @return HTTP/2 connection pool
+	 */
+	http2_pool& get_http2_pool();
 };
 
 }
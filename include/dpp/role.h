@@ -822,7 +822,7 @@ public:
 	/**
 	 * @brief Get guild members who have this role.
 	 *
-	 * @note This method requires user/members cache to be active
+	 * @note This method requires user/members cache to be active, and locks the guild
 	 * @return members_container List of members who have this role
 	 */
 	members_container get_members() const;
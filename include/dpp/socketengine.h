@@ -0,0 +1,405 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/export.h>
+#include <dpp/socket.h>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <map>
+#include <vector>
+
+namespace dpp {
+
+/**
+ * @brief Types of IO events a socket may subscribe to.
+ */
+enum socket_event_flags : uint8_t {
+	/**
+	 * @brief Socket wants to receive events when it can be read from.
+	 * This is provided by the underlying implementation.
+	 */
+	WANT_READ = 1,
+
+	/**
+	 * @brief Socket wants to receive events when it can be written to.
+	 * Write readiness is level triggered, so the owner should clear this
+	 * flag once it has nothing left to send.
+	 */
+	WANT_WRITE = 2,
+
+	/**
+	 * @brief Socket wants to receive events that indicate an error condition.
+	 * Note that EOF (graceful close) is not an error condition and is indicated
+	 * by errno being 0 and ::read() returning 0.
+	 */
+	WANT_ERROR = 4,
+};
+
+/**
+ * @brief Read ready event
+ */
+using socket_read_event = std::function<void(dpp::socket fd, const struct socket_events&)>;
+
+/**
+ * @brief Write ready event
+ */
+using socket_write_event = std::function<void(dpp::socket fd, const struct socket_events&)>;
+
+/**
+ * @brief Error event
+ */
+using socket_error_event = std::function<void(dpp::socket fd, const struct socket_events&, int error_code)>;
+
+/**
+ * @brief Ticker event, called roughly once per second on the thread running the engine
+ */
+using socket_tick_event = std::function<void()>;
+
+/**
+ * @brief Represents a socket and the events it is interested in, along with the
+ * callbacks the socket engine will invoke when those events occur.
+ */
+struct DPP_EXPORT socket_events {
+	/**
+	 * @brief File descriptor
+	 *
+	 * This should be a valid file descriptor created via ::socket().
+	 */
+	dpp::socket fd{INVALID_SOCKET};
+
+	/**
+	 * @brief Flag bit mask of values from dpp::socket_event_flags
+	 */
+	uint8_t flags{0};
+
+	/**
+	 * @brief Read ready event
+	 * @note This function will be called from a different thread to that
+	 * which adds the event set to the socket engine.
+	 */
+	socket_read_event on_read{};
+
+	/**
+	 * @brief Write ready event
+	 * @note This function will be called from a different thread to that
+	 * which adds the event set to the socket engine.
+	 */
+	socket_write_event on_write{};
+
+	/**
+	 * @brief Error event
+	 * @note This function will be called from a different thread to that
+	 * which adds the event set to the socket engine.
+	 */
+	socket_error_event on_error{};
+
+	/**
+	 * @brief Construct a new socket_events
+	 * @param socket_fd file descriptor
+	 * @param _flags initial flags bitmask
+	 * @param _on_read read ready event
+	 * @param _on_write write ready event
+	 * @param _on_error error event
+	 */
+	socket_events(dpp::socket socket_fd, uint8_t _flags, const socket_read_event& _on_read, const socket_write_event& _on_write = {}, const socket_error_event& _on_error = {})
+		: fd(socket_fd), flags(_flags), on_read(_on_read), on_write(_on_write), on_error(_on_error) { }
+
+	/**
+	 * @brief Default constructor
+	 */
+	socket_events() = default;
+};
+
+/**
+ * @brief Container of event sets keyed by socket file descriptor
+ */
+using socket_container = std::unordered_map<dpp::socket, std::unique_ptr<socket_events>>;
+
+/**
+ * @brief A socket engine is a single-threaded event loop which watches a set of sockets
+ * and calls back into their owners when they are readable, writeable or in error.
+ *
+ * Every callback for a given socket is always executed on the thread which is running
+ * the engine, so the owner of a socket never needs to lock against its own callbacks.
+ * Sockets may be registered, updated and removed from any thread.
+ *
+ * The concrete implementation is chosen by dpp::create_socket_engine(): epoll on Linux,
+ * and poll() everywhere else.
+ */
+class DPP_EXPORT socket_engine_base {
+protected:
+	/**
+	 * @brief Mutex for fds
+	 */
+	std::shared_mutex fds_mutex;
+
+	/**
+	 * @brief File descriptors, and their states
+	 */
+	socket_container fds;
+
+	/**
+	 * @brief Event sets which have been removed but may still be referenced
+	 * by the event batch currently being dispatched. Freed at the end of
+	 * each call to process_events(). Guarded by fds_mutex.
+	 */
+	std::vector<std::unique_ptr<socket_events>> to_delete;
+
+	/**
+	 * @brief Mutex for tickers and deferred work
+	 */
+	std::mutex work_mutex;
+
+	/**
+	 * @brief Functions called roughly once per second from the engine thread
+	 */
+	std::map<uint64_t, socket_tick_event> tickers;
+
+	/**
+	 * @brief Next ticker ID to allocate
+	 */
+	uint64_t next_ticker_id{1};
+
+	/**
+	 * @brief Work posted from other threads, executed on the engine thread
+	 */
+	std::vector<std::function<void()>> deferred;
+
+	/**
+	 * @brief Self-pipe used to interrupt a blocked wait when work is posted
+	 * or a socket's interest set changes. Unused on Windows, where the wait
+	 * is simply kept short.
+	 */
+	dpp::socket wake_fds[2]{INVALID_SOCKET, INVALID_SOCKET};
+
+	/**
+	 * @brief True when the engine has been asked to stop running
+	 */
+	std::atomic<bool> terminating{false};
+
+	/**
+	 * @brief Thread running this engine, if started via start()
+	 */
+	std::thread runner;
+
+	/**
+	 * @brief ID of the thread currently inside run()
+	 */
+	std::atomic<std::thread::id> loop_thread{};
+
+	/**
+	 * @brief Last time tickers were executed
+	 */
+	time_t last_tick{0};
+
+	/**
+	 * @brief Find a registered event set by file descriptor
+	 * @param fd file descriptor
+	 * @return event set, or nullptr if the socket is not (or no longer) registered
+	 */
+	socket_events* get_fd(dpp::socket fd);
+
+	/**
+	 * @brief Drain the wake pipe after it signals readable
+	 */
+	void drain_wake();
+
+	/**
+	 * @brief Run all deferred work and, once per second, all tickers
+	 */
+	void run_timers_and_work();
+
+	/**
+	 * @brief Free event sets removed during the last dispatch
+	 */
+	void prune();
+
+	/**
+	 * @brief Milliseconds until the next ticker second boundary
+	 * @return wait time in milliseconds
+	 */
+	int time_to_next_tick() const;
+
+	/**
+	 * @brief Interrupt a blocked wait so that changes made from another
+	 * thread are picked up on the next loop iteration.
+	 */
+	void wake();
+
+	/**
+	 * @brief Implementation specific registration of a socket, called
+	 * with fds_mutex held after the event set has been stored
+	 * @param e event set
+	 * @return true on success
+	 */
+	virtual bool add_watch(const socket_events& e) = 0;
+
+	/**
+	 * @brief Implementation specific update of a socket's interest set,
+	 * called with fds_mutex held after the flags have been stored
+	 * @param e event set
+	 * @return true on success
+	 */
+	virtual bool modify_watch(const socket_events& e) = 0;
+
+	/**
+	 * @brief Implementation specific removal of a socket, called
+	 * with fds_mutex held
+	 * @param fd file descriptor
+	 * @return true on success
+	 */
+	virtual bool remove_watch(dpp::socket fd) = 0;
+
+public:
+	/**
+	 * @brief Construct a socket engine, allocating the wake pipe
+	 */
+	socket_engine_base();
+
+	/**
+	 * @brief Non-copyable
+	 */
+	socket_engine_base(const socket_engine_base&) = delete;
+
+	/**
+	 * @brief Non-copyable
+	 */
+	socket_engine_base &operator=(const socket_engine_base&) = delete;
+
+	/**
+	 * @brief Destroy the engine, stopping and joining its thread if it has one
+	 */
+	virtual ~socket_engine_base();
+
+	/**
+	 * @brief Register a new socket with the socket engine
+	 * @param e Socket events
+	 * @return true if socket was added
+	 */
+	bool register_socket(const socket_events& e);
+
+	/**
+	 * @brief Update the interest flags of an existing socket in the socket engine.
+	 * The callbacks given at registration time are retained.
+	 * @param fd file descriptor
+	 * @param flags new bitmask of values from dpp::socket_event_flags
+	 * @return true if socket was updated
+	 */
+	bool update_socket(dpp::socket fd, uint8_t flags);
+
+	/**
+	 * @brief Delete a socket from the socket engine
+	 * @param fd File descriptor
+	 * @return true if socket was removed
+	 * @note Callbacks may still be in progress on the engine thread when this returns,
+	 * use run_sync() if you need to guarantee they have completed.
+	 */
+	bool remove_socket(dpp::socket fd);
+
+	/**
+	 * @brief Add a function to be called approximately once per second on the engine thread
+	 * @param tick function to call
+	 * @return ticker id used to remove it
+	 */
+	uint64_t add_ticker(const socket_tick_event& tick);
+
+	/**
+	 * @brief Remove a ticker
+	 * @param id ticker id returned by add_ticker()
+	 */
+	void remove_ticker(uint64_t id);
+
+	/**
+	 * @brief Queue a function to run on the engine thread at the next loop iteration
+	 * @param work function to call
+	 */
+	void post(const std::function<void()>& work);
+
+	/**
+	 * @brief Run a function on the engine thread and wait for it to complete.
+	 * If called from the engine thread itself, or the engine is not running,
+	 * the function is run immediately.
+	 * @param work function to call
+	 */
+	void run_sync(const std::function<void()>& work);
+
+	/**
+	 * @brief Returns true if the calling thread is the engine thread
+	 * @return true if called from inside the engine's loop
+	 */
+	[[nodiscard]] bool on_engine_thread() const;
+
+	/**
+	 * @brief Get the number of sockets registered with this engine
+	 * @return socket count
+	 */
+	size_t size();
+
+	/**
+	 * @brief Wait for and dispatch events for at most one wait period
+	 * @param timeout_ms maximum time to wait in milliseconds
+	 */
+	virtual void process_events(int timeout_ms) = 0;
+
+	/**
+	 * @brief Run a single iteration of the event loop on the calling thread:
+	 * wait for and dispatch socket events, then run any deferred work and tickers.
+	 */
+	void iterate();
+
+	/**
+	 * @brief Run the event loop on the calling thread until stop() is called
+	 */
+	void run();
+
+	/**
+	 * @brief Start the event loop on a new thread
+	 * @param name Thread name, for debuggers
+	 */
+	void start(const std::string& name);
+
+	/**
+	 * @brief Ask the event loop to stop. Does not wait for it to do so.
+	 */
+	void stop();
+
+	/**
+	 * @brief Get the native handle of the thread started by start()
+	 * @return native thread handle
+	 */
+	std::thread::native_handle_type native_handle();
+};
+
+/**
+ * @brief Create the most efficient socket engine for this platform
+ * @return socket engine
+ */
+DPP_EXPORT std::unique_ptr<socket_engine_base> create_socket_engine();
+
+}
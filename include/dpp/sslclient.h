@@ -26,7 +26,13 @@
 #include <functional>
 #include <ctime>
 #include <dpp/socket.h>
+#include <dpp/socketengine.h>
 #include <cstdint>
+#include <mutex>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <dpp/dns.h>
 
 namespace dpp {
 
@@ -37,6 +43,74 @@ namespace dpp {
  */
 class openssl_connection;
 
+class connection_pool;
+
+/**
+ * @brief Process-wide TLS handshake counters, used to compare the cost of
+ * full handshakes against resumed ones
+ */
+struct DPP_EXPORT tls_handshake_stats {
+	/**
+	 * @brief Number of handshakes which performed a full key exchange
+	 */
+	uint64_t full_handshakes{0};
+
+	/**
+	 * @brief Number of handshakes which resumed a previous session
+	 */
+	uint64_t resumed_handshakes{0};
+
+	/**
+	 * @brief Total time spent in full handshakes, in seconds
+	 */
+	double full_handshake_time{0};
+
+	/**
+	 * @brief Total time spent in resumed handshakes, in seconds
+	 */
+	double resumed_handshake_time{0};
+};
+
+/**
+ * @brief Get the TLS handshake counters for all connections made by this process.
+ * All connections share one SSL context and a cache of resumable sessions keyed
+ * by hostname, so that reconnects to the same host can skip the key exchange.
+ * @return handshake counters
+ */
+DPP_EXPORT tls_handshake_stats get_tls_handshake_stats();
+
+/**
+ * @brief Stages of an asynchronous connection, see ssl_client::connect_async()
+ */
+enum ssl_connect_state : uint8_t {
+	/**
+	 * @brief Not connecting; either connected already, or not connected at all
+	 */
+	CONNECT_IDLE,
+
+	/**
+	 * @brief Waiting for the host name to be resolved
+	 */
+	CONNECT_DNS,
+
+	/**
+	 * @brief Waiting for the TCP connection to be established
+	 */
+	CONNECT_TCP,
+
+	/**
+	 * @brief Waiting for the TLS handshake to complete
+	 */
+	CONNECT_TLS,
+};
+
+/**
+ * @brief Called on the socket engine thread when an asynchronous connect completes
+ * @param success true if the connection is established and ready to use
+ * @param error reason the connection failed, if it failed
+ */
+typedef std::function<void(bool success, const std::string& error)> connect_callback_t;
+
 /**
  * @brief A callback for socket status
  */
@@ -64,6 +138,8 @@ bool close_socket(dpp::socket sfd);
  */
 bool set_nonblocking(dpp::socket sockfd, bool non_blocking);
 
+struct ssl_connect_guard;
+
 /**
  * @brief Implements a simple non-blocking SSL stream client.
  * 
@@ -78,6 +154,208 @@ private:
 	 * @brief Clean up resources
 	 */
 	void cleanup();
+
+	/**
+	 * @brief Mutex for the output buffer, which may be written to from any thread
+	 * while the socket engine drains it
+	 */
+	std::mutex out_mutex;
+
+	/**
+	 * @brief Chunks taken from the output buffer, being written to the socket.
+	 * Only touched on the socket engine thread, so they are written without the lock.
+	 */
+	std::deque<std::string> write_chunks;
+
+	/**
+	 * @brief Offset into the first of write_chunks of the next byte to send
+	 */
+	size_t write_offset;
+
+	/**
+	 * @brief Chunks which have been completely sent, kept so that socket_write()
+	 * can reuse their allocations. Guarded by out_mutex.
+	 */
+	std::vector<std::string> spare_chunks;
+
+	/**
+	 * @brief True if a read was interrupted by the SSL layer needing to write
+	 */
+	bool read_blocked_on_write;
+
+	/**
+	 * @brief True if a write was interrupted by the SSL layer needing to read
+	 */
+	bool write_blocked_on_read;
+
+	/**
+	 * @brief True once the current connection's event loop has finished with it
+	 */
+	bool loop_ended;
+
+	/**
+	 * @brief Ticker id for one_second_timer() on the socket engine
+	 */
+	uint64_t ticker_id;
+
+	/**
+	 * @brief Custom file descriptor currently registered with the socket engine
+	 */
+	dpp::socket custom_fd;
+
+	/**
+	 * @brief Stage of an asynchronous connect in progress, if any
+	 */
+	ssl_connect_state connect_state;
+
+	/**
+	 * @brief Time at which an asynchronous connect in progress is abandoned
+	 */
+	time_t connect_deadline;
+
+	/**
+	 * @brief Time the TLS handshake of an asynchronous connect started, from utility::time_f()
+	 */
+	double handshake_started;
+
+	/**
+	 * @brief Completion callback for an asynchronous connect in progress
+	 */
+	connect_callback_t on_connected;
+
+	/**
+	 * @brief Address of the current connection attempt, reported to the DNS
+	 * cache as failed if it cannot be connected to
+	 */
+	std::string connecting_address;
+
+	/**
+	 * @brief Resolved host of an asynchronous connect in progress, whose
+	 * addresses are tried in turn
+	 */
+	dns_cache_entry_ptr connecting_host;
+
+	/**
+	 * @brief Index into connecting_host's addresses of the current connection attempt
+	 */
+	size_t connecting_index;
+
+	/**
+	 * @brief Incremented by each connect_async(), so that a host name lookup
+	 * completing after a newer attempt has started is ignored
+	 */
+	uint64_t connect_serial;
+
+	/**
+	 * @brief Shared with host name lookups still in progress, which must not
+	 * touch this client once it has been detached or destroyed
+	 */
+	std::shared_ptr<ssl_connect_guard> guard;
+
+	/**
+	 * @brief Start a non-blocking TCP connection to a resolved host, beginning
+	 * with its preferred address. Runs on the socket engine thread.
+	 * @param addr resolved host
+	 */
+	void connect_to(const dns_cache_entry_ptr& addr);
+
+	/**
+	 * @brief Start a non-blocking TCP connection to the address at connecting_index
+	 * of connecting_host. Runs on the socket engine thread.
+	 */
+	void connect_to_address();
+
+	/**
+	 * @brief After a failed TCP connection, mark the address as failed and move on
+	 * to the host's next address within the same attempt
+	 * @return true if another address is being tried, false if none are left
+	 */
+	bool try_next_address();
+
+	/**
+	 * @brief Create the TLS session for a newly connected socket, offering a
+	 * cached session for the host if there is one
+	 * @throw dpp::connection_exception Failed to create the session
+	 */
+	void setup_tls();
+
+	/**
+	 * @brief Record the outcome of a completed TLS handshake
+	 * @param started time the handshake started, from utility::time_f()
+	 */
+	void handshake_complete(double started);
+
+	/**
+	 * @brief Advance an asynchronous connect when the socket engine reports the socket is ready
+	 */
+	void continue_connect();
+
+	/**
+	 * @brief Complete an asynchronous connect, switching the socket over to normal I/O
+	 */
+	void finish_connect();
+
+	/**
+	 * @brief Abandon an asynchronous connect, closing the socket
+	 * @param error reason for the failure, passed to the completion callback
+	 */
+	void fail_connect(const std::string& error);
+
+	/**
+	 * @brief Register the connected socket with the socket engine and switch it to
+	 * non-blocking mode.
+	 * @throw dpp::connection_exception The socket is invalid or can't be made non-blocking
+	 */
+	void watch_socket();
+
+	/**
+	 * @brief Recalculate and apply the socket's interest set on the socket engine
+	 */
+	void update_interest();
+
+	/**
+	 * @brief Read as much as possible from the socket into the input buffer
+	 * @return false if the connection has ended
+	 */
+	bool do_read();
+
+	/**
+	 * @brief Write as much as possible from the output buffer to the socket
+	 * @return false if the connection has ended
+	 */
+	bool do_write();
+
+	/**
+	 * @brief Socket readable event from the socket engine
+	 */
+	void on_read();
+
+	/**
+	 * @brief Socket writeable event from the socket engine
+	 */
+	void on_write();
+
+	/**
+	 * @brief Socket error event from the socket engine
+	 * @param error_code errno style error code
+	 */
+	void on_error(int error_code);
+
+	/**
+	 * @brief Called once per second by the socket engine
+	 */
+	void on_tick();
+
+	/**
+	 * @brief Stop watching the socket and notify the derived class via on_disconnect()
+	 */
+	void end_loop();
+
+	/**
+	 * @brief Register, update or remove the custom file descriptor with the
+	 * socket engine, to match what custom_readable_fd and custom_writeable_fd return
+	 */
+	void update_custom_fd();
 protected:
 	/**
 	 * @brief Input buffer received from socket
@@ -85,13 +363,14 @@ protected:
 	std::string buffer;
 
 	/**
-	 * @brief Output buffer for sending to socket
+	 * @brief Output buffer for sending to socket, as a queue of chunks of at most
+	 * 16k each. Queued data is moved, never copied, on its way to the socket.
 	 */
-	std::string obuffer;
+	std::deque<std::string> obuffer;
 
 	/**
 	 * @brief True if in nonblocking mode. The socket switches to nonblocking mode
-	 * once ReadLoop is called.
+	 * once read_loop() or attach_engine() is called.
 	 */
 	bool nonblocking;
 
@@ -110,6 +389,12 @@ protected:
 	 */
 	std::string cipher;
 
+	/**
+	 * @brief Time the connection was made. Kept with the connection while it is
+	 * pooled, so that the pool can close connections once they reach its maximum age.
+	 */
+	time_t connection_created;
+
 	/**
 	 * @brief For timers
 	 */
@@ -145,6 +430,50 @@ protected:
 	 */
 	bool make_new;
 
+	/**
+	 * @brief True if the TLS handshake resumed a previous session
+	 */
+	bool session_resumed;
+
+	/**
+	 * @brief Time taken by the TLS handshake, in seconds
+	 */
+	double handshake_time;
+
+	/**
+	 * @brief Application protocols to offer in the TLS handshake (ALPN), in wire
+	 * format: each name preceded by its length. Empty to offer none.
+	 */
+	std::string alpn_protocols;
+
+	/**
+	 * @brief Application protocol the server chose from alpn_protocols, or empty if none
+	 */
+	std::string alpn_protocol;
+
+	/**
+	 * @brief Pool this connection was taken from and is returned to when closed
+	 * with keepalive set, or nullptr if connections are not being reused
+	 */
+	connection_pool* pool;
+
+	/**
+	 * @brief Socket engine this connection is attached to, or nullptr if not attached
+	 */
+	socket_engine_base* engine;
+
+	/**
+	 * @brief Called on the socket engine thread when the connection is lost or
+	 * closed by the remote side. The socket has already been removed from the
+	 * engine, but is still open.
+	 */
+	virtual void on_disconnect();
+
+	/**
+	 * @brief Called on the socket engine thread when everything queued with socket_write()
+	 * has been sent, so that a large body can be queued a piece at a time rather than all at once.
+	 */
+	virtual void on_write_drained();
 
 	/**
 	 * @brief Called every second
@@ -212,19 +541,88 @@ public:
 	 * @param _hostname The hostname to connect to
 	 * @param _port the Port number to connect to
 	 * @param plaintext_downgrade Set to true to connect using plaintext only, without initialising SSL.
-	 * @param reuse Attempt to reuse previous connections for this hostname and port, if available
+	 * @param reuse Attempt to reuse previous connections for this hostname and port from the connection pool, if available,
+	 * and return the connection to the pool when it is closed with keepalive still set. Has no effect without a pool.
 	 * Note that no Discord endpoints will function when downgraded. This option is provided only for
 	 * connection to non-Discord addresses such as within dpp::cluster::request().
+	 * @param connections Connection pool to take connections from and return them to, or nullptr
+	 * @param connect_immediately If true, connect (blocking) from the constructor. If false, the
+	 * caller connects later with connect() or connect_async().
 	 * @throw dpp::exception Failed to initialise connection
 	 */
-	ssl_client(const std::string &_hostname, const std::string &_port = "443", bool plaintext_downgrade = false, bool reuse = false);
+	ssl_client(const std::string &_hostname, const std::string &_port = "443", bool plaintext_downgrade = false, bool reuse = false, connection_pool* connections = nullptr, bool connect_immediately = true);
 
 	/**
-	 * @brief Nonblocking I/O loop
-	 * @throw std::exception Any std::exception (or derivative) thrown from read_loop() causes reconnection of the shard
+	 * @brief Connect without blocking the calling thread. The TCP connect and TLS handshake
+	 * are driven by readiness events on the given socket engine, so any number of connects
+	 * may be in progress at once without a thread each. On success the connection is left
+	 * attached to the engine, exactly as if attach_engine() had been called.
+	 * If called from a thread other than the engine's, this waits for the engine to start
+	 * the connect, but not for it to complete.
+	 * @note The host name is resolved through the DNS cache without blocking the engine, see
+	 * dpp::resolve_hostname_async(). If the address connected to fails, the next address for
+	 * the host is tried on the following attempt.
+	 * @param e Socket engine to drive the connection
+	 * @param callback Called on the engine thread once the connection is ready or has failed.
+	 * If it fails, the socket has already been closed.
+	 */
+	void connect_async(socket_engine_base* e, const connect_callback_t& callback);
+
+	/**
+	 * @brief Returns true while an asynchronous connect is in progress
+	 * @return true if connecting
+	 */
+	bool is_connecting() const;
+
+	/**
+	 * @brief Returns true if this connection was taken from a connection pool
+	 * rather than being newly made
+	 * @return true if the connection was reused
+	 */
+	bool is_reused() const;
+
+	/**
+	 * @brief Returns true if the TLS handshake for this connection resumed a
+	 * previous session instead of performing a full key exchange
+	 * @return true if the session was resumed
+	 */
+	bool is_session_resumed() const;
+
+	/**
+	 * @brief Get the time taken by this connection's TLS handshake
+	 * @return handshake time in seconds, or 0 if no handshake was made
+	 * (plaintext, or a reused pooled connection)
+	 */
+	double get_handshake_time() const;
+
+	/**
+	 * @brief Get the application protocol negotiated with ALPN in the TLS handshake
+	 * @return protocol name, e.g. "h2", or empty if none was negotiated
+	 */
+	const std::string& get_alpn_protocol() const;
+
+	/**
+	 * @brief Nonblocking I/O loop. Runs a private socket engine on the calling thread
+	 * until the connection ends.
+	 * @note Any std::exception (or derivative) thrown from the handlers ends the loop
 	 */
 	void read_loop();
 
+	/**
+	 * @brief Attach this connection to a shared socket engine. The engine's thread will
+	 * call handle_buffer() and one_second_timer() from then on, instead of a thread
+	 * dedicated to this connection calling read_loop(). Call it again after
+	 * reconnecting to start watching the new socket.
+	 * @param e Socket engine to attach to
+	 */
+	void attach_engine(socket_engine_base* e);
+
+	/**
+	 * @brief Detach from the socket engine. Once this returns no further callbacks
+	 * will be made from the engine's thread.
+	 */
+	void detach_engine();
+
 	/**
 	 * @brief Destroy the ssl_client object
 	 */
@@ -28,6 +28,12 @@
 #include <stddef.h>
 #include <ctime>
 #include <functional>
+#include <memory>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
 
 namespace dpp {
 
@@ -44,9 +50,11 @@ typedef size_t timer;
 typedef std::function<void(timer)> timer_callback_t;
 
 /**
- * @brief Used internally to store state of active timers
+ * @brief Used to store state of active timers, before timers moved to dpp::timer_wheel
+ * @deprecated Nothing in the library uses this any more. It is kept so that code which
+ * names it still compiles, and will be removed in a future release.
  */
-struct DPP_EXPORT timer_t {
+struct timer_t {
 	/**
 	 * @brief Timer handle
 	 */
@@ -74,15 +82,116 @@ struct DPP_EXPORT timer_t {
 };
 
 /**
- * @brief A map of timers, ordered by earliest first so that map::begin() is always the 
+ * @brief A map of timers, ordered by earliest first so that map::begin() is always the
  * soonest to be due.
+ * @deprecated Cluster timers are kept in a dpp::timer_wheel, and nothing in the library uses this
  */
-typedef std::multimap<time_t, timer_t*> timer_next_t;
+using timer_next_t DPP_DEPRECATED("Cluster timers are kept in a dpp::timer_wheel") = std::multimap<time_t, timer_t*>;
 
 /**
  * @brief A map of timers stored by handle
+ * @deprecated Cluster timers are kept in a dpp::timer_wheel, and nothing in the library uses this
  */
-typedef std::unordered_map<timer, timer_t*> timer_reg_t;
+using timer_reg_t DPP_DEPRECATED("Cluster timers are kept in a dpp::timer_wheel") = std::unordered_map<timer, timer_t*>;
+
+/**
+ * @brief A hierarchical timing wheel with millisecond resolution, used for all cluster timers.
+ *
+ * Four wheels of 256 slots each have slots 1ms, 256ms, 65.5s and 4.7h wide, so a timer
+ * due within 49 days is placed directly in a slot and later ones are moved inwards as
+ * they come into range. Adding and cancelling a timer take constant time however many
+ * are active. Timers are driven by a thread of the wheel's own, started with the first
+ * timer, and their callbacks run on that thread.
+ */
+class DPP_EXPORT timer_wheel {
+public:
+	/**
+	 * @brief Number of wheels
+	 */
+	static constexpr size_t levels = 4;
+
+private:
+	/**
+	 * @brief A timer in the wheel
+	 */
+	struct entry;
+
+	/**
+	 * @brief The wheel's slots, timers and driver state
+	 */
+	struct core;
+
+	/**
+	 * @brief State of the wheel. The driver thread holds a reference of its own, so
+	 * destroying the wheel from one of its timers leaves the state alive until the
+	 * driver has returned from the timer and stopped.
+	 */
+	std::shared_ptr<core> state;
+
+public:
+	/**
+	 * @brief Construct a timer wheel
+	 * @param start_thread If true, timers are fired by the wheel's own thread. If false,
+	 * nothing fires until advance() is called, which is useful for tests and benchmarks.
+	 */
+	explicit timer_wheel(bool start_thread = true);
+
+	/**
+	 * @brief Stop the driver thread and free all timers, without calling their on_stop.
+	 * The wheel may be destroyed from inside one of its own timers: no further timers are
+	 * called, and the driver thread stops once that timer returns.
+	 */
+	~timer_wheel();
+
+	/**
+	 * @brief A timer wheel cannot be copied
+	 */
+	timer_wheel(const timer_wheel&) = delete;
+
+	/**
+	 * @brief A timer wheel cannot be copied
+	 */
+	timer_wheel& operator=(const timer_wheel&) = delete;
+
+	/**
+	 * @brief Add a timer
+	 * @param delay Time until the first tick
+	 * @param interval Time between ticks after the first, measured from the end of the
+	 * previous tick. Zero for a timer which ticks once and is then removed.
+	 * @param on_tick Called on each tick with the timer's handle
+	 * @param on_stop Called if the timer is cancelled with cancel() (optional)
+	 * @return timer handle
+	 */
+	timer add(std::chrono::milliseconds delay, std::chrono::milliseconds interval, timer_callback_t on_tick, timer_callback_t on_stop = {});
+
+	/**
+	 * @brief Cancel a timer. It is safe to cancel a timer from inside its own on_tick.
+	 * @param t Timer handle returned by add()
+	 * @param call_on_stop If true, the timer's on_stop is called
+	 * @return true if the timer was cancelled, false if it did not exist
+	 */
+	bool cancel(timer t, bool call_on_stop = true);
+
+	/**
+	 * @brief Remove all timers without calling their on_stop. Unless called from a timer,
+	 * this waits for any timer which is running to return.
+	 */
+	void clear();
+
+	/**
+	 * @brief Fire all timers due at or before a point in time, on the calling thread.
+	 * Only for wheels constructed without a driver thread.
+	 * @param now Time since the wheel was created
+	 * @return Number of timers fired, or 0 if the wheel has a driver thread
+	 */
+	size_t advance(std::chrono::milliseconds now);
+
+	/**
+	 * @brief Get the number of active timers
+	 * @return timer count
+	 */
+	size_t size() const;
+};
 
 /**
  * @brief Trigger a timed event once.
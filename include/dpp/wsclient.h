@@ -22,6 +22,7 @@
 #pragma once
 #include <dpp/export.h>
 #include <string>
+#include <string_view>
 #include <map>
 #include <dpp/sslclient.h>
 
@@ -42,6 +43,28 @@ enum websocket_protocol_t : uint8_t {
 	ws_etf = 1
 };
 
+/**
+ * @brief Transport compression types available on the Discord gateway
+ */
+enum websocket_compression_t : uint8_t {
+	/**
+	 * @brief No transport compression
+	 */
+	wsc_none = 0,
+
+	/**
+	 * @brief zlib-stream, the default
+	 */
+	wsc_zlib = 1,
+
+	/**
+	 * @brief zstd-stream. Decompresses faster and compresses better than zlib,
+	 * but is only available if D++ was built with libzstd.
+	 * @see dpp::zstdcontext::available()
+	 */
+	wsc_zstd = 2
+};
+
 /**
  * @brief Websocket connection status
  */
@@ -129,11 +152,12 @@ class DPP_EXPORT websocket_client : public ssl_client {
 	std::map<std::string, std::string> http_headers;
 
 	/**
-	 * @brief Parse headers for a websocket frame from the buffer.
-	 * @param buffer The buffer to operate on. Will modify the string removing completed items from the head of the queue
-	 * @return true if a complete header has been received
+	 * @brief Parse headers for a websocket frame from the buffer, and pass the frame on if it is complete.
+	 * @param buffer The unprocessed part of the input buffer. On success, this view is advanced past the
+	 * completed frame; the underlying buffer is not modified.
+	 * @return true if a complete frame has been received
 	 */
-	bool parseheader(std::string& buffer);
+	bool parseheader(std::string_view& buffer);
 
 	/**
 	 * @brief Unpack a frame and pass completed frames up the stack.
@@ -157,7 +181,7 @@ class DPP_EXPORT websocket_client : public ssl_client {
 	 * @brief Handle ping requests.
 	 * @param payload The ping payload, to be returned as-is for a pong
 	 */
-	void handle_ping(const std::string& payload);
+	void handle_ping(std::string_view payload);
 
 protected:
 
@@ -182,8 +206,11 @@ public:
 	 * @param opcode The encoding type to use, either OP_BINARY or OP_TEXT
 	 * @note Voice websockets only support OP_TEXT, and other websockets must be
 	 * OP_BINARY if you are going to send ETF.
+	 * @param connect_immediately If true, make the TCP and TLS connection (blocking) from the constructor.
+	 * If false, the caller connects later via ssl_client::connect() or ssl_client::connect_async(),
+	 * then calls connect() to send the upgrade request.
 	 */
-	websocket_client(const std::string& hostname, const std::string& port = "443", const std::string& urlpath = "", ws_opcode opcode = OP_BINARY);
+	websocket_client(const std::string& hostname, const std::string& port = "443", const std::string& urlpath = "", ws_opcode opcode = OP_BINARY, bool connect_immediately = true);
 
 	/**
 	 * @brief Destroy the websocket client object
@@ -212,11 +239,26 @@ public:
 	/**
 	 * @brief Receives raw frame content only without headers
 	 *
-	 * @param buffer The buffer contents
+	 * The default implementation passes a copy of the frame to the deprecated
+	 * handle_frame(const std::string&, ws_opcode), so that classes which still
+	 * override that are called as before.
+	 *
+	 * @param buffer The frame payload. This is a view into the input buffer, only valid until this call returns
+	 * @param opcode Frame type, e.g. OP_TEXT, OP_BINARY
+	 * @return True if the frame was successfully handled. False if no valid frame is in the buffer.
+	 */
+	virtual bool handle_frame(std::string_view buffer, ws_opcode opcode);
+
+	/**
+	 * @brief Receives raw frame content only without headers
+	 *
+	 * @deprecated Override handle_frame(std::string_view, ws_opcode) instead, which
+	 * is given the frame without copying it. This is only called if that is not overridden.
+	 * @param buffer The frame payload
 	 * @param opcode Frame type, e.g. OP_TEXT, OP_BINARY
 	 * @return True if the frame was successfully handled. False if no valid frame is in the buffer.
 	 */
-	virtual bool handle_frame(const std::string& buffer, ws_opcode opcode);
+	DPP_DEPRECATED("Override handle_frame(std::string_view, ws_opcode) instead") virtual bool handle_frame(const std::string& buffer, ws_opcode opcode);
 
 	/**
 	 * @brief Called upon error frame.
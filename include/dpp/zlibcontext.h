@@ -0,0 +1,76 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/export.h>
+#include <dpp/decompressor.h>
+#include <string_view>
+
+/* Defined by zlib.h, which we don't want to make a dependency of the public headers */
+struct z_stream_s;
+
+namespace dpp {
+
+/**
+ * @brief Decompresses a zlib-stream gateway connection. A message may span more
+ * than one websocket frame; the last frame of each message ends with a zlib sync
+ * flush marker.
+ */
+class DPP_EXPORT zlibcontext : public stream_decompressor {
+	/**
+	 * @brief Zlib stream state
+	 */
+	z_stream_s* d_stream;
+
+	/**
+	 * @brief True once the message in the arena is complete, so the next
+	 * frame starts a new one
+	 */
+	bool complete;
+
+public:
+	/**
+	 * @brief Initialise a new stream
+	 * @throw dpp::connection_exception if zlib cannot be initialised
+	 */
+	zlibcontext();
+
+	/**
+	 * @brief Free the stream
+	 */
+	~zlibcontext() override;
+
+	/**
+	 * @brief Start a new stream, e.g. for a new connection. The arena and counters are kept.
+	 */
+	void reset() override;
+
+	/**
+	 * @brief Decompress one websocket frame of the stream into the arena.
+	 * @param frame compressed frame
+	 * @return true if the frame completed a message, which can then be read
+	 * from message() until the next call
+	 * @throw dpp::connection_exception if the stream is corrupt
+	 */
+	bool feed(std::string_view frame) override;
+};
+
+}
@@ -0,0 +1,79 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+#include <dpp/export.h>
+#include <dpp/decompressor.h>
+#include <string_view>
+
+/* Defined by zstd.h, which we don't want to make a dependency of the public headers */
+struct ZSTD_DCtx_s;
+
+namespace dpp {
+
+/**
+ * @brief Decompresses a zstd-stream gateway connection. Discord flushes the
+ * stream at the end of every payload, so each websocket frame is one message.
+ *
+ * @note zstd support is optional. If D++ was built without libzstd, the
+ * constructor throws and dpp::zstdcontext::available() returns false.
+ */
+class DPP_EXPORT zstdcontext : public stream_decompressor {
+	/**
+	 * @brief Zstd decompression stream
+	 */
+	ZSTD_DCtx_s* d_stream;
+
+public:
+	/**
+	 * @brief Initialise a new stream
+	 * @throw dpp::connection_exception if zstd cannot be initialised
+	 * @throw dpp::logic_exception if D++ was built without zstd support
+	 */
+	zstdcontext();
+
+	/**
+	 * @brief Free the stream
+	 */
+	~zstdcontext() override;
+
+	/**
+	 * @brief Check if D++ was built with zstd support
+	 * @return true if zstd-stream compression can be used
+	 */
+	static bool available();
+
+	/**
+	 * @brief Start a new stream, e.g. for a new connection. The arena and counters are kept.
+	 */
+	void reset() override;
+
+	/**
+	 * @brief Decompress one websocket frame of the stream into the arena.
+	 * @param frame compressed frame
+	 * @return true, as each frame is a complete message which can then be read
+	 * from message() until the next call
+	 * @throw dpp::connection_exception if the stream is corrupt
+	 */
+	bool feed(std::string_view frame) override;
+};
+
+}
@@ -0,0 +1,167 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+/* Compares dpp::cache with the single map, single lock cache it replaced.
+ *
+ * Each run starts a number of threads which share one cache of 100,000
+ * objects. Some of the threads only look objects up and the rest only store
+ * them, and the benchmark reports the total operations per second for a
+ * range of reader to writer ratios.
+ *
+ * Lock contention only shows when the threads run on separate cores. With
+ * fewer cores than threads, the threads take turns, and the results mostly
+ * show the cost of a lookup or store without any lock contention.
+ *
+ * Usage: cachebench [threads] [milliseconds per run]
+ */
+
+#include <dpp/dpp.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <chrono>
+#include <thread>
+
+/**
+ * @brief Lookups found, kept so the lookups can't be optimised away
+ */
+std::atomic<uint64_t> found_total{0};
+
+/**
+ * @brief The cache as it was before it was striped: one unordered_map behind one shared_mutex
+ */
+template<class T> class legacy_cache {
+	std::shared_mutex cache_mutex;
+	std::unordered_map<dpp::snowflake, T*> cache_map;
+public:
+	void store(T* object) {
+		std::unique_lock l(cache_mutex);
+		auto existing = cache_map.find(object->id);
+		if (existing == cache_map.end()) {
+			cache_map[object->id] = object;
+		} else if (object != existing->second) {
+			std::lock_guard<std::mutex> delete_lock(dpp::deletion_mutex);
+			dpp::queue_deletion(existing->second);
+			cache_map[object->id] = object;
+		}
+	}
+
+	T* find(dpp::snowflake id) {
+		std::shared_lock l(cache_mutex);
+		auto r = cache_map.find(id);
+		return r != cache_map.end() ? r->second : nullptr;
+	}
+};
+
+/**
+ * @brief Objects stored by the benchmark. Writers switch each id between two objects,
+ * so that every store replaces an object without allocating.
+ */
+struct bench_objects {
+	std::vector<dpp::user> first, second;
+
+	explicit bench_objects(size_t count) : first(count), second(count) {
+		for (size_t i = 0; i < count; ++i) {
+			first[i].id = second[i].id = 1000000000000000000ULL + i * 4194304ULL;
+		}
+	}
+};
+
+/**
+ * @brief Run readers and writers against a cache for a fixed time
+ * @return double operations per second across all threads
+ */
+template<class C> double run(C& cache, bench_objects& objects, size_t readers, size_t writers, std::chrono::milliseconds duration) {
+	std::atomic<bool> go{false}, stop{false};
+	std::atomic<uint64_t> total{0};
+	std::vector<std::thread> threads;
+	size_t count = objects.first.size();
+	for (size_t t = 0; t < readers + writers; ++t) {
+		bool writer = t >= readers;
+		threads.emplace_back([&, writer, t]() {
+			std::mt19937_64 rng(t);
+			uint64_t ops = 0, found = 0;
+			while (!go) {
+				std::this_thread::yield();
+			}
+			while (!stop) {
+				for (int batch = 0; batch < 256; ++batch) {
+					size_t i = rng() % count;
+					if (writer) {
+						cache.store((ops & 1) ? &objects.second[i] : &objects.first[i]);
+					} else {
+						found += cache.find(objects.first[i].id) != nullptr;
+					}
+					ops++;
+				}
+			}
+			total += ops;
+			found_total += found;
+		});
+	}
+	auto start = std::chrono::steady_clock::now();
+	go = true;
+	std::this_thread::sleep_for(duration);
+	stop = true;
+	for (auto& th : threads) {
+		th.join();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return total / seconds;
+}
+
+int main(int argc, char const *argv[]) {
+	size_t threads = argc > 1 ? std::stoul(argv[1]) : std::max(4U, std::thread::hardware_concurrency());
+	std::chrono::milliseconds duration(argc > 2 ? std::stoul(argv[2]) : 1000);
+	bench_objects objects(100000);
+
+	/* Both caches hold every object for the whole benchmark; nothing is ever freed */
+	dpp::cache<dpp::user> striped;
+	legacy_cache<dpp::user> legacy;
+	for (auto& u : objects.first) {
+		striped.store(&u);
+		legacy.store(&u);
+	}
+
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << threads << " threads, " << objects.first.size() << " objects, " << duration.count() << "ms per run\n";
+	std::cout << "readers:writers   legacy Mops/s   striped Mops/s   speedup\n";
+	size_t last = SIZE_MAX;
+	for (size_t writers : {size_t(0), threads / 16, threads / 4, threads / 2, threads}) {
+		if (writers == last) {
+			continue;
+		}
+		last = writers;
+		size_t readers = threads - writers;
+		double before = run(legacy, objects, readers, writers, duration);
+		double after = run(striped, objects, readers, writers, duration);
+		std::cout << std::setw(7) << readers << ":" << std::left << std::setw(9) << writers << std::right
+			<< std::setw(14) << before / 1e6 << std::setw(17) << after / 1e6
+			<< std::setw(9) << after / before << "x\n";
+	}
+	return 0;
+}
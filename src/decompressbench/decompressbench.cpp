@@ -0,0 +1,146 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+/* Replays a recorded gateway dump through the zlib-stream and zstd-stream
+ * decompressors, and reports the CPU time each takes per megabyte.
+ *
+ * The dump is a text file with one decompressed gateway payload per line.
+ * Each payload is compressed the way Discord sends it (one stream per
+ * connection, flushed at the end of every payload) before timing starts.
+ */
+
+#include <dpp/dpp.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+	#include <zstd.h>
+#endif
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <ctime>
+
+/**
+ * @brief Compress payloads as a single zlib-stream, one frame per payload
+ */
+std::vector<std::string> zlib_frames(const std::vector<std::string>& payloads) {
+	std::vector<std::string> frames;
+	z_stream stream{};
+	deflateInit(&stream, Z_DEFAULT_COMPRESSION);
+	for (const auto& payload : payloads) {
+		std::string frame;
+		stream.next_in = (Bytef*)payload.data();
+		stream.avail_in = (uInt)payload.size();
+		do {
+			char out[65536];
+			stream.next_out = (Bytef*)out;
+			stream.avail_out = sizeof(out);
+			deflate(&stream, Z_SYNC_FLUSH);
+			frame.append(out, sizeof(out) - stream.avail_out);
+		} while (stream.avail_out == 0);
+		frames.emplace_back(std::move(frame));
+	}
+	deflateEnd(&stream);
+	return frames;
+}
+
+#ifdef HAVE_ZSTD
+/**
+ * @brief Compress payloads as a single zstd-stream, one frame per payload
+ */
+std::vector<std::string> zstd_frames(const std::vector<std::string>& payloads) {
+	std::vector<std::string> frames;
+	ZSTD_CCtx* stream = ZSTD_createCCtx();
+	for (const auto& payload : payloads) {
+		std::string frame;
+		ZSTD_inBuffer input{payload.data(), payload.size(), 0};
+		size_t remaining;
+		do {
+			char out[65536];
+			ZSTD_outBuffer output{out, sizeof(out), 0};
+			remaining = ZSTD_compressStream2(stream, &output, &input, ZSTD_e_flush);
+			frame.append(out, output.pos);
+		} while (remaining != 0);
+		frames.emplace_back(std::move(frame));
+	}
+	ZSTD_freeCCtx(stream);
+	return frames;
+}
+#endif
+
+/**
+ * @brief Replay frames through a decompressor and print its figures
+ */
+void replay(const std::string& name, dpp::stream_decompressor& decompressor, const std::vector<std::string>& frames, int iterations) {
+	size_t compressed = 0;
+	for (const auto& frame : frames) {
+		compressed += frame.size();
+	}
+	std::clock_t start = std::clock();
+	for (int i = 0; i < iterations; ++i) {
+		decompressor.reset();
+		for (const auto& frame : frames) {
+			decompressor.feed(frame);
+		}
+	}
+	double cpu = static_cast<double>(std::clock() - start) / CLOCKS_PER_SEC;
+	dpp::decompression_stats stats = decompressor.get_stats();
+	double mb = static_cast<double>(stats.bytes_out) / (1024.0 * 1024.0);
+	std::cout << std::left << std::setw(12) << name
+		<< " compressed: " << std::setw(10) << compressed
+		<< " ratio: " << std::setw(8) << std::setprecision(3) << (compressed ? static_cast<double>(stats.bytes_out) / iterations / compressed : 0)
+		<< " CPU ms/MB: " << std::setw(8) << std::setprecision(4) << (mb > 0 ? cpu * 1000.0 / mb : 0)
+		<< " arena: " << stats.arena_size << "\n";
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::cerr << "Usage: " << argv[0] << " <gateway dump, one payload per line> [iterations]\n";
+		return 1;
+	}
+	std::ifstream dump(argv[1]);
+	if (!dump) {
+		std::cerr << "Can't open " << argv[1] << "\n";
+		return 1;
+	}
+	int iterations = argc > 2 ? std::max(1, std::stoi(argv[2])) : 10;
+	std::vector<std::string> payloads;
+	size_t total = 0;
+	for (std::string line; std::getline(dump, line);) {
+		if (!line.empty()) {
+			total += line.size();
+			payloads.emplace_back(std::move(line));
+		}
+	}
+	std::cout << payloads.size() << " payloads, " << total << " bytes, " << iterations << " iterations\n";
+
+	dpp::zlibcontext zlib;
+	replay("zlib-stream", zlib, zlib_frames(payloads), iterations);
+#ifdef HAVE_ZSTD
+	dpp::zstdcontext zstd;
+	replay("zstd-stream", zstd, zstd_frames(payloads), iterations);
+#else
+	std::cout << "zstd-stream  not available, D++ was built without libzstd\n";
+#endif
+	return 0;
+}
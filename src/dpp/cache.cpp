@@ -21,7 +21,12 @@
  ************************************************************************************/
 #include <dpp/export.h>
 #include <mutex>
+#include <atomic>
 #include <variant>
+#include <deque>
+#include <vector>
+#include <chrono>
+#include <algorithm>
 #include <dpp/cache.h>
 
 namespace dpp {
@@ -45,35 +50,129 @@ uint64_t counter () { \
 }
 
 
+namespace {
+
+/**
+ * @brief Objects in the order they were queued, so the oldest can be found
+ * without searching deletion_queue. An entry whose time does not match
+ * deletion_queue was queued again later and is skipped.
+ */
+std::deque<std::pair<time_t, managed*>> deletion_order;
+
+/**
+ * @brief Garbage collection statistics
+ */
+gc_stats stats;
+
+/**
+ * @brief Protects stats
+ */
+std::mutex stats_mutex;
+
+/**
+ * @brief How long one call to garbage_collection() may spend deleting objects
+ */
+constexpr std::chrono::microseconds gc_budget(2000);
+
+/**
+ * @brief Most objects taken off the deletion queue per lock
+ */
+constexpr size_t gc_batch = 256;
+
+/**
+ * @brief Seconds an object stays in the deletion queue
+ */
+constexpr time_t gc_delay = 60;
+
+/**
+ * @brief Milliseconds since a point in time
+ */
+double ms_since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+void queue_deletion(managed* object) {
+	time_t now = time(nullptr);
+	deletion_queue[object] = now;
+	deletion_order.emplace_back(now, object);
+}
+
 /* Because other threads and systems may run for a short while after an event is received, we don't immediately
  * delete pointers when objects are replaced. We put them into a queue, and periodically delete pointers in the
- * queue. This also rehashes unordered_maps to ensure they free their memory.
+ * queue. This also rebuilds sparse cache tables to ensure they free their memory.
+ *
+ * Deletion happens a batch at a time, with the queue only locked while a batch is taken off it, so nothing
+ * waiting to queue an object is held up by the deletes themselves.
  */
 void garbage_collection() {
+	auto start = std::chrono::steady_clock::now();
 	time_t now = time(nullptr);
-	bool repeat = false;
-	{
-		std::lock_guard<std::mutex> delete_lock(deletion_mutex);
-		do {
-			repeat = false;
-			for (auto g = deletion_queue.begin(); g != deletion_queue.end(); ++g) {
-				if (now > g->second + 60) {
-					delete g->first;
-					deletion_queue.erase(g);
-					repeat = true;
-					break;
+	double pause = 0;
+	uint64_t freed = 0, rehashed = 0, pending = 0;
+	std::vector<managed*> batch;
+	batch.reserve(gc_batch);
+	bool more = true;
+	while (more && std::chrono::steady_clock::now() - start < gc_budget) {
+		{
+			auto locked = std::chrono::steady_clock::now();
+			std::lock_guard<std::mutex> delete_lock(deletion_mutex);
+			while (batch.size() < gc_batch && !deletion_order.empty() && now > deletion_order.front().first + gc_delay) {
+				auto [queued, object] = deletion_order.front();
+				deletion_order.pop_front();
+				auto i = deletion_queue.find(object);
+				if (i != deletion_queue.end() && i->second == queued) {
+					deletion_queue.erase(i);
+					batch.push_back(object);
 				}
 			}
-		} while (repeat);
-		if (deletion_queue.size() == 0) {
-			deletion_queue = {};
+			more = batch.size() == gc_batch;
+			if (deletion_order.empty()) {
+				deletion_order = {};
+				deletion_queue = {};
+			}
+			pending = deletion_queue.size();
+			pause = std::max(pause, ms_since(locked));
 		}
+		for (managed* object : batch) {
+			delete object;
+		}
+		freed += batch.size();
+		batch.clear();
+	}
+
+	/* Check one cache per call, round robin */
+	static std::atomic<size_t> next_cache{0};
+	auto locked = std::chrono::steady_clock::now();
+	bool shrunk = false;
+	switch (next_cache++ % 5) {
+		case 0: shrunk = get_user_cache()->shrink(); break;
+		case 1: shrunk = get_channel_cache()->shrink(); break;
+		case 2: shrunk = get_guild_cache()->shrink(); break;
+		case 3: shrunk = get_role_cache()->shrink(); break;
+		case 4: shrunk = get_emoji_cache()->shrink(); break;
+	}
+	if (shrunk) {
+		rehashed++;
+		pause = std::max(pause, ms_since(locked));
 	}
-	dpp::get_user_cache()->rehash();
-	dpp::get_channel_cache()->rehash();
-	dpp::get_guild_cache()->rehash();
-	dpp::get_role_cache()->rehash();
-	dpp::get_emoji_cache()->rehash();
+
+	double run = ms_since(start);
+	std::lock_guard<std::mutex> stats_lock(stats_mutex);
+	stats.runs++;
+	stats.objects_freed += freed;
+	stats.objects_pending = pending;
+	stats.rehashes += rehashed;
+	stats.last_run_ms = run;
+	stats.total_run_ms += run;
+	stats.last_pause_ms = pause;
+	stats.max_pause_ms = std::max(stats.max_pause_ms, pause);
+}
+
+gc_stats get_gc_stats() {
+	std::lock_guard<std::mutex> stats_lock(stats_mutex);
+	return stats;
 }
 
 
@@ -534,6 +534,7 @@ std::map<snowflake, guild_member*> channel::get_members() {
 	std::map<snowflake, guild_member*> rv;
 	guild* g = dpp::find_guild(guild_id);
 	if (g) {
+		std::shared_lock lock(g->get_mutex());
 		for (auto m = g->members.begin(); m != g->members.end(); ++m) {
 			if (g->permission_overwrites(m->second, *this) & p_view_channel) {
 				rv[m->second.user_id] = &(m->second);
@@ -547,6 +548,7 @@ std::map<snowflake, voicestate> channel::get_voice_members() {
 	std::map<snowflake, voicestate> rv;
 	guild* g = dpp::find_guild(guild_id);
 	if (g) {
+		std::shared_lock lock(g->get_mutex());
 		for (auto & m : g->voice_members) {
 			if (m.second.channel_id == this->id) {
 				rv[m.second.user_id] = m.second;
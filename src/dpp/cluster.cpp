@@ -19,11 +19,16 @@
  *
  ************************************************************************************/
 #include <map>
+#include <algorithm>
+#include <mutex>
+#include <vector>
 #include <dpp/exception.h>
 #include <dpp/cluster.h>
+#include <dpp/zstdcontext.h>
 #include <chrono>
 #include <iostream>
 #include <dpp/json.h>
+#include <dpp/jsonparser.h>
 
 namespace dpp {
 
@@ -35,6 +40,46 @@ namespace dpp {
  */
 thread_local std::string audit_reason;
 
+/**
+ * @brief Clusters sharing the process-wide cache garbage collection
+ */
+struct gc_schedule {
+	/**
+	 * @brief Started clusters, in the order they started. The first of them runs
+	 * the collection timer on its timer wheel.
+	 */
+	std::vector<cluster*> clusters;
+
+	/**
+	 * @brief Collection timer, on the timer wheel of the first of clusters
+	 */
+	timer handle{0};
+
+	/**
+	 * @brief Mutex for clusters and handle
+	 */
+	std::mutex mutex;
+};
+
+/**
+ * @brief Get the garbage collection schedule. It is never destroyed, so that
+ * a cluster destroyed during static destruction can still deregister.
+ * @return schedule
+ */
+static gc_schedule& garbage_collection_schedule() {
+	static gc_schedule* schedule = new gc_schedule();
+	return *schedule;
+}
+
+/**
+ * @brief Run a small slice of cache garbage collection, once a second. This runs on
+ * a timer wheel's thread, so a long pass does not hold up the socket engines serving
+ * the shards.
+ */
+static void garbage_collection_tick(timer) {
+	dpp::garbage_collection();
+}
+
 /**
  * @brief Make a warning lambda for missing message intents
  *
@@ -84,9 +129,9 @@ template bool DPP_EXPORT validate_configuration<build_type::release>();
 
 template bool DPP_EXPORT validate_configuration<build_type::universal>();
 
-cluster::cluster(const std::string &_token, uint32_t _intents, uint32_t _shards, uint32_t _cluster_id, uint32_t _maxclusters, bool comp, cache_policy_t policy, uint32_t request_threads, uint32_t request_threads_raw)
-	: default_gateway("gateway.discord.gg"), rest(nullptr), raw_rest(nullptr), compressed(comp), start_time(0), token(_token), last_identify(time(nullptr) - 5), intents(_intents),
-	numshards(_shards), cluster_id(_cluster_id), maxclusters(_maxclusters), rest_ping(0.0), cache_policy(policy), ws_mode(ws_json)
+cluster::cluster(const std::string &_token, uint32_t _intents, uint32_t _shards, uint32_t _cluster_id, uint32_t _maxclusters, bool comp, cache_policy_t policy, uint32_t request_threads, uint32_t request_threads_raw, uint32_t _socket_threads)
+	: default_gateway("gateway.discord.gg"), rest(nullptr), raw_rest(nullptr), compressed(comp), start_time(0), socket_threads(_socket_threads), token(_token), last_identify(time(nullptr) - 5), intents(_intents),
+	numshards(_shards), cluster_id(_cluster_id), maxclusters(_maxclusters), rest_ping(0.0), cache_policy(policy), ws_mode(ws_json), ws_compression(comp ? wsc_zlib : wsc_none)
 {
 	/* Instantiate REST request queues */
 	try {
@@ -166,6 +211,17 @@ request_queue* cluster::get_raw_rest() {
 	return raw_rest;
 }
 
+connection_pool_stats cluster::get_connection_pool_stats() {
+	connection_pool_stats stats;
+	if (rest) {
+		stats += rest->get_connection_pool().get_stats();
+	}
+	if (raw_rest) {
+		stats += raw_rest->get_connection_pool().get_stats();
+	}
+	return stats;
+}
+
 cluster& cluster::set_websocket_protocol(websocket_protocol_t mode) {
 	if (start_time > 0) {
 		throw dpp::logic_exception(err_websocket_proto_already_set, "Cannot change websocket protocol on a started cluster!");
@@ -174,6 +230,18 @@ cluster& cluster::set_websocket_protocol(websocket_protocol_t mode) {
 	return *this;
 }
 
+cluster& cluster::set_websocket_compression(websocket_compression_t mode) {
+	if (start_time > 0) {
+		throw dpp::logic_exception(err_websocket_proto_already_set, "Cannot change websocket compression on a started cluster!");
+	}
+	if (mode == wsc_zstd && !zstdcontext::available()) {
+		throw dpp::logic_exception(err_no_compression_support, "D++ was built without zstd support, zstd-stream compression is not available");
+	}
+	ws_compression = mode;
+	compressed = mode != wsc_none;
+	return *this;
+}
+
 void cluster::log(dpp::loglevel severity, const std::string &msg) const {
 	if (!on_log.empty()) {
 		/* Pass to user if they've hooked the event */
@@ -181,7 +249,7 @@ void cluster::log(dpp::loglevel severity, const std::string &msg) const {
 		logmsg.severity = severity;
 		logmsg.message = msg;
 		size_t pos{0};
-		while ((pos = logmsg.message.find(token, pos)) != std::string::npos) {
+		while (!token.empty() && (pos = logmsg.message.find(token, pos)) != std::string::npos) {
 			logmsg.message.replace(pos, token.length(), "*****");
 			pos += 5;
 		}
@@ -218,6 +286,8 @@ void cluster::start(bool return_after) {
 		log(ll_warning, "You have attached an event to cluster::on_presence_update() but have not specified the privileged intent dpp::i_guild_presences. This event will not fire.");
 	}
 
+	start_garbage_collection();
+
 	/* Start up all shards */
 	gateway g;
 	try {
@@ -257,12 +327,22 @@ void cluster::start(bool return_after) {
 
 	log(ll_debug, "Starting with " + std::to_string(numshards) + " shards...");
 
+	/* Spin up the socket engines. Shards share these threads rather than having one thread each */
+	uint32_t local_shards = numshards / maxclusters + (numshards % maxclusters > cluster_id ? 1 : 0);
+	uint32_t engine_count = socket_threads ? socket_threads : std::thread::hardware_concurrency();
+	engine_count = std::max(1U, std::min(engine_count, local_shards));
+	for (uint32_t e = 0; e < engine_count; ++e) {
+		socket_engines.emplace_back(create_socket_engine());
+		socket_engines.back()->start("sockets/" + std::to_string(e));
+	}
+	log(ll_debug, "Started " + std::to_string(engine_count) + " socket engine thread" + (engine_count > 1 ? "s" : ""));
+
 	for (uint32_t s = 0; s < numshards; ++s) {
 		/* Filter out shards that aren't part of the current cluster, if the bot is clustered */
 		if (s % maxclusters == cluster_id) {
-			/* Each discord_client spawns its own thread in its run() */
+			/* Each discord_client attaches itself to one of the socket engines in its run() */
 			try {
-				this->shards[s] = new discord_client(this, s, numshards, token, intents, compressed, ws_mode);
+				this->shards[s] = new discord_client(this, s, numshards, token, intents, compressed, ws_mode, ws_compression);
 				this->shards[s]->run();
 			}
 			catch (const std::exception &e) {
@@ -311,20 +391,58 @@ void cluster::start(bool return_after) {
 	}
 }
 
+void cluster::start_garbage_collection() {
+	gc_schedule& gc = garbage_collection_schedule();
+	std::lock_guard lock(gc.mutex);
+	if (std::find(gc.clusters.begin(), gc.clusters.end(), this) != gc.clusters.end()) {
+		return;
+	}
+	gc.clusters.push_back(this);
+	if (gc.clusters.size() == 1) {
+		gc.handle = timers.add(std::chrono::seconds(1), std::chrono::seconds(1), garbage_collection_tick);
+	}
+}
+
+void cluster::stop_garbage_collection() {
+	gc_schedule& gc = garbage_collection_schedule();
+	std::lock_guard lock(gc.mutex);
+	auto iter = std::find(gc.clusters.begin(), gc.clusters.end(), this);
+	if (iter == gc.clusters.end()) {
+		return;
+	}
+	bool owner = iter == gc.clusters.begin();
+	gc.clusters.erase(iter);
+	if (!owner) {
+		return;
+	}
+	timers.cancel(gc.handle, false);
+	/* Hand the timer to the next started cluster, so collection carries on */
+	if (!gc.clusters.empty()) {
+		gc.handle = gc.clusters.front()->timers.add(std::chrono::seconds(1), std::chrono::seconds(1), garbage_collection_tick);
+	}
+}
+
 void cluster::shutdown() {
 	/* Signal condition variable to terminate */
 	terminating.notify_all();
+	stop_garbage_collection();
 	/* Free memory for active timers */
-	for (auto & t : timer_list) {
-		delete t.second;
-	}
-	timer_list.clear();
+	timers.clear();
 	/* Terminate shards */
 	for (const auto& sh : shards) {
 		log(ll_info, "Terminating shard id " + std::to_string(sh.second->shard_id));
 		delete sh.second;
 	}
 	shards.clear();
+	/* Shards have detached from the socket engines, so they can now be stopped */
+	socket_engines.clear();
+}
+
+socket_engine_base* cluster::get_socket_engine(uint32_t shard_id) {
+	if (socket_engines.empty()) {
+		return nullptr;
+	}
+	return socket_engines[(shard_id / maxclusters) % socket_engines.size()].get();
 }
 
 snowflake cluster::get_dm_channel(snowflake user_id) {
@@ -373,12 +491,27 @@ json error_response(const std::string& message, http_request_completion_t& rv)
 	return j;
 }
 
+/**
+ * @brief Interaction followups are sent to the application's own webhook. Give them the
+ * same priority as interaction responses, rather than that of any other webhook.
+ * @param req Request to set the priority of
+ * @param endpoint Endpoint, e.g. API_PATH "/webhooks"
+ * @param major_parameters Major parameters
+ * @param application_id Application ID
+ */
+static void set_followup_priority(http_request& req, const std::string& endpoint, const std::string& major_parameters, snowflake application_id)
+{
+	if (!application_id.empty() && endpoint == API_PATH "/webhooks" && major_parameters == std::to_string(application_id)) {
+		req.priority = hp_interaction;
+	}
+}
+
 void cluster::post_rest(const std::string &endpoint, const std::string &major_parameters, const std::string &parameters, http_method method, const std::string &postdata, json_encode_t callback, const std::string &filename, const std::string &filecontent, const std::string &filemimetype, const std::string &protocol) {
-	rest->post_request(std::make_unique<http_request>(endpoint + (!major_parameters.empty() ? "/" : "") + major_parameters, parameters, [endpoint, callback](http_request_completion_t rv) {
+	auto req = std::make_unique<http_request>(endpoint + (!major_parameters.empty() ? "/" : "") + major_parameters, parameters, [endpoint, callback](http_request_completion_t rv) {
 		json j;
 		if (rv.error == h_success && !rv.body.empty()) {
 			try {
-				j = json::parse(rv.body);
+				j = parse_json(rv.body);
 			}
 			catch (const std::exception &e) {
 				j = error_response(e.what(), rv);
@@ -387,7 +520,9 @@ void cluster::post_rest(const std::string &endpoint, const std::string &major_pa
 		if (callback) {
 			callback(j, rv);
 		}
-	}, postdata, method, get_audit_reason(), filename, filecontent, filemimetype, protocol));
+	}, postdata, method, get_audit_reason(), filename, filecontent, filemimetype, protocol);
+	set_followup_priority(*req, endpoint, major_parameters, me.id);
+	rest->post_request(std::move(req));
 }
 
 void cluster::post_rest_multipart(const std::string &endpoint, const std::string &major_parameters, const std::string &parameters, http_method method, const std::string &postdata, json_encode_t callback, const std::vector<message_file_data> &file_data) {
@@ -401,11 +536,11 @@ void cluster::post_rest_multipart(const std::string &endpoint, const std::string
 		file_mimetypes.push_back(data.mimetype);
 	}
 
-	rest->post_request(std::make_unique<http_request>(endpoint + (!major_parameters.empty() ? "/" : "") + major_parameters, parameters, [endpoint, callback](http_request_completion_t rv) {
+	auto req = std::make_unique<http_request>(endpoint + (!major_parameters.empty() ? "/" : "") + major_parameters, parameters, [endpoint, callback](http_request_completion_t rv) {
 		json j;
 		if (rv.error == h_success && !rv.body.empty()) {
 			try {
-				j = json::parse(rv.body);
+				j = parse_json(rv.body);
 			}
 			catch (const std::exception &e) {
 				j = error_response(e.what(), rv);
@@ -414,7 +549,9 @@ void cluster::post_rest_multipart(const std::string &endpoint, const std::string
 		if (callback) {
 			callback(j, rv);
 		}
-	}, postdata, method, get_audit_reason(), file_names, file_contents, file_mimetypes));
+	}, postdata, method, get_audit_reason(), file_names, file_contents, file_mimetypes);
+	set_followup_priority(*req, endpoint, major_parameters, me.id);
+	rest->post_request(std::move(req));
 }
 
 
@@ -448,7 +585,7 @@ void cluster::set_presence(const dpp::presence &p) {
 	json pres = p.to_json();
 	for (auto& s : shards) {
 		if (s.second->is_connected()) {
-			s.second->queue_message(s.second->jsonobj_to_string(pres));
+			s.second->queue_message(s.second->jsonobj_to_string(pres), false, "presence");
 		}
 	}
 }
@@ -20,6 +20,7 @@
  ************************************************************************************/
 #include <dpp/cluster.h>
 #include <dpp/json.h>
+#include <dpp/jsonparser.h>
 
 namespace dpp {
 
@@ -54,7 +55,7 @@ bool confirmation_callback_t::is_error() const {
 		return false;
 	}
 	try {
-		json j = json::parse(this->http_info.body);
+		json j = parse_json(this->http_info.body);
 		if (j.find("code") != j.end() && j.find("errors") != j.end() && j.find("message") != j.end()) {
 			if (j["code"].is_number_unsigned() && j["errors"].is_object() && j["message"].is_string()) {
 				return true;
@@ -122,7 +123,7 @@ std::vector<error_detail> find_errors_in_object(const std::string& obj, const st
 error_info confirmation_callback_t::get_error() const {
 	if (is_error()) {
 		try {
-			json j = json::parse(this->http_info.body);
+			json j = parse_json(this->http_info.body);
 			error_info e;
 
 			set_int32_not_null(&j, "code", e.code);
@@ -24,114 +24,39 @@
 
 namespace dpp {
 
-timer lasthandle = 1;
-std::mutex timer_guard;
-
 timer cluster::start_timer(timer_callback_t on_tick, uint64_t frequency, timer_callback_t on_stop) {
-	std::lock_guard<std::mutex> l(timer_guard);
-	timer_t* newtimer = new timer_t();
-
-	newtimer->handle = lasthandle++;
-	newtimer->next_tick = time(nullptr) + frequency;
-	newtimer->on_tick = on_tick;
-	newtimer->on_stop = on_stop;
-	newtimer->frequency = frequency;
-	timer_list[newtimer->handle] = newtimer;
-	next_timer.emplace(newtimer->next_tick, newtimer);
-
-	return newtimer->handle;
+	return timers.add(std::chrono::seconds(frequency), std::chrono::seconds(frequency), std::move(on_tick), std::move(on_stop));
 }
 
-bool cluster::stop_timer(timer t) {
-	std::lock_guard<std::mutex> l(timer_guard);
-
-	auto i = timer_list.find(t);
-	if (i != timer_list.end()) {
-		timer_t* tptr = i->second;
-		if (tptr->on_stop) {
-			/* If there is an on_stop event, call it */
-			tptr->on_stop(t);
-		}
-		timer_list.erase(i);
-		auto j = next_timer.find(tptr->next_tick);
-		if (j != next_timer.end()) {
-			next_timer.erase(j);
-		}
-		delete tptr;
-		return true;
-	}
-	return false;
+timer cluster::start_timer(timer_callback_t on_tick, std::chrono::milliseconds frequency, timer_callback_t on_stop) {
+	return timers.add(frequency, frequency, std::move(on_tick), std::move(on_stop));
 }
 
-void cluster::timer_reschedule(timer_t* t) {
-	std::lock_guard<std::mutex> l(timer_guard);
-	for (auto i = next_timer.begin(); i != next_timer.end(); ++i) {
-		/* Rescheduling the timer means finding it in the next tick map.
-		 * It should be pretty much near the start of the map so this loop
-		 * should only be at most a handful of iterations.
-		 */
-		if (i->second->handle == t->handle) {
-			next_timer.erase(i);
-			t->next_tick = time(nullptr) + t->frequency;
-			next_timer.emplace(t->next_tick, t);
-			break;
-		}
-	}
+bool cluster::stop_timer(timer t) {
+	return timers.cancel(t);
 }
 
-void cluster::tick_timers() {
-	std::vector<timer_t*> scheduled;
-	{
-		time_t now = time(nullptr);
-		std::lock_guard<std::mutex> l(timer_guard);
-		for (auto i = next_timer.begin(); i != next_timer.end(); ++i) {
-			if (now >= i->second->next_tick) {
-				scheduled.push_back(i->second);
-			} else {
-				/* The first time we encounter an entry which is not due,
-				 * we can bail out, because std::map is ordered storage so
-				 * we know at this point no more will match either.
-				 */
-				break;
-			}
-		}
-	}
-	for (auto & t : scheduled) {
-		timer handle = t->handle;
-		/* Call handler */
-		t->on_tick(t->handle);
-		/* Reschedule if it wasn't deleted.
-		 * Note: We wrap the .contains() check in a lambda as it needs locking
-		 * for thread safety, but timer_rescheudle also locks the container, so this
-		 * is the cleanest way to do it.
-		 */
-		bool not_deleted = ([handle, this]() -> bool {
-			std::lock_guard<std::mutex> l(timer_guard);
-			return timer_list.find(handle) != timer_list.end();
-		}());
-		if (not_deleted) {
-			timer_reschedule(t);
-		}
-	}
+timer_wheel& cluster::get_timer_wheel() {
+	return timers;
 }
 
 #ifdef DPP_CORO
 async<timer> cluster::co_sleep(uint64_t seconds) {
-	return async<timer>{[this, seconds] (auto &&cb) mutable {
-		start_timer([this, cb] (dpp::timer handle) {
+	return co_sleep(std::chrono::seconds(seconds));
+}
+
+async<timer> cluster::co_sleep(std::chrono::milliseconds duration) {
+	return async<timer>{[this, duration] (auto &&cb) mutable {
+		timers.add(duration, std::chrono::milliseconds(0), [cb] (dpp::timer handle) {
 			cb(handle);
-			stop_timer(handle);
-		}, seconds);
+		});
 	}};
 }
 #endif
 
 oneshot_timer::oneshot_timer(class cluster* cl, uint64_t duration, timer_callback_t callback) : owner(cl) {
-	/* Create timer */
-	th = cl->start_timer([callback, this](dpp::timer timer_handle) {
-		callback(this->get_handle());
-		this->owner->stop_timer(this->th);
-	}, duration);
+	/* Create timer, which the wheel removes once it has ticked */
+	th = cl->get_timer_wheel().add(std::chrono::seconds(duration), std::chrono::milliseconds(0), std::move(callback));
 }
 
 timer oneshot_timer::get_handle() {
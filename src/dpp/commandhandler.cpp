@@ -253,8 +253,12 @@ void commandhandler::route(const struct dpp::message_create_t& event)
 								dpp::resolved_user m;
 								m.user = *u;
 								dpp::guild* g = dpp::find_guild(event.msg.guild_id);
-								if (g->members.find(uid) != g->members.end()) {
-									m.member = g->members[uid];
+								if (g) {
+									std::shared_lock lock(g->get_mutex());
+									auto gm = g->members.find(uid);
+									if (gm != g->members.end()) {
+										m.member = gm->second;
+									}
 								}
 								param = m;
 							}
@@ -361,8 +365,12 @@ void commandhandler::route(const struct slashcommand_t & event)
 						dpp::resolved_user m;
 						m.user = *u;
 						dpp::guild* g = dpp::find_guild(event.command.guild_id);
-						if (g->members.find(uid) != g->members.end()) {
-							m.member = g->members[uid];
+						if (g) {
+							std::shared_lock lock(g->get_mutex());
+							auto gm = g->members.find(uid);
+							if (gm != g->members.end()) {
+								m.member = gm->second;
+							}
 						}
 						param = m;
 					} else {
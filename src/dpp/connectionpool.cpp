@@ -0,0 +1,169 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <dpp/connectionpool.h>
+
+namespace dpp {
+
+connection_pool_stats& connection_pool_stats::operator+=(const connection_pool_stats& other) {
+	hits += other.hits;
+	misses += other.misses;
+	handshakes += other.handshakes;
+	evictions += other.evictions;
+	idle += other.idle;
+	return *this;
+}
+
+connection_pool::connection_pool(uint32_t max_idle, time_t timeout, time_t age) : max_idle_per_host(max_idle), idle_timeout(timeout), max_age(age) {
+}
+
+bool connection_pool::expired(const pooled_connection& conn, time_t now) const {
+	return now - conn.last_used >= idle_timeout || (max_age > 0 && now - conn.created >= max_age) || !conn.is_alive();
+}
+
+std::string connection_pool::make_key(const std::string& hostname, const std::string& port, bool plaintext) {
+	return (!plaintext ? "ssl://" : "tcp://") + hostname + ":" + port;
+}
+
+std::unique_ptr<pooled_connection> connection_pool::acquire(const std::string& key) {
+	/* Connections closed here are destroyed outside the lock */
+	std::vector<std::unique_ptr<pooled_connection>> dead;
+	std::unique_ptr<pooled_connection> found;
+	{
+		std::lock_guard lock(pool_mutex);
+		auto iter = idle.find(key);
+		if (iter != idle.end()) {
+			time_t now = time(nullptr);
+			auto& conns = iter->second;
+			while (!conns.empty()) {
+				std::unique_ptr<pooled_connection> c = std::move(conns.back());
+				conns.pop_back();
+				if (!expired(*c, now)) {
+					found = std::move(c);
+					break;
+				}
+				dead.emplace_back(std::move(c));
+			}
+			if (conns.empty()) {
+				idle.erase(iter);
+			}
+		}
+	}
+	evictions += dead.size();
+	if (found) {
+		hits++;
+	} else {
+		misses++;
+	}
+	return found;
+}
+
+void connection_pool::release(const std::string& key, std::unique_ptr<pooled_connection> conn) {
+	std::unique_ptr<pooled_connection> evicted;
+	{
+		std::lock_guard lock(pool_mutex);
+		time_t now = time(nullptr);
+		if (max_idle_per_host == 0 || (max_age > 0 && now - conn->created >= max_age)) {
+			evicted = std::move(conn);
+		} else {
+			auto& conns = idle[key];
+			conn->last_used = now;
+			conns.emplace_back(std::move(conn));
+			if (conns.size() > max_idle_per_host) {
+				/* Least recently used is at the front */
+				evicted = std::move(conns.front());
+				conns.erase(conns.begin());
+			}
+		}
+	}
+	if (evicted) {
+		evictions++;
+	}
+}
+
+void connection_pool::count_handshake() {
+	handshakes++;
+}
+
+void connection_pool::prune() {
+	std::vector<std::unique_ptr<pooled_connection>> dead;
+	{
+		std::lock_guard lock(pool_mutex);
+		time_t now = time(nullptr);
+		for (auto iter = idle.begin(); iter != idle.end();) {
+			auto& conns = iter->second;
+			for (auto c = conns.begin(); c != conns.end();) {
+				if (expired(**c, now)) {
+					dead.emplace_back(std::move(*c));
+					c = conns.erase(c);
+				} else {
+					++c;
+				}
+			}
+			if (conns.empty()) {
+				iter = idle.erase(iter);
+			} else {
+				++iter;
+			}
+		}
+	}
+	evictions += dead.size();
+}
+
+void connection_pool::clear() {
+	std::unordered_map<std::string, std::vector<std::unique_ptr<pooled_connection>>> closing;
+	{
+		std::lock_guard lock(pool_mutex);
+		closing.swap(idle);
+	}
+}
+
+connection_pool& connection_pool::set_max_idle_per_host(uint32_t max_idle) {
+	max_idle_per_host = max_idle;
+	return *this;
+}
+
+connection_pool& connection_pool::set_idle_timeout(time_t timeout) {
+	idle_timeout = timeout;
+	return *this;
+}
+
+connection_pool& connection_pool::set_max_age(time_t age) {
+	max_age = age;
+	return *this;
+}
+
+connection_pool_stats connection_pool::get_stats() {
+	connection_pool_stats s;
+	s.hits = hits;
+	s.misses = misses;
+	s.handshakes = handshakes;
+	s.evictions = evictions;
+	{
+		std::lock_guard lock(pool_mutex);
+		for (const auto& [key, conns] : idle) {
+			s.idle += conns.size();
+		}
+	}
+	return s;
+}
+
+}
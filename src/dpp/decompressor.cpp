@@ -0,0 +1,59 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <dpp/decompressor.h>
+#include <algorithm>
+
+namespace dpp {
+
+size_t stream_decompressor::grow_arena(size_t compressed_size) {
+	const size_t room = std::max(min_arena_growth, compressed_size * 4);
+	if (arena.size() - arena_used < room) {
+		arena.resize(arena_used + room);
+	}
+	return arena.size() - arena_used;
+}
+
+void stream_decompressor::record(size_t compressed_size, size_t decompressed_size, bool complete, std::chrono::steady_clock::time_point start) {
+	bytes_in += compressed_size;
+	bytes_out += decompressed_size;
+	if (complete) {
+		messages++;
+	}
+	arena_size = arena.capacity();
+	decompress_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::string_view stream_decompressor::message() const {
+	return std::string_view(arena.data(), arena_used);
+}
+
+decompression_stats stream_decompressor::get_stats() const {
+	decompression_stats s;
+	s.bytes_in = bytes_in;
+	s.bytes_out = bytes_out;
+	s.messages = messages;
+	s.decompress_time = static_cast<double>(decompress_ns) / 1000000000.0;
+	s.arena_size = arena_size;
+	return s;
+}
+
+}
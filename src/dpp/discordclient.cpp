@@ -21,20 +21,24 @@
  ************************************************************************************/
 #include <string>
 #include <fstream>
+#include <algorithm>
 #include <dpp/exception.h>
 #include <dpp/discordclient.h>
 #include <dpp/cache.h>
 #include <dpp/cluster.h>
 #include <thread>
 #include <dpp/json.h>
+#include <dpp/jsonparser.h>
 #include <dpp/etf.h>
-#include <zlib.h>
+#include <dpp/zlibcontext.h>
+#include <dpp/zstdcontext.h>
 
 #define PATH_UNCOMPRESSED_JSON	"/?v=" DISCORD_API_VERSION "&encoding=json"
 #define PATH_COMPRESSED_JSON	"/?v=" DISCORD_API_VERSION "&encoding=json&compress=zlib-stream"
 #define PATH_UNCOMPRESSED_ETF	"/?v=" DISCORD_API_VERSION "&encoding=etf"
 #define PATH_COMPRESSED_ETF	"/?v=" DISCORD_API_VERSION "&encoding=etf&compress=zlib-stream"
-#define DECOMP_BUFFER_SIZE	512 * 1024
+#define PATH_ZSTD_JSON		"/?v=" DISCORD_API_VERSION "&encoding=json&compress=zstd-stream"
+#define PATH_ZSTD_ETF		"/?v=" DISCORD_API_VERSION "&encoding=etf&compress=zstd-stream"
 
 #define STRINGIFY(a) STRINGIFY_(a)
 #define STRINGIFY_(a) #a
@@ -46,31 +50,52 @@
 namespace dpp {
 
 /**
- * @brief This is an opaque class containing zlib library specific structures.
- * We define it this way so that the public facing D++ library doesn't require
- * the zlib headers be available to build against it.
+ * @brief Discord allows this many gateway sends per connection in each gateway_send_window
  */
-class zlibcontext {
-public:
-	/**
-	 * @brief Zlib stream struct
-	 */
-	z_stream d_stream;
-};
+static constexpr size_t gateway_send_limit = 120;
+
+/**
+ * @brief Length of the gateway send rate limit window, in seconds
+ */
+static constexpr double gateway_send_window = 60.0;
+
+/**
+ * @brief Sends in each window which queued messages may not use, so that heartbeats
+ * and a RESUME or IDENTIFY can always go out
+ */
+static constexpr size_t reserved_sends = 4;
 
 /**
- * @brief Stores the most recent ping message on this shard, which we check for to monitor latency
+ * @brief Coalesce key of queued heartbeats. Only the newest heartbeat is kept, and it
+ * may use the reserved sends.
  */
-thread_local static std::string last_ping_message;
+static constexpr const char* heartbeat_key = "heartbeat";
 
-discord_client::discord_client(dpp::cluster* _cluster, uint32_t _shard_id, uint32_t _max_shards, const std::string &_token, uint32_t _intents, bool comp, websocket_protocol_t ws_proto)
-       : websocket_client(_cluster->default_gateway, "443", comp ? (ws_proto == ws_json ? PATH_COMPRESSED_JSON : PATH_COMPRESSED_ETF) : (ws_proto == ws_json ? PATH_UNCOMPRESSED_JSON : PATH_UNCOMPRESSED_ETF)),
+/**
+ * @brief Get the gateway path for a protocol and compression
+ * @param compressed true if compression is enabled
+ * @param protocol JSON or ETF
+ * @param compression compression type, if compressed is true
+ * @return path and query string
+ */
+static const char* gateway_path(bool compressed, websocket_protocol_t protocol, websocket_compression_t compression) {
+	if (!compressed || compression == wsc_none) {
+		return protocol == ws_json ? PATH_UNCOMPRESSED_JSON : PATH_UNCOMPRESSED_ETF;
+	} else if (compression == wsc_zstd) {
+		return protocol == ws_json ? PATH_ZSTD_JSON : PATH_ZSTD_ETF;
+	}
+	return protocol == ws_json ? PATH_COMPRESSED_JSON : PATH_COMPRESSED_ETF;
+}
+
+discord_client::discord_client(dpp::cluster* _cluster, uint32_t _shard_id, uint32_t _max_shards, const std::string &_token, uint32_t _intents, bool comp, websocket_protocol_t ws_proto, websocket_compression_t ws_compression)
+       : websocket_client(_cluster->default_gateway, "443", gateway_path(comp, ws_proto, ws_compression), OP_BINARY, false),
         terminating(false),
-        runner(nullptr),
-	compressed(comp),
-	decomp_buffer(nullptr),
-	zlib(nullptr),
-	decompressed_total(0),
+	send_scheduled(false),
+	reconnect_at(0),
+	identify_pending(false),
+	compressed(comp && ws_compression != wsc_none),
+	compression(ws_compression),
+	decompressor(nullptr),
 	connect_time(0),
 	ping_start(0.0),
 	etf(nullptr),
@@ -91,33 +116,52 @@ discord_client::discord_client(dpp::cluster* _cluster, uint32_t _shard_id, uint3
 	resume_gateway_url(_cluster->default_gateway)	
 {
 	try {
-		zlib = new zlibcontext();
+		if (compressed) {
+			if (compression == wsc_zstd) {
+				decompressor = new zstdcontext();
+			} else {
+				decompressor = new zlibcontext();
+			}
+		}
 		etf = new etf_parser();
 	}
 	catch (std::bad_alloc&) {
-		delete zlib;
+		delete decompressor;
 		delete etf;
 		/* Clean up and rethrow to caller */
 		throw std::bad_alloc();
 	}
-	try {
-		this->connect();
-	}
-	catch (std::exception&) {
-		cleanup();
-		throw;
-	}
+	/* The connection is made asynchronously on the socket engine, from run() */
 }
 
 void discord_client::cleanup()
 {
-	terminating = true;
-	if (runner) {
-		runner->join();
-		delete runner;
+	{
+		/* Nothing else may be posted to the engine for this shard after this point */
+		std::unique_lock locker(queue_mutex);
+		terminating = true;
+	}
+	if (engine) {
+		/* Detach from the socket engine, then close gracefully from here
+		 * so that no engine callback can run against a half destroyed shard
+		 */
+		detach_engine();
+		if (this->sfd != INVALID_SOCKET) {
+			/* Send a graceful termination */
+			this->log(ll_debug, "Graceful shutdown of shard " + std::to_string(this->shard_id) + " succeeded.");
+			this->nonblocking = false;
+			try {
+				this->send_close_packet();
+			}
+			catch (const std::exception&) {
+			}
+			ssl_client::close();
+		} else {
+			this->log(ll_debug, "Graceful shutdown of shard " + std::to_string(this->shard_id) + " not possible, socket already closed.");
+		}
 	}
 	delete etf;
-	delete zlib;
+	delete decompressor;
 }
 
 discord_client::~discord_client()
@@ -127,141 +171,145 @@ discord_client::~discord_client()
 
 uint64_t discord_client::get_decompressed_bytes_in()
 {
-	return decompressed_total;
+	return decompressor ? decompressor->get_stats().bytes_out : 0;
 }
 
-void discord_client::setup_zlib()
+decompression_stats discord_client::get_decompression_stats()
 {
-	if (compressed) {
-		zlib->d_stream.zalloc = (alloc_func)0;
-		zlib->d_stream.zfree = (free_func)0;
-		zlib->d_stream.opaque = (voidpf)0;
-		int error = inflateInit(&(zlib->d_stream));
-		if (error != Z_OK) {
-			throw dpp::connection_exception((exception_error_code)error, "Can't initialise stream compression!");
-		}
-		this->decomp_buffer = new unsigned char[DECOMP_BUFFER_SIZE];
-	}
+	return decompressor ? decompressor->get_stats() : decompression_stats{};
+}
 
+void discord_client::set_resume_hostname()
+{
+	hostname = resume_gateway_url;
 }
 
-void discord_client::end_zlib()
+void discord_client::on_disconnect()
 {
-	if (compressed) {
-		inflateEnd(&(zlib->d_stream));
-		delete[] this->decomp_buffer;
-		this->decomp_buffer = nullptr;
+	if (terminating) {
+		return;
+	}
+	ready = false;
+	identify_pending = false;
+	clear_queue();
+	{
+		/* The rate limit is per connection */
+		std::unique_lock locker(queue_mutex);
+		send_times.clear();
+	}
+	ssl_client::close();
+	if (decompressor) {
+		/* A new connection is a new compression stream */
+		decompressor->reset();
 	}
+	/* Attempt reconnection on the next tick of the socket engine */
+	reconnect_at = time(nullptr);
 }
 
-void discord_client::set_resume_hostname()
+void discord_client::reconnect()
 {
-	hostname = resume_gateway_url;
+	this->log(ll_debug, "Attempting reconnection of shard " + std::to_string(this->shard_id) + " to wss://" + resume_gateway_url);
+	set_resume_hostname();
+	connect_gateway(engine);
 }
 
-void discord_client::thread_run()
+void discord_client::connect_gateway(socket_engine_base* e)
 {
-	utility::set_thread_name(std::string("shard/") + std::to_string(shard_id));
-	setup_zlib();
-	do {
-		bool error = false;
-		ready = false;
-		message_queue.clear();
-		ssl_client::read_loop();
-		if (!terminating) {
+	/* Push the next retry out while this attempt is in progress */
+	reconnect_at = time(nullptr) + 5;
+	connect_async(e, [this](bool success, const std::string& error) {
+		if (!success) {
+			log(dpp::ll_error, "Error establishing connection, retry in 5 seconds: " + error);
+			reconnect_at = time(nullptr) + 5;
+			return;
+		}
+		this->log(ll_debug, "Shard " + std::to_string(this->shard_id) + " TLS handshake took " + std::to_string(get_handshake_time() * 1000.0) + "ms" + (is_session_resumed() ? " (session resumed)" : ""));
+		try {
+			/* Send the upgrade request, the reply arrives via handle_buffer() */
+			websocket_client::connect();
+		}
+		catch (const std::exception &ex) {
+			log(dpp::ll_error, std::string("Error establishing connection, retry in 5 seconds: ") + ex.what());
 			ssl_client::close();
-			end_zlib();
-			setup_zlib();
-			do {
-				this->log(ll_debug, "Attempting reconnection of shard " + std::to_string(this->shard_id) + " to wss://" + resume_gateway_url);
-				error = false;
-				try {
-					set_resume_hostname();
-					ssl_client::connect();
-					websocket_client::connect();
-				}
-				catch (const std::exception &e) {
-					log(dpp::ll_error, std::string("Error establishing connection, retry in 5 seconds: ") + e.what());
-					ssl_client::close();
-					std::this_thread::sleep_for(std::chrono::seconds(5));
-					error = true;
-				}
-			} while (error);
+			reconnect_at = time(nullptr) + 5;
 		}
-	} while(!terminating);
-	if (this->sfd != INVALID_SOCKET) {
-		/* Send a graceful termination */
-		this->log(ll_debug, "Graceful shutdown of shard " + std::to_string(this->shard_id) + " succeeded.");
-		this->nonblocking = false;
-		this->send_close_packet();
-		ssl_client::close();
-	} else {
-		this->log(ll_debug, "Graceful shutdown of shard " + std::to_string(this->shard_id) + " not possible, socket already closed.");
-	}
-	end_zlib();
+	});
 }
 
 void discord_client::run()
 {
-	this->runner = new std::thread(&discord_client::thread_run, this);
-	this->thread_id = runner->native_handle();
+	socket_engine_base* e = creator->get_socket_engine(shard_id);
+	if (e == nullptr) {
+		throw dpp::logic_exception("Shards can only be run on a started cluster");
+	}
+	if (decompressor) {
+		decompressor->reset();
+	}
+	ready = false;
+	clear_queue();
+	{
+		std::unique_lock locker(queue_mutex);
+		send_times.clear();
+	}
+	connect_gateway(e);
+	this->thread_id = engine->native_handle();
+}
+
+void discord_client::try_identify()
+{
+	if (time(nullptr) < creator->last_identify + 5) {
+		/* Another shard identified too recently, one_second_timer() will retry */
+		identify_pending = true;
+		return;
+	}
+	identify_pending = false;
+	log(dpp::ll_debug, "Connecting new session...");
+	json obj = {
+		{ "op", 2 },
+		{
+			"d",
+			{
+				{ "token", this->token },
+				{ "properties",
+					{
+						{ "os", STRINGIFY(DPP_OS) },
+						{ "browser", "D++" },
+						{ "device", "D++" }
+					}
+				},
+				{ "shard", json::array({ shard_id, max_shards }) },
+				{ "compress", false },
+				{ "large_threshold", 250 },
+				{ "intents", this->intents }
+			}
+		}
+	};
+	send_immediate(jsonobj_to_string(obj));
+	this->connect_time = creator->last_identify = time(nullptr);
+	reconnects++;
 }
 
-bool discord_client::handle_frame(const std::string &buffer, ws_opcode opcode)
+bool discord_client::handle_frame(std::string_view buffer, ws_opcode opcode)
 {
-	std::string& data = (std::string&)buffer;
+	std::string_view data = buffer;
 
-	/* gzip compression is a special case */
+	/* Compressed frames are inflated into the shard's arena, and parsed from there */
 	if (compressed) {
-		/* Check that we have a complete compressed frame */
-		if ((uint8_t)buffer[buffer.size() - 4] == 0x00 && (uint8_t)buffer[buffer.size() - 3] == 0x00 && (uint8_t)buffer[buffer.size() - 2] == 0xFF
-		&& (uint8_t)buffer[buffer.size() - 1] == 0xFF) {
-			/* Decompress buffer */
-			decompressed.clear();
-			zlib->d_stream.next_in = (Bytef *)buffer.c_str();
-			zlib->d_stream.avail_in = (uInt)buffer.size();
-			do {
-				int have = 0;
-				zlib->d_stream.next_out = (Bytef*)decomp_buffer;
-				zlib->d_stream.avail_out = DECOMP_BUFFER_SIZE;
-				int ret = inflate(&(zlib->d_stream), Z_NO_FLUSH);
-				have = DECOMP_BUFFER_SIZE - zlib->d_stream.avail_out;
-				switch (ret)
-				{
-					case Z_NEED_DICT:
-					case Z_STREAM_ERROR:
-						this->error(err_compression_stream);
-						this->close();
-						return true;
-					break;
-					case Z_DATA_ERROR:
-						this->error(err_compression_data);
-						this->close();
-						return true;
-					break;
-					case Z_MEM_ERROR:
-						this->error(err_compression_memory);
-						this->close();
-						return true;
-					break;
-					case Z_OK:
-						this->decompressed.append((const char*)decomp_buffer, have);
-						this->decompressed_total += have;
-					break;
-					default:
-						/* Stub */
-					break;
-				}
-			} while (zlib->d_stream.avail_out == 0);
-			data = decompressed;
-		} else {
-			/* No complete compressed frame yet */
-			return false;
+		try {
+			if (!decompressor->feed(buffer)) {
+				/* No complete message yet, the rest of it is in the following frames */
+				return false;
+			}
 		}
+		catch (const dpp::connection_exception& e) {
+			this->error(e.code());
+			throw;
+		}
+		data = decompressor->message();
 	}
 
-
 	json j;
+	std::string_view etf_data;
 	
 	/**
 	 * This section parses the input frames from the websocket after they're decompressed.
@@ -273,16 +321,31 @@ bool discord_client::handle_frame(const std::string &buffer, ws_opcode opcode)
 	switch (protocol) {
 		case ws_json:
 			try {
-				j = json::parse(data);
+				j = parse_json(data);
 			}
 			catch (const std::exception &e) {
-				log(dpp::ll_error, "discord_client::handle_frame(JSON): " + std::string(e.what()) + " [" + data + "]");
+				log(dpp::ll_error, "discord_client::handle_frame(JSON): " + std::string(e.what()) + " [" + std::string(data) + "]");
 				return true;
 			}
 		break;
 		case ws_etf:
 			try {
-				j = etf->parse(data);
+				/* Only the envelope is decoded here. Dispatch event data is left undecoded for
+				 * handle_event(), as the hottest events are read directly from the ETF.
+				 */
+				etf_reader envelope(data);
+				envelope.read_map([&](std::string_view key) {
+					if (key == "d") {
+						etf_data = envelope.read_term();
+					} else {
+						j[std::string(key)] = envelope.read_json();
+					}
+				});
+				auto op = j.find("op");
+				if (!etf_data.empty() && (op == j.end() || !op->is_number() || op->get<uint32_t>() != 0)) {
+					j["d"] = etf->parse_term(etf_data);
+					etf_data = {};
+				}
 			}
 			catch (const std::exception &e) {
 				log(dpp::ll_error, "discord_client::handle_frame(ETF): " + std::string(e.what()) + " len=" + std::to_string(data.size()) + "\n" + dpp::utility::debug_dump((uint8_t*)data.data(), data.size()));
@@ -327,50 +390,24 @@ bool discord_client::handle_frame(const std::string &buffer, ws_opcode opcode)
 							}
 						}
 					};
-					this->write(jsonobj_to_string(obj), protocol == ws_etf ? OP_BINARY : OP_TEXT);
+					send_immediate(jsonobj_to_string(obj));
 					resumes++;
 				} else {
 					/* Full connect */
-					while (time(nullptr) < creator->last_identify + 5) {
-						time_t wait = (creator->last_identify + 5) - time(nullptr);
-						std::this_thread::sleep_for(std::chrono::seconds(wait));
-					}
-					log(dpp::ll_debug, "Connecting new session...");
-					json obj = {
-						{ "op", 2 },
-						{
-							"d",
-							{
-								{ "token", this->token },
-								{ "properties",
-									{
-										{ "os", STRINGIFY(DPP_OS) },
-										{ "browser", "D++" },
-										{ "device", "D++" }
-									}
-								},
-								{ "shard", json::array({ shard_id, max_shards }) },
-								{ "compress", false },
-								{ "large_threshold", 250 },
-								{ "intents", this->intents }
-							}
-						}
-					};
-					this->write(jsonobj_to_string(obj), protocol == ws_etf ? OP_BINARY : OP_TEXT);
-					this->connect_time = creator->last_identify = time(nullptr);
-					reconnects++;
+					try_identify();
 				}
 				this->last_heartbeat_ack = time(nullptr);
 				websocket_ping = 0;
 			break;
 			case 0: {
 				std::string event = j["t"];
-				handle_event(event, j, data);
+				/* Events keep a copy of their raw frame */
+				handle_event(event, j, std::string(data), etf_data);
 			}
 			break;
 			case 7:
 				log(dpp::ll_debug, "Reconnection requested, closing socket " + sessionid);
-				message_queue.clear();
+				clear_queue();
 				throw dpp::connection_exception(err_reconnection, "Remote site requested reconnection");
 			break;
 			/* Heartbeat ack */
@@ -455,14 +492,85 @@ void discord_client::log(dpp::loglevel severity, const std::string &msg) const
 	}
 }
 
-void discord_client::queue_message(const std::string &j, bool to_front)
+void discord_client::queue_message(const std::string &j, bool to_front, const std::string &coalesce_key)
 {
 	std::unique_lock locker(queue_mutex);
-	if (to_front) {
-		message_queue.emplace_front(j);
+	auto queued = message_queue.end();
+	if (!coalesce_key.empty()) {
+		queued = std::find_if(message_queue.begin(), message_queue.end(), [&coalesce_key](const queued_gateway_message& m) {
+			return m.coalesce_key == coalesce_key;
+		});
+	}
+	if (queued != message_queue.end()) {
+		/* Still waiting to be sent, so only the newest of the two needs to go */
+		queued->payload = j;
+	} else if (to_front) {
+		message_queue.push_front({j, coalesce_key});
 	} else {
-		message_queue.emplace_back(j);
+		message_queue.push_back({j, coalesce_key});
+	}
+	/* Send now if the rate limit allows, rather than on the next tick. This is posted while
+	 * holding the lock so that cleanup() cannot detach from the engine before it runs.
+	 */
+	if (engine && !terminating && !send_scheduled && is_connected()) {
+		send_scheduled = true;
+		engine->post([this]() {
+			send_queued();
+		});
+	}
+}
+
+size_t discord_client::sends_remaining(double now)
+{
+	while (!send_times.empty() && send_times.front() <= now - gateway_send_window) {
+		send_times.pop_front();
 	}
+	return send_times.size() < gateway_send_limit ? gateway_send_limit - send_times.size() : 0;
+}
+
+void discord_client::send_queued()
+{
+	std::vector<queued_gateway_message> sending;
+	{
+		std::unique_lock locker(queue_mutex);
+		send_scheduled = false;
+		if (terminating || !is_connected()) {
+			return;
+		}
+		double now = utility::time_f();
+		size_t remaining = sends_remaining(now);
+		/* A heartbeat goes first even if something else was pushed in front of it */
+		auto heartbeat = std::find_if(message_queue.begin(), message_queue.end(), [](const queued_gateway_message& m) {
+			return m.coalesce_key == heartbeat_key;
+		});
+		if (heartbeat != message_queue.end() && remaining > 0) {
+			sending.emplace_back(std::move(*heartbeat));
+			message_queue.erase(heartbeat);
+			send_times.push_back(now);
+			remaining--;
+		}
+		while (!message_queue.empty() && remaining > reserved_sends) {
+			sending.emplace_back(std::move(message_queue.front()));
+			message_queue.pop_front();
+			send_times.push_back(now);
+			remaining--;
+		}
+	}
+	for (const queued_gateway_message& m : sending) {
+		if (m.coalesce_key == heartbeat_key) {
+			ping_start = utility::time_f();
+		}
+		this->write(m.payload, protocol == ws_etf ? OP_BINARY : OP_TEXT);
+	}
+}
+
+void discord_client::send_immediate(const std::string& payload)
+{
+	{
+		std::unique_lock locker(queue_mutex);
+		send_times.push_back(utility::time_f());
+	}
+	this->write(payload, protocol == ws_etf ? OP_BINARY : OP_TEXT);
 }
 
 discord_client& discord_client::clear_queue()
@@ -478,29 +586,31 @@ size_t discord_client::get_queue_size()
 	return message_queue.size();
 }
 
+size_t discord_client::get_send_budget()
+{
+	std::unique_lock locker(queue_mutex);
+	size_t remaining = sends_remaining(utility::time_f());
+	return remaining > reserved_sends ? remaining - reserved_sends : 0;
+}
+
 void discord_client::one_second_timer()
 {
 	if (terminating) {
 		throw dpp::exception("Shard terminating due to cluster shutdown");
 	}
 
+	if (this->sfd == INVALID_SOCKET) {
+		/* Disconnected, waiting to reconnect */
+		if (time(nullptr) >= reconnect_at) {
+			reconnect();
+		}
+		return;
+	}
+
 	websocket_client::one_second_timer();
 
-	/* Every minute, rehash all containers from first shard.
-	 * We can't just get shard with the id 0 because this won't
-	 * work on a clustered environment
-	 */
-	auto shards = creator->get_shards();
-	auto first_iter = shards.begin();
-	if (first_iter != shards.end()) {
-		dpp::discord_client* first_shard = first_iter->second;
-		if (first_shard == this) {
-			creator->tick_timers();
-
-			if ((time(nullptr) % 60) == 0) {
-				dpp::garbage_collection();
-			}
-		}
+	if (identify_pending) {
+		try_identify();
 	}
 
 	/* This all only triggers if we are connected (have completed websocket, and received READY or RESUMED) */
@@ -512,27 +622,7 @@ void discord_client::one_second_timer()
 		 */
 		if ((time(nullptr) - this->last_heartbeat_ack) > heartbeat_interval * 2) {
 			log(dpp::ll_warning, "Missed heartbeat ACK, forcing reconnection to session " + sessionid);
-			message_queue.clear();
-			close_socket(sfd);
-			return;
-		}
-
-		/* Rate limit outbound messages, 1 every odd second, 2 every even second */
-		for (int x = 0; x < (time(nullptr) % 2) + 1; ++x) {
-			std::unique_lock locker(queue_mutex);
-			if (message_queue.size()) {
-				std::string message = message_queue.front();
-				message_queue.pop_front();
-				/* Checking here with .find() saves us having to deserialise the json
-				 * to find pings in our queue. The assumption is that the format of the
-				 * ping isn't going to change.
-				 */
-				if (!last_ping_message.empty() && message == last_ping_message) {
-					ping_start = utility::time_f();
-					last_ping_message.clear();
-				}
-				this->write(message, protocol == ws_etf ? OP_BINARY : OP_TEXT);
-			}
+			throw dpp::connection_exception(err_reconnection, "Missed heartbeat ACK");
 		}
 
 		/* Send pings (heartbeat opcodes) before each interval. We send them slightly more regular than expected,
@@ -541,11 +631,13 @@ void discord_client::one_second_timer()
 		if (this->heartbeat_interval && this->last_seq) {
 			/* Check if we're due to emit a heartbeat */
 			if (time(nullptr) > last_heartbeat + ((heartbeat_interval / 1000.0) * 0.75)) {
-				last_ping_message = jsonobj_to_string(json({{"op", 1}, {"d", last_seq}}));
-				queue_message(last_ping_message, true);
+				queue_message(jsonobj_to_string(json({{"op", 1}, {"d", last_seq}})), true, heartbeat_key);
 				last_heartbeat = time(nullptr);
 			}
 		}
+
+		/* Send whatever the gateway rate limit window has room for */
+		send_queued();
 	}
 }
 
@@ -554,7 +646,7 @@ uint64_t discord_client::get_guild_count() {
 	dpp::cache<guild>* c = dpp::get_guild_cache();
 	/* IMPORTANT: We must lock the container to iterate it */
 	std::shared_lock l(c->get_mutex());
-	std::unordered_map<snowflake, guild*>& gc = c->get_container();
+	auto& gc = c->get_container();
 	for (auto g = gc.begin(); g != gc.end(); ++g) {
 		dpp::guild* gp = (dpp::guild*)g->second;
 		if (gp->shard_id == this->shard_id) {
@@ -569,12 +661,13 @@ uint64_t discord_client::get_member_count() {
 	dpp::cache<guild>* c = dpp::get_guild_cache();
 	/* IMPORTANT: We must lock the container to iterate it */
 	std::shared_lock l(c->get_mutex());
-	std::unordered_map<snowflake, guild*>& gc = c->get_container();
+	auto& gc = c->get_container();
 	for (auto g = gc.begin(); g != gc.end(); ++g) {
 		dpp::guild* gp = (dpp::guild*)g->second;
 		if (gp->shard_id == this->shard_id) {
 			if (creator->cache_policy.user_policy == dpp::cp_aggressive) {
 				/* We can use actual member count if we are using full user caching */
+				std::shared_lock guild_lock(gp->get_mutex());
 				total += gp->members.size();
 			} else {
 				/* Otherwise we use approximate guild member counts from guild_create */
@@ -590,10 +683,11 @@ uint64_t discord_client::get_channel_count() {
 	dpp::cache<guild>* c = dpp::get_guild_cache();
 	/* IMPORTANT: We must lock the container to iterate it */
 	std::shared_lock l(c->get_mutex());
-	std::unordered_map<snowflake, guild*>& gc = c->get_container();
+	auto& gc = c->get_container();
 	for (auto g = gc.begin(); g != gc.end(); ++g) {
 		dpp::guild* gp = (dpp::guild*)g->second;
 		if (gp->shard_id == this->shard_id) {
+			std::shared_lock guild_lock(gp->get_mutex());
 			total += gp->channels.size();
 		}
 	}
@@ -623,7 +717,7 @@ discord_client& discord_client::connect_voice(snowflake guild_id, snowflake chan
 				{ "self_deaf", self_deaf },
 			}
 		}
-	})), false);
+	})), false, "voice:" + std::to_string(guild_id));
 #endif
 	return *this;
 }
@@ -652,7 +746,7 @@ void discord_client::disconnect_voice_internal(snowflake guild_id, bool emit_jso
 						{ "self_deaf", false },
 					}
 				}
-			})), false);
+			})), false, "voice:" + std::to_string(guild_id));
 		}
 		connecting_voice_channels.erase(v);
 	}
@@ -701,19 +795,16 @@ voiceconn::~voiceconn() {
 
 voiceconn& voiceconn::connect(snowflake guild_id) {
 	if (this->is_ready() && !this->is_active()) {
-		/* This is wrapped in a thread because instantiating discord_voice_client can initiate a blocking SSL_connect() */
-		auto t = std::thread([guild_id, this]() {
-			try {
-				this->creator->log(ll_debug, "Connecting voice for guild " + std::to_string(guild_id) + " channel " + std::to_string(this->channel_id));
-				this->voiceclient = new discord_voice_client(creator->creator, this->channel_id, guild_id, this->token, this->session_id, this->websocket_hostname, this->dave);
-				/* Note: Spawns thread! */
-				this->voiceclient->run();
-			}
-			catch (std::exception &e) {
-				this->creator->log(ll_debug, "Can't connect to voice websocket (guild_id: " + std::to_string(guild_id) + ", channel_id: " + std::to_string(this->channel_id) + ": " + std::string(e.what()));
-			}
-		});
-		t.detach();
+		try {
+			this->creator->log(ll_debug, "Connecting voice for guild " + std::to_string(guild_id) + " channel " + std::to_string(this->channel_id));
+			/* Does not block: the voice websocket is connected from the voice client's own thread */
+			this->voiceclient = new discord_voice_client(creator->creator, this->channel_id, guild_id, this->token, this->session_id, this->websocket_hostname, this->dave);
+			/* Note: Spawns thread! */
+			this->voiceclient->run();
+		}
+		catch (std::exception &e) {
+			this->creator->log(ll_debug, "Can't connect to voice websocket (guild_id: " + std::to_string(guild_id) + ", channel_id: " + std::to_string(this->channel_id) + ": " + std::string(e.what()));
+		}
 	}
 	return *this;
 }
@@ -36,8 +36,10 @@
 #include <dpp/discordevents.h>
 #include <dpp/discordclient.h>
 #include <dpp/json.h>
+#include <dpp/etf.h>
 #include <iomanip>
 #include <sstream>
+#include <algorithm>
 
 char* crossplatform_strptime(const char* s, const char* f, struct tm* tm) {
 	std::istringstream input(s);
@@ -266,69 +268,43 @@ std::string base64_encode(unsigned char const* buf, unsigned int buffer_length)
 	return ret;
 }
 
-time_t ts_not_null(const json* j, const char* keyname)
+time_t ts_from_string(std::string_view timedate)
 {
 	/* Parses discord ISO 8061 timestamps to time_t, accounting for local time adjustment.
 	 * Note that discord timestamps contain a decimal seconds part, which time_t and struct tm
 	 * can't handle. We strip these out.
 	 */
 	time_t retval = 0;
-	if (j->contains(keyname) && !(*j)[keyname].is_null() && (*j)[keyname].is_string()) {
-		tm timestamp = {};
-		std::string timedate = (*j)[keyname].get<std::string>();
-		if (timedate.find('+') != std::string::npos) {
-			if (timedate.find('.') != std::string::npos) {
-				timedate = timedate.substr(0, timedate.find('.'));
-			}
-			crossplatform_strptime(timedate.substr(0, 19).c_str(), "%Y-%m-%dT%T", &timestamp);
-			timestamp.tm_isdst = 0;
-			#ifndef _WIN32
-				retval = timegm(&timestamp);
-			#else
-				retval = _mkgmtime(&timestamp);
-			#endif
-		} else {
-			crossplatform_strptime(timedate.substr(0, 19).c_str(), "%Y-%m-%d %T", &timestamp);
-			#ifndef _WIN32
-				retval = timegm(&timestamp);
-			#else
-				retval = _mkgmtime(&timestamp);
-			#endif
-		}
+	tm timestamp = {};
+	std::string seconds(timedate.substr(0, std::min(timedate.find('.'), static_cast<size_t>(19))));
+	if (timedate.find('+') != std::string_view::npos) {
+		crossplatform_strptime(seconds.c_str(), "%Y-%m-%dT%T", &timestamp);
+		timestamp.tm_isdst = 0;
+	} else {
+		crossplatform_strptime(seconds.c_str(), "%Y-%m-%d %T", &timestamp);
 	}
+	#ifndef _WIN32
+		retval = timegm(&timestamp);
+	#else
+		retval = _mkgmtime(&timestamp);
+	#endif
 	return retval;
 }
 
+time_t ts_not_null(const json* j, const char* keyname)
+{
+	auto k = j->find(keyname);
+	if (k != j->end() && k->is_string()) {
+		return ts_from_string(k->get_ref<const std::string&>());
+	}
+	return 0;
+}
+
 void set_ts_not_null(const json* j, const char* keyname, time_t &v)
 {
-	/* Parses discord ISO 8061 timestamps to time_t, accounting for local time adjustment.
-	 * Note that discord timestamps contain a decimal seconds part, which time_t and struct tm
-	 * can't handle. We strip these out.
-	 */
-	if (j->contains(keyname) && !(*j)[keyname].is_null() && (*j)[keyname].is_string()) {
-		time_t retval = 0;
-		tm timestamp = {};
-		std::string timedate = (*j)[keyname].get<std::string>();
-		if (timedate.find('+') != std::string::npos) {
-			if (timedate.find('.') != std::string::npos) {
-				timedate = timedate.substr(0, timedate.find('.'));
-			}
-			crossplatform_strptime(timedate.substr(0, 19).c_str(), "%Y-%m-%dT%T", &timestamp);
-			timestamp.tm_isdst = 0;
-			#ifndef _WIN32
-				retval = timegm(&timestamp);
-			#else
-				retval = _mkgmtime(&timestamp);
-			#endif
-		} else {
-			crossplatform_strptime(timedate.substr(0, 19).c_str(), "%Y-%m-%d %T", &timestamp);
-			#ifndef _WIN32
-				retval = timegm(&timestamp);
-			#else
-				retval = _mkgmtime(&timestamp);
-			#endif
-		}
-		v = retval;
+	auto k = j->find(keyname);
+	if (k != j->end() && k->is_string()) {
+		v = ts_from_string(k->get_ref<const std::string&>());
 	}
 }
 
@@ -419,9 +395,25 @@ static const std::map<std::string, dpp::events::event*> event_map = {
 	{ "ENTITLEMENT_DELETE", make_static_event<dpp::events::entitlement_delete>() },
 };
 
-void discord_client::handle_event(const std::string &event, json &j, const std::string &raw)
+void discord_client::handle_event(const std::string &event, json &j, const std::string &raw, std::string_view etf_data)
 {
 	auto ev_iter = event_map.find(event);
+	if (!etf_data.empty()) {
+		/* Let the handler read the ETF in place if it can, otherwise decode it for handle() */
+		if (ev_iter != event_map.end() && ev_iter->second != nullptr) {
+			etf_reader d(etf_data, false);
+			if (ev_iter->second->handle_etf(this, d, raw)) {
+				return;
+			}
+		}
+		try {
+			j["d"] = etf->parse_term(etf_data);
+		}
+		catch (const std::exception &e) {
+			log(dpp::ll_error, "discord_client::handle_event(ETF): " + std::string(e.what()) + " event=" + event);
+			return;
+		}
+	}
 	if (ev_iter != event_map.end()) {
 		/* A handler with nullptr is silently ignored. We don't plan to make a handler for it
 		 * so this usually some user-only thing that's crept into the API and shown to bots
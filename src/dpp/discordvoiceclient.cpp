@@ -81,7 +81,7 @@ uint16_t dave_binary_header_t::get_transition_id() const {
 	return transition_id;
 }
 
-dave_binary_header_t::dave_binary_header_t(const std::string& buffer) {
+dave_binary_header_t::dave_binary_header_t(std::string_view buffer) {
 	if (buffer.length() < 5) {
 		throw dpp::length_exception("DAVE binary buffer too short (<5)");
 	}
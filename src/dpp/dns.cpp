@@ -25,7 +25,13 @@
 #include <cstring>
 #include <mutex>
 #include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <atomic>
+#include <algorithm>
 #include <dpp/exception.h>
+#include <dpp/utility.h>
 
 namespace dpp
 {
@@ -38,12 +44,32 @@ namespace dpp
 	/* Cache container */
 	dns_cache_t dns_cache;
 
+	/* Replacement resolver set via set_dns_resolver(), guarded by dns_cache_mutex */
+	dns_resolver_t custom_resolver;
+
+	/* Lifetime of cache entries */
+	std::atomic<time_t> dns_ttl{one_hour};
+
+sockaddr_storage dns_address::with_port(uint16_t port) const {
+	sockaddr_storage out = address;
+	if (family == AF_INET6) {
+		reinterpret_cast<sockaddr_in6*>(&out)->sin6_port = htons(port);
+	} else {
+		reinterpret_cast<sockaddr_in*>(&out)->sin_port = htons(port);
+	}
+	return out;
+}
+
+socket dns_address::make_connecting_socket() const {
+	return ::socket(family, socktype, protocol);
+}
+
 /**
 * @brief Get address length
 * @return address length
 */
 int dns_cache_entry::size() const {
-	return static_cast<int>(addr.ai_addrlen);
+	return addresses.empty() ? 0 : static_cast<int>(addresses.front().length);
 }
 
 const address_t dns_cache_entry::get_connecting_address(uint16_t port) const {
@@ -54,50 +80,20 @@ socket dns_cache_entry::make_connecting_socket() const {
 	return ::socket(addr.ai_family, addr.ai_socktype, addr.ai_protocol);
 }
 
-const dns_cache_entry* resolve_hostname(const std::string& hostname, const std::string& port)
-{
-	addrinfo hints, *addrs;
-	dns_cache_t::const_iterator iter;
-	time_t now = time(nullptr);
-	int error;
-	bool exists = false;
-
-	/* Thread safety scope */
-	{
-		/* Check cache for existing DNS record. This can use a shared lock. */
-		std::shared_lock dns_cache_lock(dns_cache_mutex);
-		iter = dns_cache.find(hostname);
-		if (iter != dns_cache.end()) {
-			exists = true;
-			if (now < iter->second->expire_timestamp) {
-				/* there is a cached entry that is still valid, return it */
-				return iter->second;
-			}
-		}
-	}
-	if (exists) {
-		/* there is a cached entry, but it has expired,
-		 * delete and free it, and fall through to a new lookup.
-		 * We must use a unique lock here as we modify the cache.
-		 */
-		std::unique_lock dns_cache_lock(dns_cache_mutex);
-		iter = dns_cache.find(hostname);
-		if (iter != dns_cache.end()) { /* re-validate iter */
-			delete iter->second;
-			dns_cache.erase(iter);
-		}
-	}
-
-	/* The hints indicate what sort of DNS results we are interested in.
-	 * To change this to support IPv6, one change we need to make here is
-	 * to change AF_INET to AF_UNSPEC. Everything else should just work fine.
-	 */
-	memset(&hints, 0, sizeof(addrinfo));
-	hints.ai_family = AF_INET; // IPv6 explicitly unsupported by Discord
+/**
+ * @brief Resolve a hostname via getaddrinfo()
+ * @param hostname Hostname to resolve
+ * @param port A port number or named service
+ * @return All IPv4 and IPv6 addresses, IPv4 first
+ * @throw dpp::connection_exception On failure to resolve hostname
+ */
+static std::vector<dns_address> system_resolver(const std::string& hostname, const std::string& port) {
+	addrinfo hints{}, *addrs = nullptr;
+	hints.ai_family = AF_UNSPEC;
 	hints.ai_socktype = SOCK_STREAM;
 	hints.ai_protocol = IPPROTO_TCP;
 
-	if ((error = getaddrinfo(hostname.c_str(), port.c_str(), &hints, &addrs))) {
+	if (int error = getaddrinfo(hostname.c_str(), port.c_str(), &hints, &addrs)) {
 		/**
 		 * The -20 makes sure the error codes dont conflict with codes given in the rest of the list
 		 * Because C libraries love to use -1 and below directly as conflicting error codes.
@@ -105,35 +101,297 @@ const dns_cache_entry* resolve_hostname(const std::string& hostname, const std::
 		throw dpp::connection_exception((exception_error_code)(error - 20), std::string("getaddrinfo error: ") + gai_strerror(error));
 	}
 
-	/* Thread safety scope */
+	std::vector<dns_address> result;
+	for (addrinfo* rp = addrs; rp != nullptr; rp = rp->ai_next) {
+		if ((rp->ai_family != AF_INET && rp->ai_family != AF_INET6) || rp->ai_addrlen > sizeof(sockaddr_storage)) {
+			continue;
+		}
+		dns_address a;
+		a.family = rp->ai_family;
+		a.socktype = rp->ai_socktype;
+		a.protocol = rp->ai_protocol;
+		a.length = static_cast<socklen_t>(rp->ai_addrlen);
+		std::memcpy(&a.address, rp->ai_addr, rp->ai_addrlen);
+		char buffer[INET6_ADDRSTRLEN]{};
+		const void* raw = rp->ai_family == AF_INET6
+			? static_cast<const void*>(&reinterpret_cast<const sockaddr_in6*>(&a.address)->sin6_addr)
+			: static_cast<const void*>(&reinterpret_cast<const sockaddr_in*>(&a.address)->sin_addr);
+		if (inet_ntop(rp->ai_family, raw, buffer, sizeof(buffer))) {
+			a.text = buffer;
+		}
+		result.emplace_back(a);
+	}
+
+	/* Now we're done with this horrible struct, free it */
+	freeaddrinfo(addrs);
+
+	/* Discord only supports IPv4, so prefer it */
+	std::stable_partition(result.begin(), result.end(), [](const dns_address& a) {
+		return a.family == AF_INET;
+	});
+	return result;
+}
+
+/**
+ * @brief Build a cache entry from a list of addresses
+ * @param addresses Addresses, in order of preference
+ * @return New entry
+ */
+static dns_cache_entry_ptr make_entry(std::vector<dns_address> addresses) {
+	auto entry = std::make_shared<dns_cache_entry>();
+	entry->addresses = std::move(addresses);
+	std::memset(&entry->addr, 0, sizeof(addrinfo));
+	const dns_address& preferred = entry->addresses.front();
+	entry->addr.ai_family = preferred.family;
+	entry->addr.ai_socktype = preferred.socktype;
+	entry->addr.ai_protocol = preferred.protocol;
+	entry->addr.ai_addrlen = preferred.length;
+	entry->resolved_addr = preferred.text;
+	time_t now = time(nullptr);
+	time_t ttl = dns_ttl;
+	entry->expire_timestamp = now + ttl;
+	entry->refresh_timestamp = now + (ttl * 4 / 5);
+	return entry;
+}
+
+/**
+ * @brief Resolve a hostname on the calling thread and store the result in the cache
+ * @param hostname Hostname to resolve
+ * @param port A port number or named service
+ * @return New cache entry
+ * @throw dpp::connection_exception On failure to resolve hostname
+ */
+static dns_cache_entry_ptr lookup(const std::string& hostname, const std::string& port) {
+	dns_resolver_t resolver;
 	{
-		/* Update cache, requires unique lock */
-		std::unique_lock dns_cache_lock(dns_cache_mutex);
-		dns_cache_entry* cache_entry = new dns_cache_entry();
+		std::shared_lock dns_cache_lock(dns_cache_mutex);
+		resolver = custom_resolver;
+	}
+	std::vector<dns_address> addresses = resolver ? resolver(hostname, port) : system_resolver(hostname, port);
+	if (addresses.empty()) {
+		throw dpp::connection_exception(err_connect_failure, "No addresses found for " + hostname);
+	}
+	dns_cache_entry_ptr entry = make_entry(std::move(addresses));
+
+	/* Update cache, requires unique lock */
+	std::unique_lock dns_cache_lock(dns_cache_mutex);
+	dns_cache[hostname] = entry;
+	return entry;
+}
+
+/**
+ * @brief Background resolver. Runs lookups requested by resolve_hostname_async()
+ * and refreshes of cache entries nearing expiry on a single thread, started on
+ * first use. Concurrent requests for the same host share one lookup.
+ */
+class dns_resolver_thread {
+	/**
+	 * @brief Mutex for queue, waiters and worker
+	 */
+	std::mutex queue_mutex;
+
+	/**
+	 * @brief Signalled when a lookup is queued
+	 */
+	std::condition_variable queue_ready;
+
+	/**
+	 * @brief Hosts waiting to be looked up, and their ports
+	 */
+	std::deque<std::pair<std::string, std::string>> queue;
+
+	/**
+	 * @brief Callbacks waiting on each queued or in-flight lookup, by hostname
+	 */
+	std::unordered_map<std::string, std::vector<dns_callback_t>> waiters;
+
+	/**
+	 * @brief True when the thread should exit
+	 */
+	bool terminating{false};
+
+	/**
+	 * @brief Resolver thread
+	 */
+	std::thread worker;
 
-		for (struct addrinfo* rp = addrs; rp != nullptr; rp = rp->ai_next) {
-			/* Discord only support ipv4, so iterate over any ipv6 results */
-			if (rp->ai_family != AF_INET) {
+	/**
+	 * @brief Resolver thread loop
+	 */
+	void run() {
+		utility::set_thread_name("dns");
+		std::unique_lock lock(queue_mutex);
+		while (!terminating) {
+			if (queue.empty()) {
+				queue_ready.wait(lock);
 				continue;
 			}
-			/* Save address family and other metadata for later */
-			memcpy(&cache_entry->addr, rp, sizeof(addrinfo));
-			char buffer[128];
-			sockaddr_in in{};
-			std::memcpy(&in, rp->ai_addr, sizeof(sockaddr_in));
-			if (inet_ntop(rp->ai_family, &in.sin_addr, buffer, sizeof(buffer))) {
-				cache_entry->resolved_addr = buffer;
+			auto [hostname, port] = queue.front();
+			queue.pop_front();
+			lock.unlock();
+
+			dns_cache_entry_ptr entry;
+			std::string error;
+			try {
+				entry = lookup(hostname, port);
+			}
+			catch (const std::exception& e) {
+				error = e.what();
 			}
-			break;
+
+			lock.lock();
+			std::vector<dns_callback_t> callbacks = std::move(waiters[hostname]);
+			waiters.erase(hostname);
+			lock.unlock();
+			for (auto& callback : callbacks) {
+				callback(entry, error);
+			}
+			lock.lock();
+		}
+	}
+
+public:
+	/**
+	 * @brief Queue a lookup, unless one for the same host is already queued or running
+	 * @param hostname Hostname to resolve
+	 * @param port A port number or named service
+	 * @param callback Completion callback, may be empty
+	 */
+	void enqueue(const std::string& hostname, const std::string& port, const dns_callback_t& callback) {
+		std::lock_guard lock(queue_mutex);
+		auto [iter, inserted] = waiters.try_emplace(hostname);
+		if (callback) {
+			iter->second.emplace_back(callback);
+		}
+		if (inserted) {
+			queue.emplace_back(hostname, port);
+		}
+		if (!worker.joinable()) {
+			worker = std::thread(&dns_resolver_thread::run, this);
+		}
+		queue_ready.notify_one();
+	}
+
+	/**
+	 * @brief Stop and join the resolver thread
+	 */
+	~dns_resolver_thread() {
+		{
+			std::lock_guard lock(queue_mutex);
+			terminating = true;
+		}
+		queue_ready.notify_one();
+		if (worker.joinable()) {
+			worker.join();
+		}
+	}
+};
+
+/**
+ * @brief Get the background resolver
+ * @return resolver
+ */
+static dns_resolver_thread& background_resolver() {
+	static dns_resolver_thread resolver;
+	return resolver;
+}
+
+/**
+ * @brief Find a host in the cache, queueing a background refresh if it is due one
+ * @param hostname Hostname to find
+ * @param port A port number or named service, used for a refresh
+ * @return Cached entry, or nullptr if the host is not cached or its entry has expired
+ */
+static dns_cache_entry_ptr find_cached(const std::string& hostname, const std::string& port) {
+	dns_cache_entry_ptr entry;
+	{
+		/* Check cache for existing DNS record. This can use a shared lock. */
+		std::shared_lock dns_cache_lock(dns_cache_mutex);
+		auto iter = dns_cache.find(hostname);
+		if (iter != dns_cache.end()) {
+			entry = iter->second;
 		}
+	}
+	if (!entry) {
+		return nullptr;
+	}
+	time_t now = time(nullptr);
+	if (now >= entry->expire_timestamp) {
+		/* Expired, most likely because refreshes have been failing; look it up again */
+		return nullptr;
+	}
+	if (now >= entry->refresh_timestamp) {
+		/* Nearing expiry; keep using it while a new result is fetched */
+		background_resolver().enqueue(hostname, port, {});
+	}
+	return entry;
+}
+
+dns_cache_entry_ptr resolve_hostname(const std::string& hostname, const std::string& port)
+{
+	dns_cache_entry_ptr entry = find_cached(hostname, port);
+	if (entry) {
+		return entry;
+	}
+	return lookup(hostname, port);
+}
 
-		cache_entry->expire_timestamp = now + one_hour;
-		dns_cache[hostname] = cache_entry;
+void resolve_hostname_async(const std::string& hostname, const std::string& port, const dns_callback_t& callback)
+{
+	dns_cache_entry_ptr entry = find_cached(hostname, port);
+	if (entry) {
+		if (callback) {
+			callback(entry, "");
+		}
+		return;
+	}
+	background_resolver().enqueue(hostname, port, callback);
+}
 
-		/* Now we're done with this horrible struct, free it and return */
-		freeaddrinfo(addrs);
-		return cache_entry;
+void dns_address_failed(const std::string& hostname, const std::string& address)
+{
+	std::unique_lock dns_cache_lock(dns_cache_mutex);
+	auto iter = dns_cache.find(hostname);
+	if (iter == dns_cache.end() || iter->second->addresses.size() < 2) {
+		return;
+	}
+	const dns_cache_entry& current = *iter->second;
+	auto failed = std::find_if(current.addresses.begin(), current.addresses.end(), [&address](const dns_address& a) {
+		return a.text == address;
+	});
+	if (failed == current.addresses.end()) {
+		return;
+	}
+	/* Entries are immutable, build a replacement with the failed address moved to the back */
+	std::vector<dns_address> addresses;
+	addresses.reserve(current.addresses.size());
+	for (auto a = current.addresses.begin(); a != current.addresses.end(); ++a) {
+		if (a != failed) {
+			addresses.emplace_back(*a);
+		}
 	}
+	addresses.emplace_back(*failed);
+	auto replacement = std::make_shared<dns_cache_entry>(current);
+	replacement->addresses = std::move(addresses);
+	const dns_address& preferred = replacement->addresses.front();
+	replacement->addr.ai_family = preferred.family;
+	replacement->addr.ai_socktype = preferred.socktype;
+	replacement->addr.ai_protocol = preferred.protocol;
+	replacement->addr.ai_addrlen = preferred.length;
+	replacement->resolved_addr = preferred.text;
+	iter->second = replacement;
+}
+
+void set_dns_resolver(const dns_resolver_t& resolver)
+{
+	std::unique_lock dns_cache_lock(dns_cache_mutex);
+	custom_resolver = resolver;
+	dns_cache.clear();
+}
+
+void set_dns_cache_ttl(time_t ttl)
+{
+	dns_ttl = ttl;
 }
 
 }
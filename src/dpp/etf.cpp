@@ -36,6 +36,7 @@
 #include <dpp/json.h>
 #include <zlib.h>
 #include <iostream>
+#include <charconv>
 
 namespace dpp {
 
@@ -362,7 +363,7 @@ json etf_parser::decode_map() {
 		if (key.is_number()) {
 			map.emplace(std::to_string(key.get<uint64_t>()), inner_parse());
 		} else {
-			map.emplace(key.get<std::string>(), inner_parse());
+			map.emplace(std::move(key.get_ref<std::string&>()), inner_parse());
 		}
 	}
 	return map;
@@ -628,7 +629,7 @@ json etf_parser::inner_parse() {
 	}
 }
 
-json etf_parser::parse(const std::string& in) {
+json etf_parser::parse(std::string_view in) {
 	/* Recursively decode multiple values from ETF to JSON */
 	offset = 0;
 	size = in.size();
@@ -641,6 +642,13 @@ json etf_parser::parse(const std::string& in) {
 	}
 }
 
+json etf_parser::parse_term(std::string_view term) {
+	offset = 0;
+	size = term.size();
+	data = (uint8_t*)term.data();
+	return inner_parse();
+}
+
 void etf_parser::inner_build(const json* i, etf_buffer* b)
 {
 	if (i->is_number_integer()) {
@@ -685,18 +693,18 @@ void etf_parser::inner_build(const json* i, etf_buffer* b)
 		/* Array types (can contain any other type, recursively) */
 		const size_t length = i->size();
 		if (length == 0) {
+			/* An empty list is just the nil terminator */
 			append_nil_ext(b);
 		} else {
 			if (length > std::numeric_limits<uint32_t>::max() - 1) {
 				throw dpp::parse_exception(err_etf, "ETF encode: List too large for ETF");
 			}
+			append_list_header(b, length);
+			for(size_t index = 0; index < length; ++index) {
+				inner_build(&((*i)[index]), b);
+			}
+			append_nil_ext(b);
 		}
-
-		append_list_header(b, length);
-		for(size_t index = 0; index < length; ++index) {
-			inner_build(&((*i)[index]), b);
-		}
-		append_nil_ext(b);
 	}
 	else if (i->is_object()) {
 		/* Object types (can contain any other type, recursively, but nlohmann::json only supports string keys) */
@@ -727,5 +735,412 @@ etf_buffer::etf_buffer(size_t initial) {
 
 etf_buffer::~etf_buffer() = default;
 
+etf_reader::etf_reader(std::string_view in, bool versioned) : data(reinterpret_cast<const uint8_t*>(in.data())), size(in.size()), offset(0), string_list_remaining(0) {
+	if (versioned && read_8_bits() != FORMAT_VERSION) {
+		throw dpp::parse_exception(err_etf, "Incorrect ETF version");
+	}
+}
+
+uint8_t etf_reader::read_8_bits() {
+	if (offset + sizeof(uint8_t) > size) {
+		throw dpp::parse_exception(err_etf, "ETF: read_8_bits() past end of buffer");
+	}
+	auto val = *reinterpret_cast<const uint8_t*>(data + offset);
+	offset += sizeof(uint8_t);
+	return val;
+}
+
+uint16_t etf_reader::read_16_bits() {
+	if (offset + sizeof(uint16_t) > size) {
+		throw dpp::parse_exception(err_etf, "ETF: read_16_bits() past end of buffer");
+	}
+	uint16_t val = etf_byte_order_16(*reinterpret_cast<const uint16_t*>(data + offset));
+	offset += sizeof(uint16_t);
+	return val;
+}
+
+uint32_t etf_reader::read_32_bits() {
+	if (offset + sizeof(uint32_t) > size) {
+		throw dpp::parse_exception(err_etf, "ETF: read_32_bits() past end of buffer");
+	}
+	uint32_t val = etf_byte_order_32(*reinterpret_cast<const uint32_t*>(data + offset));
+	offset += sizeof(uint32_t);
+	return val;
+}
+
+uint64_t etf_reader::read_64_bits() {
+	if (offset + sizeof(uint64_t) > size) {
+		throw dpp::parse_exception(err_etf, "ETF: read_64_bits() past end of buffer");
+	}
+	uint64_t val = etf_byte_order_64(*reinterpret_cast<const uint64_t*>(data + offset));
+	offset += sizeof(val);
+	return val;
+}
+
+std::string_view etf_reader::read_bytes(uint32_t length) {
+	if (length > size - offset) {
+		throw dpp::parse_exception(err_etf, "ETF: string past end of buffer");
+	}
+	std::string_view bytes(reinterpret_cast<const char*>(data + offset), length);
+	offset += length;
+	return bytes;
+}
+
+int64_t etf_reader::read_bigint(uint32_t digits) {
+	const uint8_t sign = read_8_bits();
+	if (digits > 8) {
+		throw dpp::parse_exception(err_etf, "ETF: big integer larger than 8 bytes unsupported");
+	}
+	uint64_t value = 0;
+	for (uint32_t i = 0; i < digits; ++i) {
+		value |= static_cast<uint64_t>(read_8_bits()) << (i * 8);
+	}
+	return sign == 0 ? static_cast<int64_t>(value) : -static_cast<int64_t>(value);
+}
+
+etf_token_type etf_reader::peek() const {
+	if (string_list_remaining) {
+		return ett_smallint;
+	}
+	if (offset >= size) {
+		throw dpp::parse_exception(err_etf, "Read past end of ETF buffer");
+	}
+	return static_cast<etf_token_type>(data[offset]);
+}
+
+bool etf_reader::at_end() const {
+	return string_list_remaining == 0 && offset >= size;
+}
+
+bool etf_reader::is_null() const {
+	if (string_list_remaining || offset >= size) {
+		return false;
+	}
+	size_t length = 0, start = offset + 1;
+	switch (data[offset]) {
+		case ett_atom:
+		case ett_atom_utf8:
+			if (start + 2 > size) {
+				return false;
+			}
+			length = etf_byte_order_16(*reinterpret_cast<const uint16_t*>(data + start));
+			start += 2;
+		break;
+		case ett_atom_small:
+		case ett_atom_utf8_small:
+			if (start + 1 > size) {
+				return false;
+			}
+			length = data[start++];
+		break;
+		default:
+			return false;
+	}
+	if (start + length > size) {
+		return false;
+	}
+	std::string_view atom(reinterpret_cast<const char*>(data + start), length);
+	return atom == "nil" || atom == "null";
+}
+
+uint32_t etf_reader::read_map_header() {
+	if (peek() != ett_map) {
+		skip();
+		return 0;
+	}
+	offset++;
+	return read_32_bits();
+}
+
+uint32_t etf_reader::read_list_header(bool& has_tail) {
+	has_tail = false;
+	switch (peek()) {
+		case ett_nil:
+			offset++;
+			return 0;
+		case ett_list:
+			offset++;
+			has_tail = true;
+			return read_32_bits();
+		case ett_small_tuple:
+			offset++;
+			return read_8_bits();
+		case ett_large_tuple:
+			offset++;
+			return read_32_bits();
+		case ett_string:
+			/* A list of bytes, each element is read as a small integer */
+			offset++;
+			string_list_remaining = read_16_bits();
+			if (string_list_remaining > size - offset) {
+				string_list_remaining = 0;
+				throw dpp::parse_exception(err_etf, "String list past end of buffer");
+			}
+			return string_list_remaining;
+		default:
+			skip();
+			return 0;
+	}
+}
+
+void etf_reader::read_list_tail() {
+	skip();
+}
+
+std::string_view etf_reader::read_key() {
+	switch (peek()) {
+		case ett_binary:
+			offset++;
+			return read_bytes(read_32_bits());
+		case ett_atom:
+		case ett_atom_utf8:
+		case ett_string:
+			offset++;
+			return read_bytes(read_16_bits());
+		case ett_atom_small:
+		case ett_atom_utf8_small:
+			offset++;
+			return read_bytes(read_8_bits());
+		case ett_smallint:
+		case ett_integer:
+		case ett_bigint_small:
+		case ett_bigint_large:
+			key_buffer = std::to_string(read_int());
+			return key_buffer;
+		default:
+			skip();
+			return {};
+	}
 }
 
+std::string_view etf_reader::read_string() {
+	switch (peek()) {
+		case ett_binary:
+			offset++;
+			return read_bytes(read_32_bits());
+		case ett_string:
+			offset++;
+			return read_bytes(read_16_bits());
+		case ett_atom:
+		case ett_atom_small:
+		case ett_atom_utf8:
+		case ett_atom_utf8_small: {
+			/* nil, null, true and false are not strings */
+			std::string_view atom = read_key();
+			if (atom == "nil" || atom == "null" || atom == "true" || atom == "false") {
+				return {};
+			}
+			return atom;
+		}
+		default:
+			skip();
+			return {};
+	}
+}
+
+int64_t etf_reader::read_int() {
+	if (string_list_remaining) {
+		string_list_remaining--;
+		return read_8_bits();
+	}
+	switch (peek()) {
+		case ett_smallint:
+			offset++;
+			return read_8_bits();
+		case ett_integer:
+			offset++;
+			return static_cast<int32_t>(read_32_bits());
+		case ett_bigint_small:
+			offset++;
+			return read_bigint(read_8_bits());
+		case ett_bigint_large:
+			offset++;
+			return read_bigint(read_32_bits());
+		case ett_float:
+		case ett_new_float:
+			return static_cast<int64_t>(read_double());
+		case ett_binary: {
+			std::string_view number = read_string();
+			int64_t value = 0;
+			std::from_chars(number.data(), number.data() + number.size(), value);
+			return value;
+		}
+		default:
+			skip();
+			return 0;
+	}
+}
+
+snowflake etf_reader::read_snowflake() {
+	if (peek() == ett_binary) {
+		std::string_view number = read_string();
+		uint64_t value = 0;
+		std::from_chars(number.data(), number.data() + number.size(), value);
+		return value;
+	}
+	return static_cast<uint64_t>(read_int());
+}
+
+bool etf_reader::read_bool() {
+	switch (peek()) {
+		case ett_atom:
+		case ett_atom_small:
+		case ett_atom_utf8:
+		case ett_atom_utf8_small:
+			return read_key() == "true";
+		default:
+			skip();
+			return false;
+	}
+}
+
+double etf_reader::read_double() {
+	switch (peek()) {
+		case ett_new_float: {
+			offset++;
+			union {
+				uint64_t ui64;
+				double df;
+			} val;
+			val.ui64 = read_64_bits();
+			return val.df;
+		}
+		case ett_float: {
+			offset++;
+			std::string float_str(read_bytes(31));
+			return strtod(float_str.c_str(), nullptr);
+		}
+		case ett_smallint:
+		case ett_integer:
+		case ett_bigint_small:
+		case ett_bigint_large:
+			return static_cast<double>(read_int());
+		default:
+			skip();
+			return 0;
+	}
+}
+
+void etf_reader::skip() {
+	if (string_list_remaining) {
+		string_list_remaining--;
+		read_8_bits();
+		return;
+	}
+	const uint8_t type = read_8_bits();
+	switch (type) {
+		case ett_smallint:
+			read_bytes(1);
+		break;
+		case ett_integer:
+			read_bytes(4);
+		break;
+		case ett_float:
+			read_bytes(31);
+		break;
+		case ett_new_float:
+			read_bytes(8);
+		break;
+		case ett_atom:
+		case ett_atom_utf8:
+		case ett_string:
+			read_bytes(read_16_bits());
+		break;
+		case ett_atom_small:
+		case ett_atom_utf8_small:
+			read_bytes(read_8_bits());
+		break;
+		case ett_binary:
+			read_bytes(read_32_bits());
+		break;
+		case ett_bit_binary: {
+			const uint32_t length = read_32_bits();
+			read_bytes(1);
+			read_bytes(length);
+		}
+		break;
+		case ett_bigint_small:
+			read_bytes(read_8_bits());
+			read_bytes(1);
+		break;
+		case ett_bigint_large:
+			read_bytes(read_32_bits());
+			read_bytes(1);
+		break;
+		case ett_nil:
+		break;
+		case ett_small_tuple: {
+			const uint8_t elements = read_8_bits();
+			for (uint8_t i = 0; i < elements; ++i) {
+				skip();
+			}
+		}
+		break;
+		case ett_large_tuple: {
+			const uint32_t elements = read_32_bits();
+			for (uint32_t i = 0; i < elements; ++i) {
+				skip();
+			}
+		}
+		break;
+		case ett_list: {
+			const uint32_t elements = read_32_bits();
+			for (uint32_t i = 0; i < elements; ++i) {
+				skip();
+			}
+			/* Tail */
+			skip();
+		}
+		break;
+		case ett_map: {
+			const uint32_t pairs = read_32_bits();
+			for (uint32_t i = 0; i < pairs; ++i) {
+				skip();
+				skip();
+			}
+		}
+		break;
+		case ett_reference:
+			skip();
+			read_bytes(5);
+		break;
+		case ett_new_reference: {
+			const uint16_t ids = read_16_bits();
+			skip();
+			read_bytes(1);
+			read_bytes(ids * 4);
+		}
+		break;
+		case ett_port:
+			skip();
+			read_bytes(5);
+		break;
+		case ett_pid:
+			skip();
+			read_bytes(9);
+		break;
+		case ett_export:
+			skip();
+			skip();
+			skip();
+		break;
+		default:
+			throw dpp::parse_exception(err_etf, "Unsupported data type in ETF");
+	}
+}
+
+std::string_view etf_reader::read_term() {
+	const size_t start = offset;
+	skip();
+	return std::string_view(reinterpret_cast<const char*>(data + start), offset - start);
+}
+
+json etf_reader::read_json() {
+	if (string_list_remaining) {
+		return read_int();
+	}
+	etf_parser parser;
+	return parser.parse_term(read_term());
+}
+
+}
@@ -51,9 +51,7 @@ void channel_create::handle(discord_client* client, json &j, const std::string &
 		}
 	} else {
 		c = dpp::find_channel(snowflake_not_null(&d, "id"));
-		if (!c) {
-			c = new dpp::channel();
-		}
+		c = c ? new dpp::channel(*c) : new dpp::channel();
 		c->fill_from_json(&d);
 		dpp::get_channel_cache()->store(c);
 		if (c->recipients.size()) {
@@ -63,6 +61,7 @@ void channel_create::handle(discord_client* client, json &j, const std::string &
 		}
 		g = dpp::find_guild(c->guild_id);
 		if (g) {
+			std::unique_lock lock(g->get_mutex());
 			g->channels.push_back(c->id);
 		}
 	}
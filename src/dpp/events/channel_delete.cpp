@@ -41,6 +41,7 @@ void channel_delete::handle(discord_client* client, json &j, const std::string &
 	const channel c = channel().fill_from_json(&d);
 	guild* g = find_guild(c.guild_id);
 	if (g) {
+		std::unique_lock lock(g->get_mutex());
 		g->channels.erase(std::remove(g->channels.begin(), g->channels.end(), c.id), g->channels.end());
 	}
 	if (client->creator->cache_policy.channel_policy != cp_none) {
@@ -46,7 +46,10 @@ void channel_update::handle(discord_client* client, json &j, const std::string &
 	} else {
 		c = dpp::find_channel(snowflake_not_null(&d, "id"));
 		if (c) {
+			/* Cached channels are never changed in place; publish an updated copy */
+			c = new dpp::channel(*c);
 			c->fill_from_json(&d);
+			dpp::get_channel_cache()->store(c);
 		}
 	}
 	if (!client->creator->on_channel_update.empty()) {
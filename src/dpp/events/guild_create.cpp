@@ -25,19 +25,21 @@
 #include <dpp/cache.h>
 #include <dpp/stringops.h>
 #include <dpp/json.h>
+#include <dpp/etf.h>
 
 
 
 namespace dpp::events {
 /**
- * @brief Handle event
- * 
+ * @brief Handle a GUILD_CREATE from either protocol
+ *
  * @param client Websocket client (current shard)
- * @param j JSON data for the event
- * @param raw Raw JSON string
+ * @param d JSON data for the event
+ * @param raw Raw event string
+ * @param etf_members In ETF mode, the undecoded member list, read in place instead of d["members"]
+ * @param etf_presences In ETF mode, the undecoded presence list, read in place instead of d["presences"]
  */
-void guild_create::handle(discord_client* client, json &j, const std::string &raw) {
-	json& d = j["d"];
+void guild_create::handle_guild(discord_client* client, json &d, const std::string &raw, std::string_view etf_members, std::string_view etf_presences) {
 	dpp::guild newguild;
 	dpp::guild* g = nullptr;
 
@@ -58,6 +60,7 @@ void guild_create::handle(discord_client* client, json &j, const std::string &ra
 			g = new dpp::guild();
 			is_new_guild = true;
 		}
+		std::unique_lock lock(g->get_mutex());
 		g->fill_from_json(client, &d);
 		g->shard_id = client->shard_id;
 		if (!g->is_unavailable() && is_new_guild) {
@@ -67,9 +70,7 @@ void guild_create::handle(discord_client* client, json &j, const std::string &ra
 				g->roles.reserve(d["roles"].size());
 				for (auto & role : d["roles"]) {
 					dpp::role *r = dpp::find_role(snowflake_not_null(&role, "id"));
-					if (!r) {
-						r = new dpp::role();
-					}
+					r = r ? new dpp::role(*r) : new dpp::role();
 					r->fill_from_json(g->id, &role);
 					dpp::get_role_cache()->store(r);
 					g->roles.push_back(r->id);
@@ -81,9 +82,7 @@ void guild_create::handle(discord_client* client, json &j, const std::string &ra
 			g->channels.reserve(d["channels"].size());
 			for (auto & channel : d["channels"]) {
 				dpp::channel* c = dpp::find_channel(snowflake_not_null(&channel, "id"));
-				if (!c) {
-					c = new dpp::channel();
-				}
+				c = c ? new dpp::channel(*c) : new dpp::channel();
 				c->fill_from_json(&channel);
 				c->guild_id = g->id;
 				dpp::get_channel_cache()->store(c);
@@ -98,7 +97,26 @@ void guild_create::handle(discord_client* client, json &j, const std::string &ra
 			}
 
 			/* Store guild members */
-			if (client->creator->cache_policy.user_policy == cp_aggressive) {
+			if (client->creator->cache_policy.user_policy == cp_aggressive && !etf_members.empty()) {
+				etf_reader members(etf_members, false);
+				members.read_list([&]() {
+					json user;
+					dpp::guild_member gm;
+					gm.fill_from_etf(members, g->id, &user);
+					/* Only store ones we don't have already otherwise gm will leak */
+					if (g->members.find(gm.user_id) == g->members.end()) {
+						dpp::user* u = dpp::find_user(gm.user_id);
+						if (!u) {
+							u = new dpp::user();
+							u->fill_from_json(&user);
+							dpp::get_user_cache()->store(u);
+						} else {
+							u->refcount++;
+						}
+						g->members[gm.user_id] = gm;
+					}
+				});
+			} else if (client->creator->cache_policy.user_policy == cp_aggressive) {
 				g->members.reserve(d["members"].size());
 				for (auto & user : d["members"]) {
 					snowflake userid = snowflake_not_null(&(user["user"]), "id");
@@ -133,6 +151,7 @@ void guild_create::handle(discord_client* client, json &j, const std::string &ra
 				}
 			}
 		}
+		lock.unlock();
 		dpp::get_guild_cache()->store(g);
 		if (is_new_guild && g->id && (client->intents & dpp::i_guild_members)) {
 			if (client->creator->cache_policy.user_policy == cp_aggressive) {
@@ -140,7 +159,7 @@ void guild_create::handle(discord_client* client, json &j, const std::string &ra
 				if (client->intents & dpp::i_guild_presences) {
 					chunk_req["d"]["presences"] = true;
 				}
-				client->queue_message(client->jsonobj_to_string(chunk_req));
+				client->queue_message(client->jsonobj_to_string(chunk_req), false, "members:" + std::to_string(g->id));
 			}
 		}
 	}
@@ -150,7 +169,16 @@ void guild_create::handle(discord_client* client, json &j, const std::string &ra
 		gc.created = g;
 
 		/* Fill presences if there are any */
-		if (d.find("presences") != d.end()) {
+		if (!etf_presences.empty()) {
+			etf_reader presences(etf_presences, false);
+			presences.read_list([&]() {
+				presence p;
+				p.fill_from_etf(presences);
+				if (p.user_id) {
+					gc.presences.emplace(p.user_id, p);
+				}
+			});
+		} else if (d.find("presences") != d.end()) {
 			for (auto & p : d["presences"]) {
 				try {
 					snowflake user_id = std::stoull(p["user"]["id"].get<std::string>());
@@ -207,4 +235,40 @@ void guild_create::handle(discord_client* client, json &j, const std::string &ra
 	}
 }
 
+/**
+ * @brief Handle event
+ * 
+ * @param client Websocket client (current shard)
+ * @param j JSON data for the event
+ * @param raw Raw JSON string
+ */
+void guild_create::handle(discord_client* client, json &j, const std::string &raw) {
+	handle_guild(client, j["d"], raw, {}, {});
+}
+
+/**
+ * @brief Handle event from ETF. The member and presence lists, which are the bulk
+ * of the event, are read in place; the rest is decoded to json.
+ * 
+ * @param client Websocket client (current shard)
+ * @param r ETF reader for the event's data
+ * @param raw Raw ETF string
+ * @return true, the event is always handled
+ */
+bool guild_create::handle_etf(discord_client* client, etf_reader &r, const std::string &raw) {
+	json d = json::object();
+	std::string_view members, presences;
+	r.read_map([&](std::string_view key) {
+		if (key == "members") {
+			members = r.read_term();
+		} else if (key == "presences") {
+			presences = r.read_term();
+		} else {
+			d[std::string(key)] = r.read_json();
+		}
+	});
+	handle_guild(client, d, raw, members, presences);
+	return true;
+}
+
 };
@@ -43,9 +43,9 @@ void guild_delete::handle(discord_client* client, json &j, const std::string &ra
 	if (!g) {
 		guild_del.fill_from_json(&d);
 	} else {
+		std::unique_lock lock(g->get_mutex());
 		guild_del = *g;
 		if (!bool_not_null(&d, "unavailable")) {
-			dpp::get_guild_cache()->remove(g);
 			if (client->creator->cache_policy.emoji_policy != dpp::cp_none) {
 				for (auto & ee : g->emojis) {
 					dpp::emoji* fe = dpp::find_emoji(ee);
@@ -80,6 +80,9 @@ void guild_delete::handle(discord_client* client, json &j, const std::string &ra
 				}
 			}
 			g->members.clear();
+			/* The guild cache is iterated with guilds locked inside it, so never wait on it holding a guild */
+			lock.unlock();
+			dpp::get_guild_cache()->remove(g);
 		} else {
 			g->flags |= dpp::g_unavailable;
 		}
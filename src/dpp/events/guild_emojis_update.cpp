@@ -46,6 +46,7 @@ void guild_emojis_update::handle(discord_client* client, json &j, const std::str
 	std::vector<dpp::snowflake> emojis;
 	if (client->creator->cache_policy.emoji_policy != dpp::cp_none) {
 		if (g) {
+			std::shared_lock lock(g->get_mutex());
 			for (auto & ee : g->emojis) {
 				dpp::emoji* fe = dpp::find_emoji(ee);
 				if (fe) {
@@ -63,6 +64,7 @@ void guild_emojis_update::handle(discord_client* client, json &j, const std::str
 			emojis.push_back(e->id);
 		}
 		if (g) {
+			std::unique_lock lock(g->get_mutex());
 			g->emojis = emojis;
 		}
 	} else {
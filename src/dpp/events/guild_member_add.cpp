@@ -58,14 +58,18 @@ void guild_member_add::handle(discord_client* client, json &j, const std::string
 		} else {
 			u->refcount++;
 		}
-		dpp::guild_member gm;
 		gmr.added = {};
-		if (g && u && u->id && g->members.find(u->id) == g->members.end()) {
-			gm.fill_from_json(&d, g->id, u->id);
-			g->members[u->id] = gm;
-			gmr.added = gm;
-		} else if (g && u && u->id) {
-			gmr.added = g->members.find(u->id)->second;
+		if (g && u && u->id) {
+			std::unique_lock lock(g->get_mutex());
+			auto existing = g->members.find(u->id);
+			if (existing == g->members.end()) {
+				dpp::guild_member gm;
+				gm.fill_from_json(&d, g->id, u->id);
+				g->members[u->id] = gm;
+				gmr.added = gm;
+			} else {
+				gmr.added = existing->second;
+			}
 		}
 		if (!client->creator->on_guild_member_add.empty()) {
 			gmr.adding_guild = g;
@@ -49,6 +49,7 @@ void guild_member_remove::handle(discord_client* client, json &j, const std::str
 	}
 
 	if (client->creator->cache_policy.user_policy != dpp::cp_none && gmr.removing_guild) {
+		std::unique_lock lock(gmr.removing_guild->get_mutex());
 		auto i = gmr.removing_guild->members.find(gmr.removed.id);
 		if (i != gmr.removing_guild->members.end()) {
 			dpp::user* u = dpp::find_user(gmr.removed.id);
@@ -59,6 +59,7 @@ void guild_member_update::handle(discord_client* client, json &j, const std::str
 			guild_member m;
 			m.fill_from_json(&user, guild_id, u->id);
 			if (g) {
+				std::unique_lock lock(g->get_mutex());
 				g->members[u->id] = m;
 			}
 
@@ -25,6 +25,7 @@
 #include <dpp/cache.h>
 #include <dpp/stringops.h>
 #include <dpp/json.h>
+#include <dpp/etf.h>
 
 
 namespace dpp::events {
@@ -52,6 +53,7 @@ void guild_members_chunk::handle(discord_client* client, json &j, const std::str
 					u->fill_from_json(&userspart);
 					dpp::get_user_cache()->store(u);
 				}
+				std::unique_lock lock(g->get_mutex());
 				if (g->members.find(u->id) == g->members.end()) {
 					dpp::guild_member gm;
 					gm.fill_from_json(&userrec, g->id, u->id);
@@ -71,4 +73,57 @@ void guild_members_chunk::handle(discord_client* client, json &j, const std::str
 	}
 }
 
+/**
+ * @brief Handle event from ETF, reading the members in place
+ * 
+ * @param client Websocket client (current shard)
+ * @param d ETF reader for the event's data
+ * @param raw Raw ETF string
+ * @return true, the event is always handled
+ */
+bool guild_members_chunk::handle_etf(discord_client* client, etf_reader &d, const std::string &raw) {
+	dpp::guild_member_map um;
+	dpp::guild* g = nullptr;
+	std::string_view members;
+	d.read_map([&](std::string_view key) {
+		if (key == "guild_id") {
+			g = dpp::find_guild(d.read_snowflake());
+		} else if (key == "members") {
+			/* The guild id may follow the member list, so read this afterwards */
+			members = d.read_term();
+		} else {
+			d.skip();
+		}
+	});
+	if (g && !members.empty() && client->creator->cache_policy.user_policy == cp_aggressive) {
+		/* Store guild members */
+		etf_reader m(members, false);
+		m.read_list([&]() {
+			json userspart;
+			dpp::guild_member gm;
+			gm.fill_from_etf(m, g->id, &userspart);
+			dpp::user* u = dpp::find_user(gm.user_id);
+			if (!u) {
+				u = new dpp::user();
+				u->fill_from_json(&userspart);
+				dpp::get_user_cache()->store(u);
+			}
+			std::unique_lock lock(g->get_mutex());
+			if (g->members.find(u->id) == g->members.end()) {
+				g->members[u->id] = gm;
+				if (!client->creator->on_guild_members_chunk.empty()) {
+					um[u->id] = gm;
+				}
+			}
+		});
+	}
+	if (!client->creator->on_guild_members_chunk.empty()) {
+		dpp::guild_members_chunk_t gmc(client, raw);
+		gmc.adding = g;
+		gmc.members = &um;
+		client->creator->on_guild_members_chunk.call(gmc);
+	}
+	return true;
+}
+
 };
\ No newline at end of file
@@ -54,12 +54,11 @@ void guild_role_create::handle(discord_client* client, json &j, const std::strin
 	} else {
 		json &role = d["role"];
 		dpp::role *r = dpp::find_role(snowflake_not_null(&role, "id"));
-		if (!r) {
-			r = new dpp::role();
-		}
+		r = r ? new dpp::role(*r) : new dpp::role();
 		r->fill_from_json(guild_id, &role);
 		dpp::get_role_cache()->store(r);
 		if (g) {
+			std::unique_lock lock(g->get_mutex());
 			g->roles.push_back(r->id);
 		}
 		if (!client->creator->on_guild_role_create.empty()) {
@@ -61,6 +61,7 @@ void guild_role_delete::handle(discord_client* client, json &j, const std::strin
 		}
 		if (r) {
 			if (g) {
+				std::unique_lock lock(g->get_mutex());
 				auto i = std::find(g->roles.begin(), g->roles.end(), r->id);
 				if (i != g->roles.end()) {
 					g->roles.erase(i);
@@ -53,7 +53,10 @@ void guild_role_update::handle(discord_client* client, json &j, const std::strin
 		json& role = d["role"];
 		dpp::role *r = dpp::find_role(snowflake_not_null(&role, "id"));
 		if (r) {
-			r->fill_from_json(g->id, &role);
+			/* Cached roles are never changed in place; publish an updated copy */
+			r = new dpp::role(*r);
+			r->fill_from_json(guild_id, &role);
+			dpp::get_role_cache()->store(r);
 			if (!client->creator->on_guild_role_update.empty()) {
 				dpp::guild_role_update_t gru(client, raw);
 				gru.updating_guild = g;
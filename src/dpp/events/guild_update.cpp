@@ -46,6 +46,7 @@ void guild_update::handle(discord_client* client, json &j, const std::string &ra
 	} else {
 		g = dpp::find_guild(snowflake_not_null(&d, "id"));
 		if (g) {
+			std::unique_lock lock(g->get_mutex());
 			g->fill_from_json(client, &d);
 			if (!g->is_unavailable()) {
 				if (client->creator->cache_policy.role_policy != dpp::cp_none && d.find("roles") != d.end()) {
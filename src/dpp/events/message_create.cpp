@@ -24,6 +24,7 @@
 #include <dpp/message.h>
 #include <dpp/stringops.h>
 #include <dpp/json.h>
+#include <dpp/etf.h>
 
 
 namespace dpp::events {
@@ -47,4 +48,23 @@ void message_create::handle(discord_client* client, json &j, const std::string &
 	}
 }
 
+/**
+ * @brief Handle event from ETF, reading the message in place
+ * 
+ * @param client Websocket client (current shard)
+ * @param d ETF reader for the event's data
+ * @param raw Raw ETF string
+ * @return true, the event is always handled
+ */
+bool message_create::handle_etf(discord_client* client, etf_reader &d, const std::string &raw) {
+
+	if (!client->creator->on_message_create.empty()) {
+		dpp::message_create_t msg(client, raw);
+		msg.msg.fill_from_etf(d, client->creator->cache_policy);
+		msg.msg.owner = client->creator;
+		client->creator->on_message_create.call(msg);
+	}
+	return true;
+}
+
 };
\ No newline at end of file
@@ -23,6 +23,7 @@
 #include <dpp/cluster.h>
 #include <dpp/stringops.h>
 #include <dpp/json.h>
+#include <dpp/etf.h>
 
 
 namespace dpp::events {
@@ -44,4 +45,21 @@ void presence_update::handle(discord_client* client, json &j, const std::string
 	}
 }
 
+/**
+ * @brief Handle event from ETF, reading the presence in place
+ * 
+ * @param client Websocket client (current shard)
+ * @param d ETF reader for the event's data
+ * @param raw Raw ETF string
+ * @return true, the event is always handled
+ */
+bool presence_update::handle_etf(discord_client* client, etf_reader &d, const std::string &raw) {
+	if (!client->creator->on_presence_update.empty()) {
+		dpp::presence_update_t pu(client, raw);
+		pu.rich_presence.fill_from_etf(d);
+		client->creator->on_presence_update.call(pu);
+	}
+	return true;
+}
+
 };
\ No newline at end of file
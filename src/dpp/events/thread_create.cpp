@@ -36,6 +36,7 @@ void thread_create::handle(discord_client* client, json& j, const std::string& r
 	t.fill_from_json(&d);
 	dpp::guild* g = dpp::find_guild(t.guild_id);
 	if (g) {
+		std::unique_lock lock(g->get_mutex());
 		g->threads.push_back(t.id);
 	}
 	if (!client->creator->on_thread_create.empty()) {
@@ -36,6 +36,7 @@ void thread_delete::handle(discord_client* client, json& j, const std::string& r
 	t.fill_from_json(&d);
 	dpp::guild* g = dpp::find_guild(t.guild_id);
 	if (g) {
+		std::unique_lock lock(g->get_mutex());
 		g->threads.erase(std::remove(g->threads.begin(), g->threads.end(), t.id), g->threads.end());
 	}
 	if (!client->creator->on_thread_delete.empty()) {
@@ -33,6 +33,7 @@ void thread_list_sync::handle(discord_client* client, json& j, const std::string
 
 	dpp::guild* g = dpp::find_guild(snowflake_not_null(&d, "guild_id"));
 	if (g) {
+		std::unique_lock lock(g->get_mutex());
 		/** Store thread IDs*/
 		if (d.find("threads") != d.end()) {
 			for (auto& t : d["threads"]) {
@@ -44,11 +44,18 @@ void user_update::handle(discord_client* client, json &j, const std::string &raw
 		if (client->creator->cache_policy.user_policy != dpp::cp_none) {
 			dpp::user* u = dpp::find_user(user_id);
 			if (u) {
+				/* Cached users are never changed in place; publish an updated copy */
+				u = new dpp::user(*u);
 				u->fill_from_json(&d);
+				dpp::get_user_cache()->store(u);
 			}
 			if (!client->creator->on_user_update.empty()) {
 				dpp::user_update_t uu(client, raw);
-				uu.updated = *u;
+				if (u) {
+					uu.updated = *u;
+				} else {
+					uu.updated.fill_from_json(&d);
+				}
 				client->creator->on_user_update.call(uu);
 			}
 		} else {
@@ -47,6 +47,7 @@ void voice_state_update::handle(discord_client* client, json &j, const std::stri
 	/* Update guild voice states */
 	dpp::guild* g = dpp::find_guild(vsu.state.guild_id);
 	if (g) {
+		std::unique_lock lock(g->get_mutex());
 		if (vsu.state.channel_id.empty()) {
 			auto ve = g->voice_members.find(vsu.state.user_id);
 			if (ve != g->voice_members.end()) {
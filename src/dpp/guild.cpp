@@ -23,6 +23,7 @@
 #include <dpp/discordevents.h>
 #include <dpp/stringops.h>
 #include <dpp/json.h>
+#include <dpp/etf.h>
 
 namespace dpp {
 
@@ -114,23 +115,27 @@ guild_member& guild_member::set_nickname(const std::string& nick) {
 }
 
 guild_member& guild_member::add_role(dpp::snowflake role_id) {
-	roles.emplace_back(role_id);
+	std::vector<snowflake> r = roles.get();
+	r.emplace_back(role_id);
+	roles = r;
 	flags |= gm_roles_action;
 	return *this;
 }
 
 guild_member& guild_member::remove_role(dpp::snowflake role_id) {
-	roles.erase(std::remove(roles.begin(), roles.end(), role_id), roles.end());
+	std::vector<snowflake> r = roles.get();
+	r.erase(std::remove(r.begin(), r.end(), role_id), r.end());
+	roles = r;
 	flags |= gm_roles_action;
 	return *this;
 }
 
 std::string guild_member::get_nickname() const {
-	return nickname;
+	return nickname.get();
 }
 
 const std::vector<dpp::snowflake>& guild_member::get_roles() const {
-	return roles;
+	return roles.get();
 }
 
 
@@ -176,12 +181,77 @@ guild_member& guild_member::fill_from_json(nlohmann::json* j, snowflake g_id, sn
 	return *this;
 }
 
+guild_member& guild_member::fill_from_etf(etf_reader& r, snowflake g_id, nlohmann::json* user) {
+	this->guild_id = g_id;
+	std::vector<snowflake> role_list;
+	uint16_t member_flags = 0;
+	auto read_ts = [&r](time_t& v) {
+		std::string_view ts = r.read_string();
+		if (!ts.empty()) {
+			v = ts_from_string(ts);
+		}
+	};
+	r.read_map([&](std::string_view key) {
+		if (key == "user") {
+			if (user) {
+				*user = r.read_json();
+				this->user_id = snowflake_not_null(user, "id");
+			} else {
+				r.read_map([&](std::string_view user_key) {
+					if (user_key == "id") {
+						this->user_id = r.read_snowflake();
+					} else {
+						r.skip();
+					}
+				});
+			}
+		} else if (key == "nick") {
+			this->nickname = std::string(r.read_string());
+		} else if (key == "joined_at") {
+			read_ts(this->joined_at);
+		} else if (key == "premium_since") {
+			read_ts(this->premium_since);
+		} else if (key == "communication_disabled_until") {
+			read_ts(this->communication_disabled_until);
+		} else if (key == "flags") {
+			member_flags = static_cast<uint16_t>(r.read_int());
+		} else if (key == "roles") {
+			r.read_list([&]() {
+				role_list.emplace_back(r.read_snowflake());
+			});
+		} else if (key == "avatar" && !r.is_null()) {
+			std::string av(r.read_string());
+			if (av.substr(0, 2) == "a_") {
+				this->flags |= gm_animated_avatar;
+			}
+			this->avatar = av;
+		} else if (key == "deaf") {
+			this->flags |= r.read_bool() ? gm_deaf : 0;
+		} else if (key == "mute") {
+			this->flags |= r.read_bool() ? gm_mute : 0;
+		} else if (key == "pending") {
+			this->flags |= r.read_bool() ? gm_pending : 0;
+		} else {
+			r.skip();
+		}
+	});
+	for (auto & flag : membermap) {
+		if (member_flags & flag.first) {
+			this->flags |= flag.second;
+		}
+	}
+	this->roles = role_list;
+	return *this;
+}
+
 bool guild_member::is_communication_disabled() const {
 	return communication_disabled_until > time(nullptr);
 }
 
 void from_json(const nlohmann::json& j, guild_member& gm) {
-	set_string_not_null(&j, "nick", gm.nickname);
+	std::string nick = gm.nickname.get();
+	set_string_not_null(&j, "nick", nick);
+	gm.nickname = nick;
 	set_ts_not_null(&j, "joined_at", gm.joined_at);
 	set_ts_not_null(&j, "premium_since", gm.premium_since);
 	set_ts_not_null(&j, "communication_disabled_until", gm.communication_disabled_until);
@@ -196,7 +266,9 @@ void from_json(const nlohmann::json& j, guild_member& gm) {
 		}
 	}
 
-	set_snowflake_array_not_null(&j, "roles", gm.roles);
+	std::vector<snowflake> role_list;
+	set_snowflake_array_not_null(&j, "roles", role_list);
+	gm.roles = role_list;
 
 	if (j.contains("avatar") && !j.at("avatar").is_null()) {
 		std::string av = string_not_null(&j, "avatar");
@@ -238,7 +310,7 @@ json guild_member::to_json_impl(bool with_id) const {
 
 	if (this->flags & gm_nickname_action) {
 		if (!this->nickname.empty()) {
-			j["nick"] = this->nickname;
+			j["nick"] = this->nickname.get();
 		} else {
 			j["nick"] = json::value_t::null;
 		}
@@ -246,7 +318,7 @@ json guild_member::to_json_impl(bool with_id) const {
 
 	if (this->flags & gm_roles_action) {
 		j["roles"] = {};
-		for (const auto & role : this->roles) {
+		for (const auto & role : this->roles.get()) {
 			j["roles"].push_back(std::to_string(role));
 		}
 	}
@@ -626,7 +698,12 @@ json guild::to_json_impl(bool with_id) const {
 	return j;
 }
 
+std::shared_mutex& guild::get_mutex() const {
+	return lists_mutex;
+}
+
 void guild::rehash_members() {
+	std::unique_lock lock(lists_mutex);
 	members_container n;
 	n.reserve(members.size());
 	for (auto t = members.begin(); t != members.end(); ++t) {
@@ -787,11 +864,15 @@ permission guild::base_permissions(const user* user) const {
 		return 0;
 	}
 
-	auto mi = members.find(user->id);
-	if (mi == members.end()) {
-		return 0;
+	guild_member gm;
+	{
+		std::shared_lock lock(lists_mutex);
+		auto mi = members.find(user->id);
+		if (mi == members.end()) {
+			return 0;
+		}
+		gm = mi->second;
 	}
-	guild_member gm = mi->second;
 
 	return base_permissions(gm);
 }
@@ -848,11 +929,15 @@ permission guild::permission_overwrites(const uint64_t base_permissions, const u
 		}
 	}
 
-	auto mi = members.find(user->id);
-	if (mi == members.end()) {
-		return 0;
+	guild_member gm;
+	{
+		std::shared_lock lock(lists_mutex);
+		auto mi = members.find(user->id);
+		if (mi == members.end()) {
+			return 0;
+		}
+		gm = mi->second;
 	}
-	guild_member gm = mi->second;
 
 	// Apply role specific overwrites.
 	uint64_t allow = 0;
@@ -946,7 +1031,11 @@ permission guild::permission_overwrites(const guild_member &member, const channe
 }
 
 bool guild::connect_member_voice(snowflake user_id, bool self_mute, bool self_deaf, bool dave) {
-	for (auto & c : channels) {
+	/* Copy the list, as channel::get_voice_members() locks the guild too */
+	std::vector<snowflake> channel_list = read([](const guild& g) {
+		return g.channels;
+	});
+	for (auto & c : channel_list) {
 		channel* ch = dpp::find_channel(c);
 		if (!ch || (!ch->is_voice_channel() && !ch->is_stage_channel())) {
 			continue;
@@ -1018,6 +1107,7 @@ std::string guild::get_splash_url(uint16_t size, const image_type format) const
 guild_member find_guild_member(const snowflake guild_id, const snowflake user_id) {
 	guild* g = find_guild(guild_id);
 	if (g) {
+		std::shared_lock lock(g->get_mutex());
 		auto gm = g->members.find(user_id);
 		if (gm != g->members.end()) {
 			return gm->second;
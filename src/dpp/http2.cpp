@@ -0,0 +1,1449 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <dpp/http2.h>
+#include <dpp/stringops.h>
+#include <algorithm>
+#include <array>
+#include <charconv>
+
+namespace dpp {
+
+namespace {
+
+/**
+ * @brief HPACK static table (RFC 7541 appendix A). Index 1 is the first entry.
+ */
+const std::array<hpack_field, hpack_table::static_entries> static_table {{
+	{":authority", ""},
+	{":method", "GET"},
+	{":method", "POST"},
+	{":path", "/"},
+	{":path", "/index.html"},
+	{":scheme", "http"},
+	{":scheme", "https"},
+	{":status", "200"},
+	{":status", "204"},
+	{":status", "206"},
+	{":status", "304"},
+	{":status", "400"},
+	{":status", "404"},
+	{":status", "500"},
+	{"accept-charset", ""},
+	{"accept-encoding", "gzip, deflate"},
+	{"accept-language", ""},
+	{"accept-ranges", ""},
+	{"accept", ""},
+	{"access-control-allow-origin", ""},
+	{"age", ""},
+	{"allow", ""},
+	{"authorization", ""},
+	{"cache-control", ""},
+	{"content-disposition", ""},
+	{"content-encoding", ""},
+	{"content-language", ""},
+	{"content-length", ""},
+	{"content-location", ""},
+	{"content-range", ""},
+	{"content-type", ""},
+	{"cookie", ""},
+	{"date", ""},
+	{"etag", ""},
+	{"expect", ""},
+	{"expires", ""},
+	{"from", ""},
+	{"host", ""},
+	{"if-match", ""},
+	{"if-modified-since", ""},
+	{"if-none-match", ""},
+	{"if-range", ""},
+	{"if-unmodified-since", ""},
+	{"last-modified", ""},
+	{"link", ""},
+	{"location", ""},
+	{"max-forwards", ""},
+	{"proxy-authenticate", ""},
+	{"proxy-authorization", ""},
+	{"range", ""},
+	{"referer", ""},
+	{"refresh", ""},
+	{"retry-after", ""},
+	{"server", ""},
+	{"set-cookie", ""},
+	{"strict-transport-security", ""},
+	{"transfer-encoding", ""},
+	{"user-agent", ""},
+	{"vary", ""},
+	{"via", ""},
+	{"www-authenticate", ""},
+}};
+
+/**
+ * @brief HPACK Huffman code (RFC 7541 appendix B) for each byte value: the code, right aligned, and its length in bits
+ */
+constexpr std::array<std::pair<uint32_t, uint8_t>, 256> huffman_codes {{
+	{0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28}, {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+	{0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28}, {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+	{0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28}, {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+	{0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28}, {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+	{0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12}, {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+	{0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11}, {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+	{0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6}, {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+	{0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8}, {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+	{0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+	{0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7}, {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+	{0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7}, {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+	{0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+	{0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+	{0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7}, {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+	{0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5}, {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+	{0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+	{0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20}, {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+	{0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+	{0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23}, {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+	{0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23}, {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+	{0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+	{0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24}, {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+	{0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21}, {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+	{0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22}, {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+	{0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19}, {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+	{0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27}, {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+	{0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27}, {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+	{0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+	{0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21}, {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+	{0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+	{0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+	{0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27}, {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+}};
+
+/**
+ * @brief Decoding table for the Huffman code. Codes of the same length are
+ * consecutive, so a code is found from the first code of its length.
+ */
+struct huffman_decode_table {
+	/**
+	 * @brief First code of each length
+	 */
+	std::array<uint32_t, 31> first{};
+
+	/**
+	 * @brief Number of codes of each length
+	 */
+	std::array<uint16_t, 31> count{};
+
+	/**
+	 * @brief Position in symbols of the first code of each length
+	 */
+	std::array<uint16_t, 31> offset{};
+
+	/**
+	 * @brief Byte values in order of code length, then code
+	 */
+	std::array<uint8_t, 256> symbols{};
+
+	huffman_decode_table() {
+		std::array<uint16_t, 256> order;
+		for (size_t i = 0; i < order.size(); ++i) {
+			order[i] = static_cast<uint16_t>(i);
+		}
+		std::sort(order.begin(), order.end(), [](uint16_t a, uint16_t b) {
+			return huffman_codes[a].second != huffman_codes[b].second ? huffman_codes[a].second < huffman_codes[b].second : huffman_codes[a].first < huffman_codes[b].first;
+		});
+		for (size_t i = 0; i < order.size(); ++i) {
+			const auto& [code, length] = huffman_codes[order[i]];
+			symbols[i] = static_cast<uint8_t>(order[i]);
+			if (count[length]++ == 0) {
+				first[length] = code;
+				offset[length] = static_cast<uint16_t>(i);
+			}
+		}
+	}
+};
+
+const huffman_decode_table huffman_decoding;
+
+/**
+ * @brief Client connection preface (RFC 9113 section 3.4)
+ */
+constexpr std::string_view connection_preface{"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"};
+
+/**
+ * @brief Frame types
+ */
+enum frame_type : uint8_t {
+	frame_data = 0x0,
+	frame_headers = 0x1,
+	frame_priority = 0x2,
+	frame_rst_stream = 0x3,
+	frame_settings = 0x4,
+	frame_push_promise = 0x5,
+	frame_ping = 0x6,
+	frame_goaway = 0x7,
+	frame_window_update = 0x8,
+	frame_continuation = 0x9,
+};
+
+/**
+ * @brief Frame flags
+ */
+enum frame_flags : uint8_t {
+	flag_end_stream = 0x1,
+	flag_ack = 0x1,
+	flag_end_headers = 0x4,
+	flag_padded = 0x8,
+	flag_priority = 0x20,
+};
+
+/**
+ * @brief SETTINGS parameters
+ */
+enum settings_parameter : uint16_t {
+	settings_header_table_size = 0x1,
+	settings_enable_push = 0x2,
+	settings_max_concurrent_streams = 0x3,
+	settings_initial_window_size = 0x4,
+	settings_max_frame_size = 0x5,
+};
+
+/**
+ * @brief Error codes, sent in RST_STREAM and GOAWAY
+ */
+enum h2_error : uint32_t {
+	h2_no_error = 0x0,
+	h2_protocol_error = 0x1,
+	h2_internal_error = 0x2,
+	h2_flow_control_error = 0x3,
+	h2_frame_size_error = 0x6,
+	h2_refused_stream = 0x7,
+	h2_cancel = 0x8,
+	h2_compression_error = 0x9,
+};
+
+/**
+ * @brief Size of a frame header
+ */
+constexpr size_t frame_header_size{9};
+
+/**
+ * @brief Largest frame payload, before the peer allows more. We never allow more,
+ * so this is also the largest frame we accept.
+ */
+constexpr uint32_t default_max_frame{16384};
+
+/**
+ * @brief Flow control window every endpoint starts with
+ */
+constexpr int64_t default_window{65535};
+
+/**
+ * @brief Largest flow control window allowed
+ */
+constexpr int64_t max_window{0x7fffffff};
+
+/**
+ * @brief Receive window we give each stream, large enough that a typical
+ * response never waits for a WINDOW_UPDATE
+ */
+constexpr uint32_t stream_receive_window{1024 * 1024};
+
+/**
+ * @brief Receive window we give the connection, shared by all of its streams
+ */
+constexpr uint32_t connection_receive_window{16 * 1024 * 1024};
+
+/**
+ * @brief Streams assumed to be allowed before the peer's SETTINGS arrive
+ */
+constexpr uint32_t default_max_streams{100};
+
+/**
+ * @brief Request body bytes queued each time the socket drains, spread across the streams
+ */
+constexpr size_t body_budget{64 * 1024};
+
+/**
+ * @brief Seconds a connection with no streams is kept open
+ */
+constexpr time_t idle_timeout{60};
+
+/**
+ * @brief Headers with no meaning in HTTP/2, which must not be sent (RFC 9113 section 8.2.2)
+ */
+constexpr std::array connection_headers {
+	std::string_view{"connection"},
+	std::string_view{"host"},
+	std::string_view{"keep-alive"},
+	std::string_view{"proxy-connection"},
+	std::string_view{"transfer-encoding"},
+	std::string_view{"upgrade"},
+	std::string_view{"content-length"},
+};
+
+void put_u32(std::string& out, uint32_t value) {
+	out += static_cast<char>((value >> 24) & 0xff);
+	out += static_cast<char>((value >> 16) & 0xff);
+	out += static_cast<char>((value >> 8) & 0xff);
+	out += static_cast<char>(value & 0xff);
+}
+
+uint32_t get_u32(std::string_view in) {
+	return (static_cast<uint32_t>(static_cast<uint8_t>(in[0])) << 24) | (static_cast<uint32_t>(static_cast<uint8_t>(in[1])) << 16) |
+		(static_cast<uint32_t>(static_cast<uint8_t>(in[2])) << 8) | static_cast<uint32_t>(static_cast<uint8_t>(in[3]));
+}
+
+std::string settings_entry(uint16_t id, uint32_t value) {
+	std::string entry;
+	entry += static_cast<char>(id >> 8);
+	entry += static_cast<char>(id & 0xff);
+	put_u32(entry, value);
+	return entry;
+}
+
+/**
+ * @brief Remove the padding of a DATA or HEADERS frame
+ * @param flags frame flags
+ * @param payload frame payload, changed to the data within the padding
+ * @return false if the padding is longer than the frame
+ */
+bool strip_padding(uint8_t flags, std::string_view& payload) {
+	if (!(flags & flag_padded)) {
+		return true;
+	}
+	if (payload.empty()) {
+		return false;
+	}
+	size_t padding = static_cast<uint8_t>(payload[0]);
+	if (padding >= payload.size()) {
+		return false;
+	}
+	payload = payload.substr(1, payload.size() - 1 - padding);
+	return true;
+}
+
+}
+
+hpack_table::hpack_table(size_t table_size) : size(0), max_size(table_size) {
+}
+
+void hpack_table::evict(size_t limit) {
+	while (size > limit && !entries.empty()) {
+		size -= entries.back().first.size() + entries.back().second.size() + 32;
+		entries.pop_back();
+	}
+}
+
+void hpack_table::add(std::string_view name, std::string_view value) {
+	const size_t entry_size = name.size() + value.size() + 32;
+	if (entry_size > max_size) {
+		evict(0);
+		return;
+	}
+	evict(max_size - entry_size);
+	entries.emplace_front(std::string(name), std::string(value));
+	size += entry_size;
+}
+
+const hpack_field* hpack_table::get(size_t index) const {
+	if (index == 0) {
+		return nullptr;
+	}
+	if (index <= static_entries) {
+		return &static_table[index - 1];
+	}
+	index -= static_entries + 1;
+	return index < entries.size() ? &entries[index] : nullptr;
+}
+
+size_t hpack_table::find(std::string_view name, std::string_view value, bool& exact) const {
+	size_t name_match = 0;
+	exact = false;
+	for (size_t i = 0; i < static_entries; ++i) {
+		if (static_table[i].first == name) {
+			if (static_table[i].second == value) {
+				exact = true;
+				return i + 1;
+			}
+			name_match = name_match ? name_match : i + 1;
+		}
+	}
+	for (size_t i = 0; i < entries.size(); ++i) {
+		if (entries[i].first == name) {
+			if (entries[i].second == value) {
+				exact = true;
+				return static_entries + i + 1;
+			}
+			name_match = name_match ? name_match : static_entries + i + 1;
+		}
+	}
+	return name_match;
+}
+
+void hpack_table::set_max_size(size_t table_size) {
+	max_size = table_size;
+	evict(max_size);
+}
+
+size_t hpack_table::get_max_size() const {
+	return max_size;
+}
+
+size_t hpack_table::get_size() const {
+	return size;
+}
+
+hpack_encoder::hpack_encoder() : size_update(false) {
+}
+
+void hpack_encoder::set_max_table_size(size_t table_size) {
+	/* The peer may allow a larger table, but there is no need for one */
+	table_size = std::min<size_t>(table_size, 4096);
+	if (table_size != table.get_max_size()) {
+		table.set_max_size(table_size);
+		size_update = true;
+	}
+}
+
+void hpack_encoder::append_integer(std::string& out, uint64_t value, uint8_t prefix_bits, uint8_t flags) {
+	const uint64_t limit = (1u << prefix_bits) - 1;
+	if (value < limit) {
+		out += static_cast<char>(flags | value);
+		return;
+	}
+	out += static_cast<char>(flags | limit);
+	value -= limit;
+	while (value >= 128) {
+		out += static_cast<char>((value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	out += static_cast<char>(value);
+}
+
+std::string hpack_encoder::huffman_encode(std::string_view s) {
+	std::string out;
+	out.reserve(s.size());
+	uint64_t bits = 0;
+	uint8_t pending = 0;
+	for (char c : s) {
+		const auto& [code, length] = huffman_codes[static_cast<uint8_t>(c)];
+		bits = (bits << length) | code;
+		pending += length;
+		while (pending >= 8) {
+			pending -= 8;
+			out += static_cast<char>(bits >> pending);
+		}
+		bits &= (uint64_t{1} << pending) - 1;
+	}
+	if (pending) {
+		/* Padded with the most significant bits of the end of string code, which are all ones */
+		out += static_cast<char>((bits << (8 - pending)) | ((1u << (8 - pending)) - 1));
+	}
+	return out;
+}
+
+void hpack_encoder::append_string(std::string& out, std::string_view s) {
+	std::string coded = huffman_encode(s);
+	if (coded.size() < s.size()) {
+		append_integer(out, coded.size(), 7, 0x80);
+		out += coded;
+	} else {
+		append_integer(out, s.size(), 7, 0x00);
+		out += s;
+	}
+}
+
+std::string hpack_encoder::encode(const std::vector<hpack_field>& fields) {
+	std::string out;
+	if (size_update) {
+		append_integer(out, table.get_max_size(), 5, 0x20);
+		size_update = false;
+	}
+	for (auto& [name, value] : fields) {
+		bool exact = false;
+		size_t index = table.find(name, value, exact);
+		if (exact) {
+			append_integer(out, index, 7, 0x80);
+			continue;
+		}
+		/* Values which change on nearly every request would only push useful entries out of the table */
+		const bool indexed = name != ":path" && name != "content-length" && name.size() + value.size() + 32 <= table.get_max_size() / 2;
+		append_integer(out, index, indexed ? 6 : 4, indexed ? 0x40 : 0x00);
+		if (index == 0) {
+			append_string(out, name);
+		}
+		append_string(out, value);
+		if (indexed) {
+			table.add(name, value);
+		}
+	}
+	return out;
+}
+
+hpack_decoder::hpack_decoder(size_t table_size) : table(table_size), max_allowed(table_size) {
+}
+
+bool hpack_decoder::read_integer(std::string_view block, size_t& pos, uint8_t prefix_bits, uint64_t& value) {
+	if (pos >= block.size()) {
+		return false;
+	}
+	const uint64_t limit = (1u << prefix_bits) - 1;
+	value = static_cast<uint8_t>(block[pos++]) & limit;
+	if (value < limit) {
+		return true;
+	}
+	for (uint8_t shift = 0; pos < block.size(); shift += 7) {
+		if (shift > 56) {
+			return false;
+		}
+		uint8_t b = static_cast<uint8_t>(block[pos++]);
+		value += static_cast<uint64_t>(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool hpack_decoder::huffman_decode(std::string_view s, std::string& out) {
+	uint32_t code = 0;
+	uint8_t length = 0;
+	for (char c : s) {
+		for (int bit = 7; bit >= 0; --bit) {
+			code = (code << 1) | ((static_cast<uint8_t>(c) >> bit) & 1);
+			if (++length > 30) {
+				/* Longer than any code, including end of string, which must not appear */
+				return false;
+			}
+			const uint32_t first = huffman_decoding.first[length];
+			if (huffman_decoding.count[length] && code >= first && code - first < huffman_decoding.count[length]) {
+				out += static_cast<char>(huffman_decoding.symbols[huffman_decoding.offset[length] + code - first]);
+				code = 0;
+				length = 0;
+			}
+		}
+	}
+	/* Anything left over must be padding: fewer than 8 bits, all ones */
+	return length < 8 && code == (1u << length) - 1;
+}
+
+bool hpack_decoder::read_string(std::string_view block, size_t& pos, std::string& out) {
+	if (pos >= block.size()) {
+		return false;
+	}
+	const bool huffman = static_cast<uint8_t>(block[pos]) & 0x80;
+	uint64_t length = 0;
+	if (!read_integer(block, pos, 7, length) || length > block.size() - pos) {
+		return false;
+	}
+	std::string_view s = block.substr(pos, length);
+	pos += length;
+	out.clear();
+	if (huffman) {
+		return huffman_decode(s, out);
+	}
+	out.assign(s);
+	return true;
+}
+
+bool hpack_decoder::decode(std::string_view block, std::vector<hpack_field>& fields) {
+	size_t pos = 0;
+	while (pos < block.size()) {
+		const uint8_t b = static_cast<uint8_t>(block[pos]);
+		uint64_t index = 0;
+		if (b & 0x80) {
+			/* Indexed field */
+			if (!read_integer(block, pos, 7, index)) {
+				return false;
+			}
+			const hpack_field* field = table.get(index);
+			if (!field) {
+				return false;
+			}
+			fields.emplace_back(*field);
+			continue;
+		}
+		if ((b & 0xe0) == 0x20) {
+			/* Dynamic table size update */
+			if (!read_integer(block, pos, 5, index) || index > max_allowed) {
+				return false;
+			}
+			table.set_max_size(index);
+			continue;
+		}
+		/* Literal field, with incremental indexing, without indexing, or never indexed */
+		const bool indexed = (b & 0xc0) == 0x40;
+		if (!read_integer(block, pos, indexed ? 6 : 4, index)) {
+			return false;
+		}
+		hpack_field field;
+		if (index) {
+			const hpack_field* name = table.get(index);
+			if (!name) {
+				return false;
+			}
+			field.first = name->first;
+		} else if (!read_string(block, pos, field.first)) {
+			return false;
+		}
+		if (!read_string(block, pos, field.second)) {
+			return false;
+		}
+		if (indexed) {
+			table.add(field.first, field.second);
+		}
+		fields.emplace_back(std::move(field));
+	}
+	return true;
+}
+
+http2_stream::http2_stream()
+	: connection(nullptr),
+	id(0),
+	send_window(0),
+	body_sent(0),
+	unacknowledged(0),
+	headers_received(false),
+	finished(false),
+	status(0),
+	port(443),
+	plaintext(false),
+	path("/"),
+	request_timeout(5),
+	deadline(0),
+	timed_out(false),
+	aborted(false),
+	retry(false)
+{
+}
+
+uint64_t http2_stream::body_length() const {
+	return streaming.source ? streaming.source_length : body.size();
+}
+
+void http2_stream::finish() {
+	if (finished) {
+		return;
+	}
+	finished = true;
+	connection = nullptr;
+	if (completion) {
+		completion(this);
+	}
+}
+
+const std::string http2_stream::get_header(std::string header_name) const {
+	auto h = response_headers.find(lowercase(header_name));
+	return h == response_headers.end() ? "" : h->second;
+}
+
+const std::multimap<std::string, std::string> http2_stream::get_headers() const {
+	return response_headers;
+}
+
+const std::string http2_stream::get_content() const {
+	return content;
+}
+
+uint16_t http2_stream::get_status() const {
+	return status;
+}
+
+uint64_t http2_stream::get_received_length() const {
+	return decoder.get_received_length();
+}
+
+uint64_t http2_stream::get_decoded_length() const {
+	return decoder.get_decoded_length();
+}
+
+uint32_t http2_stream::get_id() const {
+	return id;
+}
+
+http2_connection::http2_connection(socket_engine_base* e, http2_pool* pool, const std::string& hostname, uint16_t port, bool plaintext)
+	: ssl_client(hostname, std::to_string(port), plaintext, false, nullptr, false),
+	owner(pool),
+	ready(false),
+	closed(false),
+	going_away(false),
+	parsing(false),
+	next_stream_id(1),
+	send_window(default_window),
+	peer_initial_window(default_window),
+	peer_max_frame(default_max_frame),
+	peer_max_streams(default_max_streams),
+	unacknowledged(0),
+	continuation_stream(0),
+	continuation_end_stream(false),
+	idle_since(time(nullptr)),
+	peak_streams(0)
+{
+	keepalive = false;
+	/* Offer HTTP/2, and HTTP/1.1 so that a server without it can tell us so */
+	alpn_protocols = std::string("\x02h2\x08http/1.1", 12);
+	connect_async(e, [this](bool success, const std::string& error) {
+		connected(success, error);
+	});
+}
+
+http2_connection::~http2_connection() {
+	detach_engine();
+}
+
+void http2_connection::connected(bool success, const std::string& error) {
+	if (!success) {
+		log(ll_error, "HTTP/2 connection to " + hostname + ":" + port + " failed: " + error);
+		shut_down(false);
+		return;
+	}
+	if (!plaintext && get_alpn_protocol() != "h2") {
+		/* Requests to this host are made with HTTP/1.1 from now on */
+		owner->set_http1(http2_pool::make_key(hostname, static_cast<uint16_t>(std::stoul(port)), plaintext));
+		shut_down(true);
+		return;
+	}
+	ready = true;
+	out += connection_preface;
+	frame(frame_settings, 0, 0, settings_entry(settings_enable_push, 0) + settings_entry(settings_initial_window_size, stream_receive_window));
+	std::string increment;
+	put_u32(increment, connection_receive_window - default_window);
+	frame(frame_window_update, 0, 0, increment);
+	/* Requests may be sent straight after the preface, without waiting for the server's settings */
+	open_streams();
+	flush();
+}
+
+void http2_connection::frame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload) {
+	const uint32_t length = static_cast<uint32_t>(payload.size());
+	out += static_cast<char>((length >> 16) & 0xff);
+	out += static_cast<char>((length >> 8) & 0xff);
+	out += static_cast<char>(length & 0xff);
+	out += static_cast<char>(type);
+	out += static_cast<char>(flags);
+	put_u32(out, stream_id & 0x7fffffff);
+	out += payload;
+}
+
+void http2_connection::flush() {
+	if (!out.empty() && sfd != INVALID_SOCKET) {
+		socket_write(out);
+	}
+	out.clear();
+}
+
+void http2_connection::submit(const std::shared_ptr<http2_stream>& s) {
+	if (closed || going_away) {
+		s->retry = going_away;
+		s->finish();
+		return;
+	}
+	s->connection = this;
+	pending.emplace_back(s);
+	if (ready) {
+		open_streams();
+		flush();
+	}
+}
+
+void http2_connection::cancel(const std::shared_ptr<http2_stream>& s) {
+	if (s->finished || s->connection != this) {
+		return;
+	}
+	s->aborted = true;
+	auto open = streams.find(s->id);
+	if (s->id && open != streams.end()) {
+		reset(s->id, h2_cancel);
+		open_streams();
+		flush();
+		return;
+	}
+	pending.erase(std::remove(pending.begin(), pending.end(), s), pending.end());
+	s->finish();
+}
+
+void http2_connection::open_streams() {
+	while (ready && !going_away && !pending.empty() && streams.size() < peer_max_streams) {
+		std::shared_ptr<http2_stream> s = std::move(pending.front());
+		pending.pop_front();
+		send_headers(s);
+	}
+	if (going_away && !pending.empty()) {
+		/* Never to be opened here, but they can be sent on another connection */
+		std::deque<std::shared_ptr<http2_stream>> waiting;
+		waiting.swap(pending);
+		for (auto& s : waiting) {
+			s->retry = true;
+			s->finish();
+		}
+	}
+	send_bodies();
+}
+
+void http2_connection::send_headers(const std::shared_ptr<http2_stream>& s) {
+	const uint64_t length = s->body_length();
+	std::vector<hpack_field> fields {
+		{":method", s->method},
+		{":scheme", plaintext ? "http" : "https"},
+		{":authority", s->hostname + (s->port == (plaintext ? 80 : 443) ? "" : ":" + std::to_string(s->port))},
+		{":path", s->path.empty() ? "/" : s->path},
+	};
+	bool accept_encoding = false;
+	for (auto& [k, v] : s->headers) {
+		std::string name = lowercase(k);
+		if (std::find(connection_headers.begin(), connection_headers.end(), name) != connection_headers.end()) {
+			continue;
+		}
+		accept_encoding = accept_encoding || name == "accept-encoding";
+		fields.emplace_back(std::move(name), v);
+	}
+	if (!accept_encoding) {
+		/* Decoded by the stream's http_body_decoder as the body arrives */
+		fields.emplace_back("accept-encoding", "gzip, deflate");
+	}
+	if (length || s->method == "POST" || s->method == "PUT" || s->method == "PATCH") {
+		fields.emplace_back("content-length", std::to_string(length));
+	}
+	std::string block = encoder.encode(fields);
+
+	s->id = next_stream_id;
+	s->send_window = peer_initial_window;
+	next_stream_id += 2;
+	if (next_stream_id > max_window) {
+		/* Stream identifiers are used up, new requests need a new connection */
+		going_away = true;
+	}
+	streams.emplace(s->id, s);
+	peak_streams = std::max(peak_streams, streams.size());
+	owner->record_peak(peak_streams);
+
+	/* Split into a HEADERS frame and as many CONTINUATION frames as the peer's frame size needs */
+	std::string_view rest = block;
+	uint8_t type = frame_headers;
+	uint8_t flags = length == 0 ? flag_end_stream : 0;
+	do {
+		std::string_view piece = rest.substr(0, peer_max_frame);
+		rest.remove_prefix(piece.size());
+		frame(type, flags | (rest.empty() ? flag_end_headers : 0), s->id, piece);
+		type = frame_continuation;
+		flags = 0;
+	} while (!rest.empty());
+}
+
+void http2_connection::send_bodies() {
+	size_t budget = body_budget;
+	std::vector<uint32_t> sending;
+	for (auto& [stream_id, s] : streams) {
+		if (s->body_sent < s->body_length()) {
+			sending.push_back(stream_id);
+		}
+	}
+	for (uint32_t stream_id : sending) {
+		auto s = streams.find(stream_id);
+		if (budget == 0 || send_window <= 0) {
+			break;
+		}
+		if (s != streams.end() && !send_body(*s->second, budget)) {
+			reset(stream_id, h2_cancel);
+		}
+	}
+}
+
+bool http2_connection::send_body(http2_stream& s, size_t& budget) {
+	const uint64_t length = s.body_length();
+	std::string piece;
+	while (s.body_sent < length && budget > 0) {
+		const int64_t window = std::min(s.send_window, send_window);
+		if (window <= 0) {
+			break;
+		}
+		const size_t want = static_cast<size_t>(std::min<uint64_t>({length - s.body_sent, static_cast<uint64_t>(window), peer_max_frame, budget}));
+		std::string_view data;
+		if (s.streaming.source) {
+			piece.resize(want);
+			const size_t got = std::min(s.streaming.source(piece.data(), want), want);
+			if (got == 0) {
+				/* The source ended before the length it gave, so the request can't be completed */
+				log(ll_error, "Request body source ended " + std::to_string(length - s.body_sent) + " bytes early");
+				return false;
+			}
+			data = std::string_view(piece.data(), got);
+		} else {
+			data = std::string_view(s.body).substr(s.body_sent, want);
+		}
+		s.body_sent += data.size();
+		s.send_window -= data.size();
+		send_window -= data.size();
+		budget -= data.size();
+		frame(frame_data, s.body_sent == length ? flag_end_stream : 0, s.id, data);
+	}
+	return true;
+}
+
+void http2_connection::on_write_drained() {
+	if (!closed) {
+		send_bodies();
+		flush();
+	}
+}
+
+bool http2_connection::handle_buffer(std::string& buffer) {
+	parsing = true;
+	size_t pos = 0;
+	bool ok = true;
+	while (ok && buffer.size() - pos >= frame_header_size) {
+		std::string_view header(buffer.data() + pos, frame_header_size);
+		const uint32_t length = (static_cast<uint32_t>(static_cast<uint8_t>(header[0])) << 16) | (static_cast<uint32_t>(static_cast<uint8_t>(header[1])) << 8) | static_cast<uint8_t>(header[2]);
+		if (length > default_max_frame) {
+			connection_error(h2_frame_size_error, "Frame of " + std::to_string(length) + " bytes is larger than allowed");
+			ok = false;
+			break;
+		}
+		if (buffer.size() - pos < frame_header_size + length) {
+			break;
+		}
+		const uint8_t type = static_cast<uint8_t>(header[3]);
+		const uint8_t flags = static_cast<uint8_t>(header[4]);
+		const uint32_t stream_id = get_u32(header.substr(5)) & 0x7fffffff;
+		std::string_view payload(buffer.data() + pos + frame_header_size, length);
+		pos += frame_header_size + length;
+		ok = handle_frame(type, flags, stream_id, payload) && !closed;
+	}
+	parsing = false;
+	if (!ok || closed) {
+		/* The socket is closed by on_disconnect(), once the read has finished with the buffer */
+		return false;
+	}
+	buffer.erase(0, pos);
+	flush();
+	/* A server which has gone away closes once its last stream completes */
+	return !(going_away && streams.empty());
+}
+
+bool http2_connection::handle_frame(uint8_t type, uint8_t flags, uint32_t stream_id, std::string_view payload) {
+	if (continuation_stream && (type != frame_continuation || stream_id != continuation_stream)) {
+		connection_error(h2_protocol_error, "Header block interrupted by another frame");
+		return false;
+	}
+	switch (type) {
+		case frame_data: {
+			if (stream_id == 0) {
+				connection_error(h2_protocol_error, "DATA frame on stream 0");
+				return false;
+			}
+			/* Padding counts against flow control, so the whole frame is acknowledged */
+			unacknowledged += static_cast<uint32_t>(payload.size());
+			if (unacknowledged >= connection_receive_window / 2) {
+				std::string increment;
+				put_u32(increment, unacknowledged);
+				frame(frame_window_update, 0, 0, increment);
+				unacknowledged = 0;
+			}
+			const size_t frame_length = payload.size();
+			if (!strip_padding(flags, payload)) {
+				connection_error(h2_protocol_error, "Invalid padding");
+				return false;
+			}
+			auto s = streams.find(stream_id);
+			if (s == streams.end()) {
+				/* Reset or timed out, and the server has not yet seen it */
+				return true;
+			}
+			http2_stream& stream = *s->second;
+			if (!stream.headers_received) {
+				reset(stream_id, h2_protocol_error);
+				return true;
+			}
+			if (!stream.decoder.append(payload, stream.content, stream.streaming.sink)) {
+				log(ll_error, "Can't decode response body on stream " + std::to_string(stream_id));
+				reset(stream_id, h2_internal_error);
+				return true;
+			}
+			if (flags & flag_end_stream) {
+				complete(stream_id);
+				return true;
+			}
+			stream.unacknowledged += static_cast<uint32_t>(frame_length);
+			if (stream.unacknowledged >= stream_receive_window / 2) {
+				std::string increment;
+				put_u32(increment, stream.unacknowledged);
+				frame(frame_window_update, 0, stream_id, increment);
+				stream.unacknowledged = 0;
+			}
+			return true;
+		}
+		case frame_headers: {
+			if (stream_id == 0) {
+				connection_error(h2_protocol_error, "HEADERS frame on stream 0");
+				return false;
+			}
+			if (!strip_padding(flags, payload)) {
+				connection_error(h2_protocol_error, "Invalid padding");
+				return false;
+			}
+			if (flags & flag_priority) {
+				if (payload.size() < 5) {
+					connection_error(h2_frame_size_error, "HEADERS frame too short for its priority");
+					return false;
+				}
+				payload.remove_prefix(5);
+			}
+			if (flags & flag_end_headers) {
+				return handle_headers(stream_id, payload, flags & flag_end_stream);
+			}
+			continuation_stream = stream_id;
+			continuation_end_stream = flags & flag_end_stream;
+			header_block.assign(payload);
+			return true;
+		}
+		case frame_continuation: {
+			if (!continuation_stream) {
+				connection_error(h2_protocol_error, "CONTINUATION frame without a header block");
+				return false;
+			}
+			header_block.append(payload);
+			if (!(flags & flag_end_headers)) {
+				return true;
+			}
+			std::string block;
+			block.swap(header_block);
+			continuation_stream = 0;
+			return handle_headers(stream_id, block, continuation_end_stream);
+		}
+		case frame_rst_stream: {
+			if (stream_id == 0 || payload.size() != 4) {
+				connection_error(h2_protocol_error, "Invalid RST_STREAM frame");
+				return false;
+			}
+			auto s = streams.find(stream_id);
+			if (s != streams.end()) {
+				std::shared_ptr<http2_stream> stream = std::move(s->second);
+				streams.erase(s);
+				/* A refused stream was not processed at all, and can be sent again */
+				stream->retry = get_u32(payload) == h2_refused_stream;
+				stream->finish();
+				open_streams();
+			}
+			return true;
+		}
+		case frame_settings:
+			return handle_settings(flags, payload);
+		case frame_push_promise:
+			/* Push is disabled in our settings, so the server must not push */
+			connection_error(h2_protocol_error, "PUSH_PROMISE received with push disabled");
+			return false;
+		case frame_ping: {
+			if (stream_id != 0 || payload.size() != 8) {
+				connection_error(h2_protocol_error, "Invalid PING frame");
+				return false;
+			}
+			if (!(flags & flag_ack)) {
+				frame(frame_ping, flag_ack, 0, payload);
+			}
+			return true;
+		}
+		case frame_goaway: {
+			if (stream_id != 0 || payload.size() < 8) {
+				connection_error(h2_protocol_error, "Invalid GOAWAY frame");
+				return false;
+			}
+			const uint32_t last_stream = get_u32(payload) & 0x7fffffff;
+			const uint32_t error_code = get_u32(payload.substr(4));
+			if (error_code != h2_no_error) {
+				log(ll_warning, "HTTP/2 server " + hostname + " is going away, error " + std::to_string(error_code) + ": " + std::string(payload.substr(8)));
+			}
+			going_away = true;
+			/* Streams after the last one the server will process were never seen, and can be sent again */
+			std::vector<std::shared_ptr<http2_stream>> unprocessed;
+			for (auto s = streams.upper_bound(last_stream); s != streams.end(); s = streams.erase(s)) {
+				unprocessed.emplace_back(std::move(s->second));
+			}
+			for (auto& s : pending) {
+				unprocessed.emplace_back(std::move(s));
+			}
+			pending.clear();
+			for (auto& s : unprocessed) {
+				s->retry = true;
+				s->finish();
+			}
+			return true;
+		}
+		case frame_window_update: {
+			if (payload.size() != 4) {
+				connection_error(h2_frame_size_error, "Invalid WINDOW_UPDATE frame");
+				return false;
+			}
+			const uint32_t increment = get_u32(payload) & 0x7fffffff;
+			if (stream_id == 0) {
+				if (increment == 0 || send_window + increment > max_window) {
+					connection_error(h2_flow_control_error, "Invalid connection window update");
+					return false;
+				}
+				send_window += increment;
+			} else {
+				auto s = streams.find(stream_id);
+				if (s == streams.end()) {
+					return true;
+				}
+				if (increment == 0 || s->second->send_window + increment > max_window) {
+					reset(stream_id, h2_flow_control_error);
+					return true;
+				}
+				s->second->send_window += increment;
+			}
+			send_bodies();
+			return true;
+		}
+		default:
+			/* PRIORITY, and frame types we do not know, which must be ignored */
+			return true;
+	}
+}
+
+bool http2_connection::handle_headers(uint32_t stream_id, std::string_view block, bool end_stream) {
+	/* Decoded even if the stream is gone, to keep the table in step with the server's */
+	std::vector<hpack_field> fields;
+	if (!decoder.decode(block, fields)) {
+		connection_error(h2_compression_error, "Malformed header block");
+		return false;
+	}
+	auto s = streams.find(stream_id);
+	if (s == streams.end()) {
+		return true;
+	}
+	http2_stream& stream = *s->second;
+	const bool first_response = !stream.headers_received;
+	if (first_response) {
+		uint16_t status = 0;
+		for (auto& [name, value] : fields) {
+			if (name == ":status") {
+				std::from_chars(value.data(), value.data() + value.size(), status);
+			}
+		}
+		if (status < 100) {
+			reset(stream_id, h2_protocol_error);
+			return true;
+		}
+		if (status < 200) {
+			/* Informational, the real response follows */
+			return true;
+		}
+		stream.status = status;
+		stream.headers_received = true;
+	}
+	/* The response headers, or trailers, which are added to them */
+	for (auto& [name, value] : fields) {
+		if (name.empty() || name[0] != ':') {
+			stream.response_headers.emplace(name, value);
+		}
+	}
+	auto encoding = stream.response_headers.find("content-encoding");
+	if (first_response && !end_stream && encoding != stream.response_headers.end() && !stream.decoder.start(encoding->second)) {
+		log(ll_error, "Can't decode response body on stream " + std::to_string(stream_id));
+		reset(stream_id, h2_internal_error);
+		return true;
+	}
+	if (end_stream) {
+		complete(stream_id);
+	}
+	return true;
+}
+
+bool http2_connection::handle_settings(uint8_t flags, std::string_view payload) {
+	if (flags & flag_ack) {
+		return true;
+	}
+	if (payload.size() % 6 != 0) {
+		connection_error(h2_frame_size_error, "Invalid SETTINGS frame");
+		return false;
+	}
+	for (size_t i = 0; i < payload.size(); i += 6) {
+		const uint16_t id = static_cast<uint16_t>((static_cast<uint8_t>(payload[i]) << 8) | static_cast<uint8_t>(payload[i + 1]));
+		const uint32_t value = get_u32(payload.substr(i + 2));
+		switch (id) {
+			case settings_header_table_size:
+				encoder.set_max_table_size(value);
+				break;
+			case settings_max_concurrent_streams:
+				peer_max_streams = value;
+				break;
+			case settings_initial_window_size: {
+				if (value > max_window) {
+					connection_error(h2_flow_control_error, "Invalid initial window size");
+					return false;
+				}
+				/* Open streams' windows move by the change (RFC 9113 section 6.9.2) */
+				const int64_t delta = static_cast<int64_t>(value) - peer_initial_window;
+				peer_initial_window = value;
+				for (auto& [stream_id, s] : streams) {
+					s->send_window += delta;
+				}
+				break;
+			}
+			case settings_max_frame_size:
+				if (value < default_max_frame || value > 0xffffff) {
+					connection_error(h2_protocol_error, "Invalid maximum frame size");
+					return false;
+				}
+				peer_max_frame = value;
+				break;
+			default:
+				break;
+		}
+	}
+	frame(frame_settings, flag_ack, 0, {});
+	open_streams();
+	return true;
+}
+
+void http2_connection::complete(uint32_t stream_id) {
+	auto s = streams.find(stream_id);
+	if (s == streams.end()) {
+		return;
+	}
+	std::shared_ptr<http2_stream> stream = std::move(s->second);
+	streams.erase(s);
+	if (streams.empty()) {
+		idle_since = time(nullptr);
+	}
+	stream->finish();
+	open_streams();
+}
+
+void http2_connection::reset(uint32_t stream_id, uint32_t error_code) {
+	std::string code;
+	put_u32(code, error_code);
+	frame(frame_rst_stream, 0, stream_id, code);
+	auto s = streams.find(stream_id);
+	if (s == streams.end()) {
+		return;
+	}
+	std::shared_ptr<http2_stream> stream = std::move(s->second);
+	streams.erase(s);
+	if (streams.empty()) {
+		idle_since = time(nullptr);
+	}
+	stream->finish();
+}
+
+void http2_connection::connection_error(uint32_t error_code, const std::string& reason) {
+	log(ll_error, "HTTP/2 connection to " + hostname + " failed: " + reason);
+	std::string payload;
+	put_u32(payload, streams.empty() ? 0 : streams.rbegin()->first);
+	put_u32(payload, error_code);
+	frame(frame_goaway, 0, 0, payload);
+	flush();
+	shut_down(next_stream_id > 1);
+}
+
+void http2_connection::shut_down(bool retry_pending) {
+	if (closed) {
+		return;
+	}
+	closed = true;
+	ready = false;
+	if (!parsing) {
+		ssl_client::close();
+	}
+	std::map<uint32_t, std::shared_ptr<http2_stream>> open;
+	open.swap(streams);
+	std::deque<std::shared_ptr<http2_stream>> waiting;
+	waiting.swap(pending);
+	for (auto& [stream_id, s] : open) {
+		/* The server may have processed these, so they can't be sent again */
+		s->finish();
+	}
+	for (auto& s : waiting) {
+		s->retry = retry_pending;
+		s->finish();
+	}
+	owner->connection_closed();
+}
+
+void http2_connection::on_disconnect() {
+	/* Streams not yet sent are sent again elsewhere, unless the connection never worked at all */
+	shut_down(next_stream_id > 1);
+	ssl_client::close();
+}
+
+void http2_connection::one_second_timer() {
+	if (closed || is_connecting()) {
+		return;
+	}
+	const time_t now = time(nullptr);
+	std::vector<uint32_t> expired;
+	for (auto& [stream_id, s] : streams) {
+		if (s->deadline && now >= s->deadline) {
+			expired.push_back(stream_id);
+		}
+	}
+	for (uint32_t stream_id : expired) {
+		streams[stream_id]->timed_out = true;
+		reset(stream_id, h2_cancel);
+	}
+	for (auto s = pending.begin(); s != pending.end();) {
+		if ((*s)->deadline && now >= (*s)->deadline) {
+			std::shared_ptr<http2_stream> stream = std::move(*s);
+			s = pending.erase(s);
+			stream->timed_out = true;
+			stream->finish();
+		} else {
+			++s;
+		}
+	}
+	if (!expired.empty()) {
+		open_streams();
+	}
+	flush();
+	if (streams.empty() && (going_away || (pending.empty() && now - idle_since >= idle_timeout))) {
+		shut_down(true);
+	}
+}
+
+size_t http2_connection::get_load() const {
+	return streams.size() + pending.size();
+}
+
+uint32_t http2_connection::get_max_streams() const {
+	return peer_max_streams;
+}
+
+size_t http2_connection::get_peak_streams() const {
+	return peak_streams;
+}
+
+bool http2_connection::is_accepting() const {
+	return !closed && !going_away;
+}
+
+bool http2_connection::is_closed() const {
+	return closed;
+}
+
+http2_pool::http2_pool(socket_engine_base* e, uint32_t max_connections) : engine(e), max_connections_per_host(std::max<uint32_t>(max_connections, 1)), ticker_id(0) {
+	ticker_id = engine->add_ticker([this]() {
+		prune();
+	});
+}
+
+http2_pool::~http2_pool() {
+	engine->run_sync([this]() {
+		engine->remove_ticker(ticker_id);
+		/* Destroyed without completing their streams, whose owners have already gone */
+		connections.clear();
+	});
+}
+
+std::string http2_pool::make_key(const std::string& hostname, uint16_t port, bool plaintext) {
+	return (!plaintext ? "h2://" : "h2c://") + hostname + ":" + std::to_string(port);
+}
+
+void http2_pool::submit(const std::shared_ptr<http2_stream>& s) {
+	s->deadline = time(nullptr) + s->request_timeout;
+	streams++;
+	engine->post([this, s]() {
+		dispatch(s);
+	});
+}
+
+void http2_pool::cancel(const std::shared_ptr<http2_stream>& s) {
+	auto work = [s]() {
+		if (s->connection) {
+			s->connection->cancel(s);
+		}
+	};
+	if (engine->on_engine_thread()) {
+		work();
+	} else {
+		engine->post(work);
+	}
+}
+
+void http2_pool::dispatch(const std::shared_ptr<http2_stream>& s) {
+	const std::string key = make_key(s->hostname, s->port, s->plaintext);
+	if (is_http1(s->hostname, s->port, s->plaintext)) {
+		s->retry = true;
+		s->finish();
+		return;
+	}
+	auto& list = connections[key];
+	http2_connection* best = nullptr;
+	uint32_t accepting = 0;
+	for (auto& c : list) {
+		if (c->is_accepting()) {
+			accepting++;
+			if (!best || c->get_load() < best->get_load()) {
+				best = c.get();
+			}
+		}
+	}
+	if (!best || (best->get_load() >= best->get_max_streams() && accepting < max_connections_per_host)) {
+		list.emplace_back(std::make_unique<http2_connection>(engine, this, s->hostname, s->port, s->plaintext));
+		connections_opened++;
+		open_connections++;
+		best = list.back().get();
+	}
+	best->submit(s);
+}
+
+void http2_pool::set_http1(const std::string& key) {
+	std::lock_guard lock(hosts_mutex);
+	http1_hosts.emplace(key);
+}
+
+bool http2_pool::is_http1(const std::string& hostname, uint16_t port, bool plaintext) const {
+	std::lock_guard lock(hosts_mutex);
+	return http1_hosts.find(make_key(hostname, port, plaintext)) != http1_hosts.end();
+}
+
+void http2_pool::connection_closed() {
+	open_connections--;
+}
+
+void http2_pool::record_peak(size_t open_streams) {
+	uint64_t peak = peak_streams.load();
+	while (open_streams > peak && !peak_streams.compare_exchange_weak(peak, open_streams)) {
+	}
+}
+
+void http2_pool::prune() {
+	for (auto list = connections.begin(); list != connections.end();) {
+		auto& conns = list->second;
+		conns.erase(std::remove_if(conns.begin(), conns.end(), [](const std::unique_ptr<http2_connection>& c) {
+			return c->is_closed();
+		}), conns.end());
+		list = conns.empty() ? connections.erase(list) : std::next(list);
+	}
+}
+
+http2_pool& http2_pool::set_max_connections_per_host(uint32_t max_connections) {
+	max_connections_per_host = std::max<uint32_t>(max_connections, 1);
+	return *this;
+}
+
+http2_pool_stats http2_pool::get_stats() const {
+	http2_pool_stats stats;
+	stats.connections_opened = connections_opened;
+	stats.connections = open_connections;
+	stats.streams = streams;
+	stats.peak_streams = peak_streams;
+	return stats;
+}
+
+}
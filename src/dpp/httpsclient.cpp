@@ -25,91 +25,414 @@
 #include <algorithm>
 #include <stdlib.h>
 #include <climits>
+#include <charconv>
+#include <cstring>
+#include <memory>
 #include <dpp/httpsclient.h>
 #include <dpp/utility.h>
+#include <dpp/exception.h>
+#include <zlib.h>
 
 namespace dpp {
 
-https_client::https_client(const std::string &hostname, uint16_t port,  const std::string &urlpath, const std::string &verb, const std::string &req_body, const http_headers& extra_headers, bool plaintext_connection, uint16_t request_timeout, const std::string &protocol)
-	: ssl_client(hostname, std::to_string(port), plaintext_connection, false),
+/**
+ * @brief Most of a streamed request body read from its source at once, one ssl_client output chunk
+ */
+constexpr size_t source_piece_size{16 * 1024};
+
+https_client::https_client(const std::string &hostname, uint16_t port,  const std::string &urlpath, const std::string &verb, const std::string &req_body, const http_headers& extra_headers, bool plaintext_connection, uint16_t request_timeout, const std::string &protocol, connection_pool* connections, const https_streaming& streaming)
+	: ssl_client(hostname, std::to_string(port), plaintext_connection, connections != nullptr, connections),
 	state(HTTPS_HEADERS),
 	request_type(verb),
 	path(urlpath),
 	request_body(req_body),
+	body_source(streaming.source),
+	body_source_length(streaming.source ? streaming.source_length : 0),
+	body_source_sent(0),
+	body_sink(streaming.sink),
 	content_length(0),
 	request_headers(extra_headers),
 	status(0),
 	http_protocol(protocol),
 	timeout(request_timeout),
-	timed_out(false)
+	finished(false),
+	timed_out(false),
+	aborted(false)
 {
 	nonblocking = false;
 	timeout = time(nullptr) + request_timeout;
 	https_client::connect();
 }
 
-void https_client::connect()
+https_client::https_client(socket_engine_base* e, const std::string &hostname, uint16_t port,  const std::string &urlpath, const std::string &verb, const std::string &req_body, const http_headers& extra_headers, bool plaintext_connection, uint16_t request_timeout, const std::string &protocol, connection_pool* connections, const https_client_completion_t& done, const https_streaming& streaming)
+	: ssl_client(hostname, std::to_string(port), plaintext_connection, connections != nullptr, connections, false),
+	state(HTTPS_HEADERS),
+	request_type(verb),
+	path(urlpath),
+	request_body(req_body),
+	body_source(streaming.source),
+	body_source_length(streaming.source ? streaming.source_length : 0),
+	body_source_sent(0),
+	body_sink(streaming.sink),
+	content_length(0),
+	request_headers(extra_headers),
+	status(0),
+	http_protocol(protocol),
+	timeout(time(nullptr) + request_timeout),
+	completion(done),
+	finished(false),
+	timed_out(false),
+	aborted(false)
+{
+	/* Set now, so that the destructor waits for the engine to start the request */
+	engine = e;
+	engine->post([this]() {
+		start_async();
+	});
+}
+
+https_client::~https_client()
+{
+	detach_engine();
+}
+
+std::string https_client::build_request() const
 {
-	state = HTTPS_HEADERS;
 	std::string map_headers;
+	bool accept_encoding = false;
 	for (auto& [k,v] : request_headers) {
 		map_headers += k + ": " + v + "\r\n";
+		accept_encoding = accept_encoding || lowercase(k) == "accept-encoding";
+	}
+	if (!accept_encoding) {
+		/* Decoded by content_decoder as the body arrives */
+		map_headers += "Accept-Encoding: gzip, deflate\r\n";
 	}
+	return this->request_type + " " + this->path + " HTTP/" + http_protocol + "\r\n"
+		"Host: " + this->hostname + "\r\n"
+		"pragma: no-cache\r\n"
+		"Connection: keep-alive\r\n"
+		"Content-Length: " +
+		std::to_string(body_source ? body_source_length : this->request_body.length()) +
+		"\r\n" +
+		map_headers +
+		"\r\n" +
+		(body_source ? std::string() : this->request_body);
+}
+
+void https_client::connect()
+{
+	state = HTTPS_HEADERS;
 	if (this->sfd != SOCKET_ERROR) {
-		this->socket_write(
-			this->request_type + " " + this->path + " HTTP/" + http_protocol + "\r\n"
-			"Host: " + this->hostname + "\r\n"
-			"pragma: no-cache\r\n"
-			"Connection: keep-alive\r\n"
-			"Content-Length: " +
-			std::to_string(this->request_body.length()) +
-			"\r\n" +
-			map_headers +
-			"\r\n" +
-			this->request_body
-		);
-		read_loop();
+		this->socket_write(build_request());
+		/* Written in lock-step, a piece at a time, before the read loop starts */
+		while (write_source_piece()) {
+		}
+		if (this->sfd != SOCKET_ERROR) {
+			read_loop();
+		}
 	}
 }
 
-multipart_content https_client::build_multipart(const std::string &json, const std::vector<std::string>& filenames, const std::vector<std::string>& contents, const std::vector<std::string>& mimetypes) {
-	if (filenames.empty() && contents.empty()) {
-		if (!json.empty()) {
-			return { json, "application/json" };
-		} else {
-			return {json, ""};
+bool https_client::write_source_piece()
+{
+	if (!body_source || body_source_sent >= body_source_length) {
+		return false;
+	}
+	char piece[source_piece_size];
+	const size_t want = static_cast<size_t>(std::min<uint64_t>(sizeof(piece), body_source_length - body_source_sent));
+	const size_t got = std::min(body_source(piece, want), want);
+	if (got == 0) {
+		/* The source ended before the length it gave, so the request can't be completed */
+		log(ll_error, "Request body source ended " + std::to_string(body_source_length - body_source_sent) + " bytes early");
+		keepalive = false;
+		this->close();
+		finish();
+		return false;
+	}
+	body_source_sent += got;
+	socket_write(std::string_view(piece, got));
+	return body_source_sent < body_source_length;
+}
+
+void https_client::on_write_drained()
+{
+	/* A few socket buffers at a time, so memory use stays the same however large the body */
+	for (int pieces = 0; pieces < 4 && write_source_piece(); ++pieces) {
+	}
+}
+
+void https_client::start_async()
+{
+	if (!make_new) {
+		/* A pooled connection, ready to send on */
+		attach_engine(engine);
+		if (finished) {
+			/* The socket could not be watched, and the request has already failed */
+			return;
 		}
-	} else {
-		/* Note: loss of upper 32 bits on this value is INTENTIONAL */
-		uint32_t dummy1 = (uint32_t)time(nullptr) + (uint32_t)time(nullptr);
-		time_t dummy2 = time(nullptr) * time(nullptr);
-		const std::string two_cr("\r\n\r\n");
-		const std::string boundary("-------------" + to_hex(dummy1) + to_hex(dummy2));
-		const std::string part_start("--" + boundary + "\r\nContent-Disposition: form-data; ");
-		const std::string mime_type_start("\r\nContent-Type: ");
-		const std::string default_mime_type("application/octet-stream");
-		
-		std::string content("--" + boundary);
-
-		/* Special case, single file */
-		content += "\r\nContent-Type: application/json\r\nContent-Disposition: form-data; name=\"payload_json\"" + two_cr;
-		content += json + "\r\n";
-		if (filenames.size() == 1 && contents.size() == 1) {
-			content += part_start + "name=\"file\"; filename=\"" + filenames[0] + "\"";
-			content += mime_type_start + (mimetypes.empty() || mimetypes[0].empty() ? default_mime_type : mimetypes[0]) + two_cr;
-			content += contents[0];
+		socket_write(build_request());
+		return;
+	}
+	connect_async(engine, [this](bool success, const std::string&) {
+		if (!success) {
+			finish();
+			return;
+		}
+		socket_write(build_request());
+	});
+}
+
+void https_client::finish()
+{
+	if (finished) {
+		return;
+	}
+	finished = true;
+	if (completion) {
+		completion(this);
+	}
+}
+
+void https_client::on_disconnect()
+{
+	finish();
+}
+
+void https_client::abort()
+{
+	aborted = true;
+	keepalive = false;
+	this->close();
+	finish();
+}
+
+http_body_decoder::http_body_decoder() : decoder(nullptr), deflate_encoded(false), received(0), decoded(0)
+{
+}
+
+http_body_decoder::~http_body_decoder()
+{
+	if (decoder) {
+		inflateEnd(decoder);
+		delete decoder;
+	}
+}
+
+bool http_body_decoder::start(const std::string& content_encoding)
+{
+	std::string encoding = lowercase(trim(content_encoding));
+	if (encoding == "deflate") {
+		deflate_encoded = true;
+	} else if (encoding != "gzip" && encoding != "x-gzip") {
+		/* identity, or an encoding we did not ask for, which is passed through as is */
+		return true;
+	}
+	decoder = new z_stream{};
+	/* Adding 32 to the window bits accepts either a gzip or a zlib header */
+	if (inflateInit2(decoder, 15 + 32) != Z_OK) {
+		delete decoder;
+		decoder = nullptr;
+		return false;
+	}
+	return true;
+}
+
+bool http_body_decoder::append(std::string_view data, std::string& body, const https_body_sink& sink)
+{
+	if (!decoder) {
+		received += data.size();
+		decoded += data.size();
+		if (sink) {
+			sink(data);
 		} else {
-			/* Multiple files */
-			for (size_t i = 0; i < filenames.size(); ++i) {
-				content += part_start + "name=\"files[" + std::to_string(i) + "]\"; filename=\"" + filenames[i] + "\"";
-				content += "\r\nContent-Type: " + (mimetypes.size() <= i || mimetypes[i].empty() ? default_mime_type : mimetypes[i]) + two_cr;
-				content += contents[i];
-				content += "\r\n";
+			body.append(data);
+		}
+		return true;
+	}
+	if (deflate_encoded && received == 0 && data.size() >= 2) {
+		/* Not a valid zlib header, so raw deflate data */
+		unsigned int cmf = static_cast<unsigned char>(data[0]), flg = static_cast<unsigned char>(data[1]);
+		if ((cmf & 0x0f) != Z_DEFLATED || (cmf * 256 + flg) % 31 != 0) {
+			inflateReset2(decoder, -15);
+		}
+	}
+	received += data.size();
+	/* Decoded into the body, or into a reusable piece for the sink */
+	std::string& out = sink ? piece : body;
+	if (sink) {
+		piece.clear();
+	}
+	decoder->next_in = (Bytef*)data.data();
+	decoder->avail_in = (uInt)data.size();
+	do {
+		/* Inflate directly into the free space at the end of the output */
+		const size_t used = out.size();
+		const size_t room = std::max<size_t>(data.size() * 4, 16384);
+		out.resize(used + room);
+		decoder->next_out = (Bytef*)out.data() + used;
+		decoder->avail_out = (uInt)room;
+		int ret = inflate(decoder, Z_NO_FLUSH);
+		out.resize(used + room - decoder->avail_out);
+		decoded += room - decoder->avail_out;
+		if (ret == Z_STREAM_END) {
+			/* Anything after the end of the stream is ignored */
+			break;
+		} else if (ret == Z_BUF_ERROR) {
+			/* No more progress until more input arrives */
+			break;
+		} else if (ret != Z_OK) {
+			return false;
+		}
+	} while (decoder->avail_in > 0 || decoder->avail_out == 0);
+	if (sink && !piece.empty()) {
+		sink(piece);
+	}
+	return true;
+}
+
+uint64_t http_body_decoder::get_received_length() const
+{
+	return received;
+}
+
+uint64_t http_body_decoder::get_decoded_length() const
+{
+	return decoded;
+}
+
+std::string https_client::gzip(std::string_view data)
+{
+	z_stream s{};
+	/* Adding 16 to the window bits writes a gzip header rather than a zlib one */
+	if (deflateInit2(&s, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		throw dpp::connection_exception(err_compression_memory, "Can't initialise request compression");
+	}
+	std::string out;
+	out.resize(deflateBound(&s, (uLong)data.size()));
+	s.next_in = (Bytef*)data.data();
+	s.avail_in = (uInt)data.size();
+	s.next_out = (Bytef*)out.data();
+	s.avail_out = (uInt)out.size();
+	int ret = deflate(&s, Z_FINISH);
+	out.resize(s.total_out);
+	deflateEnd(&s);
+	if (ret != Z_STREAM_END) {
+		throw dpp::connection_exception(err_compression_stream, "Request compression error");
+	}
+	return out;
+}
+
+void multipart_stream::add_part(std::string part) {
+	if (!part.empty()) {
+		length += part.length();
+		segments.emplace_back(parts.emplace_back(std::move(part)));
+	}
+}
+
+void multipart_stream::add_content(std::string_view content) {
+	if (!content.empty()) {
+		length += content.length();
+		segments.emplace_back(content);
+	}
+}
+
+https_body_source multipart_stream::source() const {
+	return [this, segment = size_t{0}, offset = size_t{0}](char* buffer, size_t max) mutable -> size_t {
+		size_t written = 0;
+		while (written < max && segment < segments.size()) {
+			std::string_view pending = segments[segment].substr(offset);
+			const size_t length = std::min(pending.length(), max - written);
+			std::memcpy(buffer + written, pending.data(), length);
+			written += length;
+			offset += length;
+			if (offset >= segments[segment].length()) {
+				++segment;
+				offset = 0;
 			}
 		}
-		content += "\r\n--" + boundary + "--";
-		return { content, "multipart/form-data; boundary=" + boundary };
+		return written;
+	};
+}
+
+multipart_stream https_client::stream_multipart(const std::string &json, const std::vector<std::string>& filenames, const std::vector<std::string>& contents, const std::vector<std::string>& mimetypes) {
+	multipart_stream stream;
+	if (filenames.empty() && contents.empty()) {
+		stream.add_content(json);
+		stream.mimetype = json.empty() ? "" : "application/json";
+		return stream;
 	}
+	/* Note: loss of upper 32 bits on this value is INTENTIONAL */
+	uint32_t dummy1 = (uint32_t)time(nullptr) + (uint32_t)time(nullptr);
+	time_t dummy2 = time(nullptr) * time(nullptr);
+	const std::string two_cr("\r\n\r\n");
+	const std::string boundary("-------------" + to_hex(dummy1) + to_hex(dummy2));
+	const std::string part_start("--" + boundary + "\r\nContent-Disposition: form-data; ");
+	const std::string mime_type_start("\r\nContent-Type: ");
+	const std::string default_mime_type("application/octet-stream");
+
+	/* Boundaries and part headers collect here until the next content, which is referred to, not copied */
+	std::string text("--" + boundary);
+	auto content = [&stream, &text](std::string_view c) {
+		stream.add_part(std::move(text));
+		text.clear();
+		stream.add_content(c);
+	};
+
+	/* Special case, single file */
+	text += "\r\nContent-Type: application/json\r\nContent-Disposition: form-data; name=\"payload_json\"" + two_cr;
+	content(json);
+	text += "\r\n";
+	if (filenames.size() == 1 && contents.size() == 1) {
+		text += part_start + "name=\"file\"; filename=\"" + filenames[0] + "\"";
+		text += mime_type_start + (mimetypes.empty() || mimetypes[0].empty() ? default_mime_type : mimetypes[0]) + two_cr;
+		content(contents[0]);
+	} else {
+		/* Multiple files */
+		for (size_t i = 0; i < filenames.size(); ++i) {
+			text += part_start + "name=\"files[" + std::to_string(i) + "]\"; filename=\"" + filenames[i] + "\"";
+			text += "\r\nContent-Type: " + (mimetypes.size() <= i || mimetypes[i].empty() ? default_mime_type : mimetypes[i]) + two_cr;
+			content(contents[i]);
+			text += "\r\n";
+		}
+	}
+	text += "\r\n--" + boundary + "--";
+	stream.add_part(std::move(text));
+	stream.mimetype = "multipart/form-data; boundary=" + boundary;
+	return stream;
+}
+
+multipart_content https_client::build_multipart(const std::string &json, const std::vector<std::string>& filenames, const std::vector<std::string>& contents, const std::vector<std::string>& mimetypes) {
+	multipart_stream stream = stream_multipart(json, filenames, contents, mimetypes);
+	multipart_content content{std::string(), stream.mimetype};
+	content.body.reserve(stream.length);
+	for (std::string_view segment : stream.segments) {
+		content.body.append(segment);
+	}
+	return content;
+}
+
+https_body_source https_client::file_source(const std::string& filename, uint64_t& length) {
+	auto file = std::make_shared<std::ifstream>(filename, std::ios::binary | std::ios::ate);
+	if (!file->is_open()) {
+		throw dpp::file_exception("Can't open " + filename + " for reading");
+	}
+	length = static_cast<uint64_t>(file->tellg());
+	file->seekg(0);
+	return [file](char* buffer, size_t max) -> size_t {
+		file->read(buffer, static_cast<std::streamsize>(max));
+		return static_cast<size_t>(file->gcount());
+	};
+}
+
+https_body_sink https_client::file_sink(const std::string& filename) {
+	auto file = std::make_shared<std::ofstream>(filename, std::ios::binary | std::ios::trunc);
+	if (!file->is_open()) {
+		throw dpp::file_exception("Can't open " + filename + " for writing");
+	}
+	return [file](std::string_view piece) {
+		file->write(piece.data(), static_cast<std::streamsize>(piece.length()));
+	};
 }
 
 const std::string https_client::get_header(std::string header_name) const {
@@ -149,8 +472,51 @@ const std::multimap<std::string, std::string> https_client::get_headers() const
 	return response_headers;
 }
 
+namespace {
+
+/**
+ * @brief The part of the input buffer which has been processed. It is removed from
+ * the buffer in one go, when handle_buffer() returns or before the connection is closed,
+ * rather than piece by piece as each chunk is read.
+ */
+struct consumed_input {
+	/**
+	 * @brief Input buffer
+	 */
+	std::string& buffer;
+
+	/**
+	 * @brief Number of bytes at the start of the buffer which have been processed
+	 */
+	size_t pos{0};
+
+	/**
+	 * @brief Get the input which has not been processed
+	 * @return unprocessed input
+	 */
+	std::string_view rest() const {
+		return std::string_view(buffer).substr(pos);
+	}
+
+	/**
+	 * @brief Remove the processed input from the buffer. ssl_client::close() only
+	 * returns a connection to the pool once the buffer is empty.
+	 */
+	void flush() {
+		buffer.erase(0, std::min(pos, buffer.size()));
+		pos = 0;
+	}
+
+	~consumed_input() {
+		flush();
+	}
+};
+
+}
+
 bool https_client::handle_buffer(std::string &buffer)
 {
+	consumed_input consumed{buffer};
 	bool state_changed = false;
 	do {
 		state_changed = false;
@@ -159,13 +525,10 @@ bool https_client::handle_buffer(std::string &buffer)
 				if (buffer.find("\r\n\r\n") != std::string::npos) {
 					/* Got all headers, proceed to new state */
 
-					std::string unparsed = buffer;
-
-					/* Get headers string */
-					std::string headers = buffer.substr(0, buffer.find("\r\n\r\n"));
-
-					/* Modify buffer, remove headers section */
-					buffer.erase(0, buffer.find("\r\n\r\n") + 4);
+					/* Get headers string, and mark the headers section as processed */
+					const size_t headers_end = buffer.find("\r\n\r\n");
+					std::string headers = buffer.substr(0, headers_end);
+					consumed.pos = headers_end + 4;
 
 					/* Process headers into map */
 					std::vector<std::string> h = utility::tokenize(headers);
@@ -195,6 +558,9 @@ bool https_client::handle_buffer(std::string &buffer)
 							auto it_conn = response_headers.find("connection");
 							if (it_conn != response_headers.end() && it_conn->second == "close") {
 								keepalive = false;
+							} else if (req_status[0] == "HTTP/1.0" && (it_conn == response_headers.end() || it_conn->second != "keep-alive")) {
+								/* HTTP/1.0 closes the connection unless asked not to */
+								keepalive = false;
 							}
 							chunked = false;
 							auto it_txenc = response_headers.find("transfer-encoding");
@@ -207,15 +573,27 @@ bool https_client::handle_buffer(std::string &buffer)
 									state_changed = true;
 								}
 							}
+							if (!chunked && content_length == ULLONG_MAX) {
+								/* Body is delimited by the server closing the connection */
+								keepalive = false;
+							}
+							auto encoding = response_headers.find("content-encoding");
+							if (encoding != response_headers.end() && !content_decoder.start(encoding->second)) {
+								keepalive = false;
+								return false;
+							}
 							status = atoi(req_status[1].c_str());
 							if (status == 204  || status < 200 || status == 304 || content_length == 0) {
+								state = HTTPS_DONE;
+								consumed.flush();
+								this->close();
 								return false;
 							} else if (!chunked) {
 								state = HTTPS_CONTENT;
 								state_changed = true;
-								continue;
 							}
-							return true;
+							/* The start of the body may have arrived with the headers */
+							continue;
 						} else {
 							/* Non-HTTP-like response with invalid headers. Go no further. */
 							keepalive = false;
@@ -229,13 +607,14 @@ bool https_client::handle_buffer(std::string &buffer)
 				}
 			break;
 			case HTTPS_CHUNK_CONTENT: {
-				size_t to_read = buffer.size();
-				if (chunk_receive + buffer.size() > chunk_size) {
-					to_read = chunk_size - chunk_receive;
+				std::string_view in = consumed.rest();
+				size_t to_read = std::min<size_t>(in.size(), chunk_size - chunk_receive);
+				if (!content_decoder.append(in.substr(0, to_read), body, body_sink)) {
+					keepalive = false;
+					return false;
 				}
-				body += buffer.substr(0, to_read);
 				chunk_receive += to_read;
-				buffer.erase(0, to_read);
+				consumed.pos += to_read;
 				if (chunk_receive >= chunk_size) {
 					state = HTTPS_CHUNK_TRAILER;
 					state_changed = true;
@@ -246,31 +625,31 @@ bool https_client::handle_buffer(std::string &buffer)
 			break;
 			case HTTPS_CHUNK_LAST:
 			case HTTPS_CHUNK_TRAILER:
-				if (buffer.length() >= 2 && buffer.substr(0, 2) == "\r\n") {
+				if (consumed.rest().substr(0, 2) == "\r\n") {
+					consumed.pos += 2;
 					if (state == HTTPS_CHUNK_LAST) {
 						state = HTTPS_DONE;
+						consumed.flush();
 						this->close();
 						return false;
 					} else {
 						state = HTTPS_CHUNK_LEN;
-						buffer.erase(0, 2);
 					}
 					state_changed = true;
 				}
 			break;
-			case HTTPS_CHUNK_LEN:
-				if (buffer.find("\r\n") != std::string::npos) {
+			case HTTPS_CHUNK_LEN: {
+				std::string_view in = consumed.rest();
+				size_t eol = in.find("\r\n");
+				if (eol != std::string_view::npos) {
 					chunk_receive = 0;
-					std::string chunk_length_str = buffer.substr(0, buffer.find("\r\n"));
-					buffer.erase(0, buffer.find("\r\n") + 2);
-					try {
-						size_t index = 0;
-						chunk_size = std::stoi(chunk_length_str, &index, 16);
-					}
-					catch (const std::exception&) {
+					/* Parsed where it lies; anything after the hex digits is a chunk extension */
+					auto [end, error] = std::from_chars(in.data(), in.data() + eol, chunk_size, 16);
+					if (error != std::errc() || end == in.data()) {
 						keepalive = false;
 						return false;
 					}
+					consumed.pos += eol + 2;
 					state = HTTPS_CHUNK_CONTENT;
 					if (chunk_size == 0) {
 						state = HTTPS_CHUNK_LAST;
@@ -278,17 +657,23 @@ bool https_client::handle_buffer(std::string &buffer)
 					}
 					state_changed = true;
 				}
+			}
 			break;
 			case HTTPS_CONTENT:
-				body += buffer;
-				buffer.clear();
-				if (content_length == ULLONG_MAX || body.length() >= content_length) {
+				if (!content_decoder.append(consumed.rest(), body, body_sink)) {
+					keepalive = false;
+					return false;
+				}
+				consumed.pos = buffer.size();
+				if (content_length == ULLONG_MAX || content_decoder.get_received_length() >= content_length) {
 					state = HTTPS_DONE;
+					consumed.flush();
 					this->close();
 					return false;
 				}
 			break;
 			case HTTPS_DONE:
+				consumed.flush();
 				this->close();
 				return false;
 			break;
@@ -306,11 +691,23 @@ const std::string https_client::get_content() const {
 	return body;
 }
 
+uint64_t https_client::get_received_length() const {
+	return content_decoder.get_received_length();
+}
+
+uint64_t https_client::get_decoded_length() const {
+	return content_decoder.get_decoded_length();
+}
+
 http_state https_client::get_state() {
 	return this->state;
 }
 
 void https_client::one_second_timer() {
+	if (is_connecting() || finished) {
+		/* ssl_client times out the connection attempt itself */
+		return;
+	}
 	if ((this->sfd == SOCKET_ERROR || time(nullptr) >= timeout) && this->state != HTTPS_DONE) {
 		/* if and only if response is timed out */
 		if (this->sfd != SOCKET_ERROR) {
@@ -318,14 +715,17 @@ void https_client::one_second_timer() {
 		}
 		keepalive = false;
 		this->close();
+		finish();
 	}
 }
 
 void https_client::close() {
 	if (state != HTTPS_DONE) {
+		/* The response is incomplete, so the connection can't be reused */
+		keepalive = false;
 		state = HTTPS_DONE;
-		ssl_client::close();
 	}
+	ssl_client::close();
 }
 
 http_connect_info https_client::get_host_info(std::string url) {
@@ -0,0 +1,155 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <dpp/jsonparser.h>
+#include <dpp/exception.h>
+#include <atomic>
+#ifdef HAVE_SIMDJSON
+	#include <simdjson.h>
+#endif
+
+namespace dpp {
+
+namespace {
+
+#ifdef HAVE_SIMDJSON
+std::atomic<json_parser_backend> selected_backend{jpb_simdjson};
+
+/**
+ * @brief Thrown internally for a document simdjson parsed which the tree can't hold
+ * exactly, so that it is parsed again by nlohmann::json.
+ */
+struct unrepresentable {};
+
+/**
+ * @brief Build a dpp::json value from an element of a simdjson document.
+ * Numbers are typed the way nlohmann::json types them: non-negative integers
+ * are unsigned, negative integers signed, everything else floating point.
+ */
+void build_tree(simdjson::dom::element e, json& out) {
+	switch (e.type()) {
+		case simdjson::dom::element_type::OBJECT: {
+			out = json::object();
+			json::object_t& obj = out.get_ref<json::object_t&>();
+			for (simdjson::dom::key_value_pair field : simdjson::dom::object(e)) {
+				/* Duplicate keys keep the last value, like nlohmann::json */
+				build_tree(field.value, obj[std::string(field.key)]);
+			}
+			break;
+		}
+		case simdjson::dom::element_type::ARRAY: {
+			simdjson::dom::array arr(e);
+			out = json::array();
+			json::array_t& a = out.get_ref<json::array_t&>();
+			a.reserve(arr.size());
+			for (simdjson::dom::element child : arr) {
+				build_tree(child, a.emplace_back());
+			}
+			break;
+		}
+		case simdjson::dom::element_type::STRING:
+			out = std::string(std::string_view(e));
+			break;
+		case simdjson::dom::element_type::INT64: {
+			int64_t v = int64_t(e);
+			if (v >= 0) {
+				out = static_cast<uint64_t>(v);
+			} else {
+				out = v;
+			}
+			break;
+		}
+		case simdjson::dom::element_type::UINT64:
+			out = uint64_t(e);
+			break;
+		case simdjson::dom::element_type::DOUBLE:
+			out = double(e);
+			break;
+		case simdjson::dom::element_type::BOOL:
+			out = bool(e);
+			break;
+		case simdjson::dom::element_type::NULL_VALUE:
+			out = nullptr;
+			break;
+		default:
+			throw unrepresentable();
+	}
+}
+
+json parse_simdjson(std::string_view text) {
+	/* The parser keeps its buffers between documents, so each thread reuses its own */
+	thread_local simdjson::dom::parser parser;
+	simdjson::dom::element doc;
+	if (parser.parse(text.data(), text.length(), true).get(doc) == simdjson::SUCCESS) {
+		try {
+			json j;
+			build_tree(doc, j);
+			return j;
+		}
+		catch (const unrepresentable&) {
+		}
+	}
+	/* Invalid or unrepresentable: nlohmann::json throws the same exception it always did, or handles it */
+	return json::parse(text);
+}
+#else
+std::atomic<json_parser_backend> selected_backend{jpb_nlohmann};
+#endif
+
+}
+
+json parse_json(std::string_view text) {
+	return parse_json(text, selected_backend.load(std::memory_order_relaxed));
+}
+
+json parse_json(std::string_view text, json_parser_backend backend) {
+	switch (backend) {
+#ifdef HAVE_SIMDJSON
+		case jpb_simdjson:
+			return parse_simdjson(text);
+#endif
+		case jpb_nlohmann:
+			return json::parse(text);
+		default:
+			throw dpp::logic_exception(err_no_json_parser, "This JSON parser is not available in this build of D++");
+	}
+}
+
+void set_json_parser(json_parser_backend backend) {
+	if (!json_parser_available(backend)) {
+		throw dpp::logic_exception(err_no_json_parser, "This JSON parser is not available in this build of D++");
+	}
+	selected_backend = backend;
+}
+
+json_parser_backend get_json_parser() {
+	return selected_backend;
+}
+
+bool json_parser_available(json_parser_backend backend) {
+#ifdef HAVE_SIMDJSON
+	return backend == jpb_nlohmann || backend == jpb_simdjson;
+#else
+	return backend == jpb_nlohmann;
+#endif
+}
+
+}
@@ -22,6 +22,7 @@
 #include <dpp/message.h>
 #include <dpp/cache.h>
 #include <dpp/json.h>
+#include <dpp/etf.h>
 #include <dpp/discordevents.h>
 #include <dpp/cluster.h>
 
@@ -1308,6 +1309,76 @@ message& message::fill_from_json(json* d, cache_policy_t cp) {
 	this->id = snowflake_not_null(d, "id");
 	this->channel_id = snowflake_not_null(d, "channel_id");
 	this->guild_id = snowflake_not_null(d, "guild_id");
+	this->flags = int16_not_null(d, "flags");
+	this->type = static_cast<message_type>(int8_not_null(d, "type"));
+	this->content = string_not_null(d, "content");
+	this->sent = ts_not_null(d, "timestamp");
+	this->edited = ts_not_null(d, "edited_timestamp");
+	this->tts = bool_not_null(d, "tts");
+	this->mention_everyone = bool_not_null(d, "mention_everyone");
+	if (((*d)["nonce"]).is_string()) {
+		this->nonce = string_not_null(d, "nonce");
+	} else if (((*d)["nonce"]).is_number_integer()) {
+		this->nonce = std::to_string(((*d)["nonce"]).get<uint64_t>());
+	} else {
+		this->nonce = std::to_string(snowflake_not_null(d, "nonce"));
+	}
+	this->pinned = bool_not_null(d, "pinned");
+	this->webhook_id = snowflake_not_null(d, "webhook_id");
+	return fill_objects_from_json(d, cp);
+}
+
+message& message::fill_from_etf(etf_reader& r, cache_policy_t cp) {
+	/* Nested objects are collected here and filled from json afterwards */
+	json d = json::object();
+	this->id = this->channel_id = this->guild_id = this->webhook_id = 0;
+	this->flags = 0;
+	this->type = static_cast<message_type>(0);
+	this->content.clear();
+	this->sent = this->edited = 0;
+	this->tts = this->mention_everyone = this->pinned = false;
+	this->nonce = "0";
+	r.read_map([&](std::string_view key) {
+		if (key == "id") {
+			this->id = r.read_snowflake();
+		} else if (key == "channel_id") {
+			this->channel_id = r.read_snowflake();
+		} else if (key == "guild_id") {
+			this->guild_id = r.read_snowflake();
+		} else if (key == "flags") {
+			this->flags = static_cast<uint16_t>(r.read_int());
+		} else if (key == "type") {
+			this->type = static_cast<message_type>(r.read_int());
+		} else if (key == "content") {
+			this->content = r.read_string();
+		} else if (key == "timestamp") {
+			std::string_view ts = r.read_string();
+			this->sent = ts.empty() ? 0 : ts_from_string(ts);
+		} else if (key == "edited_timestamp") {
+			std::string_view ts = r.read_string();
+			this->edited = ts.empty() ? 0 : ts_from_string(ts);
+		} else if (key == "tts") {
+			this->tts = r.read_bool();
+		} else if (key == "mention_everyone") {
+			this->mention_everyone = r.read_bool();
+		} else if (key == "nonce") {
+			if (r.peek() == ett_binary) {
+				this->nonce = r.read_string();
+			} else {
+				this->nonce = std::to_string(r.read_snowflake());
+			}
+		} else if (key == "pinned") {
+			this->pinned = r.read_bool();
+		} else if (key == "webhook_id") {
+			this->webhook_id = r.read_snowflake();
+		} else {
+			d[std::string(key)] = r.read_json();
+		}
+	});
+	return fill_objects_from_json(&d, cp);
+}
+
+message& message::fill_objects_from_json(json* d, cache_policy_t cp) {
 	/* We didn't get a guild id. See if we can find one in the channel */
 	if (guild_id.empty() && !channel_id.empty()) {
 		dpp::channel* c = dpp::find_channel(this->channel_id);
@@ -1315,8 +1386,6 @@ message& message::fill_from_json(json* d, cache_policy_t cp) {
 			this->guild_id = c->guild_id;
 		}
 	}
-	this->flags = int16_not_null(d, "flags");
-	this->type = static_cast<message_type>(int8_not_null(d, "type"));
 	this->author = user();
 	/* May be null, if its null cache it from the partial */
 	if (d->find("author") != d->end()) {
@@ -1373,6 +1442,7 @@ message& message::fill_from_json(json* d, cache_policy_t cp) {
 			this->member.fill_from_json(&mi, this->guild_id, uid);
 		} else if (g) {
 			/* User caching on, lazy or aggressive - cache the member information */
+			std::unique_lock lock(g->get_mutex());
 			auto thismember = g->members.find(uid);
 			if (thismember == g->members.end()) {
 				if (!uid.empty() && author.id) {
@@ -1398,24 +1468,12 @@ message& message::fill_from_json(json* d, cache_policy_t cp) {
 		}
 	}
 	set_object_array_not_null<component>(d, "components", this->components);
-	this->content = string_not_null(d, "content");
-	this->sent = ts_not_null(d, "timestamp");
-	this->edited = ts_not_null(d, "edited_timestamp");
-	this->tts = bool_not_null(d, "tts");
-	this->mention_everyone = bool_not_null(d, "mention_everyone");
 	if (d->find("reactions") != d->end()) {
 		json & el = (*d)["reactions"];
 		for (auto& e : el) {
 			this->reactions.emplace_back(reaction(&e));
 		}
 	}
-	if (((*d)["nonce"]).is_string()) {
-		this->nonce = string_not_null(d, "nonce");
-	} else {
-		this->nonce = std::to_string(snowflake_not_null(d, "nonce"));
-	}
-	this->pinned = bool_not_null(d, "pinned");
-	this->webhook_id = snowflake_not_null(d, "webhook_id");
 	for (auto& e : (*d)["attachments"]) {
 		this->attachments.emplace_back(attachment(this, &e));
 	}
@@ -22,6 +22,7 @@
 #include <dpp/presence.h>
 #include <dpp/discordevents.h>
 #include <dpp/json.h>
+#include <dpp/etf.h>
 
 namespace dpp {
 
@@ -106,140 +107,172 @@ presence::presence(presence_status status, const activity &a) {
 
 presence::~presence() = default;
 
+namespace {
+
+/**
+ * @brief Convert a status string to its presence flag
+ * @param status status string, e.g. "online"
+ * @param online flag for online
+ * @param idle flag for idle
+ * @param dnd flag for do not disturb
+ * @return the matching flag, or 0 for offline or an unknown status
+ */
+uint8_t status_flag(std::string_view status, uint8_t online, uint8_t idle, uint8_t dnd) {
+	if (status == "online") {
+		return online;
+	} else if (status == "idle") {
+		return idle;
+	} else if (status == "dnd") {
+		return dnd;
+	}
+	return 0;
+}
+
+/**
+ * @brief Build an activity from its json
+ * @param act activity json
+ * @return activity
+ */
+activity activity_from_json(json& act) {
+	activity a;
+	a.name = string_not_null(&act, "name");
+	a.details = string_not_null(&act, "details");
+	if (act.find("assets") != act.end()) {
+		a.assets.large_image = string_not_null(&act["assets"], "large_image");
+		a.assets.large_text = string_not_null(&act["assets"], "large_text");
+		a.assets.small_image = string_not_null(&act["assets"], "small_image");
+		a.assets.small_text = string_not_null(&act["assets"], "small_text");
+	}
+	a.state = string_not_null(&act, "state");
+	a.type = (activity_type)int8_not_null(&act, "type");
+	a.url = string_not_null(&act, "url");
+	if (act.find("buttons") != act.end()) {
+		for (auto &b : act["buttons"]) {
+			activity_button btn;
+			if (b.is_string()) { // its may be just a string (label) because normal bots cannot access the button URLs
+				btn.label = b.get<std::string>();;
+			} else {
+				btn.label = string_not_null(&b, "label");
+				btn.url = string_not_null(&b, "url");
+			}
+			a.buttons.push_back(btn);
+		}
+	}
+	if (act.find("emoji") != act.end()) {
+		a.emoji.name = string_not_null(&act["emoji"], "name");
+		a.emoji.id = snowflake_not_null(&act["emoji"], "id");
+		if (bool_not_null(&act["emoji"], "animated")) {
+			a.emoji.flags |= e_animated;
+		}
+	}
+	if (act.find("party") != act.end()) {
+		a.party.id = snowflake_not_null(&act["party"], "id");
+		if (act["party"].find("size") != act["party"].end()) { // "size" is an array of two integers
+			try {
+				a.party.current_size = act["party"]["size"][0].get<int32_t>();
+				a.party.maximum_size = act["party"]["size"][1].get<int32_t>();
+			} catch ([[maybe_unused]] std::exception &exception) {}
+		}
+	}
+	if (act.find("secrets") != act.end()) {
+		a.secrets.join = string_not_null(&act["secret"], "join");
+		a.secrets.spectate = string_not_null(&act["secret"], "spectate");
+		a.secrets.match = string_not_null(&act["secret"], "match");
+	}
+	a.created_at = int64_not_null(&act, "created_at");
+	if (act.find("timestamps") != act.end()) {
+		a.start = int64_not_null(&act["timestamps"], "start");
+		a.end = int64_not_null(&act["timestamps"], "end");
+	}
+	a.application_id = snowflake_not_null(&act, "application_id");
+	a.flags = int8_not_null(&act, "flags");
+	a.is_instance = bool_not_null(&act, "instance");
+
+	return a;
+}
+
+}
+
 presence& presence::fill_from_json_impl(nlohmann::json* j) {
 	guild_id = snowflake_not_null(j, "guild_id");
 	user_id = snowflake_not_null(&((*j)["user"]), "id");
 
 	auto f = j->find("client_status");
 	if (f != j->end()) {
-
-		bool update_desktop = false, update_web = false, update_mobile = false;
-		std::string desktop, mobile, web;
-
 		if (f->find("desktop") != f->end()) {
-			desktop = string_not_null(&((*j)["client_status"]), "desktop");
-			update_desktop = true;
-		}
-		if (f->find("mobile") != f->end()) {
-			mobile = string_not_null(&((*j)["client_status"]), "mobile");
-			update_mobile = true;
-		}
-		if (f->find("web") != f->end()) {
-			web = string_not_null(&((*j)["client_status"]), "web");
-			update_web = true;
-		}
-
-		if (update_desktop) {
 			flags &= PF_CLEAR_DESKTOP;
-			if (desktop == "online") {
-				flags |= p_desktop_online;
-			} else if (desktop == "idle") {
-				flags |= p_desktop_idle;
-			} else if (desktop == "dnd") {
-				flags |= p_desktop_dnd;
-			}
+			flags |= status_flag(string_not_null(&((*j)["client_status"]), "desktop"), p_desktop_online, p_desktop_idle, p_desktop_dnd);
 		}
-
-		if (update_mobile) {
+		if (f->find("mobile") != f->end()) {
 			flags &= PF_CLEAR_MOBILE;
-			if (mobile == "online") {
-				flags |= p_mobile_online;
-			} else if (mobile == "idle") {
-				flags |= p_mobile_idle;
-			} else if (mobile == "dnd") {
-				flags |= p_mobile_dnd;
-			}
+			flags |= status_flag(string_not_null(&((*j)["client_status"]), "mobile"), p_mobile_online, p_mobile_idle, p_mobile_dnd);
 		}
-
-		if (update_web) {
+		if (f->find("web") != f->end()) {
 			flags &= PF_CLEAR_WEB;
-			if (web == "online") {
-				flags |= p_web_online;
-			} else if (web == "idle") {
-				flags |= p_web_idle;
-			} else if (web == "dnd") {
-				flags |= p_web_dnd;
-			}
+			flags |= status_flag(string_not_null(&((*j)["client_status"]), "web"), p_web_online, p_web_idle, p_web_dnd);
 		}
 	}
 
 	if (j->contains("status")) {
 		flags &= PF_CLEAR_STATUS;
-		std::string main = string_not_null(j, "status");
-		if (main == "online") {
-			flags |= p_status_online;
-		} else if (main == "idle") {
-			flags |= p_status_idle;
-		} else if (main == "dnd") {
-			flags |= p_status_dnd;
-		}
+		flags |= status_flag(string_not_null(j, "status"), p_status_online, p_status_idle, p_status_dnd);
 	}
 
-
 	if (j->contains("activities")) {
 		activities.clear();
 		for (auto & act : (*j)["activities"]) {
-			activity a;
-			a.name = string_not_null(&act, "name");
-			a.details = string_not_null(&act, "details");
-			if (act.find("assets") != act.end()) {
-				a.assets.large_image = string_not_null(&act["assets"], "large_image");
-				a.assets.large_text = string_not_null(&act["assets"], "large_text");
-				a.assets.small_image = string_not_null(&act["assets"], "small_image");
-				a.assets.small_text = string_not_null(&act["assets"], "small_text");
-			}
-			a.state = string_not_null(&act, "state");
-			a.type = (activity_type)int8_not_null(&act, "type");
-			a.url = string_not_null(&act, "url");
-			if (act.find("buttons") != act.end()) {
-				for (auto &b : act["buttons"]) {
-					activity_button btn;
-					if (b.is_string()) { // its may be just a string (label) because normal bots cannot access the button URLs
-						btn.label = b.get<std::string>();;
-					} else {
-						btn.label = string_not_null(&b, "label");
-						btn.url = string_not_null(&b, "url");
-					}
-					a.buttons.push_back(btn);
-				}
-			}
-			if (act.find("emoji") != act.end()) {
-				a.emoji.name = string_not_null(&act["emoji"], "name");
-				a.emoji.id = snowflake_not_null(&act["emoji"], "id");
-				if (bool_not_null(&act["emoji"], "animated")) {
-					a.emoji.flags |= e_animated;
-				}
-			}
-			if (act.find("party") != act.end()) {
-				a.party.id = snowflake_not_null(&act["party"], "id");
-				if (act["party"].find("size") != act["party"].end()) { // "size" is an array of two integers
-					try {
-						a.party.current_size = act["party"]["size"][0].get<int32_t>();
-						a.party.maximum_size = act["party"]["size"][1].get<int32_t>();
-					} catch ([[maybe_unused]] std::exception &exception) {}
-				}
-			}
-			if (act.find("secrets") != act.end()) {
-				a.secrets.join = string_not_null(&act["secret"], "join");
-				a.secrets.spectate = string_not_null(&act["secret"], "spectate");
-				a.secrets.match = string_not_null(&act["secret"], "match");
-			}
-			a.created_at = int64_not_null(&act, "created_at");
-			if (act.find("timestamps") != act.end()) {
-				a.start = int64_not_null(&act["timestamps"], "start");
-				a.end = int64_not_null(&act["timestamps"], "end");
-			}
-			a.application_id = snowflake_not_null(&act, "application_id");
-			a.flags = int8_not_null(&act, "flags");
-			a.is_instance = bool_not_null(&act, "instance");
-
-			activities.push_back(a);
+			activities.push_back(activity_from_json(act));
 		}
 	}
 
 	return *this;
 }
 
+presence& presence::fill_from_etf(etf_reader& r) {
+	r.read_map([&](std::string_view key) {
+		if (key == "guild_id") {
+			guild_id = r.read_snowflake();
+		} else if (key == "user") {
+			user_id = 0;
+			r.read_map([&](std::string_view user_key) {
+				if (user_key == "id") {
+					user_id = r.read_snowflake();
+				} else {
+					r.skip();
+				}
+			});
+		} else if (key == "client_status") {
+			r.read_map([&](std::string_view platform) {
+				if (platform == "desktop") {
+					flags &= PF_CLEAR_DESKTOP;
+					flags |= status_flag(r.read_string(), p_desktop_online, p_desktop_idle, p_desktop_dnd);
+				} else if (platform == "mobile") {
+					flags &= PF_CLEAR_MOBILE;
+					flags |= status_flag(r.read_string(), p_mobile_online, p_mobile_idle, p_mobile_dnd);
+				} else if (platform == "web") {
+					flags &= PF_CLEAR_WEB;
+					flags |= status_flag(r.read_string(), p_web_online, p_web_idle, p_web_dnd);
+				} else {
+					r.skip();
+				}
+			});
+		} else if (key == "status") {
+			flags &= PF_CLEAR_STATUS;
+			flags |= status_flag(r.read_string(), p_status_online, p_status_idle, p_status_dnd);
+		} else if (key == "activities") {
+			/* Activities are rare and deeply nested, so these are decoded individually */
+			activities.clear();
+			r.read_list([&]() {
+				json act = r.read_json();
+				activities.push_back(activity_from_json(act));
+			});
+		} else {
+			r.skip();
+		}
+	});
+	return *this;
+}
+
 json presence::to_json_impl(bool with_id) const {
 	std::map<presence_status, std::string> status_name_mapping = {
 		{ps_online, "online"},
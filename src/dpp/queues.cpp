@@ -28,11 +28,126 @@
 #include <dpp/queues.h>
 #include <dpp/cluster.h>
 #include <dpp/httpsclient.h>
+#include <dpp/exception.h>
+#include <dpp/json.h>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <array>
+#include <tuple>
 
 namespace dpp {
 
+namespace {
+
+constexpr std::array request_verb {
+	"GET",
+	"POST",
+	"PUT",
+	"PATCH",
+	"DELETE"
+};
+
+/**
+ * @brief Convert a rate limit header in seconds with a fractional part, e.g. "1.234",
+ * to milliseconds, rounding up.
+ */
+uint64_t header_ms(const std::string& value) {
+	double seconds = value.empty() ? 0 : std::strtod(value.c_str(), nullptr);
+	return seconds > 0 ? static_cast<uint64_t>(std::ceil(seconds * 1000.0)) : 0;
+}
+
+/**
+ * @brief Routes which page through or act on many objects at once, scheduled as hp_bulk
+ */
+constexpr std::array bulk_routes {
+	"GET /guilds/:major/audit-logs",
+	"GET /guilds/:major/prune",
+	"POST /guilds/:major/prune",
+	"GET /guilds/:major/members",
+	"GET /guilds/:major/members/search",
+	"GET /guilds/:major/bans",
+	"POST /guilds/:major/bulk-ban",
+	"GET /channels/:major/messages",
+	"POST /channels/:major/messages/bulk-delete",
+	"GET /channels/:major/messages/:id/reactions/:emoji",
+	"GET /channels/:major/threads/archived/public",
+	"GET /channels/:major/threads/archived/private",
+	"GET /channels/:major/users/@me/threads/archived/private",
+};
+
+/**
+ * @brief Format milliseconds as seconds for log messages
+ */
+std::string seconds_string(uint64_t ms) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.3f", static_cast<double>(ms) / 1000.0);
+	return buf;
+}
+
+}
+
+rest_route rest_route::from_path(http_method method, std::string_view path) {
+	rest_route r;
+	path = path.substr(0, path.find('?'));
+	std::vector<std::string_view> segments;
+	for (size_t start = 0; start < path.length();) {
+		size_t end = std::min(path.find('/', start), path.length());
+		if (end > start) {
+			segments.emplace_back(path.substr(start, end - start));
+		}
+		start = end + 1;
+	}
+	/* Skip "/api/v10" */
+	size_t first = 0;
+	if (segments.size() >= 2 && segments[0] == "api" && segments[1].length() > 1 && segments[1][0] == 'v') {
+		first = 2;
+	}
+	/* Discord scopes buckets by channel, guild, webhook (with its token) or interaction (with its token) */
+	size_t major_end = first;
+	if (segments.size() > first + 1) {
+		std::string_view top = segments[first];
+		if (top == "channels" || top == "guilds") {
+			major_end = first + 2;
+		} else if (top == "webhooks" || top == "interactions") {
+			major_end = std::min(first + 3, segments.size());
+		}
+		r.global = top != "interactions";
+	}
+	r.route = request_verb[method];
+	r.route += ' ';
+	for (size_t i = first; i < segments.size(); ++i) {
+		std::string_view segment = segments[i];
+		r.route += '/';
+		if (i < major_end) {
+			r.major.append(r.major.empty() ? "" : "/").append(segment);
+			r.route.append(i == first ? segment : ":major");
+		} else if (i > first && segments[i - 1] == "reactions") {
+			r.route += ":emoji";
+		} else if (std::all_of(segment.begin(), segment.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+			r.route += ":id";
+		} else {
+			r.route.append(segment);
+		}
+	}
+	if (!r.global) {
+		r.priority = hp_interaction;
+	} else if (std::find(bulk_routes.begin(), bulk_routes.end(), r.route) != bulk_routes.end()) {
+		r.priority = hp_bulk;
+	}
+	return r;
+}
+
+double queue_wait_stats::average_wait() const {
+	return requests ? total_wait / requests : 0;
+}
+
+int64_t transfer_stats::bytes_saved() const {
+	return static_cast<int64_t>(decoded) - static_cast<int64_t>(received) + static_cast<int64_t>(uncompressed) - static_cast<int64_t>(sent);
+}
+
 http_request::http_request(const std::string &_endpoint, const std::string &_parameters, http_completion_event completion, const std::string &_postdata, http_method _method, const std::string &audit_reason, const std::string &filename, const std::string &filecontent, const std::string &filemimetype, const std::string &http_protocol)
- : complete_handler(completion), completed(false), non_discord(false), endpoint(_endpoint), parameters(_parameters), postdata(_postdata),  method(_method), reason(audit_reason), mimetype("application/json"), waiting(false), protocol(http_protocol), request_timeout(5)
+ : complete_handler(completion), completed(false), non_discord(false), cancelled(false), processor(nullptr), endpoint(_endpoint), parameters(_parameters), postdata(_postdata),  method(_method), reason(audit_reason), mimetype("application/json"), waiting(false), protocol(http_protocol), request_timeout(5), priority(get_route().priority)
 {
 	if (!filename.empty()) {
 		file_name.push_back(filename);
@@ -46,13 +161,13 @@ http_request::http_request(const std::string &_endpoint, const std::string &_par
 }
 
 http_request::http_request(const std::string &_endpoint, const std::string &_parameters, http_completion_event completion, const std::string &_postdata, http_method method, const std::string &audit_reason, const std::vector<std::string> &filename, const std::vector<std::string> &filecontent, const std::vector<std::string> &filemimetypes, const std::string &http_protocol)
- : complete_handler(completion), completed(false), non_discord(false), endpoint(_endpoint), parameters(_parameters), postdata(_postdata),  method(method), reason(audit_reason), file_name(filename), file_content(filecontent), file_mimetypes(filemimetypes), mimetype("application/json"), waiting(false), protocol(http_protocol), request_timeout(5)
+ : complete_handler(completion), completed(false), non_discord(false), cancelled(false), processor(nullptr), endpoint(_endpoint), parameters(_parameters), postdata(_postdata),  method(method), reason(audit_reason), file_name(filename), file_content(filecontent), file_mimetypes(filemimetypes), mimetype("application/json"), waiting(false), protocol(http_protocol), request_timeout(5), priority(get_route().priority)
 {
 }
 
 
 http_request::http_request(const std::string &_url, http_completion_event completion, http_method _method, const std::string &_postdata, const std::string &_mimetype, const std::multimap<std::string, std::string> &_headers, const std::string &http_protocol, time_t _request_timeout)
- : complete_handler(completion), completed(false), non_discord(true), endpoint(_url), postdata(_postdata), method(_method), mimetype(_mimetype), req_headers(_headers), waiting(false), protocol(http_protocol), request_timeout(_request_timeout)
+ : complete_handler(completion), completed(false), non_discord(true), cancelled(false), processor(nullptr), endpoint(_url), postdata(_postdata), method(_method), mimetype(_mimetype), req_headers(_headers), waiting(false), protocol(http_protocol), request_timeout(_request_timeout), priority(hp_normal)
 {
 }
 
@@ -65,8 +180,8 @@ void http_request::complete(const http_request_completion_t &c) {
 	}
 }
 
-/* Fill a http_request_completion_t from a HTTP result */
-void populate_result(const std::string &url, cluster* owner, http_request_completion_t& rv, const https_client &res) {
+/* Fill a http_request_completion_t from a HTTP result, from an https_client or http2_stream */
+template <typename response> void populate_result(const std::string &url, cluster* owner, http_request_completion_t& rv, const response &res) {
 	rv.status = res.get_status();
 	rv.body = res.get_content();
 	for (auto &v : res.get_headers()) {
@@ -77,22 +192,34 @@ void populate_result(const std::string &url, cluster* owner, http_request_comple
 
 	rv.ratelimit_limit = from_string<uint64_t>(res.get_header("x-ratelimit-limit"));
 	rv.ratelimit_remaining = from_string<uint64_t>(res.get_header("x-ratelimit-remaining"));
-	rv.ratelimit_reset_after = from_string<uint64_t>(res.get_header("x-ratelimit-reset-after"));
+	rv.ratelimit_reset_after_ms = header_ms(res.get_header("x-ratelimit-reset-after"));
 	rv.ratelimit_bucket = res.get_header("x-ratelimit-bucket");
 	rv.ratelimit_global = (res.get_header("x-ratelimit-global") == "true");
 	owner->rest_ping = rv.latency;
-	if (res.get_header("x-ratelimit-retry-after") != "") {
-		rv.ratelimit_retry_after = from_string<uint64_t>(res.get_header("x-ratelimit-retry-after"));
+	std::string retry_after = res.get_header("retry-after");
+	if (retry_after.empty()) {
+		retry_after = res.get_header("x-ratelimit-retry-after");
 	}
-	uint64_t rl_timer = rv.ratelimit_retry_after ? rv.ratelimit_retry_after : rv.ratelimit_reset_after;
+	rv.ratelimit_retry_after_ms = header_ms(retry_after);
 	if (rv.status == 429) {
-		owner->log(ll_warning, "Rate limited on endpoint " + url + ", reset after " + std::to_string(rl_timer) + "s!");
+		/* The body of a 429 has retry_after to the millisecond, the header only to the second */
+		json j = json::parse(rv.body, nullptr, false);
+		if (j.is_object() && j.contains("retry_after") && j["retry_after"].is_number()) {
+			rv.ratelimit_retry_after_ms = static_cast<uint64_t>(std::ceil(j["retry_after"].get<double>() * 1000.0));
+			rv.ratelimit_global = rv.ratelimit_global || j.value("global", false);
+		}
+	}
+	rv.ratelimit_reset_after = (rv.ratelimit_reset_after_ms + 999) / 1000;
+	rv.ratelimit_retry_after = (rv.ratelimit_retry_after_ms + 999) / 1000;
+	uint64_t rl_timer = rv.ratelimit_retry_after_ms ? rv.ratelimit_retry_after_ms : rv.ratelimit_reset_after_ms;
+	if (rv.status == 429) {
+		owner->log(ll_warning, "Rate limited on endpoint " + url + ", reset after " + seconds_string(rl_timer) + "s!");
 	}
 	if (url != "/api/v" DISCORD_API_VERSION "/gateway/bot") {	// Squelch this particular api endpoint or it generates a warning the minute we boot a cluster
 		if (rv.ratelimit_global) {
-			owner->log(ll_warning, "At global rate limit on endpoint " + url + ", reset after " + std::to_string(rl_timer) + "s!");
+			owner->log(ll_warning, "At global rate limit on endpoint " + url + ", reset after " + seconds_string(rl_timer) + "s!");
 		} else if (rv.ratelimit_remaining == 0 && rl_timer > 0) {
-			owner->log(ll_debug, "Waiting for endpoint " + url + " rate limit, next request in " + std::to_string(rl_timer) + "s");
+			owner->log(ll_debug, "Waiting for endpoint " + url + " rate limit, next request in " + seconds_string(rl_timer) + "s");
 		}
 	}
 }
@@ -103,13 +230,96 @@ bool http_request::is_completed()
 	return completed;
 }
 
-/* Execute a HTTP request */
-http_request_completion_t http_request::run(cluster* owner) {
+rest_route http_request::get_route() const
+{
+	if (non_discord) {
+		rest_route r;
+		r.route = endpoint;
+		r.global = false;
+		return r;
+	}
+	return rest_route::from_path(method, parameters.empty() ? endpoint : endpoint + "/" + parameters);
+}
 
-	http_request_completion_t rv;
-	double start = dpp::utility::time_f();
-	std::string _host = DISCORD_HOST;
-	std::string _url = endpoint;
+struct http_request::target {
+	/**
+	 * @brief Scheme, host and port to connect to
+	 */
+	http_connect_info hci;
+
+	/**
+	 * @brief Path to request
+	 */
+	std::string url;
+
+	/**
+	 * @brief Request headers
+	 */
+	http_headers headers;
+
+	/**
+	 * @brief Request body and its MIME type
+	 */
+	multipart_content multipart;
+
+	/**
+	 * @brief Size of the request body before compression, or 0 if it was not compressed
+	 */
+	size_t uncompressed_size{0};
+
+	/**
+	 * @brief Multipart body with attachments, referring to the request's file contents
+	 * rather than copying them. Used instead of multipart.body if it has any segments.
+	 */
+	multipart_stream stream;
+
+	/**
+	 * @brief Get the body source and sink for one attempt at sending the request
+	 * @param request The request
+	 * @return streaming options
+	 */
+	https_streaming streaming(const http_request& request) const {
+		https_streaming s;
+		s.sink = request.body_sink;
+		if (request.body_source) {
+			s.source = request.body_source;
+			s.source_length = request.body_source_length;
+		} else if (!stream.segments.empty()) {
+			s.source = stream.source();
+			s.source_length = stream.length;
+		}
+		return s;
+	}
+
+	/**
+	 * @brief Get the connection pool a request may use
+	 * @param request The request
+	 * @param processor Request queue, or nullptr
+	 * @return connection pool, or nullptr if the request must be made on a new connection
+	 */
+	static connection_pool* pool(const http_request& request, request_queue* processor) {
+		/* A body source can't be rewound, to send again if a pooled connection turns out to be closed */
+		return processor && !request.body_source ? &processor->get_connection_pool() : nullptr;
+	}
+
+	/**
+	 * @brief Check if a request is to be sent over HTTP/2
+	 * @param request The request
+	 * @param processor Request queue
+	 * @return true to send it as a stream on a shared HTTP/2 connection
+	 */
+	bool http2(const http_request& request, request_queue* processor) const {
+		/* Like a pooled connection, a stream may need to be sent again, which a body source can't be */
+		if (request.body_source || (request.protocol != "2" && (request.non_discord || !processor->is_http2_enabled()))) {
+			return false;
+		}
+		return !processor->get_http2_pool().is_http1(hci.hostname, hci.port, !hci.is_ssl);
+	}
+};
+
+void http_request::prepare(request_queue* processor, cluster* owner, target& t) const {
+	std::string _host = processor ? processor->get_base_url() : DISCORD_HOST;
+	t.url = endpoint;
 
 	if (non_discord) {
 		std::size_t s_start = endpoint.find("://", 0);
@@ -123,69 +333,144 @@ http_request_completion_t http_request::run(cluster* owner) {
 			std::size_t s_end = endpoint.find_first_of("/?#", s_start + 1);
 			if (s_end != std::string::npos) {
 				_host = endpoint.substr(0, s_end);
-				_url = endpoint.substr(s_end);
+				t.url = endpoint.substr(s_end);
 			} else {
 				_host = endpoint;
-				_url.clear();
+				t.url.clear();
 			}
 		} else {
 			owner->log(ll_error, "Request to '" + endpoint + "' missing protocol scheme. This is not supported. Please specify http or https.");
 		}
 	}
 
-	rv.ratelimit_limit = rv.ratelimit_remaining = rv.ratelimit_reset_after = rv.ratelimit_retry_after = 0;
-	rv.status = 0;
-	rv.latency = 0;
-	rv.ratelimit_global = false;
-
-	dpp::http_headers headers;
 	if (non_discord) {
 		/* Requests outside of Discord have their own headers an NEVER EVER send a bot token! */
 		for (auto& r : req_headers) {
-			headers.emplace(r.first, r.second);
+			t.headers.emplace(r.first, r.second);
 		};
 	} else {
 		/* Always attach token and correct user agent when sending REST to Discord */
-		headers.emplace("Authorization", "Bot " + owner->token);
-		headers.emplace("User-Agent", http_version);
+		t.headers.emplace("Authorization", "Bot " + owner->token);
+		t.headers.emplace("User-Agent", http_version);
 		if (!reason.empty()) {
-			headers.emplace("X-Audit-Log-Reason", reason);
+			t.headers.emplace("X-Audit-Log-Reason", reason);
 		}
 		if (!empty(parameters)) {
-			_url = endpoint + "/" +parameters;
+			t.url = endpoint + "/" +parameters;
 		}
 	}
 
-	constexpr std::array request_verb {
-		"GET",
-		"POST",
-		"PUT",
-		"PATCH",
-		"DELETE"
-	};
-
-	multipart_content multipart;
 	if (non_discord) {
-		multipart = { postdata, mimetype };
+		t.multipart = { postdata, mimetype };
+	} else if (file_content.empty() || compress_request) {
+		t.multipart = https_client::build_multipart(postdata, file_name, file_content, file_mimetypes);
 	} else {
-		multipart = https_client::build_multipart(postdata, file_name, file_content, file_mimetypes);
+		/* Attachments are sent from where they are, rather than copied into one body */
+		t.stream = https_client::stream_multipart(postdata, file_name, file_content, file_mimetypes);
+		t.multipart.mimetype = t.stream.mimetype;
+	}
+	if (!t.multipart.mimetype.empty()) {
+		t.headers.emplace("Content-Type", t.multipart.mimetype);
 	}
-	if (!multipart.mimetype.empty()) {
-		headers.emplace("Content-Type", multipart.mimetype);
+	if (compress_request && !body_source && t.multipart.body.size() >= compress_threshold) {
+		try {
+			std::string compressed = https_client::gzip(t.multipart.body);
+			if (compressed.size() < t.multipart.body.size()) {
+				t.uncompressed_size = t.multipart.body.size();
+				t.multipart.body = std::move(compressed);
+				t.headers.emplace("Content-Encoding", "gzip");
+			}
+		}
+		catch (const dpp::exception& e) {
+			owner->log(ll_warning, "Sending request to " + t.url + " uncompressed: " + std::string(e.what()));
+		}
+	}
+	t.hci = https_client::get_host_info(_host);
+}
+
+template <typename response> void http_request::record_transfer(request_queue* processor, const target& t, const response& res) const {
+	if (!processor || non_discord || res.get_status() == 0) {
+		return;
+	}
+	transfer_stats transfer;
+	transfer.responses = 1;
+	transfer.received = res.get_received_length();
+	transfer.decoded = res.get_decoded_length();
+	if (t.uncompressed_size) {
+		transfer.compressed_requests = 1;
+		transfer.sent = t.multipart.body.size();
+		transfer.uncompressed = t.uncompressed_size;
+	}
+	processor->record_transfer(get_route().route, transfer);
+}
+
+namespace {
+
+/**
+ * @brief Fill a http_request_completion_t from a finished https_client or
+ * http2_stream, logging why if there is no usable response
+ */
+template <typename response> void read_result(const http_connect_info& hci, const std::string& url, cluster* owner, http_request_completion_t& rv, const response& cli) {
+	if (cli.timed_out) {
+		rv.error = h_connection;
+		owner->log(ll_error, "HTTP(S) error on " + hci.scheme + " connection to " + hci.hostname + ":" + std::to_string(hci.port) + ": Timed out while waiting for the response");
+	} else if (cli.get_status() < 100) {
+		rv.error = h_connection;
+		owner->log(ll_error, "HTTP(S) error on " + hci.scheme + " connection to " + hci.hostname + ":" + std::to_string(hci.port) + ": Malformed HTTP response");
+	} else {
+		populate_result(url, owner, rv, cli);
 	}
-	http_connect_info hci = https_client::get_host_info(_host);
+}
+
+/**
+ * @brief An empty result, before the request is made
+ */
+http_request_completion_t empty_result() {
+	http_request_completion_t rv;
+	rv.ratelimit_limit = rv.ratelimit_remaining = rv.ratelimit_reset_after = rv.ratelimit_retry_after = 0;
+	rv.ratelimit_reset_after_ms = rv.ratelimit_retry_after_ms = 0;
+	rv.status = 0;
+	rv.latency = 0;
+	rv.ratelimit_global = false;
+	return rv;
+}
+
+}
+
+/* Execute a HTTP request */
+http_request_completion_t http_request::run(cluster* owner) {
+	return run(nullptr, owner);
+}
+
+/* Execute a HTTP request, reusing a pooled connection if one is available */
+http_request_completion_t http_request::run(request_queue* processor, cluster* owner) {
+
+	http_request_completion_t rv = empty_result();
+	double start = dpp::utility::time_f();
+	target t;
+	prepare(processor, owner, t);
+	const http_connect_info& hci = t.hci;
 	try {
-		https_client cli(hci.hostname, hci.port, _url, request_verb[method], multipart.body, headers, !hci.is_ssl, owner->request_timeout, protocol);
-		rv.latency = dpp::utility::time_f() - start;
-		if (cli.timed_out) {
-			rv.error = h_connection;			
-			owner->log(ll_error, "HTTP(S) error on " + hci.scheme + " connection to " + hci.hostname + ":" + std::to_string(hci.port) + ": Timed out while waiting for the response");
-		} else if (cli.get_status() < 100) {
-			rv.error = h_connection;
-			owner->log(ll_error, "HTTP(S) error on " + hci.scheme + " connection to " + hci.hostname + ":" + std::to_string(hci.port) + ": Malformed HTTP response");
-		} else {
-			populate_result(_url, owner, rv, cli);
+		connection_pool* pool = target::pool(*this, processor);
+		std::unique_ptr<https_client> cli;
+		try {
+			cli = std::make_unique<https_client>(hci.hostname, hci.port, t.url, request_verb[method], t.multipart.body, t.headers, !hci.is_ssl, owner->request_timeout, protocol, pool, t.streaming(*this));
 		}
+		catch (const dpp::connection_exception& e) {
+			/* A pooled connection which the server has since closed fails on write */
+			if (!pool || (e.code() != err_write && e.code() != err_ssl_write)) {
+				throw;
+			}
+		}
+		if (!cli || (cli->is_reused() && !cli->timed_out && cli->get_bytes_in() == 0)) {
+			/* The server closed the pooled connection before it saw our request. Nothing was
+			 * received, so it is safe to send the request again, on a fresh connection.
+			 */
+			cli = std::make_unique<https_client>(hci.hostname, hci.port, t.url, request_verb[method], t.multipart.body, t.headers, !hci.is_ssl, owner->request_timeout, protocol, pool, t.streaming(*this));
+		}
+		rv.latency = dpp::utility::time_f() - start;
+		read_result(hci, t.url, owner, rv, *cli);
+		record_transfer(processor, t, *cli);
 	}
 	catch (const std::exception& e) {
 		owner->log(ll_error, "HTTP(S) error on " + hci.scheme + " connection to " + hci.hostname + ":" + std::to_string(hci.port) + ": " + std::string(e.what()));
@@ -197,12 +482,85 @@ http_request_completion_t http_request::run(cluster* owner) {
 	return rv;
 }
 
-request_queue::request_queue(class cluster* owner, uint32_t request_threads) : creator(owner), terminating(false), globally_ratelimited(false), globally_limited_for(0), in_thread_pool_size(request_threads)
+/* Start a HTTP request on the request queue's socket engine */
+http_transfer http_request::run_async(request_queue* processor, cluster* owner, const std::function<void(http_request_completion_t)>& done) {
+	double start = dpp::utility::time_f();
+	auto t = std::make_shared<target>();
+	prepare(processor, owner, *t);
+	http_transfer transfer;
+	try {
+		if (t->http2(*this, processor)) {
+			auto stream = std::make_shared<http2_stream>();
+			stream->method = request_verb[method];
+			stream->hostname = t->hci.hostname;
+			stream->port = t->hci.port;
+			stream->plaintext = !t->hci.is_ssl;
+			stream->path = t->url.empty() ? "/" : t->url;
+			stream->headers = t->headers;
+			stream->body = t->multipart.body;
+			stream->streaming = t->streaming(*this);
+			stream->request_timeout = owner->request_timeout;
+			stream->completion = [this, processor, t, start, owner, done](http2_stream* s) {
+				http_request_completion_t rv = empty_result();
+				rv.latency = dpp::utility::time_f() - start;
+				if (s->aborted || s->retry) {
+					/* Abandoned, or never seen by the server, which is retried */
+					rv.error = h_connection;
+				} else {
+					read_result(t->hci, t->url, owner, rv, *s);
+					record_transfer(processor, *t, *s);
+				}
+				completed = true;
+				done(rv);
+			};
+			processor->get_http2_pool().submit(stream);
+			transfer.stream = stream;
+			return transfer;
+		}
+		transfer.client = std::make_shared<https_client>(processor->get_socket_engine(), t->hci.hostname, t->hci.port, t->url, request_verb[method], t->multipart.body, t->headers, !t->hci.is_ssl, owner->request_timeout, protocol, target::pool(*this, processor), [this, processor, t, start, owner, done](https_client* cli) {
+			http_request_completion_t rv = empty_result();
+			rv.latency = dpp::utility::time_f() - start;
+			if (cli->aborted || (cli->is_reused() && !cli->timed_out && cli->get_status() == 0)) {
+				/* Abandoned, or a pooled connection the server had closed, which is retried */
+				rv.error = h_connection;
+			} else {
+				read_result(t->hci, t->url, owner, rv, *cli);
+				record_transfer(processor, *t, *cli);
+			}
+			completed = true;
+			done(rv);
+		}, t->streaming(*this));
+	}
+	catch (const std::exception& e) {
+		owner->log(ll_error, "HTTP(S) error on " + t->hci.scheme + " connection to " + t->hci.hostname + ":" + std::to_string(t->hci.port) + ": " + std::string(e.what()));
+		http_request_completion_t rv = empty_result();
+		rv.error = h_connection;
+		completed = true;
+		done(rv);
+	}
+	return transfer;
+}
+
+void http_request::cancel() {
+	cancelled.store(true);
+	if (processor) {
+		processor->wake();
+	}
+}
+
+bool http_request::is_cancelled() const {
+	return cancelled.load();
+}
+
+request_queue::request_queue(class cluster* owner, uint32_t request_threads, uint32_t completion_threads) : creator(owner), out_sleeping(0), responses_out(4096), terminating(false), global_limit(50), global_tokens(50), global_refilled(std::chrono::steady_clock::now()), globally_limited_until(0), http2_enabled(false), base_url(DISCORD_HOST), in_thread_pool_size(request_threads)
 {
+	io_engine = create_socket_engine();
+	io_engine->start("http_io");
+	http2 = std::make_unique<http2_pool>(io_engine.get());
 	for (uint32_t in_alloc = 0; in_alloc < in_thread_pool_size; ++in_alloc) {
 		requests_in.push_back(std::make_unique<in_thread>(owner, this, in_alloc));
 	}
-	out_thread = new std::thread(&request_queue::out_loop, this);
+	add_completion_threads(std::max<uint32_t>(completion_threads, 1));
 }
 
 request_queue& request_queue::add_request_threads(uint32_t request_threads)
@@ -219,7 +577,20 @@ uint32_t request_queue::get_request_thread_count() const
 	return in_thread_pool_size;
 }
 
-in_thread::in_thread(class cluster* owner, class request_queue* req_q, uint32_t index) : terminating(false), requests(req_q), creator(owner)
+request_queue& request_queue::add_completion_threads(uint32_t completion_threads)
+{
+	for (uint32_t out_alloc = 0; out_alloc < completion_threads; ++out_alloc) {
+		out_threads.emplace_back(&request_queue::out_loop, this, static_cast<uint32_t>(out_threads.size()));
+	}
+	return *this;
+}
+
+uint32_t request_queue::get_completion_thread_count() const
+{
+	return static_cast<uint32_t>(out_threads.size());
+}
+
+in_thread::in_thread(class cluster* owner, class request_queue* req_q, uint32_t index) : terminating(false), requests(req_q), creator(owner), woken(false)
 {
 	this->in_thr = new std::thread(&in_thread::in_loop, this, index);
 }
@@ -229,229 +600,424 @@ in_thread::~in_thread()
 	terminate();
 	in_thr->join();
 	delete in_thr;
+	/* Abandon anything still in flight, so that no callbacks arrive once the thread has gone */
+	requests->io_engine->run_sync([this]() {
+		for (auto& [request, f] : in_flight) {
+			if (f.transfer.client) {
+				f.transfer.client->abort();
+			}
+			if (f.transfer.stream) {
+				requests->http2->cancel(f.transfer.stream);
+			}
+		}
+	});
+	in_flight.clear();
 }
 
 void in_thread::terminate()
 {
-	terminating.store(true, std::memory_order_relaxed);
+	{
+		std::scoped_lock lock(in_mutex);
+		terminating.store(true, std::memory_order_relaxed);
+		woken = true;
+	}
+	in_ready.notify_one();
+}
+
+void in_thread::wake()
+{
+	{
+		std::scoped_lock lock(in_mutex);
+		woken = true;
+	}
 	in_ready.notify_one();
 }
 
 request_queue::~request_queue()
 {
-	terminating.store(true, std::memory_order_relaxed);
-	out_ready.notify_one();
+	{
+		std::scoped_lock lock(out_mutex);
+		terminating.store(true, std::memory_order_relaxed);
+	}
+	out_ready.notify_all();
 	for (auto& in_thr : requests_in) {
 		in_thr->terminate(); // signal all of them here, otherwise they will all join 1 by 1 and it will take forever
 	}
-	out_thread->join();
-	delete out_thread;
+	for (auto& out_thr : out_threads) {
+		out_thr.join();
+	}
 }
 
-namespace
+void in_thread::update_bucket(const rest_route& route, const http_request_completion_t& rv)
 {
-
-/**
- * @brief Comparator for sorting a request container
- */
-struct compare_request {
-	/**
-	 * @brief Less_than comparator for sorting
-	 * @param lhs Left-hand side
-	 * @param rhs Right-hand side
-	 * @return Whether lhs comes before rhs in strict ordering
+	if (!rv.ratelimit_bucket.empty()) {
+		requests->learn_bucket(route, rv.ratelimit_bucket);
+	}
+	std::string key = requests->bucket_key(route);
+	if (rv.ratelimit_bucket.empty() && rv.status != 429) {
+		/* No rate limit headers, the route is not limited */
+		buckets.erase(key);
+		return;
+	}
+	auto now = std::chrono::steady_clock::now();
+	auto existing = buckets.find(key);
+	/* Responses to requests in flight together can be seen in any order. Within the
+	 * same window, the lowest remaining count is the most recent.
 	 */
-	bool operator()(const std::unique_ptr<http_request>& lhs, const std::unique_ptr<http_request>& rhs) const noexcept {
-		return std::less{}(lhs->endpoint, rhs->endpoint);
-	};
+	bool same_window = existing != buckets.end() && now < existing->second.reset_at && rv.status != 429;
+	bucket_t& b = buckets[key];
+	auto reset_at = now + std::chrono::milliseconds(std::max(rv.ratelimit_reset_after_ms, rv.status == 429 ? rv.ratelimit_retry_after_ms : 0));
+	b.limit = rv.ratelimit_limit;
+	b.remaining = rv.status == 429 ? 0 : (same_window ? std::min(b.remaining, rv.ratelimit_remaining) : rv.ratelimit_remaining);
+	b.reset_after = rv.ratelimit_reset_after;
+	b.retry_after = rv.ratelimit_retry_after;
+	b.timestamp = time(nullptr);
+	b.reset_at = same_window ? std::max(b.reset_at, reset_at) : reset_at;
+	if (rv.ratelimit_global) {
+		requests->set_globally_limited(now + std::chrono::milliseconds(rv.ratelimit_retry_after_ms ? rv.ratelimit_retry_after_ms : rv.ratelimit_reset_after_ms));
+	}
+}
 
-	/**
-	 * @brief Less_than comparator for sorting
-	 * @param lhs Left-hand side
-	 * @param rhs Right-hand side
-	 * @return Whether lhs comes before rhs in strict ordering
-	 */
-	bool operator()(const std::unique_ptr<http_request>& lhs, std::string_view rhs) const noexcept {
-		return std::less{}(lhs->endpoint, rhs);
-	};
+void in_thread::complete(std::unique_ptr<http_request> request, const http_request_completion_t& rv)
+{
+	request->completed = true;
+	requests->push_completed({std::move(request), std::make_unique<http_request_completion_t>(rv)});
+}
 
-	/**
-	 * @brief Less_than comparator for sorting
-	 * @param lhs Left-hand side
-	 * @param rhs Right-hand side
-	 * @return Whether lhs comes before rhs in strict ordering
-	 */
-	bool operator()(std::string_view lhs, const std::unique_ptr<http_request>& rhs) const noexcept {
-		return std::less{}(lhs, rhs->endpoint);
-	};
-};
+bool in_thread::collect_finished()
+{
+	std::vector<std::pair<http_request*, http_request_completion_t>> results;
+	{
+		std::scoped_lock lock(in_mutex);
+		results.swap(finished);
+	}
+	for (auto& [request_view, rv] : results) {
+		auto f = in_flight.find(request_view);
+		if (f == in_flight.end()) {
+			continue;
+		}
+		in_flight_request done = std::move(f->second);
+		in_flight.erase(f);
+		if (--bucket_in_flight[done.bucket_key] == 0) {
+			bucket_in_flight.erase(done.bucket_key);
+		}
+		if (--queue_in_flight[done.queue_key] == 0) {
+			queue_in_flight.erase(done.queue_key);
+		}
+		if (!done.bucket_known && --unknown_in_flight[done.route.major] == 0) {
+			unknown_in_flight.erase(done.route.major);
+		}
+		std::shared_ptr<https_client> cli = std::move(done.transfer.client);
+		std::shared_ptr<http2_stream> stream = std::move(done.transfer.stream);
+		bool resend = (cli && cli->is_reused() && !cli->aborted && !cli->timed_out && cli->get_status() == 0) || (stream && stream->retry);
+		if (resend && done.aborted == h_success) {
+			/* The server closed the pooled connection before it saw our request, or did not
+			 * process our HTTP/2 stream. It is safe to send the request again, ahead of the
+			 * rest of its queue.
+			 */
+			std::scoped_lock lock(in_mutex);
+			requests_in[done.queue_key].emplace_front(std::move(done.request));
+		} else if (done.aborted != h_success) {
+			rv.error = done.aborted;
+			complete(std::move(done.request), rv);
+		} else {
+			update_bucket(done.route, rv);
+			complete(std::move(done.request), rv);
+		}
+		if (cli) {
+			/* Destroyed on the engine's thread, where detaching from it does not wait */
+			requests->io_engine->post([cli]() {});
+		}
+	}
+	return !results.empty();
+}
 
+void in_thread::expire(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::time_point& next)
+{
+	const std::chrono::steady_clock::time_point no_deadline{};
+	std::vector<std::pair<std::unique_ptr<http_request>, http_error>> expired;
+	{
+		std::scoped_lock lock(in_mutex);
+		for (auto queue = requests_in.begin(); queue != requests_in.end();) {
+			auto& q = queue->second;
+			for (auto r = q.begin(); r != q.end();) {
+				http_request* request_view = r->get();
+				if (request_view->is_cancelled() || (request_view->deadline != no_deadline && now >= request_view->deadline)) {
+					expired.emplace_back(std::move(*r), request_view->is_cancelled() ? h_cancelled : h_deadline);
+					r = q.erase(r);
+					continue;
+				}
+				if (request_view->deadline != no_deadline) {
+					next = std::min(next, request_view->deadline);
+				}
+				++r;
+			}
+			queue = q.empty() ? requests_in.erase(queue) : std::next(queue);
+		}
+	}
+	for (auto& [request, reason] : expired) {
+		http_request_completion_t rv = empty_result();
+		rv.error = reason;
+		complete(std::move(request), rv);
+	}
+
+	for (auto& [request_view, f] : in_flight) {
+		if (f.aborted != h_success) {
+			continue;
+		}
+		if (request_view->is_cancelled() || (request_view->deadline != no_deadline && now >= request_view->deadline)) {
+			/* Completes through collect_finished() once the client has been closed */
+			f.aborted = request_view->is_cancelled() ? h_cancelled : h_deadline;
+			if (f.transfer.client) {
+				requests->io_engine->post([cli = f.transfer.client]() {
+					cli->abort();
+				});
+			}
+			if (f.transfer.stream) {
+				requests->http2->cancel(f.transfer.stream);
+			}
+		} else if (request_view->deadline != no_deadline) {
+			next = std::min(next, request_view->deadline);
+		}
+	}
 }
 
-void in_thread::in_loop(uint32_t index)
+size_t in_thread::in_flight_limit(http_priority priority)
 {
-	utility::set_thread_name(std::string("http_req/") + std::to_string(index));
-	while (!terminating.load(std::memory_order_relaxed)) {
-		std::mutex mtx;
-		std::unique_lock<std::mutex> lock{ mtx };
-		in_ready.wait_for(lock, std::chrono::seconds(1));
-		/* New request to be sent! */
+	switch (priority) {
+		case hp_interaction:
+			return max_in_flight;
+		case hp_normal:
+			return max_in_flight * 3 / 4;
+		default:
+			return max_in_flight / 2;
+	}
+}
 
-		if (!requests->globally_ratelimited) {
+bool in_thread::start_requests(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::time_point& next)
+{
+	bool started = false;
+	/* Highest priority first, then longest waiting first */
+	std::vector<std::tuple<http_priority, std::chrono::steady_clock::time_point, std::string>> keys;
+	{
+		std::scoped_lock lock(in_mutex);
+		keys.reserve(requests_in.size());
+		for (auto& [key, queue] : requests_in) {
+			keys.emplace_back(queue.front()->priority, queue.front()->queued_at, key);
+		}
+	}
+	std::sort(keys.begin(), keys.end());
 
-			std::vector<http_request*> requests_view;
+	for (auto& [priority, queued_at, key] : keys) {
+		while (!terminating.load(std::memory_order_relaxed)) {
+			/* Only this thread removes requests, so the head stays valid once the lock is released */
+			http_request* request_view = nullptr;
 			{
-				/* Gather all the requests first within a mutex */
-				std::shared_lock lock(in_mutex);
-				if (requests_in.empty()) {
-					/* Nothing to copy, wait again */
-					continue;
+				std::scoped_lock lock(in_mutex);
+				auto queue = requests_in.find(key);
+				if (queue != requests_in.end()) {
+					request_view = queue->second.front().get();
 				}
-				requests_view.reserve(requests_in.size());
-				std::transform(requests_in.begin(), requests_in.end(), std::back_inserter(requests_view), [](const std::unique_ptr<http_request> &r) {
-					return r.get();
-				});
 			}
-
-			for (auto& request_view : requests_view) {
-				const std::string &key = request_view->endpoint;
-				http_request_completion_t rv;
-				auto                      currbucket = buckets.find(key);
-
-				if (currbucket != buckets.end()) {
-					/* There's a bucket for this request. Check its status. If the bucket says to wait,
-					* skip all requests in this bucket till its ok.
-					*/
-					if (currbucket->second.remaining < 1) {
-						uint64_t wait = (currbucket->second.retry_after ? currbucket->second.retry_after : currbucket->second.reset_after);
-						if ((uint64_t)time(nullptr) > currbucket->second.timestamp + wait) {
-							/* Time has passed, we can process this bucket again. send its request. */
-							rv = request_view->run(creator);
-						} else {
-							if (!request_view->waiting) {
-								request_view->waiting = true;
-							}
-							/* Time not up yet, wait more */
-							break;
-						}
-					} else {
-						/* There's limit remaining, we can just run the request */
-						rv = request_view->run(creator);
-					}
-				} else {
-					/* No bucket for this endpoint yet. Just send it, and make one from its reply */
-					rv = request_view->run(creator);
+			if (!request_view) {
+				break;
+			}
+			if (in_flight.size() >= in_flight_limit(request_view->priority)) {
+				/* Started again as soon as one finishes */
+				break;
+			}
+			rest_route route = request_view->get_route();
+			std::string bk = requests->bucket_key(route);
+			auto bucket = buckets.find(bk);
+			auto flying = bucket_in_flight.find(bk);
+			uint64_t in_bucket = flying != bucket_in_flight.end() ? flying->second : 0;
+			if (bucket == buckets.end()) {
+				/* Until the bucket is known, only one request at a time, to learn it */
+				if (queue_in_flight.find(key) != queue_in_flight.end()) {
+					break;
 				}
-
-				bucket_t newbucket;
-				newbucket.limit = rv.ratelimit_limit;
-				newbucket.remaining = rv.ratelimit_remaining;
-				newbucket.reset_after = rv.ratelimit_reset_after;
-				newbucket.retry_after = rv.ratelimit_retry_after;
-				newbucket.timestamp = time(nullptr);
-				requests->globally_ratelimited = rv.ratelimit_global;
-				if (requests->globally_ratelimited) {
-					requests->globally_limited_for = (newbucket.retry_after ? newbucket.retry_after : newbucket.reset_after);
+			} else {
+				/* Requests already in flight count against what is left in the bucket */
+				auto unknown = unknown_in_flight.find(route.major);
+				in_bucket += unknown != unknown_in_flight.end() ? unknown->second : 0;
+				uint64_t allowed = now >= bucket->second.reset_at ? std::max<uint64_t>(bucket->second.limit, 1) : bucket->second.remaining;
+				if (in_bucket >= allowed) {
+					request_view->waiting = true;
+					if (now < bucket->second.reset_at) {
+						next = std::min(next, bucket->second.reset_at);
+					}
+					break;
 				}
-				buckets[request_view->endpoint] = newbucket;
+			}
+			std::chrono::steady_clock::time_point retry_at;
+			if (route.global && !requests->take_global(now, retry_at, request_view->priority)) {
+				request_view->waiting = true;
+				next = std::min(next, retry_at);
+				break;
+			}
 
-				/* Remove the request from the incoming requests to transfer it to completed requests */
-				std::unique_ptr<http_request> request;
-				{
-					/* Find the owned pointer in requests_in */
-					std::scoped_lock lock1{in_mutex};
-
-					auto [begin, end] = std::equal_range(requests_in.begin(), requests_in.end(), key, compare_request{});
-					for (auto it = begin; it != end; ++it) {
-						if (it->get() == request_view) {
-							/* Grab and remove */
-							request = std::move(*it);
-							requests_in.erase(it);
-							break;
-						}
-					}
+			std::unique_ptr<http_request> request;
+			{
+				std::scoped_lock lock(in_mutex);
+				auto queue = requests_in.find(key);
+				request = std::move(queue->second.front());
+				queue->second.pop_front();
+				if (queue->second.empty()) {
+					requests_in.erase(queue);
 				}
-				/* Make a new entry in the completion list and notify */
-				auto hrc = std::make_unique<http_request_completion_t>();
-				*hrc = rv;
+			}
+			request->waiting = false;
+			requests->record_wait(request->priority, std::chrono::duration<double>(now - request->queued_at).count());
+			in_flight_request& f = in_flight[request_view];
+			f.route = route;
+			f.queue_key = key;
+			f.bucket_key = bk;
+			f.bucket_known = bucket != buckets.end();
+			f.request = std::move(request);
+			bucket_in_flight[bk]++;
+			queue_in_flight[key]++;
+			if (!f.bucket_known) {
+				unknown_in_flight[route.major]++;
+			}
+			f.transfer = request_view->run_async(requests, creator, [this, request_view](http_request_completion_t rv) {
 				{
-					std::scoped_lock lock1(requests->out_mutex);
-					requests->responses_out.push({std::move(request), std::move(hrc)});
+					std::scoped_lock lock(in_mutex);
+					finished.emplace_back(request_view, std::move(rv));
+					woken = true;
 				}
-				requests->out_ready.notify_one();
-			}
+				in_ready.notify_one();
+			});
+			started = true;
+		}
+	}
+	return started;
+}
 
-		} else {
-			if (requests->globally_limited_for > 0) {
-				std::this_thread::sleep_for(std::chrono::seconds(requests->globally_limited_for));
-				requests->globally_limited_for = 0;
+void in_thread::in_loop(uint32_t index)
+{
+	utility::set_thread_name(std::string("http_req/") + std::to_string(index));
+	auto last_prune = std::chrono::steady_clock::now();
+	while (!terminating.load(std::memory_order_relaxed)) {
+		auto now = std::chrono::steady_clock::now();
+		/* Wake up at least once a second, or when the first held bucket resets or deadline passes */
+		auto next = now + std::chrono::seconds(1);
+
+		bool progress = collect_finished();
+		now = std::chrono::steady_clock::now();
+		expire(now, next);
+		if (start_requests(now, next)) {
+			progress = true;
+		}
+
+		now = std::chrono::steady_clock::now();
+		if (now - last_prune >= std::chrono::seconds(60)) {
+			/* Forget buckets which have reset, they hold nothing back */
+			last_prune = now;
+			for (auto b = buckets.begin(); b != buckets.end();) {
+				b = b->second.reset_at <= now && bucket_in_flight.find(b->first) == bucket_in_flight.end() ? buckets.erase(b) : std::next(b);
 			}
-			requests->globally_ratelimited = false;
-			in_ready.notify_one();
+		}
+
+		if (!progress) {
+			/* Nothing more can happen until a request finishes, a bucket resets or a new request arrives */
+			std::unique_lock lock(in_mutex);
+			in_ready.wait_until(lock, next, [this]() {
+				return woken;
+			});
+			woken = false;
 		}
 	}
 }
 
-bool request_queue::queued_deleting_request::operator<(const queued_deleting_request& other) const noexcept {
-	return time_to_delete < other.time_to_delete;
+void request_queue::push_completed(completed_request completed)
+{
+	if (!responses_out.try_push(completed)) {
+		/* Only if callbacks are falling far behind */
+		std::scoped_lock lock(out_mutex);
+		responses_overflow.push(std::move(completed));
+	}
+	/* Pairs with the fence in out_loop: either a completion thread going to sleep sees
+	 * the request we pushed, or we see that it is asleep and wake it.
+	 */
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (out_sleeping.load(std::memory_order_relaxed) > 0) {
+		{
+			std::scoped_lock lock(out_mutex);
+		}
+		out_ready.notify_one();
+	}
 }
 
-bool request_queue::queued_deleting_request::operator<(time_t time) const noexcept {
-	return time_to_delete < time;
+bool request_queue::take_completed(std::vector<completed_request>& batch)
+{
+	completed_request c;
+	while (batch.size() < completion_batch && responses_out.try_pop(c)) {
+		batch.emplace_back(std::move(c));
+	}
+	if (batch.empty()) {
+		std::scoped_lock lock(out_mutex);
+		while (batch.size() < completion_batch && !responses_overflow.empty()) {
+			batch.emplace_back(std::move(responses_overflow.front()));
+			responses_overflow.pop();
+		}
+	}
+	return !batch.empty();
 }
 
-
-void request_queue::out_loop()
+void request_queue::out_loop(uint32_t index)
 {
-	utility::set_thread_name("req_callback");
+	utility::set_thread_name(std::string("req_callback/") + std::to_string(index));
+	time_t last_prune = 0;
+	std::vector<completed_request> batch;
+	batch.reserve(completion_batch);
 	while (!terminating.load(std::memory_order_relaxed)) {
-
-		std::mutex mtx;
-		std::unique_lock lock{ mtx };
-		out_ready.wait_for(lock, std::chrono::seconds(1));
-		time_t now = time(nullptr);
-
-		/* A request has been completed! */
-		completed_request queue_head = {};
-		{
-			std::scoped_lock lock1(out_mutex);
-			if (responses_out.size()) {
-				queue_head = std::move(responses_out.front());
-				responses_out.pop();
+		if (take_completed(batch)) {
+			for (auto& c : batch) {
+				if (c.request && c.response) {
+					c.request->complete(*c.response);
+				}
+				/* Freed as soon as its callback returns. Nothing refers to a request once
+				 * it has completed, as cancel() is only valid until then.
+				 */
+				c = {};
 			}
+			batch.clear();
+			continue;
 		}
 
-		if (queue_head.request && queue_head.response) {
-			queue_head.request->complete(*queue_head.response);
-			/* Queue deletions for 60 seconds from now */
-			auto when = now + 60;
-			auto where = std::lower_bound(responses_to_delete.begin(), responses_to_delete.end(), when);
-			responses_to_delete.insert(where, {when, std::move(queue_head)});
+		/* Close any idle connections which have expired or been dropped by the server */
+		time_t now = time(nullptr);
+		if (index == 0 && now != last_prune) {
+			last_prune = now;
+			connections.prune();
 		}
 
-		/* Check for deletable items every second regardless of select status */
-		auto end = std::lower_bound(responses_to_delete.begin(), responses_to_delete.end(), now);
-		if (end != responses_to_delete.begin()) {
-			responses_to_delete.erase(responses_to_delete.begin(), end);
+		std::unique_lock lock(out_mutex);
+		out_sleeping.fetch_add(1);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (responses_out.size_approx() == 0 && responses_overflow.empty() && !terminating.load(std::memory_order_relaxed)) {
+			out_ready.wait_for(lock, std::chrono::seconds(1));
 		}
+		out_sleeping.fetch_sub(1);
 	}
 }
 
 /* Post a http_request into the queue */
 void in_thread::post_request(std::unique_ptr<http_request> req)
 {
+	rest_route route = req->get_route();
+	req->queued_at = std::chrono::steady_clock::now();
 	{
 		std::scoped_lock lock(in_mutex);
-
-		auto where = std::lower_bound(requests_in.begin(), requests_in.end(), req->endpoint, compare_request{});
-		requests_in.emplace(where, std::move(req));
+		requests_in[route.route + "|" + route.major].emplace_back(std::move(req));
+		woken = true;
 	}
 	in_ready.notify_one();
 }
 
-/* Simple hash function for hashing urls into thread pool values,
- * ensuring that the same url always ends up on the same thread,
- * which means that it will be part of the same ratelimit bucket.
+/* Simple hash function for hashing major parameters into thread pool values,
+ * ensuring that the same major parameter always ends up on the same thread,
+ * which means that its ratelimit buckets are all tracked in one place.
  * I did consider std::hash for this, but std::hash returned even
  * numbers for absolutely every string i passed it on g++ 10.0,
  * so this was a no-no. There are also much bigger more complex
@@ -470,13 +1036,159 @@ inline uint32_t hash(const char *s)
 /* Post a http_request into a request queue */
 request_queue& request_queue::post_request(std::unique_ptr<http_request> req)
 {
-	requests_in[hash(req->endpoint.c_str()) % in_thread_pool_size]->post_request(std::move(req));
+	req->processor = this;
+	rest_route route = req->get_route();
+	/* Bucket counters belong to a thread. Routes with a major parameter all go to its
+	 * thread; other routes go to the thread of their bucket once Discord has reported
+	 * it, as several routes may share one bucket.
+	 */
+	const std::string key = route.major.empty() ? bucket_key(route) : route.major;
+	requests_in[hash(key.c_str()) % in_thread_pool_size]->post_request(std::move(req));
 	return *this;
 }
 
+std::string request_queue::bucket_key(const rest_route& route)
+{
+	std::shared_lock lock(route_mutex);
+	auto b = route_buckets.find(route.route);
+	return (b != route_buckets.end() ? b->second : route.route) + "|" + route.major;
+}
+
+void request_queue::learn_bucket(const rest_route& route, const std::string& bucket)
+{
+	{
+		std::shared_lock lock(route_mutex);
+		auto b = route_buckets.find(route.route);
+		if (b != route_buckets.end() && b->second == bucket) {
+			return;
+		}
+	}
+	std::unique_lock lock(route_mutex);
+	route_buckets[route.route] = bucket;
+}
+
+bool request_queue::take_global(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::time_point& retry_at, http_priority priority)
+{
+	std::chrono::steady_clock::time_point limited{std::chrono::steady_clock::duration(globally_limited_until.load())};
+	if (now < limited) {
+		retry_at = limited;
+		return false;
+	}
+	std::scoped_lock lock(global_mutex);
+	if (global_limit == 0) {
+		return true;
+	}
+	double elapsed = std::chrono::duration<double>(now - global_refilled).count();
+	global_tokens = std::min(static_cast<double>(global_limit), global_tokens + elapsed * global_limit);
+	global_refilled = now;
+	/* Lower priorities leave part of the burst for higher ones. This only limits bursts,
+	 * as the bucket keeps refilling at the full rate.
+	 */
+	double needed = 1 + (priority == hp_bulk ? global_limit / 4 : (priority == hp_normal ? global_limit / 10 : 0));
+	if (global_tokens >= needed) {
+		global_tokens -= 1;
+		return true;
+	}
+	retry_at = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>((needed - global_tokens) / global_limit));
+	return false;
+}
+
+void request_queue::record_wait(http_priority priority, double wait)
+{
+	std::scoped_lock lock(wait_mutex);
+	queue_wait_stats& w = wait_stats[priority];
+	w.requests++;
+	w.total_wait += wait;
+	w.max_wait = std::max(w.max_wait, wait);
+}
+
+queue_wait_stats request_queue::get_queue_wait_stats(http_priority priority)
+{
+	std::scoped_lock lock(wait_mutex);
+	return wait_stats[std::min<uint8_t>(priority, hp_bulk)];
+}
+
+void request_queue::record_transfer(const std::string& route, const transfer_stats& transfer)
+{
+	std::scoped_lock lock(transfer_mutex);
+	transfer_stats& t = transfers[route];
+	t.responses += transfer.responses;
+	t.received += transfer.received;
+	t.decoded += transfer.decoded;
+	t.compressed_requests += transfer.compressed_requests;
+	t.sent += transfer.sent;
+	t.uncompressed += transfer.uncompressed;
+}
+
+std::map<std::string, transfer_stats> request_queue::get_transfer_stats()
+{
+	std::scoped_lock lock(transfer_mutex);
+	return std::map<std::string, transfer_stats>(transfers.begin(), transfers.end());
+}
+
+void request_queue::set_globally_limited(std::chrono::steady_clock::time_point until)
+{
+	auto ticks = until.time_since_epoch().count();
+	auto current = globally_limited_until.load();
+	while (current < ticks && !globally_limited_until.compare_exchange_weak(current, ticks)) {
+	}
+}
+
 bool request_queue::is_globally_ratelimited() const
 {
-	return this->globally_ratelimited;
+	return std::chrono::steady_clock::now().time_since_epoch().count() < globally_limited_until.load();
+}
+
+request_queue& request_queue::set_global_rate_limit(uint32_t requests_per_second)
+{
+	std::scoped_lock lock(global_mutex);
+	global_limit = requests_per_second;
+	global_tokens = std::min(global_tokens, static_cast<double>(requests_per_second));
+	return *this;
+}
+
+request_queue& request_queue::set_base_url(const std::string& url)
+{
+	base_url = url;
+	return *this;
+}
+
+const std::string& request_queue::get_base_url() const
+{
+	return base_url;
+}
+
+void request_queue::wake()
+{
+	for (auto& in_thr : requests_in) {
+		in_thr->wake();
+	}
+}
+
+socket_engine_base* request_queue::get_socket_engine()
+{
+	return io_engine.get();
+}
+
+request_queue& request_queue::set_http2(bool enabled)
+{
+	http2_enabled = enabled;
+	return *this;
+}
+
+bool request_queue::is_http2_enabled() const
+{
+	return http2_enabled;
+}
+
+http2_pool& request_queue::get_http2_pool()
+{
+	return *http2;
+}
+
+connection_pool& request_queue::get_connection_pool()
+{
+	return connections;
 }
 
 }
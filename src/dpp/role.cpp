@@ -379,6 +379,7 @@ members_container role::get_members() const {
 	members_container gm;
 	guild* g = dpp::find_guild(this->guild_id);
 	if (g) {
+		std::shared_lock lock(g->get_mutex());
 		if (this->guild_id == this->id) {
 			/* Special shortcircuit for everyone-role. Always includes all users. */
 			return g->members;
@@ -662,6 +662,7 @@ void from_json(const nlohmann::json& j, interaction& i) {
 			/* User caching on, lazy or aggressive - cache or update the member information */
 			guild* g = dpp::find_guild(i.guild_id);
 			if (g) {
+				std::unique_lock lock(g->get_mutex());
 				g->members[i.member.user_id] = i.member;
 			}
 		}
@@ -0,0 +1,280 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <dpp/socketengine.h>
+#include <dpp/sslclient.h>
+#include <dpp/utility.h>
+#include <chrono>
+#include <future>
+#ifndef _WIN32
+	#include <unistd.h>
+	#include <fcntl.h>
+#endif
+
+namespace dpp {
+
+socket_engine_base::socket_engine_base() {
+#ifndef _WIN32
+	int p[2];
+	if (pipe(p) == 0) {
+		wake_fds[0] = p[0];
+		wake_fds[1] = p[1];
+		set_nonblocking(wake_fds[0], true);
+		set_nonblocking(wake_fds[1], true);
+	}
+#endif
+}
+
+socket_engine_base::~socket_engine_base() {
+	stop();
+	if (runner.joinable()) {
+		runner.join();
+	}
+#ifndef _WIN32
+	if (wake_fds[0] != INVALID_SOCKET) {
+		::close(wake_fds[0]);
+		::close(wake_fds[1]);
+	}
+#endif
+}
+
+socket_events* socket_engine_base::get_fd(dpp::socket fd) {
+	std::shared_lock lock(fds_mutex);
+	auto iter = fds.find(fd);
+	if (iter == fds.end()) {
+		return nullptr;
+	}
+	return iter->second.get();
+}
+
+bool socket_engine_base::register_socket(const socket_events& e) {
+	if (e.fd == INVALID_SOCKET) {
+		return false;
+	}
+	std::unique_lock lock(fds_mutex);
+	auto iter = fds.find(e.fd);
+	if (iter != fds.end()) {
+		/* A stale entry for a recycled file descriptor, retire it */
+		remove_watch(e.fd);
+		to_delete.emplace_back(std::move(iter->second));
+		fds.erase(iter);
+	}
+	auto& stored = fds.emplace(e.fd, std::make_unique<socket_events>(e)).first->second;
+	bool r = add_watch(*stored);
+	if (!r) {
+		fds.erase(e.fd);
+	}
+	lock.unlock();
+	wake();
+	return r;
+}
+
+bool socket_engine_base::update_socket(dpp::socket fd, uint8_t flags) {
+	std::unique_lock lock(fds_mutex);
+	auto iter = fds.find(fd);
+	if (iter == fds.end()) {
+		return false;
+	}
+	if (iter->second->flags == flags) {
+		return true;
+	}
+	iter->second->flags = flags;
+	bool r = modify_watch(*iter->second);
+	lock.unlock();
+	wake();
+	return r;
+}
+
+bool socket_engine_base::remove_socket(dpp::socket fd) {
+	std::unique_lock lock(fds_mutex);
+	auto iter = fds.find(fd);
+	if (iter == fds.end()) {
+		return false;
+	}
+	remove_watch(fd);
+	to_delete.emplace_back(std::move(iter->second));
+	fds.erase(iter);
+	return true;
+}
+
+void socket_engine_base::prune() {
+	std::unique_lock lock(fds_mutex);
+	to_delete.clear();
+}
+
+size_t socket_engine_base::size() {
+	std::shared_lock lock(fds_mutex);
+	return fds.size();
+}
+
+uint64_t socket_engine_base::add_ticker(const socket_tick_event& tick) {
+	std::lock_guard lock(work_mutex);
+	uint64_t id = next_ticker_id++;
+	tickers.emplace(id, tick);
+	return id;
+}
+
+void socket_engine_base::remove_ticker(uint64_t id) {
+	std::lock_guard lock(work_mutex);
+	tickers.erase(id);
+}
+
+void socket_engine_base::post(const std::function<void()>& work) {
+	{
+		std::lock_guard lock(work_mutex);
+		deferred.emplace_back(work);
+	}
+	wake();
+}
+
+bool socket_engine_base::on_engine_thread() const {
+	return loop_thread.load() == std::this_thread::get_id();
+}
+
+void socket_engine_base::run_sync(const std::function<void()>& work) {
+	if (on_engine_thread()) {
+		work();
+		return;
+	}
+	std::promise<void> done;
+	std::future<void> waiter = done.get_future();
+	{
+		std::unique_lock lock(work_mutex);
+		if (loop_thread.load() == std::thread::id{}) {
+			/* Nothing is running the loop, so nothing can race with us */
+			lock.unlock();
+			work();
+			return;
+		}
+		deferred.emplace_back([&work, &done]() {
+			work();
+			done.set_value();
+		});
+	}
+	wake();
+	waiter.wait();
+}
+
+void socket_engine_base::wake() {
+#ifndef _WIN32
+	if (wake_fds[1] != INVALID_SOCKET && !on_engine_thread()) {
+		char c = 0;
+		[[maybe_unused]] auto r = ::write(wake_fds[1], &c, 1);
+	}
+#endif
+}
+
+void socket_engine_base::drain_wake() {
+#ifndef _WIN32
+	char buf[64];
+	while (::read(wake_fds[0], buf, sizeof(buf)) > 0) {
+	}
+#endif
+}
+
+int socket_engine_base::time_to_next_tick() const {
+	const int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	if (now / 1000 != (int64_t)last_tick) {
+		return 0;
+	}
+	int wait = 1000 - (int)(now % 1000);
+#ifdef _WIN32
+	/* There is no wake pipe on Windows, so keep the wait short enough for changes to be noticed */
+	wait = std::min(wait, 50);
+#endif
+	return wait;
+}
+
+void socket_engine_base::run_timers_and_work() {
+	std::vector<std::function<void()>> work;
+	{
+		std::lock_guard lock(work_mutex);
+		work.swap(deferred);
+	}
+	for (auto& w : work) {
+		w();
+	}
+	if (last_tick != time(nullptr)) {
+		last_tick = time(nullptr);
+		/* Take a snapshot of the ticker ids, a ticker may add or remove tickers when called */
+		std::vector<uint64_t> ids;
+		{
+			std::lock_guard lock(work_mutex);
+			ids.reserve(tickers.size());
+			for (auto& t : tickers) {
+				ids.emplace_back(t.first);
+			}
+		}
+		for (auto id : ids) {
+			socket_tick_event tick;
+			{
+				std::lock_guard lock(work_mutex);
+				auto iter = tickers.find(id);
+				if (iter == tickers.end()) {
+					continue;
+				}
+				tick = iter->second;
+			}
+			tick();
+		}
+	}
+}
+
+void socket_engine_base::iterate() {
+	process_events(time_to_next_tick());
+	run_timers_and_work();
+}
+
+void socket_engine_base::run() {
+	loop_thread = std::this_thread::get_id();
+	while (!terminating) {
+		iterate();
+	}
+	std::vector<std::function<void()>> work;
+	{
+		std::lock_guard lock(work_mutex);
+		loop_thread = std::thread::id{};
+		work.swap(deferred);
+	}
+	/* Anything still waiting on run_sync() must not be left blocked */
+	for (auto& w : work) {
+		w();
+	}
+}
+
+void socket_engine_base::start(const std::string& name) {
+	runner = std::thread([this, name]() {
+		utility::set_thread_name(name);
+		run();
+	});
+	loop_thread = runner.get_id();
+}
+
+void socket_engine_base::stop() {
+	terminating = true;
+	wake();
+}
+
+std::thread::native_handle_type socket_engine_base::native_handle() {
+	return runner.native_handle();
+}
+
+}
@@ -0,0 +1,163 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#ifdef __linux__
+#include <dpp/socketengine.h>
+#include <dpp/exception.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+namespace dpp {
+
+/**
+ * @brief Maximum number of events returned from a single epoll_wait()
+ */
+constexpr int MAX_EPOLL_EVENTS{128};
+
+/**
+ * @brief Convert a socket_events flags bitmask into epoll event bits
+ * @param flags bitmask of values from dpp::socket_event_flags
+ * @return epoll event bits
+ */
+static uint32_t to_epoll_events(uint8_t flags) {
+	uint32_t events = EPOLLRDHUP;
+	if (flags & WANT_READ) {
+		events |= EPOLLIN;
+	}
+	if (flags & WANT_WRITE) {
+		events |= EPOLLOUT;
+	}
+	if (flags & WANT_ERROR) {
+		events |= EPOLLERR;
+	}
+	return events;
+}
+
+/**
+ * @brief Linux epoll(7) socket engine. Interest set changes are made directly
+ * in the kernel, so they take effect even while another thread is blocked in
+ * epoll_wait().
+ */
+class socket_engine_epoll : public socket_engine_base {
+	/**
+	 * @brief epoll instance
+	 */
+	int epoll_handle{INVALID_SOCKET};
+
+	/**
+	 * @brief Returned events
+	 */
+	epoll_event events[MAX_EPOLL_EVENTS]{};
+
+protected:
+	bool add_watch(const socket_events& e) override {
+		epoll_event ev{};
+		ev.events = to_epoll_events(e.flags);
+		ev.data.fd = e.fd;
+		return epoll_ctl(epoll_handle, EPOLL_CTL_ADD, e.fd, &ev) >= 0;
+	}
+
+	bool modify_watch(const socket_events& e) override {
+		epoll_event ev{};
+		ev.events = to_epoll_events(e.flags);
+		ev.data.fd = e.fd;
+		return epoll_ctl(epoll_handle, EPOLL_CTL_MOD, e.fd, &ev) >= 0;
+	}
+
+	bool remove_watch(dpp::socket fd) override {
+		epoll_event ev{};
+		return epoll_ctl(epoll_handle, EPOLL_CTL_DEL, fd, &ev) >= 0;
+	}
+
+public:
+	socket_engine_epoll() : epoll_handle(epoll_create1(EPOLL_CLOEXEC)) {
+		if (epoll_handle == -1) {
+			throw dpp::connection_exception(err_epoll, "Failed to initialise epoll()");
+		}
+		if (wake_fds[0] != INVALID_SOCKET) {
+			epoll_event ev{};
+			ev.events = EPOLLIN;
+			ev.data.fd = wake_fds[0];
+			epoll_ctl(epoll_handle, EPOLL_CTL_ADD, wake_fds[0], &ev);
+		}
+	}
+
+	~socket_engine_epoll() override {
+		if (epoll_handle != -1) {
+			::close(epoll_handle);
+		}
+	}
+
+	void process_events(int timeout_ms) override {
+		int i = epoll_wait(epoll_handle, events, MAX_EPOLL_EVENTS, timeout_ms);
+
+		for (int j = 0; j < i; j++) {
+			epoll_event ev = events[j];
+			const int fd = ev.data.fd;
+
+			if (fd == wake_fds[0]) {
+				drain_wake();
+				continue;
+			}
+
+			/* A previous callback in this batch may have removed this socket */
+			socket_events* eh = get_fd(fd);
+			if (eh == nullptr) {
+				continue;
+			}
+
+			if ((ev.events & EPOLLHUP) != 0U || (ev.events & EPOLLERR) != 0U) {
+				int errcode = 0;
+				socklen_t codesize = sizeof(errcode);
+				getsockopt(fd, SOL_SOCKET, SO_ERROR, &errcode, &codesize);
+				if (eh->on_error) {
+					eh->on_error(fd, *eh, errcode);
+				}
+				continue;
+			}
+
+			if ((ev.events & EPOLLIN) != 0U || (ev.events & EPOLLRDHUP) != 0U) {
+				if (eh->on_read) {
+					eh->on_read(fd, *eh);
+				}
+				/* The read callback may have removed the socket */
+				if (get_fd(fd) != eh) {
+					continue;
+				}
+			}
+
+			if ((ev.events & EPOLLOUT) != 0U && eh->on_write) {
+				eh->on_write(fd, *eh);
+			}
+		}
+		prune();
+	}
+};
+
+std::unique_ptr<socket_engine_base> create_socket_engine_epoll() {
+	return std::make_unique<socket_engine_epoll>();
+}
+
+}
+#endif
@@ -0,0 +1,160 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <dpp/socketengine.h>
+#ifdef _WIN32
+	/* Windows-specific sockets includes */
+	#include <WinSock2.h>
+	#include <WS2tcpip.h>
+	#include <io.h>
+	/* Windows doesn't have standard poll(), it has WSAPoll.
+	 * It's the same thing with different symbol names.
+	 * Microsoft gotta be different.
+	 */
+	#define poll(fds, nfds, timeout) WSAPoll(fds, nfds, timeout)
+	#define pollfd WSAPOLLFD
+#else
+	/* Anything other than Windows (e.g. sane OSes) */
+	#include <poll.h>
+	#include <sys/socket.h>
+	#include <unistd.h>
+#endif
+#include <thread>
+#include <chrono>
+
+namespace dpp {
+
+/**
+ * @brief Portable poll() socket engine. The pollfd set is rebuilt from the
+ * registered sockets on every iteration, so interest set changes made on other
+ * threads take effect once the wait is interrupted via the wake pipe.
+ */
+class socket_engine_poll : public socket_engine_base {
+	/**
+	 * @brief Pollfd set passed to poll(), reused across iterations
+	 */
+	std::vector<pollfd> poll_set;
+
+protected:
+	bool add_watch(const socket_events& e) override {
+		return true;
+	}
+
+	bool modify_watch(const socket_events& e) override {
+		return true;
+	}
+
+	bool remove_watch(dpp::socket fd) override {
+		return true;
+	}
+
+public:
+	void process_events(int timeout_ms) override {
+		poll_set.clear();
+		{
+			std::shared_lock lock(fds_mutex);
+			poll_set.reserve(fds.size() + 1);
+			for (const auto& [fd, e] : fds) {
+				pollfd pfd{};
+				pfd.fd = fd;
+				if (e->flags & WANT_READ) {
+					pfd.events |= POLLIN;
+				}
+				if (e->flags & WANT_WRITE) {
+					pfd.events |= POLLOUT;
+				}
+				poll_set.emplace_back(pfd);
+			}
+		}
+		if (wake_fds[0] != INVALID_SOCKET) {
+			pollfd pfd{};
+			pfd.fd = wake_fds[0];
+			pfd.events = POLLIN;
+			poll_set.emplace_back(pfd);
+		}
+
+		if (poll_set.empty()) {
+			/* WSAPoll fails with no sockets, and there is nothing to wait for anyway */
+			std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+			return;
+		}
+
+		int i = ::poll(poll_set.data(), static_cast<unsigned int>(poll_set.size()), timeout_ms);
+
+		for (size_t j = 0; j < poll_set.size() && i > 0; j++) {
+			const pollfd& pfd = poll_set[j];
+			if (pfd.revents == 0) {
+				continue;
+			}
+			i--;
+
+			if (pfd.fd == wake_fds[0]) {
+				drain_wake();
+				continue;
+			}
+
+			/* A previous callback in this batch may have removed this socket */
+			socket_events* eh = get_fd(pfd.fd);
+			if (eh == nullptr) {
+				continue;
+			}
+
+			if ((pfd.revents & POLLHUP) != 0 || (pfd.revents & POLLERR) != 0 || (pfd.revents & POLLNVAL) != 0) {
+				int errcode = 0;
+				socklen_t codesize = sizeof(errcode);
+				getsockopt(pfd.fd, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&errcode), &codesize);
+				if (eh->on_error) {
+					eh->on_error(pfd.fd, *eh, errcode);
+				}
+				continue;
+			}
+
+			if ((pfd.revents & POLLIN) != 0) {
+				if (eh->on_read) {
+					eh->on_read(pfd.fd, *eh);
+				}
+				/* The read callback may have removed the socket */
+				if (get_fd(pfd.fd) != eh) {
+					continue;
+				}
+			}
+
+			if ((pfd.revents & POLLOUT) != 0 && eh->on_write) {
+				eh->on_write(pfd.fd, *eh);
+			}
+		}
+		prune();
+	}
+};
+
+#ifdef __linux__
+std::unique_ptr<socket_engine_base> create_socket_engine_epoll();
+#endif
+
+std::unique_ptr<socket_engine_base> create_socket_engine() {
+#ifdef __linux__
+	return create_socket_engine_epoll();
+#else
+	return std::make_unique<socket_engine_poll>();
+#endif
+}
+
+}
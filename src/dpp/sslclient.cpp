@@ -38,6 +38,7 @@
 	/* Anyting other than Windows (e.g. sane OSes) */
 	#include <poll.h>
 	#include <sys/socket.h>
+	#include <sys/uio.h>
 	#include <unistd.h>
 #endif
 #include <csignal>
@@ -57,10 +58,14 @@
 #endif
 #include <exception>
 #include <string>
+#include <algorithm>
 #include <iostream>
 #include <unordered_map>
 #include <chrono>
+#include <mutex>
+#include <atomic>
 #include <dpp/sslclient.h>
+#include <dpp/connectionpool.h>
 #include <dpp/exception.h>
 #include <dpp/utility.h>
 #include <dpp/stringops.h>
@@ -84,15 +89,6 @@ public:
 	SSL* ssl;
 };
 
-/**
- * @brief Keepalive cache record
- */
-struct keepalive_cache_t {
-	time_t created;
-	openssl_connection* ssl;
-	dpp::socket sfd;
-};
-
 /**
  * @brief Custom deleter for SSL_CTX
  */
@@ -104,20 +100,103 @@ public:
 };
 
 /**
- * @brief OpenSSL context
+ * @brief Custom deleter for SSL_SESSION
  */
-thread_local std::unique_ptr<SSL_CTX, openssl_context_deleter> openssl_context;
+class openssl_session_deleter {
+public:
+	void operator()(SSL_SESSION* session) const noexcept {
+		SSL_SESSION_free(session);
+	}
+};
+
+/**
+ * @brief Resumable TLS sessions by hostname. Sessions are added by OpenSSL's new
+ * session callback, which for TLS 1.3 fires when the server sends a session
+ * ticket after the handshake, and for TLS 1.2 at the end of the handshake.
+ */
+static std::unordered_map<std::string, std::unique_ptr<SSL_SESSION, openssl_session_deleter>> openssl_sessions;
+
+/**
+ * @brief Mutex for openssl_sessions
+ */
+static std::mutex openssl_sessions_mutex;
+
+/**
+ * @brief Handshake counters and total time spent in handshakes, in microseconds
+ */
+static std::atomic<uint64_t> full_handshakes{0}, resumed_handshakes{0}, full_handshake_us{0}, resumed_handshake_us{0};
+
+/**
+ * @brief Store a new resumable session against the hostname the connection was made to
+ * @param ssl Connection
+ * @param session New session
+ * @return 1 if we took ownership of the session, 0 if not
+ */
+static int on_new_session(SSL* ssl, SSL_SESSION* session) {
+	const char* servername = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+	if (servername == nullptr || !SSL_SESSION_is_resumable(session)) {
+		return 0;
+	}
+	std::lock_guard lock(openssl_sessions_mutex);
+	openssl_sessions[servername].reset(session);
+	return 1;
+}
 
 /**
- * @brief Keepalive sessions, per-thread
+ * @brief Get the process-wide client context, creating it on first use.
+ * One context is shared by every connection on every thread, so that TLS
+ * sessions made by one connection can be resumed by any other.
+ * @return SSL context
+ * @throw dpp::connection_exception Failed to create the context
  */
-thread_local std::unordered_map<std::string, keepalive_cache_t> keepalives;
+static SSL_CTX* get_openssl_context() {
+	static std::unique_ptr<SSL_CTX, openssl_context_deleter> openssl_context;
+	static std::mutex context_mutex;
+
+	std::lock_guard lock(context_mutex);
+	if (!openssl_context) {
+		/* Create SSL context */
+		std::unique_ptr<SSL_CTX, openssl_context_deleter> context(SSL_CTX_new(TLS_client_method()));
+		if (!context) {
+			throw dpp::connection_exception(err_ssl_context, "Failed to create SSL client context!");
+		}
+
+		/* Do not allow SSL 3.0, TLS 1.0 or 1.1
+		 * https://www.packetlabs.net/posts/tls-1-1-no-longer-secure/
+		 */
+		if (!SSL_CTX_set_min_proto_version(context.get(), TLS1_2_VERSION)) {
+			throw dpp::connection_exception(err_ssl_version, "Failed to set minimum SSL version!");
+		}
+
+		/* Client side session caching, stored by us keyed by hostname rather than in OpenSSL's internal cache */
+		SSL_CTX_set_session_cache_mode(context.get(), SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(context.get(), on_new_session);
+
+		openssl_context = std::move(context);
+	}
+	return openssl_context.get();
+}
+
+tls_handshake_stats get_tls_handshake_stats() {
+	tls_handshake_stats stats;
+	stats.full_handshakes = full_handshakes;
+	stats.resumed_handshakes = resumed_handshakes;
+	stats.full_handshake_time = full_handshake_us / 1000000.0;
+	stats.resumed_handshake_time = resumed_handshake_us / 1000000.0;
+	return stats;
+}
 
 /* You'd think that we would get better performance with a bigger buffer, but SSL frames are 16k each.
  * SSL_read in non-blocking mode will only read 16k at a time. There's no point in a bigger buffer as
  * it'd go unused.
  */
-constexpr uint16_t DPP_BUFSIZE{16 * 1024};
+constexpr size_t DPP_BUFSIZE{16 * 1024};
+
+/* Most chunks gathered into a single writev() on plaintext sockets */
+constexpr int DPP_MAX_IOV{64};
+
+/* Most emptied output chunks kept for reuse per connection */
+constexpr size_t DPP_MAX_SPARE_CHUNKS{4};
 
 /* Represents a failed socket system call, e.g. connect() failure */
 constexpr int ERROR_STATUS{-1};
@@ -205,6 +284,12 @@ int connect_with_timeout(dpp::socket sockfd, const struct sockaddr *addr, sockle
 		pfd.events = POLLOUT;
 		const int r = ::poll(&pfd, 1, 10);
 		if (r > 0 && pfd.revents & POLLOUT) {
+			/* A refused connect also reports writable, with the reason in SO_ERROR */
+			int error = 0;
+			socklen_t error_size = sizeof(error);
+			if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &error_size) != 0 || error != 0) {
+				throw connection_exception(err_connect_failure, strerror(error ? error : errno));
+			}
 			rc = 0;
 		} else if (r != 0 || pfd.revents & POLLERR) {
 			throw connection_exception(err_connection_timed_out, strerror(errno));
@@ -230,10 +315,50 @@ void set_signal_handler(int signal)
 }
 #endif
 
-ssl_client::ssl_client(const std::string &_hostname, const std::string &_port, bool plaintext_downgrade, bool reuse) :
+pooled_connection::~pooled_connection()
+{
+	if (ssl) {
+		if (ssl->ssl) {
+			SSL_free(ssl->ssl);
+		}
+		delete ssl;
+	}
+	if (sfd != INVALID_SOCKET) {
+		close_socket(sfd);
+	}
+}
+
+bool pooled_connection::is_alive() const
+{
+	if (sfd == INVALID_SOCKET || (ssl && (!ssl->ssl || SSL_pending(ssl->ssl) > 0))) {
+		return false;
+	}
+	/* An idle connection should have nothing to read. If it is readable, the
+	 * server has either closed it or sent something we were not expecting.
+	 */
+	pollfd pfd = {};
+	pfd.fd = sfd;
+	pfd.events = POLLIN;
+	return ::poll(&pfd, 1, 0) == 0;
+}
+
+ssl_client::ssl_client(const std::string &_hostname, const std::string &_port, bool plaintext_downgrade, bool reuse, connection_pool* connections, bool connect_immediately) :
+	write_offset(0),
+	read_blocked_on_write(false),
+	write_blocked_on_read(false),
+	loop_ended(true),
+	ticker_id(0),
+	custom_fd(INVALID_SOCKET),
+	connect_state(CONNECT_IDLE),
+	connect_deadline(0),
+	handshake_started(0),
+	connecting_index(0),
+	connect_serial(0),
+	guard(std::make_shared<ssl_connect_guard>()),
 	nonblocking(false),
 	sfd(INVALID_SOCKET),
 	ssl(nullptr),
+	connection_created(time(nullptr)),
 	last_tick(time(nullptr)),
 	hostname(_hostname),
 	port(_port),
@@ -241,7 +366,11 @@ ssl_client::ssl_client(const std::string &_hostname, const std::string &_port, b
 	bytes_in(0),
 	plaintext(plaintext_downgrade),
 	make_new(true),
-	keepalive(reuse)
+	session_resumed(false),
+	handshake_time(0),
+	pool(connections),
+	engine(nullptr),
+	keepalive(reuse && connections != nullptr)
 {
 #ifndef WIN32
 	set_signal_handler(SIGALRM);
@@ -257,34 +386,19 @@ ssl_client::ssl_client(const std::string &_hostname, const std::string &_port, b
 	}
 #endif
 	if (keepalive) {
-		std::string identifier((!plaintext ? "ssl://" : "tcp://") + hostname + ":" + port);
-		auto iter = keepalives.find(identifier);
-		if (iter != keepalives.end()) {
-			/* Found a keepalive connection, check it is still connected/valid via poll() for error */
-			pollfd pfd = {};
-			pfd.fd = iter->second.sfd;
-			pfd.events = POLLOUT;
-			int r = ::poll(&pfd, 1, 1);
-			if (time(nullptr) > (iter->second.created + 60) || r < 0 || pfd.revents & POLLERR) {
-				make_new = true;
-				/* This connection is dead, free its resources and make a new one */
-				if (iter->second.ssl->ssl) {
-					SSL_free(iter->second.ssl->ssl);
-					iter->second.ssl->ssl = nullptr;
-				}
-				close_socket(iter->second.sfd);
-				iter->second.sfd = INVALID_SOCKET;
-				delete iter->second.ssl;
-			} else {
-				/* Connection is good, lets use it */
-				this->sfd = iter->second.sfd;
-				this->ssl = iter->second.ssl;
-				make_new = false;
-			}
-			/* We don't keep in-flight connections in the keepalives list */
-			keepalives.erase(iter);
+		std::unique_ptr<pooled_connection> conn = pool->acquire(connection_pool::make_key(hostname, port, plaintext));
+		if (conn) {
+			/* Take ownership of the pooled socket and TLS session */
+			this->sfd = conn->sfd;
+			this->ssl = conn->ssl;
+			this->cipher = conn->cipher;
+			this->connection_created = conn->created;
+			conn->sfd = INVALID_SOCKET;
+			conn->ssl = nullptr;
+			/* It was left in non-blocking mode by the read loop which last used it */
+			set_nonblocking(this->sfd, false);
+			make_new = false;
 		}
-
 	}
 	if (make_new) {
 		if (plaintext) {
@@ -293,6 +407,9 @@ ssl_client::ssl_client(const std::string &_hostname, const std::string &_port, b
 			ssl = new openssl_connection();
 		}
 	}
+	if (!connect_immediately) {
+		return;
+	}
 	try {
 		this->connect();
 	}
@@ -302,6 +419,73 @@ ssl_client::ssl_client(const std::string &_hostname, const std::string &_port, b
 	}
 }
 
+void ssl_client::setup_tls()
+{
+	/* Create SSL session */
+	ssl->ssl = SSL_new(get_openssl_context());
+	if (ssl->ssl == nullptr) {
+		throw dpp::connection_exception(err_ssl_new, "SSL_new failed!");
+	}
+
+	SSL_set_fd(ssl->ssl, (int)sfd);
+
+	/* Server name identification (SNI) */
+	SSL_set_tlsext_host_name(ssl->ssl, hostname.c_str());
+
+	/* Application protocol negotiation (ALPN) */
+	if (!alpn_protocols.empty() && SSL_set_alpn_protos(ssl->ssl, reinterpret_cast<const unsigned char*>(alpn_protocols.data()), static_cast<unsigned int>(alpn_protocols.size())) != 0) {
+		throw dpp::connection_exception(err_ssl_new, "SSL_set_alpn_protos failed!");
+	}
+
+	/* Offer the last session we were given for this host, skipping the key exchange if the server accepts it */
+	std::lock_guard lock(openssl_sessions_mutex);
+	auto iter = openssl_sessions.find(hostname);
+	if (iter != openssl_sessions.end()) {
+		SSL_set_session(ssl->ssl, iter->second.get());
+	}
+}
+
+void ssl_client::handshake_complete(double started)
+{
+	handshake_time = utility::time_f() - started;
+	session_resumed = SSL_session_reused(ssl->ssl) == 1;
+	if (session_resumed) {
+		resumed_handshakes++;
+		resumed_handshake_us += static_cast<uint64_t>(handshake_time * 1000000.0);
+	} else {
+		full_handshakes++;
+		full_handshake_us += static_cast<uint64_t>(handshake_time * 1000000.0);
+	}
+	this->cipher = SSL_get_cipher(ssl->ssl);
+	const unsigned char* protocol = nullptr;
+	unsigned int protocol_length = 0;
+	SSL_get0_alpn_selected(ssl->ssl, &protocol, &protocol_length);
+	if (protocol) {
+		alpn_protocol.assign(reinterpret_cast<const char*>(protocol), protocol_length);
+	}
+}
+
+/**
+ * @brief Forget the cached session for a host after a failed handshake, so
+ * that a session the server rejects is not offered again
+ * @param hostname host name
+ */
+static void forget_session(const std::string& hostname)
+{
+	std::lock_guard lock(openssl_sessions_mutex);
+	openssl_sessions.erase(hostname);
+}
+
+/**
+ * @brief Shared between an ssl_client and the host name lookups it is waiting on.
+ * A lookup completes on the resolver thread; once alive is cleared under the
+ * mutex, its result must be discarded.
+ */
+struct ssl_connect_guard {
+	std::mutex mutex;
+	bool alive{true};
+};
+
 /* SSL Client constructor throws std::runtime_error if it can't connect to the host */
 void ssl_client::connect()
 {
@@ -309,53 +493,40 @@ void ssl_client::connect()
 	nonblocking = false;
 
 	if (make_new) {
-		/* Resolve hostname to IP */
-		int err = 0;
-		const dns_cache_entry* addr = resolve_hostname(hostname, port);
-		sfd = addr->make_connecting_socket();
-		address_t destination = addr->get_connecting_address(from_string<uint16_t>(this->port, std::dec));
-		if (sfd == ERROR_STATUS) {
-			err = errno;
-		} else if (connect_with_timeout(sfd, destination.get_socket_address(), destination.size(), SOCKET_OP_TIMEOUT) != 0) {
+		/* Resolve hostname to IP, and try each address in turn */
+		std::string error = "No addresses for host";
+		dns_cache_entry_ptr addr = resolve_hostname(hostname, port);
+		const uint16_t port_number = from_string<uint16_t>(this->port, std::dec);
+		for (const dns_address& candidate : addr->addresses) {
+			sfd = candidate.make_connecting_socket();
+			if (sfd == ERROR_STATUS) {
+				error = strerror(errno);
+				continue;
+			}
+			sockaddr_storage destination = candidate.with_port(port_number);
+			try {
+				if (connect_with_timeout(sfd, reinterpret_cast<sockaddr*>(&destination), candidate.length, SOCKET_OP_TIMEOUT) == 0) {
+					break;
+				}
+				error = strerror(errno);
+			}
+			catch (const dpp::connection_exception& e) {
+				error = e.what();
+			}
+			/* Refused, timed out or errored; move on to the next address */
 			close_socket(sfd);
 			sfd = ERROR_STATUS;
+			dns_address_failed(hostname, candidate.text);
 		}
 
 		/* Check if none of the IPs yielded a valid connection */
 		if (sfd == ERROR_STATUS) {
-			throw dpp::connection_exception(err_connect_failure, strerror(err));
+			sfd = INVALID_SOCKET;
+			throw dpp::connection_exception(err_connect_failure, error);
 		}
 
 		if (!plaintext) {
-			/* Each thread needs a context, but we don't need to make a new one for each connection */
-			if (!openssl_context) {
-				/* We're good to go - hand the fd over to openssl */
-				const SSL_METHOD *method = TLS_client_method(); /* Create new client-method instance */
-
-				/* Create SSL context */
-				openssl_context.reset(SSL_CTX_new(method));
-				if (!openssl_context) {
-					throw dpp::connection_exception(err_ssl_context, "Failed to create SSL client context!");
-				}
-
-				/* Do not allow SSL 3.0, TLS 1.0 or 1.1
-				* https://www.packetlabs.net/posts/tls-1-1-no-longer-secure/
-				*/
-				if (!SSL_CTX_set_min_proto_version(openssl_context.get(), TLS1_2_VERSION)) {
-					throw dpp::connection_exception(err_ssl_version, "Failed to set minimum SSL version!");
-				}
-			}
-
-			/* Create SSL session */
-			ssl->ssl = SSL_new(openssl_context.get());
-			if (ssl->ssl == nullptr) {
-				throw dpp::connection_exception(err_ssl_new, "SSL_new failed!");
-			}
-
-			SSL_set_fd(ssl->ssl, (int)sfd);
-
-			/* Server name identification (SNI) */
-			SSL_set_tlsext_host_name(ssl->ssl, hostname.c_str());
+			setup_tls();
 
 #ifndef _WIN32
 			/* On Linux, we can set socket timeouts so that SSL_connect eventually gives up */
@@ -365,25 +536,290 @@ void ssl_client::connect()
 			setsockopt(sfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
 			setsockopt(sfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
 #endif
+			double handshake_start = utility::time_f();
 			if (SSL_connect(ssl->ssl) != 1) {
+				forget_session(hostname);
 				throw dpp::connection_exception(err_ssl_connect, "SSL_connect error");
 			}
+			handshake_complete(handshake_start);
+		}
+		if (pool) {
+			pool->count_handshake();
+		}
+	}
+}
+
+void ssl_client::connect_async(socket_engine_base* e, const connect_callback_t& callback)
+{
+	engine = e;
+	engine->run_sync([this, callback]() {
+		if (ticker_id == 0) {
+			ticker_id = engine->add_ticker([this]() { on_tick(); });
+		}
+		on_connected = callback;
+		nonblocking = false;
+		loop_ended = true;
+		connect_deadline = time(nullptr) + (SOCKET_OP_TIMEOUT / 1000);
+		connect_state = CONNECT_DNS;
+		uint64_t serial = ++connect_serial;
+		/* A cached host answers immediately on this thread. Anything else is
+		 * answered from the resolver thread, and must hop back to the engine.
+		 */
+		resolve_hostname_async(hostname, port, [this, serial, g = guard, e = engine](dns_cache_entry_ptr addr, const std::string& error) {
+			if (e->on_engine_thread()) {
+				if (addr) {
+					connect_to(addr);
+				} else {
+					fail_connect(error);
+				}
+				return;
+			}
+			e->post([this, serial, g, addr, error]() {
+				/* The lock is released before connecting, as a failed connect calls
+				 * on_connected, which may destroy this client and lock the guard in
+				 * cleanup(). Nothing else can destroy it meanwhile: a client attached
+				 * to an engine detaches on the engine thread, which is this thread.
+				 */
+				{
+					std::lock_guard lock(g->mutex);
+					if (!g->alive || serial != connect_serial || connect_state != CONNECT_DNS) {
+						return;
+					}
+				}
+				if (addr) {
+					connect_to(addr);
+				} else {
+					fail_connect(error);
+				}
+			});
+		});
+	});
+}
+
+void ssl_client::connect_to(const dns_cache_entry_ptr& addr)
+{
+	connecting_host = addr;
+	connecting_index = 0;
+	if (addr->addresses.empty()) {
+		fail_connect("No addresses for host");
+		return;
+	}
+	connect_to_address();
+}
+
+void ssl_client::connect_to_address()
+{
+	try {
+		const dns_address& destination = connecting_host->addresses[connecting_index];
+		connecting_address = destination.text;
+		connect_state = CONNECT_TCP;
+		/* Each address gets the full timeout, as with the blocking connect() */
+		connect_deadline = time(nullptr) + (SOCKET_OP_TIMEOUT / 1000);
+		sfd = destination.make_connecting_socket();
+		if (sfd == ERROR_STATUS) {
+			sfd = INVALID_SOCKET;
+			throw dpp::connection_exception(err_connect_failure, strerror(errno));
+		}
+		if (!set_nonblocking(sfd, true)) {
+			throw dpp::connection_exception(err_nonblocking_failure, "Can't switch socket to non-blocking mode!");
+		}
+		sockaddr_storage address = destination.with_port(from_string<uint16_t>(this->port, std::dec));
+#ifdef _WIN32
+		int rc = WSAConnect(sfd, reinterpret_cast<sockaddr*>(&address), destination.length, nullptr, nullptr, nullptr, nullptr);
+		int err = rc == 0 ? 0 : WSAGetLastError();
+		bool in_progress = (err == WSAEWOULDBLOCK);
+#else
+		int rc = ::connect(sfd, reinterpret_cast<sockaddr*>(&address), destination.length);
+		int err = rc == 0 ? 0 : errno;
+		bool in_progress = (err == EINPROGRESS || err == EWOULDBLOCK);
+#endif
+		if (rc != 0 && !in_progress) {
+			throw dpp::connection_exception(err_connect_failure, strerror(err));
+		}
+		socket_events events(
+			sfd,
+			WANT_WRITE | WANT_ERROR,
+			[this](dpp::socket, const socket_events&) { continue_connect(); },
+			[this](dpp::socket, const socket_events&) { continue_connect(); },
+			[this](dpp::socket, const socket_events&, int error_code) {
+				fail_connect(error_code ? strerror(error_code) : "Connection refused");
+			}
+		);
+		if (!engine->register_socket(events)) {
+			throw dpp::connection_exception(err_socket_error, "Can't add socket to socket engine");
+		}
+	}
+	catch (const std::exception& ex) {
+		fail_connect(ex.what());
+	}
+}
 
-			this->cipher = SSL_get_cipher(ssl->ssl);
+void ssl_client::continue_connect()
+{
+	try {
+		if (connect_state == CONNECT_TCP) {
+			int err = 0;
+			socklen_t errsize = sizeof(err);
+			if (getsockopt(sfd, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&err), &errsize) != 0 || err != 0) {
+				fail_connect(strerror(err ? err : errno));
+				return;
+			}
+			if (pool) {
+				pool->count_handshake();
+			}
+			if (plaintext) {
+				finish_connect();
+				return;
+			}
+			setup_tls();
+			connect_state = CONNECT_TLS;
+			handshake_started = utility::time_f();
+		}
+		if (connect_state == CONNECT_TLS) {
+			int r = SSL_connect(ssl->ssl);
+			if (r == 1) {
+				handshake_complete(handshake_started);
+				finish_connect();
+				return;
+			}
+			switch (SSL_get_error(ssl->ssl, r)) {
+				case SSL_ERROR_WANT_READ:
+					engine->update_socket(sfd, WANT_READ | WANT_ERROR);
+				break;
+				case SSL_ERROR_WANT_WRITE:
+					engine->update_socket(sfd, WANT_READ | WANT_WRITE | WANT_ERROR);
+				break;
+				default:
+					forget_session(hostname);
+					fail_connect("SSL_connect error");
+				break;
+			}
+		}
+	}
+	catch (const std::exception& e) {
+		fail_connect(e.what());
+	}
+}
+
+void ssl_client::finish_connect()
+{
+	connect_state = CONNECT_IDLE;
+	connecting_address.clear();
+	connecting_host.reset();
+	connect_callback_t callback;
+	callback.swap(on_connected);
+	try {
+		/* Replaces the connecting event set with the normal I/O handlers */
+		watch_socket();
+	}
+	catch (const std::exception& e) {
+		fail_connect(e.what());
+		if (callback) {
+			callback(false, e.what());
 		}
+		return;
+	}
+	if (callback) {
+		callback(true, "");
 	}
 }
 
+bool ssl_client::try_next_address()
+{
+	if (connect_state != CONNECT_TCP || connecting_address.empty()) {
+		return false;
+	}
+	/* Later attempts prefer the host's other addresses */
+	dns_address_failed(hostname, connecting_address);
+	connecting_address.clear();
+	if (!connecting_host || connecting_index + 1 >= connecting_host->addresses.size()) {
+		return false;
+	}
+	if (engine && sfd != INVALID_SOCKET) {
+		engine->remove_socket(sfd);
+	}
+	close_socket(sfd);
+	sfd = INVALID_SOCKET;
+	connecting_index++;
+	connect_to_address();
+	return true;
+}
+
+void ssl_client::fail_connect(const std::string& error)
+{
+	if (try_next_address()) {
+		return;
+	}
+	connect_callback_t callback;
+	callback.swap(on_connected);
+	connect_state = CONNECT_IDLE;
+	connecting_address.clear();
+	connecting_host.reset();
+	this->close();
+	if (callback) {
+		callback(false, error);
+	}
+}
+
+bool ssl_client::is_connecting() const
+{
+	return connect_state != CONNECT_IDLE;
+}
+
+bool ssl_client::is_reused() const
+{
+	return !make_new;
+}
+
+bool ssl_client::is_session_resumed() const
+{
+	return session_resumed;
+}
+
+double ssl_client::get_handshake_time() const
+{
+	return handshake_time;
+}
+
+const std::string& ssl_client::get_alpn_protocol() const
+{
+	return alpn_protocol;
+}
+
 void ssl_client::socket_write(const std::string_view data)
 {
 	/* If we are in nonblocking mode, append to the buffer,
 	 * otherwise just use SSL_write directly. The only time we
 	 * use SSL_write directly is during connection before the
-	 * ReadLoop is called, which allows for guaranteed simple
-	 * lock-step delivery e.g. for HTTP header negotiation
+	 * socket is handed to a socket engine, which allows for
+	 * guaranteed simple lock-step delivery e.g. for HTTP header
+	 * negotiation
 	 */
 	if (nonblocking) {
-		obuffer += data;
+		{
+			std::lock_guard lock(out_mutex);
+			std::string_view pending = data;
+			while (!pending.empty()) {
+				if (obuffer.empty() || obuffer.back().length() >= DPP_BUFSIZE) {
+					if (spare_chunks.empty()) {
+						obuffer.emplace_back().reserve(DPP_BUFSIZE);
+					} else {
+						obuffer.emplace_back(std::move(spare_chunks.back()));
+						spare_chunks.pop_back();
+					}
+				}
+				std::string& chunk = obuffer.back();
+				const size_t length = std::min(pending.length(), DPP_BUFSIZE - chunk.length());
+				chunk.append(pending.data(), length);
+				pending.remove_prefix(length);
+			}
+			/* Still under out_mutex, so that the engine thread cannot clear WANT_WRITE
+			 * based on an empty buffer it saw before this data was added
+			 */
+			if (engine && sfd != INVALID_SOCKET) {
+				engine->update_socket(sfd, WANT_READ | WANT_WRITE | WANT_ERROR);
+			}
+		}
 		return;
 	}
 
@@ -403,6 +839,10 @@ void ssl_client::one_second_timer()
 {
 }
 
+void ssl_client::on_write_drained()
+{
+}
+
 std::string ssl_client::get_cipher() {
 	return cipher;
 }
@@ -411,209 +851,435 @@ void ssl_client::log(dpp::loglevel severity, const std::string &msg) const
 {
 }
 
-void ssl_client::read_loop()
+/* The I/O handlers below are non-blocking and driven by a socket engine. They
+ * cannot read while waiting for write, or write while waiting for read. This is
+ * a limitation of the openssl libraries, as SSL is sent and received in low
+ * level ~16k frames which must be synchronised and ordered correctly. Attempting
+ * to send while we need another frame or receive while we are due to send a frame
+ * would cause the protocol to break.
+ */
+
+void ssl_client::watch_socket()
 {
-	/* The read loop is non-blocking using poll(). This method
-	 * cannot read while it is waiting for write, or write while it is
-	 * waiting for read. This is a limitation of the openssl libraries,
-	 * as SSL is sent and received in low level ~16k frames which must
-	 * be synchronised and ordered correctly. Attempting to send while
-	 * we need another frame or receive while we are due to send a frame
-	 * would cause the protocol to break.
-	 */
-	int r = 0, sockets = 1;
-	size_t client_to_server_length = 0, client_to_server_offset = 0;
-	bool read_blocked_on_write =  false, write_blocked_on_read = false, read_blocked = false;
-	pollfd pfd[2] = {};
-	char client_to_server_buffer[DPP_BUFSIZE], server_to_client_buffer[DPP_BUFSIZE];
+	if (sfd == INVALID_SOCKET)  {
+		throw dpp::connection_exception(err_invalid_socket, "Invalid file descriptor in read_loop()");
+	}
 
-	try {
+	/* Make the socket nonblocking */
+	if (!set_nonblocking(sfd, true)) {
+		throw dpp::connection_exception(err_nonblocking_failure, "Can't switch socket to non-blocking mode!");
+	}
+	nonblocking = true;
+	loop_ended = false;
+	read_blocked_on_write = false;
+	write_blocked_on_read = false;
+	write_chunks.clear();
+	write_offset = 0;
+
+	socket_events events(
+		sfd,
+		WANT_READ | WANT_ERROR,
+		[this](dpp::socket, const socket_events&) { on_read(); },
+		[this](dpp::socket, const socket_events&) { on_write(); },
+		[this](dpp::socket, const socket_events&, int error_code) { on_error(error_code); }
+	);
+	if (!engine->register_socket(events)) {
+		throw dpp::connection_exception(err_socket_error, "Can't add socket to socket engine");
+	}
+	update_interest();
+}
 
-		if (sfd == INVALID_SOCKET)  {
-			throw dpp::connection_exception(err_invalid_socket, "Invalid file descriptor in read_loop()");
+void ssl_client::update_interest()
+{
+	if (loop_ended || sfd == INVALID_SOCKET) {
+		return;
+	}
+	/* Decide and apply under out_mutex, or a socket_write() between the two could have its WANT_WRITE cleared */
+	std::lock_guard lock(out_mutex);
+	bool want_write = read_blocked_on_write || !write_chunks.empty() || !obuffer.empty();
+	engine->update_socket(sfd, WANT_READ | WANT_ERROR | (want_write ? WANT_WRITE : 0));
+}
+
+bool ssl_client::do_read()
+{
+	char server_to_client_buffer[DPP_BUFSIZE];
+
+	if (plaintext) {
+		read_blocked_on_write = false;
+		int r = (int) ::recv(sfd, server_to_client_buffer, DPP_BUFSIZE, 0);
+
+		if (r <= 0) {
+			/* error or EOF */
+			return false;
 		}
-		
-		/* Make the socket nonblocking */
-		if (!set_nonblocking(sfd, true)) {
-			throw dpp::connection_exception(err_nonblocking_failure, "Can't switch socket to non-blocking mode!");
+
+		buffer.append(server_to_client_buffer, r);
+		if (!this->handle_buffer(buffer)) {
+			return false;
 		}
-		nonblocking = true;
+		bytes_in += r;
+		return true;
+	}
 
-		/* Loop until there is a socket error */
-		while(true) {
+	bool read_blocked = false;
+	do {
+		read_blocked_on_write = false;
+		read_blocked = false;
 
-			if (last_tick != time(nullptr)) {
-				this->one_second_timer();
-				last_tick = time(nullptr);
-			}
+		int r = SSL_read(ssl->ssl, server_to_client_buffer, DPP_BUFSIZE);
+		int e = SSL_get_error(ssl->ssl, r);
 
-			sockets = 1;
-			pfd[0].fd = sfd;
-			pfd[0].events = POLLIN;
-			pfd[1].events = 0;
+		switch (e) {
+			case SSL_ERROR_NONE:
+				/* Data received, add it to the buffer */
+				if (r > 0) {
+					buffer.append(server_to_client_buffer, r);
+					if (!this->handle_buffer(buffer)) {
+						return false;
+					}
+					bytes_in += r;
+				}
+			break;
+			case SSL_ERROR_ZERO_RETURN:
+				/* End of data */
+				SSL_shutdown(ssl->ssl);
+				return false;
+			break;
+			case SSL_ERROR_WANT_READ:
+				read_blocked = true;
+			break;
+
+			/* We get a WANT_WRITE if we're trying to rehandshake and we block on a write during that rehandshake.
+			 * We need to wait on the socket to be writeable but reinitiate the read when it is
+			 */
+			case SSL_ERROR_WANT_WRITE:
+				read_blocked_on_write = true;
+				return true;
+			break;
+			default:
+				return false;
+			break;
+		}
 
-			if (custom_readable_fd && custom_readable_fd() >= 0) {
-				int cfd = (int)custom_readable_fd();
-				pfd[1].fd = cfd;
-				pfd[1].events = POLLIN;
-				sockets = 2;
+		/* We need a check for read_blocked here because SSL_pending() doesn't work properly during the
+		 * handshake. This check prevents a busy-wait loop around SSL_read()
+		 */
+	} while (SSL_pending(ssl->ssl) && !read_blocked);
+	return true;
+}
+
+bool ssl_client::do_write()
+{
+	/* Take everything queued so far; the chunks are moved, not copied */
+	{
+		std::lock_guard lock(out_mutex);
+		while (!obuffer.empty()) {
+			write_chunks.emplace_back(std::move(obuffer.front()));
+			obuffer.pop_front();
+		}
+	}
+
+	write_blocked_on_read = false;
+	bool blocked = false;
+	std::vector<std::string> sent;
+
+	while (!write_chunks.empty() && !blocked) {
+		if (plaintext) {
+#ifndef _WIN32
+			/* Gather as many chunks as we can into one system call */
+			iovec iov[DPP_MAX_IOV];
+			int count = 0;
+			for (auto chunk = write_chunks.begin(); chunk != write_chunks.end() && count < DPP_MAX_IOV; ++chunk, ++count) {
+				const size_t offset = count == 0 ? write_offset : 0;
+				iov[count].iov_base = chunk->data() + offset;
+				iov[count].iov_len = chunk->length() - offset;
 			}
-			if (custom_writeable_fd && custom_writeable_fd() >= 0) {
-				int cfd = (int)custom_writeable_fd();
-				pfd[1].fd = cfd;
-				pfd[1].events |= POLLOUT;
-				sockets = 2;
+			ssize_t r = ::writev(sfd, iov, count);
+			if (r < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					break;
+				}
+				/* Write error */
+				return false;
 			}
-
-			if (sfd == -1) {
-				throw dpp::connection_exception(err_invalid_socket, "File descriptor invalidated, connection died");
+			bytes_out += r;
+			write_offset += r;
+			/* Release every chunk that has been completely sent */
+			while (!write_chunks.empty() && write_offset >= write_chunks.front().length()) {
+				write_offset -= write_chunks.front().length();
+				sent.emplace_back(std::move(write_chunks.front()));
+				write_chunks.pop_front();
 			}
-
-			/* If we're waiting for a read on the socket don't try to write to the server */
-			if (client_to_server_length || obuffer.length() || read_blocked_on_write) {
-				pfd[0].events |= POLLOUT;
+			blocked = r == 0;
+#else
+			const std::string& chunk = write_chunks.front();
+			int r = (int) ::send(sfd, chunk.data() + write_offset, static_cast<int>(chunk.length() - write_offset), 0);
+			if (r < 0) {
+				/* Write error */
+				return false;
+			}
+			bytes_out += r;
+			write_offset += r;
+			if (write_offset >= chunk.length()) {
+				write_offset = 0;
+				sent.emplace_back(std::move(write_chunks.front()));
+				write_chunks.pop_front();
 			}
+			blocked = r == 0;
+#endif
+		} else {
+			/* Each chunk is at most one TLS record. If a write blocks it is retried
+			 * later with the same buffer and length, as OpenSSL requires.
+			 */
+			const std::string& chunk = write_chunks.front();
+			int r = SSL_write(ssl->ssl, chunk.data() + write_offset, static_cast<int>(chunk.length() - write_offset));
+
+			switch (SSL_get_error(ssl->ssl, r)) {
+				/* We wrote something */
+				case SSL_ERROR_NONE:
+					write_offset += r;
+					bytes_out += r;
+					if (write_offset >= chunk.length()) {
+						write_offset = 0;
+						sent.emplace_back(std::move(write_chunks.front()));
+						write_chunks.pop_front();
+					}
+				break;
+
+				/* We would have blocked */
+				case SSL_ERROR_WANT_WRITE:
+					blocked = true;
+				break;
+
+				/* We get a WANT_READ if we're trying to rehandshake and we block on write during the current connection.
+				 * We need to wait on the socket to be readable but reinitiate our write when it is
+				 */
+				case SSL_ERROR_WANT_READ:
+					write_blocked_on_read = true;
+					blocked = true;
+				break;
+
+				/* Some other error */
+				default:
+					return false;
+				break;
+			}
+		}
+	}
 
-			const int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-			int poll_time = 1000 - (now % 1000);
-			poll_time = poll_time > 400 ? 1000 : poll_time + poll_time / 3 + 1;
-			r = ::poll(pfd, sockets, now / 1000 == (int64_t)last_tick ? poll_time : 0);
+	if (!sent.empty()) {
+		std::lock_guard lock(out_mutex);
+		for (auto& chunk : sent) {
+			if (spare_chunks.size() >= DPP_MAX_SPARE_CHUNKS) {
+				break;
+			}
+			chunk.clear();
+			spare_chunks.emplace_back(std::move(chunk));
+		}
+	}
+	return true;
+}
 
-			if (r == 0) {
-				continue;
+void ssl_client::on_read()
+{
+	try {
+		if (!write_blocked_on_read) {
+			if (!do_read()) {
+				end_loop();
+				return;
 			}
+		} else if (!do_write()) {
+			end_loop();
+			return;
+		}
+		update_interest();
+	}
+	catch (const std::exception &e) {
+		log(ll_warning, std::string("Read loop ended: ") + e.what());
+		end_loop();
+	}
+}
 
-			if (custom_writeable_fd && custom_writeable_fd() >= 0 && pfd[1].revents & POLLOUT) {
-				custom_writeable_ready();
+void ssl_client::on_write()
+{
+	try {
+		if (read_blocked_on_write) {
+			if (!do_read()) {
+				end_loop();
+				return;
 			}
-			if (custom_readable_fd && custom_readable_fd() >= 0 && pfd[1].revents & POLLIN) {
-				custom_readable_ready();
+		} else if (!write_blocked_on_read) {
+			if (!do_write()) {
+				end_loop();
+				return;
 			}
-			if ((pfd[0].revents & POLLERR) || (pfd[0].revents & POLLNVAL) || sfd == INVALID_SOCKET) {
-				throw dpp::connection_exception(err_socket_error, strerror(errno));
+			bool drained = write_chunks.empty();
+			if (drained) {
+				std::lock_guard lock(out_mutex);
+				drained = obuffer.empty();
 			}
+			if (drained) {
+				on_write_drained();
+			}
+		}
+		update_interest();
+	}
+	catch (const std::exception &e) {
+		log(ll_warning, std::string("Read loop ended: ") + e.what());
+		end_loop();
+	}
+}
 
-			/* Now check if there's data to read */
-			if (((pfd[0].revents & POLLIN) && !write_blocked_on_read) || (read_blocked_on_write && (pfd[0].revents & POLLOUT))) {
-				if (plaintext) {
-					read_blocked_on_write = false;
-					read_blocked = false;
-					r = (int) ::recv(sfd, server_to_client_buffer, DPP_BUFSIZE, 0);
-
-					if (r <= 0) {
-						/* error or EOF */
-						return;
-					}
+void ssl_client::on_error(int error_code)
+{
+	log(ll_warning, std::string("Read loop ended: ") + strerror(error_code));
+	end_loop();
+}
 
-					buffer.append(server_to_client_buffer, r);
-					if (!this->handle_buffer(buffer)) {
-						return;
-					}
-					bytes_in += r;
-				} else {
-					do {
-						read_blocked_on_write = false;
-						read_blocked = false;
-						
-						r = SSL_read(ssl->ssl,server_to_client_buffer,DPP_BUFSIZE);
-						int e = SSL_get_error(ssl->ssl,r);
-
-						switch (e) {
-							case SSL_ERROR_NONE:
-								/* Data received, add it to the buffer */
-								if (r > 0) {
-									buffer.append(server_to_client_buffer, r);
-									if (!this->handle_buffer(buffer)) {
-										return;
-									}
-									bytes_in += r;
-								}
-							break;
-							case SSL_ERROR_ZERO_RETURN:
-								/* End of data */
-								SSL_shutdown(ssl->ssl);
-								return;
-							break;
-							case SSL_ERROR_WANT_READ:
-								read_blocked = true;
-							break;
-									
-							/* We get a WANT_WRITE if we're trying to rehandshake and we block on a write during that rehandshake.
-							* We need to wait on the socket to be writeable but reinitiate the read when it is
-							*/
-							case SSL_ERROR_WANT_WRITE:
-								read_blocked_on_write = true;
-							break;
-							default:
-								return;
-							break;
-						}
-
-						/* We need a check for read_blocked here because SSL_pending() doesn't work properly during the
-						* handshake. This check prevents a busy-wait loop around SSL_read()
-						*/
-					} while (SSL_pending(ssl->ssl) && !read_blocked);
-				}
-			}
+void ssl_client::on_tick()
+{
+	last_tick = time(nullptr);
+	if (connect_state != CONNECT_IDLE && last_tick >= connect_deadline) {
+		fail_connect("Connection timed out");
+	}
+	try {
+		this->one_second_timer();
+	}
+	catch (const std::exception &e) {
+		if (!loop_ended) {
+			log(ll_warning, std::string("Read loop ended: ") + e.what());
+			end_loop();
+		}
+	}
+}
 
-			/* Check for input on the sendq */
-			if (obuffer.length() && client_to_server_length == 0) {
-				memcpy(&client_to_server_buffer, obuffer.data(), obuffer.length() > DPP_BUFSIZE ? DPP_BUFSIZE : obuffer.length());
-				client_to_server_length = obuffer.length() > DPP_BUFSIZE ? DPP_BUFSIZE : obuffer.length();
-				obuffer = obuffer.substr(client_to_server_length, obuffer.length());
-				client_to_server_offset = 0;
-			}
+void ssl_client::end_loop()
+{
+	if (loop_ended) {
+		return;
+	}
+	loop_ended = true;
+	if (engine && sfd != INVALID_SOCKET) {
+		engine->remove_socket(sfd);
+	}
+	this->on_disconnect();
+}
 
-			/* If the socket is writeable... */
-			if (((pfd[0].revents & POLLOUT) && client_to_server_length) || (write_blocked_on_read && (pfd[0].revents & POLLIN))) {
-				write_blocked_on_read = false;
-				/* Try to write */
+void ssl_client::on_disconnect()
+{
+}
 
-				if (plaintext) {
-					r = (int) ::send(sfd, client_to_server_buffer + client_to_server_offset, (int)client_to_server_length, 0);
+void ssl_client::update_custom_fd()
+{
+	dpp::socket rfd = custom_readable_fd ? custom_readable_fd() : INVALID_SOCKET;
+	dpp::socket wfd = custom_writeable_fd ? custom_writeable_fd() : INVALID_SOCKET;
+	dpp::socket want_fd = (rfd != INVALID_SOCKET && rfd >= 0) ? rfd : wfd;
+	if (want_fd < 0) {
+		want_fd = INVALID_SOCKET;
+	}
+	uint8_t flags = WANT_ERROR;
+	if (rfd != INVALID_SOCKET && rfd >= 0) {
+		flags |= WANT_READ;
+	}
+	if (wfd != INVALID_SOCKET && wfd >= 0) {
+		flags |= WANT_WRITE;
+	}
 
-					if (r < 0) {
-						/* Write error */
-						return;
+	if (want_fd != custom_fd) {
+		if (custom_fd != INVALID_SOCKET) {
+			engine->remove_socket(custom_fd);
+		}
+		custom_fd = want_fd;
+		if (custom_fd != INVALID_SOCKET) {
+			engine->register_socket(socket_events(
+				custom_fd,
+				flags,
+				[this](dpp::socket, const socket_events&) {
+					if (custom_readable_ready) {
+						custom_readable_ready();
 					}
-
-					client_to_server_length -= r;
-					client_to_server_offset += r;
-					bytes_out += r;
-				} else {
-					r = SSL_write(ssl->ssl, client_to_server_buffer + client_to_server_offset, (int)client_to_server_length);
-
-					switch(SSL_get_error(ssl->ssl,r)) {
-						/* We wrote something */
-						case SSL_ERROR_NONE:
-							client_to_server_length -= r;
-							client_to_server_offset += r;
-							bytes_out += r;
-						break;
-							
-						/* We would have blocked */
-						case SSL_ERROR_WANT_WRITE:
-						break;
-				
-						/* We get a WANT_READ if we're trying to rehandshake and we block onwrite during the current connection.
-						* We need to wait on the socket to be readable but reinitiate our write when it is
-						*/
-						case SSL_ERROR_WANT_READ:
-							write_blocked_on_read = true;
-						break;
-								
-						/* Some other error */
-						default:
-							return;
-						break;
+				},
+				[this](dpp::socket, const socket_events&) {
+					if (custom_writeable_ready) {
+						custom_writeable_ready();
 					}
 				}
-			}
+			));
 		}
+	} else if (custom_fd != INVALID_SOCKET) {
+		engine->update_socket(custom_fd, flags);
+	}
+}
+
+void ssl_client::read_loop()
+{
+	std::unique_ptr<socket_engine_base> local_engine = create_socket_engine();
+	engine = local_engine.get();
+	custom_fd = INVALID_SOCKET;
+
+	try {
+		watch_socket();
 	}
 	catch (const std::exception &e) {
 		log(ll_warning, std::string("Read loop ended: ") + e.what());
+		engine = nullptr;
+		return;
+	}
+	ticker_id = engine->add_ticker([this]() { on_tick(); });
+
+	/* Loop until there is a socket error or the connection is closed */
+	while (!loop_ended) {
+		try {
+			update_custom_fd();
+		}
+		catch (const std::exception &e) {
+			log(ll_warning, std::string("Read loop ended: ") + e.what());
+			end_loop();
+			break;
+		}
+		engine->iterate();
 	}
+	engine = nullptr;
+	ticker_id = 0;
+}
+
+void ssl_client::attach_engine(socket_engine_base* e)
+{
+	engine = e;
+	engine->run_sync([this]() {
+		if (ticker_id == 0) {
+			ticker_id = engine->add_ticker([this]() { on_tick(); });
+		}
+		try {
+			watch_socket();
+		}
+		catch (const std::exception &e) {
+			log(ll_warning, std::string("Read loop ended: ") + e.what());
+			loop_ended = false;
+			end_loop();
+		}
+	});
+}
+
+void ssl_client::detach_engine()
+{
+	if (!engine) {
+		return;
+	}
+	engine->run_sync([this]() {
+		engine->remove_ticker(ticker_id);
+		ticker_id = 0;
+		/* Any host name lookup still in progress now has nowhere to go */
+		connect_serial++;
+		if (connect_state == CONNECT_DNS) {
+			connect_state = CONNECT_IDLE;
+		}
+		if (sfd != INVALID_SOCKET) {
+			engine->remove_socket(sfd);
+		}
+		loop_ended = true;
+	});
+	engine = nullptr;
 }
 
 uint64_t ssl_client::get_bytes_out()
@@ -633,35 +1299,58 @@ bool ssl_client::handle_buffer(std::string &buffer)
 
 void ssl_client::close()
 {
-	if (keepalive && this->sfd != INVALID_SOCKET) {
-		std::string identifier((!plaintext ? "ssl://" : "tcp://") + hostname + ":" + port);
-		auto iter = keepalives.find(identifier);
-		if (iter == keepalives.end()) {
-			keepalive_cache_t kc;
-			kc.created = time(nullptr);
-			kc.sfd = this->sfd;
-			kc.ssl = this->ssl;
-			keepalives.emplace(identifier, kc);
+	if (keepalive && this->sfd != INVALID_SOCKET && buffer.empty()) {
+		/* Hand the connection back to the pool, it is no longer ours to close */
+		if (engine) {
+			engine->remove_socket(this->sfd);
 		}
+		auto conn = std::make_unique<pooled_connection>();
+		conn->sfd = this->sfd;
+		conn->ssl = this->ssl;
+		conn->cipher = this->cipher;
+		conn->created = this->connection_created;
+		this->sfd = INVALID_SOCKET;
+		this->ssl = nullptr;
+		pool->release(connection_pool::make_key(hostname, port, plaintext), std::move(conn));
 		return;
 	}
 
-	if (!plaintext && ssl->ssl) {
+	connect_state = CONNECT_IDLE;
+	if (engine && this->sfd != INVALID_SOCKET) {
+		engine->remove_socket(this->sfd);
+	}
+	if (!plaintext && ssl && ssl->ssl) {
+		/* Send close_notify before freeing; OpenSSL marks the session of a connection
+		 * freed without one as not resumable, and that session is shared by the host.
+		 */
+		if (SSL_is_init_finished(ssl->ssl)) {
+			SSL_shutdown(ssl->ssl);
+		}
 		SSL_free(ssl->ssl);
 		ssl->ssl = nullptr;
 	}
 	close_socket(sfd);
 	sfd = INVALID_SOCKET;
-	obuffer.clear();
+	{
+		std::lock_guard lock(out_mutex);
+		obuffer.clear();
+	}
+	write_chunks.clear();
+	write_offset = 0;
 	buffer.clear();
 }
 
 void ssl_client::cleanup()
 {
-	this->close();
-	if (!keepalive) {
-		delete ssl;
+	{
+		std::lock_guard lock(guard->mutex);
+		guard->alive = false;
 	}
+	/* Only a connection closed explicitly after a completed exchange goes back to the pool */
+	keepalive = false;
+	this->close();
+	delete ssl;
+	ssl = nullptr;
 }
 
 ssl_client::~ssl_client()
@@ -0,0 +1,557 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <dpp/timer.h>
+#include <dpp/utility.h>
+#include <algorithm>
+
+namespace dpp {
+
+namespace {
+
+/**
+ * @brief Each wheel has 2^wheel_bits slots
+ */
+constexpr uint64_t wheel_bits = 8;
+
+/**
+ * @brief Mask of a slot index within a wheel
+ */
+constexpr uint64_t wheel_mask = (1ULL << wheel_bits) - 1;
+
+/**
+ * @brief Timers due this many milliseconds or more in the future are parked
+ * in the last slot the outermost wheel can reach, and moved on from there
+ */
+constexpr uint64_t wheel_span = 1ULL << (wheel_bits * timer_wheel::levels);
+
+}
+
+/**
+ * @brief A timer in the wheel, linked into the list of one slot
+ */
+struct timer_wheel::entry {
+	/**
+	 * @brief Timer handle
+	 */
+	timer handle{0};
+
+	/**
+	 * @brief Time the timer is next due, in milliseconds since the wheel was created
+	 */
+	uint64_t expiry{0};
+
+	/**
+	 * @brief Milliseconds between ticks, or 0 for a timer which only ticks once
+	 */
+	uint64_t interval{0};
+
+	/**
+	 * @brief Lambda to call on tick
+	 */
+	timer_callback_t on_tick;
+
+	/**
+	 * @brief Lambda to call on stop (optional)
+	 */
+	timer_callback_t on_stop;
+
+	/**
+	 * @brief Previous timer in the same slot
+	 */
+	entry* prev{nullptr};
+
+	/**
+	 * @brief Next timer in the same slot
+	 */
+	entry* next{nullptr};
+
+	/**
+	 * @brief Head of the slot list this timer is in, or nullptr if it is in none
+	 */
+	entry** list{nullptr};
+
+	/**
+	 * @brief Wheel the timer is in, if list is set
+	 */
+	size_t level{0};
+
+	/**
+	 * @brief True while on_tick is running on the driver
+	 */
+	bool firing{false};
+
+	/**
+	 * @brief Set if the timer was cancelled while firing, so the driver deletes it afterwards
+	 */
+	bool cancelled{false};
+};
+
+/**
+ * @brief The wheel's state, shared between the wheel and its driver thread
+ */
+struct timer_wheel::core {
+	/**
+	 * @brief Slot lists of each wheel, the innermost first
+	 */
+	entry* slots[levels][wheel_mask + 1]{};
+
+	/**
+	 * @brief Number of timers in each wheel, so that empty wheels can be skipped
+	 */
+	size_t occupied[levels]{};
+
+	/**
+	 * @brief All active timers by handle
+	 */
+	std::unordered_map<timer, entry*> entries;
+
+	/**
+	 * @brief Next timer handle to allocate
+	 */
+	timer next_handle{1};
+
+	/**
+	 * @brief Next millisecond to be processed, counted from epoch
+	 */
+	uint64_t current{0};
+
+	/**
+	 * @brief Current time of a wheel without a driver thread, as last passed to advance()
+	 */
+	uint64_t manual_now{0};
+
+	/**
+	 * @brief Time the wheel was created
+	 */
+	std::chrono::steady_clock::time_point epoch{std::chrono::steady_clock::now()};
+
+	/**
+	 * @brief True if the wheel runs its own driver thread
+	 */
+	bool threaded;
+
+	/**
+	 * @brief Guards all of the wheel's state
+	 */
+	mutable std::mutex mutex;
+
+	/**
+	 * @brief Wakes the driver when it is stopping or an earlier timer was added
+	 */
+	std::condition_variable wake;
+
+	/**
+	 * @brief Driver thread
+	 */
+	std::thread driver;
+
+	/**
+	 * @brief Set when the wheel is destroyed, to stop the driver and any batch of timers being called
+	 */
+	bool stopping{false};
+
+	/**
+	 * @brief True while the driver is calling timers
+	 */
+	bool busy{false};
+
+	/**
+	 * @brief Notified when the driver has finished calling a batch of timers
+	 */
+	std::condition_variable idle;
+
+	/**
+	 * @brief Millisecond the driver is sleeping until
+	 */
+	uint64_t wake_at{0};
+
+	/**
+	 * @brief Construct an empty wheel
+	 * @param start_thread true if timers are fired by a driver thread
+	 */
+	explicit core(bool start_thread) : threaded(start_thread) {
+	}
+
+	/**
+	 * @brief Free all timers. The driver has been joined or detached by now.
+	 */
+	~core() {
+		for (auto& e : entries) {
+			delete e.second;
+		}
+	}
+
+	/**
+	 * @brief Milliseconds since epoch, or the time given to advance() if there is no driver thread
+	 * @return current time
+	 */
+	uint64_t elapsed() const;
+
+	/**
+	 * @brief Place a timer in the slot for its expiry. Call with the mutex held.
+	 * @param e timer to place
+	 */
+	void link(entry* e);
+
+	/**
+	 * @brief Remove a timer from its slot. Call with the mutex held.
+	 * @param e timer to remove
+	 */
+	void unlink(entry* e);
+
+	/**
+	 * @brief Step the wheel forwards to a point in time, collecting every timer which
+	 * becomes due. Call with the mutex held.
+	 * @param now time to step to
+	 * @param due receives the timers to fire
+	 */
+	void collect(uint64_t now, std::vector<entry*>& due);
+
+	/**
+	 * @brief Call the timers collected by collect(), then reschedule or delete each one.
+	 * Stops early if the wheel is destroyed by one of them. Call without the mutex held,
+	 * and while holding a reference to the core.
+	 * @param due timers to fire, cleared on return
+	 */
+	void fire(std::vector<entry*>& due);
+
+	/**
+	 * @brief Find the next millisecond the driver needs to wake at. Call with the mutex held.
+	 * @return time of the next occupied inner slot, or of the next cascade
+	 */
+	uint64_t next_due() const;
+
+	/**
+	 * @brief Driver thread main loop
+	 * @param self reference which keeps the core alive until the driver stops
+	 */
+	static void run(std::shared_ptr<core> self);
+};
+
+timer_wheel::timer_wheel(bool start_thread) : state(std::make_shared<core>(start_thread)) {
+}
+
+timer_wheel::~timer_wheel() {
+	{
+		std::lock_guard lock(state->mutex);
+		state->stopping = true;
+	}
+	state->wake.notify_all();
+	if (state->driver.joinable()) {
+		if (state->driver.get_id() == std::this_thread::get_id()) {
+			/* Destroyed from inside one of its own timers. The driver still holds the
+			 * core, and stops as soon as the timer returns.
+			 */
+			state->driver.detach();
+		} else {
+			state->driver.join();
+		}
+	}
+}
+
+uint64_t timer_wheel::core::elapsed() const {
+	if (!threaded) {
+		return manual_now;
+	}
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void timer_wheel::core::link(entry* e) {
+	uint64_t expiry = std::max(e->expiry, current);
+	uint64_t delta = expiry - current;
+	if (delta >= wheel_span) {
+		expiry = current + wheel_span - 1;
+		delta = wheel_span - 1;
+	}
+	size_t level = 0;
+	while (level + 1 < levels && delta >= (1ULL << (wheel_bits * (level + 1)))) {
+		++level;
+	}
+	entry** list = &slots[level][(expiry >> (wheel_bits * level)) & wheel_mask];
+	e->list = list;
+	e->level = level;
+	occupied[level]++;
+	e->prev = nullptr;
+	e->next = *list;
+	if (*list) {
+		(*list)->prev = e;
+	}
+	*list = e;
+}
+
+void timer_wheel::core::unlink(entry* e) {
+	if (e->prev) {
+		e->prev->next = e->next;
+	} else if (e->list) {
+		*e->list = e->next;
+	}
+	if (e->next) {
+		e->next->prev = e->prev;
+	}
+	if (e->list) {
+		occupied[e->level]--;
+	}
+	e->prev = e->next = nullptr;
+	e->list = nullptr;
+}
+
+void timer_wheel::core::collect(uint64_t now, std::vector<entry*>& due) {
+	if (entries.empty()) {
+		/* Nothing to cascade or fire, so there is no need to step through each millisecond */
+		current = std::max(current, now + 1);
+		return;
+	}
+	while (current <= now) {
+		size_t index = current & wheel_mask;
+		if (index == 0) {
+			/* The inner wheel has gone round, move the next slot of each outer wheel inwards */
+			for (size_t level = 1; level < levels; ++level) {
+				size_t outer = (current >> (wheel_bits * level)) & wheel_mask;
+				entry* e = slots[level][outer];
+				slots[level][outer] = nullptr;
+				while (e) {
+					entry* next = e->next;
+					occupied[level]--;
+					link(e);
+					e = next;
+				}
+				if (outer != 0) {
+					break;
+				}
+			}
+		}
+		entry* e = slots[0][index];
+		if (!e) {
+			if (occupied[0]) {
+				/* Skip the empty slots up to the next occupied one or the next cascade */
+				uint64_t boundary = (current | wheel_mask) + 1;
+				do {
+					current++;
+				} while (current < boundary && current <= now && !slots[0][current & wheel_mask]);
+			} else {
+				/* While the inner wheels are empty, nothing happens until the first
+				 * occupied wheel next moves a slot inwards, so jump straight there
+				 */
+				size_t level = 1;
+				while (level < levels && !occupied[level]) {
+					++level;
+				}
+				if (level == levels) {
+					current = now + 1;
+				} else {
+					uint64_t span = 1ULL << (wheel_bits * level);
+					current = std::min(now + 1, (current | (span - 1)) + 1);
+				}
+			}
+			continue;
+		}
+		slots[0][index] = nullptr;
+		current++;
+		while (e) {
+			entry* next = e->next;
+			occupied[0]--;
+			e->prev = e->next = nullptr;
+			e->list = nullptr;
+			e->firing = true;
+			due.push_back(e);
+			e = next;
+		}
+	}
+}
+
+void timer_wheel::core::fire(std::vector<entry*>& due) {
+	for (entry* e : due) {
+		{
+			std::lock_guard lock(mutex);
+			if (e->cancelled) {
+				/* Cancelled by an earlier timer in the same batch */
+				delete e;
+				continue;
+			}
+		}
+		try {
+			e->on_tick(e->handle);
+		}
+		catch (const std::exception&) {
+			/* A throwing timer must not take down the others on the same driver */
+		}
+		std::lock_guard lock(mutex);
+		e->firing = false;
+		if (stopping) {
+			/* The wheel was destroyed by this timer. Timers still in entries are freed
+			 * with the core, only the cancelled ones belong to us now.
+			 */
+			for (auto i = std::find(due.begin(), due.end(), e); i != due.end(); ++i) {
+				if ((*i)->cancelled) {
+					delete *i;
+				}
+			}
+			break;
+		}
+		if (e->cancelled) {
+			delete e;
+		} else if (e->interval) {
+			e->expiry = elapsed() + e->interval;
+			link(e);
+		} else {
+			entries.erase(e->handle);
+			delete e;
+		}
+	}
+	due.clear();
+}
+
+uint64_t timer_wheel::core::next_due() const {
+	/* Find the next occupied slot of the inner wheel, or otherwise wake for the next cascade */
+	if ((current & wheel_mask) == 0) {
+		return current;
+	}
+	uint64_t boundary = (current | wheel_mask) + 1;
+	for (uint64_t t = current; t < boundary; ++t) {
+		if (slots[0][t & wheel_mask]) {
+			return t;
+		}
+	}
+	return boundary;
+}
+
+void timer_wheel::core::run(std::shared_ptr<core> self) {
+	utility::set_thread_name("timer wheel");
+	std::vector<entry*> due;
+	std::unique_lock lock(self->mutex);
+	while (!self->stopping) {
+		self->collect(self->elapsed(), due);
+		if (!due.empty()) {
+			self->busy = true;
+			lock.unlock();
+			self->fire(due);
+			lock.lock();
+			self->busy = false;
+			self->idle.notify_all();
+			continue;
+		}
+		if (self->entries.empty()) {
+			self->wake_at = UINT64_MAX;
+			self->wake.wait(lock);
+		} else {
+			self->wake_at = self->next_due();
+			self->wake.wait_until(lock, self->epoch + std::chrono::milliseconds(self->wake_at));
+		}
+	}
+}
+
+timer timer_wheel::add(std::chrono::milliseconds delay, std::chrono::milliseconds interval, timer_callback_t on_tick, timer_callback_t on_stop) {
+	entry* e = new entry();
+	e->interval = std::max<int64_t>(interval.count(), 0);
+	e->on_tick = std::move(on_tick);
+	e->on_stop = std::move(on_stop);
+	core& w = *state;
+	std::lock_guard lock(w.mutex);
+	e->handle = w.next_handle++;
+	e->expiry = w.elapsed() + std::max<int64_t>(delay.count(), 0);
+	w.link(e);
+	w.entries.emplace(e->handle, e);
+	if (w.threaded) {
+		if (!w.driver.joinable()) {
+			w.wake_at = e->expiry;
+			w.driver = std::thread(&core::run, state);
+		} else if (e->expiry < w.wake_at) {
+			w.wake.notify_one();
+		}
+	}
+	return e->handle;
+}
+
+bool timer_wheel::cancel(timer t, bool call_on_stop) {
+	timer_callback_t on_stop;
+	{
+		core& w = *state;
+		std::lock_guard lock(w.mutex);
+		auto i = w.entries.find(t);
+		if (i == w.entries.end()) {
+			return false;
+		}
+		entry* e = i->second;
+		w.entries.erase(i);
+		if (call_on_stop) {
+			on_stop = std::move(e->on_stop);
+		}
+		if (e->firing) {
+			/* The driver still needs it, and deletes it once on_tick returns */
+			e->cancelled = true;
+		} else {
+			w.unlink(e);
+			delete e;
+		}
+	}
+	if (on_stop) {
+		on_stop(t);
+	}
+	return true;
+}
+
+void timer_wheel::clear() {
+	core& w = *state;
+	std::unique_lock lock(w.mutex);
+	for (auto& [handle, e] : w.entries) {
+		if (e->firing) {
+			e->cancelled = true;
+		} else {
+			delete e;
+		}
+	}
+	w.entries.clear();
+	for (auto& wheel : w.slots) {
+		std::fill(std::begin(wheel), std::end(wheel), nullptr);
+	}
+	std::fill(std::begin(w.occupied), std::end(w.occupied), 0);
+	/* Whatever owns the timers may be about to go away, so let any running callback finish first */
+	if (w.driver.joinable() && w.driver.get_id() != std::this_thread::get_id()) {
+		w.idle.wait(lock, [&w]() {
+			return !w.busy;
+		});
+	}
+}
+
+size_t timer_wheel::advance(std::chrono::milliseconds now) {
+	/* A timer may destroy the wheel, so hold on to the core until they have all run */
+	std::shared_ptr<core> w = state;
+	std::vector<entry*> due;
+	{
+		std::lock_guard lock(w->mutex);
+		if (w->threaded) {
+			return 0;
+		}
+		w->manual_now = std::max<uint64_t>(w->manual_now, now.count());
+		w->collect(w->manual_now, due);
+	}
+	size_t count = due.size();
+	w->fire(due);
+	return count;
+}
+
+size_t timer_wheel::size() const {
+	std::lock_guard lock(state->mutex);
+	return state->entries.size();
+}
+
+}
@@ -33,7 +33,7 @@
 namespace dpp {
 
 discord_voice_client::discord_voice_client(dpp::cluster* _cluster, snowflake _channel_id, snowflake _server_id, const std::string &_token, const std::string &_session_id, const std::string &_host, bool enable_dave)
-	: websocket_client(_host.substr(0, _host.find(':')), _host.substr(_host.find(':') + 1, _host.length()), "/?v=" + std::to_string(voice_protocol_version), OP_TEXT),
+	: websocket_client(_host.substr(0, _host.find(':')), _host.substr(_host.find(':') + 1, _host.length()), "/?v=" + std::to_string(voice_protocol_version), OP_TEXT, false),
 	runner(nullptr),
 	connect_time(0),
 	mixer(std::make_unique<audio_mixer>()),
@@ -70,13 +70,7 @@ discord_voice_client::discord_voice_client(dpp::cluster* _cluster, snowflake _ch
 	if (!repacketizer) {
 		throw dpp::voice_exception(err_opus, "discord_voice_client::discord_voice_client; opus_repacketizer_create() failed");
 	}
-	try {
-		this->connect();
-	}
-	catch (...) {
-		cleanup();
-		throw;
-	}
+	/* The websocket is connected from the voice client's own thread, see run() */
 }
 
 }
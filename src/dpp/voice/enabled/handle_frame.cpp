@@ -25,6 +25,7 @@
 #include <dpp/isa_detection.h>
 #include <dpp/discordvoiceclient.h>
 #include <dpp/json.h>
+#include <dpp/jsonparser.h>
 #include "../../dave/encryptor.h"
 
 #include "enabled.h"
@@ -88,7 +89,7 @@ void discord_voice_client::update_ratchets(bool force) {
 
 }
 
-bool discord_voice_client::handle_frame(const std::string &data, ws_opcode opcode) {
+bool discord_voice_client::handle_frame(std::string_view data, ws_opcode opcode) {
 	json j;
 
 	/**
@@ -173,11 +174,11 @@ bool discord_voice_client::handle_frame(const std::string &data, ws_opcode opcod
 	}
 
 	try {
-		log(dpp::ll_trace, std::string("R: ") + data);
-		j = json::parse(data);
+		log(dpp::ll_trace, "R: " + std::string(data));
+		j = parse_json(data);
 	}
 	catch (const std::exception &e) {
-		log(dpp::ll_error, std::string("discord_voice_client::handle_frame ") + e.what() + ": " + data);
+		log(dpp::ll_error, std::string("discord_voice_client::handle_frame ") + e.what() + ": " + std::string(data));
 		return true;
 	}
 
@@ -204,7 +205,7 @@ bool discord_voice_client::handle_frame(const std::string &data, ws_opcode opcod
 			}
 			break;
 			case voice_client_platform: {
-				voice_client_platform_t vcp(nullptr, data);
+				voice_client_platform_t vcp(nullptr, std::string(data));
 				vcp.voice_client = this;
 				vcp.user_id = snowflake_not_null(&j["d"], "user_id");
 				vcp.platform = static_cast<client_platform_t>(int8_not_null(&j["d"], "platform"));
@@ -300,7 +301,7 @@ bool discord_voice_client::handle_frame(const std::string &data, ws_opcode opcod
 					dave_mls_pending_remove_list.insert(u_id);
 
 					if (!creator->on_voice_client_disconnect.empty()) {
-						voice_client_disconnect_t vcd(nullptr, data);
+						voice_client_disconnect_t vcd(nullptr, std::string(data));
 						vcd.voice_client = this;
 						vcd.user_id = u_id;
 						creator->on_voice_client_disconnect.call(vcd);
@@ -318,7 +319,7 @@ bool discord_voice_client::handle_frame(const std::string &data, ws_opcode opcod
 					ssrc_map[u_ssrc] = u_id;
 
 					if (!creator->on_voice_client_speaking.empty()) {
-						voice_client_speaking_t vcs(nullptr, data);
+						voice_client_speaking_t vcs(nullptr, std::string(data));
 						vcs.voice_client = this;
 						vcs.user_id = u_id;
 						vcs.ssrc = u_ssrc;
@@ -416,7 +417,7 @@ bool discord_voice_client::handle_frame(const std::string &data, ws_opcode opcod
 					send_silence(20);
 					/* Fire on_voice_ready */
 					if (!creator->on_voice_ready.empty()) {
-						voice_ready_t rdy(nullptr, data);
+						voice_ready_t rdy(nullptr, std::string(data));
 						rdy.voice_client = this;
 						rdy.voice_channel_id = this->channel_id;
 						creator->on_voice_ready.call(rdy);
@@ -476,7 +477,7 @@ bool discord_voice_client::handle_frame(const std::string &data, ws_opcode opcod
 			}
 			break;
 			default: {
-				log(ll_debug, "Unknown voice opcode " + std::to_string(op) + ": " + data);
+				log(ll_debug, "Unknown voice opcode " + std::to_string(op) + ": " + std::string(data));
 			}
 			break;
 		}
@@ -489,7 +490,7 @@ bool discord_voice_client::handle_frame(const std::string &data, ws_opcode opcod
  * Handle DAVE frame utilities.
  */
 
-void discord_voice_client::ready_for_transition(const std::string &data) {
+void discord_voice_client::ready_for_transition(std::string_view data) {
 	if (mls_state == nullptr) {
 		/* Impossible! */
 		return;
@@ -518,7 +519,7 @@ void discord_voice_client::ready_for_transition(const std::string &data) {
 		mls_state->done_ready = true;
 
 		if (!creator->on_voice_ready.empty()) {
-			voice_ready_t rdy(nullptr, data);
+			voice_ready_t rdy(nullptr, std::string(data));
 			rdy.voice_client = this;
 			rdy.voice_channel_id = this->channel_id;
 			creator->on_voice_ready.call(rdy);
@@ -29,6 +29,11 @@
 
 namespace dpp {
 
+/* Unlike shards, a voice client keeps a thread of its own running read_loop(), rather
+ * than attaching to the cluster's shared socket engines. write_ready() paces outgoing
+ * audio by sleeping for the duration of each packet it sends, which on a shared engine
+ * would hold up every other connection on it for as long as audio is playing.
+ */
 void discord_voice_client::thread_run()
 {
 	utility::set_thread_name(std::string("vc/") + std::to_string(server_id));
@@ -36,8 +41,30 @@ void discord_voice_client::thread_run()
 	size_t times_looped = 0;
 	time_t last_loop_time = time(nullptr);
 
-	do {
+	/* (Re)connect the websocket, retrying every 5 seconds until connected or terminating.
+	 * This is done here rather than in the constructor, so that creating a voice
+	 * client never blocks the caller.
+	 */
+	auto establish = [this]() {
 		bool error = false;
+		do {
+			error = false;
+			try {
+				ssl_client::connect();
+				websocket_client::connect();
+			}
+			catch (const std::exception &e) {
+				log(dpp::ll_error, std::string("Error establishing voice websocket connection, retry in 5 seconds: ") + e.what());
+				ssl_client::close();
+				std::this_thread::sleep_for(std::chrono::seconds(5));
+				error = true;
+			}
+		} while (error && !terminating);
+	};
+
+	establish();
+
+	while (!terminating) {
 		ssl_client::read_loop();
 		ssl_client::close();
 
@@ -61,20 +88,9 @@ void discord_voice_client::thread_run()
 
 		if (!terminating) {
 			log(dpp::ll_debug, "Attempting to reconnect the websocket...");
-			do {
-				try {
-					ssl_client::connect();
-					websocket_client::connect();
-				}
-				catch (const std::exception &e) {
-					log(dpp::ll_error, std::string("Error establishing voice websocket connection, retry in 5 seconds: ") + e.what());
-					ssl_client::close();
-					std::this_thread::sleep_for(std::chrono::seconds(5));
-					error = true;
-				}
-			} while (error && !terminating);
+			establish();
 		}
-	} while(!terminating);
+	}
 }
 
 void discord_voice_client::run()
@@ -28,7 +28,7 @@
 namespace dpp {
 
 	discord_voice_client::discord_voice_client(dpp::cluster* _cluster, snowflake _channel_id, snowflake _server_id, const std::string &_token, const std::string &_session_id, const std::string &_host, bool enable_dave)
-		: websocket_client(_host.substr(0, _host.find(':')), _host.substr(_host.find(':') + 1, _host.length()), "/?v=" + std::to_string(voice_protocol_version), OP_TEXT)
+		: websocket_client(_host.substr(0, _host.find(':')), _host.substr(_host.find(':') + 1, _host.length()), "/?v=" + std::to_string(voice_protocol_version), OP_TEXT, false)
 	{
 		throw dpp::voice_exception(err_no_voice_support, "Voice support not enabled in this build of D++");
 	}
@@ -49,7 +49,7 @@ namespace dpp {
 		return false;
 	}
 
-	bool discord_voice_client::handle_frame(const std::string &data, ws_opcode opcode) {
+	bool discord_voice_client::handle_frame(std::string_view data, ws_opcode opcode) {
 		return false;
 	}
 
@@ -37,8 +37,8 @@ constexpr size_t WS_MAX_PAYLOAD_LENGTH_SMALL = 125;
 constexpr size_t WS_MAX_PAYLOAD_LENGTH_LARGE = 65535;
 constexpr size_t MAXHEADERSIZE = sizeof(uint64_t) + 2;
 
-websocket_client::websocket_client(const std::string& hostname, const std::string& port, const std::string& urlpath, ws_opcode opcode)
-	: ssl_client(hostname, port),
+websocket_client::websocket_client(const std::string& hostname, const std::string& port, const std::string& urlpath, ws_opcode opcode, bool connect_immediately)
+	: ssl_client(hostname, port, false, false, nullptr, connect_immediately),
 	state(HTTP_HEADERS),
 	path(urlpath),
 	data_opcode(opcode)
@@ -73,6 +73,12 @@ void websocket_client::connect()
 	);
 }
 
+bool websocket_client::handle_frame(std::string_view buffer, ws_opcode opcode)
+{
+	/* Derived classes written against the old signature still override this one */
+	return handle_frame(std::string(buffer), opcode);
+}
+
 bool websocket_client::handle_frame(const std::string& buffer, ws_opcode opcode)
 {
 	/* This is a stub for classes that derive the websocket client */
@@ -179,8 +185,23 @@ bool websocket_client::handle_buffer(std::string& buffer)
 			return false;
 		}
 	} else if (state == CONNECTED) {
-		/* Process packets until we can't (buffer will erase data until parseheader returns false) */
-		while (this->parseheader(buffer)) { }
+		/* Process frames in place until we can't, then remove them all from the buffer at once.
+		 * If a frame handler closes the connection, the buffer is cleared under us, so stop.
+		 */
+		const size_t length = buffer.length();
+		std::string_view pending(buffer);
+		try {
+			while (buffer.length() == length && this->parseheader(pending)) { }
+		}
+		catch (const std::exception&) {
+			if (buffer.length() == length) {
+				buffer.erase(0, length - pending.length());
+			}
+			throw;
+		}
+		if (buffer.length() == length) {
+			buffer.erase(0, length - pending.length());
+		}
 	}
 
 	return true;
@@ -191,7 +212,7 @@ ws_state websocket_client::get_state() const
 	return this->state;
 }
 
-bool websocket_client::parseheader(std::string& data)
+bool websocket_client::parseheader(std::string_view& data)
 {
 	if (data.size() < 4) {
 		/* Not enough data to form a frame yet */
@@ -257,8 +278,8 @@ bool websocket_client::parseheader(std::string& data)
 				this->handle_frame(data.substr(payloadstartoffset, len), static_cast<ws_opcode>(opcode & ~WS_FINBIT));
 			}
 
-			/* Remove this frame from the input buffer */
-			data.erase(data.begin(), data.begin() + payloadstartoffset + len);
+			/* Move past this frame */
+			data.remove_prefix(payloadstartoffset + len);
 
 			return true;
 		}
@@ -296,7 +317,7 @@ void websocket_client::one_second_timer()
 	}
 }
 
-void websocket_client::handle_ping(const std::string &payload)
+void websocket_client::handle_ping(std::string_view payload)
 {
 	/* For receiving pings we echo back their payload with the type OP_PONG */
 	unsigned char out[MAXHEADERSIZE];
@@ -0,0 +1,92 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <dpp/zlibcontext.h>
+#include <dpp/exception.h>
+#include <zlib.h>
+#include <algorithm>
+#include <chrono>
+
+namespace dpp {
+
+/* The zlib sync flush marker which ends each complete gateway message */
+static constexpr unsigned char sync_flush_suffix[4]{0x00, 0x00, 0xFF, 0xFF};
+
+zlibcontext::zlibcontext() : d_stream(new z_stream{}), complete(true) {
+	int error = inflateInit(d_stream);
+	if (error != Z_OK) {
+		delete d_stream;
+		throw dpp::connection_exception((exception_error_code)error, "Can't initialise stream compression!");
+	}
+}
+
+zlibcontext::~zlibcontext() {
+	inflateEnd(d_stream);
+	delete d_stream;
+}
+
+void zlibcontext::reset() {
+	inflateReset(d_stream);
+	arena_used = 0;
+	complete = true;
+}
+
+bool zlibcontext::feed(std::string_view frame) {
+	auto start = std::chrono::steady_clock::now();
+	if (complete) {
+		/* Start the next message at the beginning of the arena, keeping its allocation */
+		arena_used = 0;
+		complete = false;
+	}
+
+	d_stream->next_in = (Bytef*)frame.data();
+	d_stream->avail_in = (uInt)frame.size();
+	size_t produced = 0;
+	do {
+		/* Inflate directly into the free space at the end of the arena */
+		const size_t room = grow_arena(frame.size());
+		d_stream->next_out = (Bytef*)arena.data() + arena_used;
+		d_stream->avail_out = (uInt)room;
+		int ret = inflate(d_stream, Z_SYNC_FLUSH);
+		const size_t have = room - d_stream->avail_out;
+		arena_used += have;
+		produced += have;
+		switch (ret) {
+			case Z_NEED_DICT:
+			case Z_STREAM_ERROR:
+				throw dpp::connection_exception(err_compression_stream, "Compression stream error");
+			case Z_DATA_ERROR:
+				throw dpp::connection_exception(err_compression_data, "Compression data error");
+			case Z_MEM_ERROR:
+				throw dpp::connection_exception(err_compression_memory, "Compression memory error");
+			default:
+				/* Z_OK, or Z_BUF_ERROR when there was nothing left to do */
+			break;
+		}
+	} while (d_stream->avail_out == 0);
+
+	complete = frame.size() >= sizeof(sync_flush_suffix) && std::equal(frame.end() - sizeof(sync_flush_suffix), frame.end(), (const char*)sync_flush_suffix);
+
+	record(frame.size(), produced, complete, start);
+	return complete;
+}
+
+}
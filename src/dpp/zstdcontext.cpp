@@ -0,0 +1,97 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include <dpp/zstdcontext.h>
+#include <dpp/exception.h>
+#include <chrono>
+#ifdef HAVE_ZSTD
+	#include <zstd.h>
+#endif
+
+namespace dpp {
+
+#ifdef HAVE_ZSTD
+
+zstdcontext::zstdcontext() : d_stream(ZSTD_createDStream()) {
+	if (d_stream == nullptr) {
+		throw dpp::connection_exception(err_compression_memory, "Can't initialise stream compression!");
+	}
+}
+
+zstdcontext::~zstdcontext() {
+	ZSTD_freeDStream(d_stream);
+}
+
+bool zstdcontext::available() {
+	return true;
+}
+
+void zstdcontext::reset() {
+	ZSTD_DCtx_reset(d_stream, ZSTD_reset_session_only);
+	arena_used = 0;
+}
+
+bool zstdcontext::feed(std::string_view frame) {
+	auto start = std::chrono::steady_clock::now();
+	arena_used = 0;
+
+	ZSTD_inBuffer input{frame.data(), frame.size(), 0};
+	while (true) {
+		/* Decompress directly into the free space at the end of the arena */
+		const size_t room = grow_arena(frame.size());
+		ZSTD_outBuffer output{arena.data() + arena_used, room, 0};
+		const size_t ret = ZSTD_decompressStream(d_stream, &output, &input);
+		arena_used += output.pos;
+		if (ZSTD_isError(ret)) {
+			throw dpp::connection_exception(err_compression_data, std::string("Compression data error: ") + ZSTD_getErrorName(ret));
+		}
+		/* All input consumed, and the output was not the limit, so everything is flushed */
+		if (input.pos == input.size && output.pos < output.size) {
+			break;
+		}
+	}
+
+	record(frame.size(), arena_used, true, start);
+	return true;
+}
+
+#else
+
+zstdcontext::zstdcontext() : d_stream(nullptr) {
+	throw dpp::logic_exception(err_no_compression_support, "D++ was built without zstd support, zstd-stream compression is not available");
+}
+
+zstdcontext::~zstdcontext() = default;
+
+bool zstdcontext::available() {
+	return false;
+}
+
+void zstdcontext::reset() {
+}
+
+bool zstdcontext::feed(std::string_view frame) {
+	return false;
+}
+
+#endif
+
+}
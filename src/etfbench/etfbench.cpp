@@ -0,0 +1,220 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+/* Compares the two ways an ETF gateway payload can be read: decoding the whole
+ * payload to nlohmann::json then calling fill_from_json(), and reading it in place
+ * with dpp::etf_reader and fill_from_etf(), as the shards now do for their hottest
+ * events. Only GUILD_CREATE and MESSAGE_CREATE payloads are timed.
+ *
+ * The dump is a text file with one JSON gateway payload per line, which is encoded
+ * to ETF before timing starts. Without a dump, generated payloads are used.
+ */
+
+#include <dpp/dpp.h>
+#include <dpp/etf.h>
+#include <dpp/json.h>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <ctime>
+
+using json = nlohmann::json;
+
+const dpp::cache_policy_t no_cache = {dpp::cp_none, dpp::cp_none, dpp::cp_none};
+
+/**
+ * @brief Generate a GUILD_CREATE with the given number of members and presences
+ */
+json generated_guild_create(size_t members) {
+	json d = {{"id", "825407338755653642"}, {"name", "D++ Benchmark"}, {"member_count", members}, {"channels", json::array()}, {"roles", json::array()}};
+	for (size_t i = 0; i < members; ++i) {
+		std::string id = std::to_string(189759562910400512ull + i);
+		d["members"].push_back({
+			{"user", {{"id", id}, {"username", "user" + std::to_string(i)}, {"discriminator", "0"}, {"global_name", nullptr}, {"avatar", "9c2b6b8ed4d7a4a11bd25a3b5bcc8bc6"}}},
+			{"nick", i % 3 ? json(nullptr) : json("nick" + std::to_string(i))}, {"roles", {"416737094522568706", "416737120858832906"}},
+			{"joined_at", "2021-03-15T14:45:31.411000+00:00"}, {"premium_since", nullptr}, {"flags", 0}, {"deaf", false}, {"mute", false}, {"pending", false}
+		});
+		d["presences"].push_back({
+			{"user", {{"id", id}}}, {"status", "online"}, {"client_status", {{"desktop", "online"}}},
+			{"activities", i % 4 ? json::array() : json::array({{{"name", "D++"}, {"type", 0}, {"created_at", 1234}}})}
+		});
+	}
+	return {{"op", 0}, {"s", 1}, {"t", "GUILD_CREATE"}, {"d", d}};
+}
+
+/**
+ * @brief Generate a MESSAGE_CREATE
+ */
+json generated_message_create() {
+	return {{"op", 0}, {"s", 2}, {"t", "MESSAGE_CREATE"}, {"d", {
+		{"id", "1234567890123456789"}, {"channel_id", "825411707521728511"}, {"guild_id", "825407338755653642"},
+		{"content", "The quick brown fox jumps over the lazy dog"}, {"timestamp", "2024-01-02T03:04:05.678000+00:00"},
+		{"edited_timestamp", nullptr}, {"tts", false}, {"mention_everyone", false}, {"pinned", false}, {"type", 0}, {"flags", 0},
+		{"nonce", "1234567890123456000"}, {"mentions", json::array()}, {"mention_roles", json::array()}, {"attachments", json::array()},
+		{"embeds", json::array()}, {"components", json::array()},
+		{"author", {{"id", "189759562910400512"}, {"username", "brain"}, {"discriminator", "0"}, {"avatar", nullptr}}},
+		{"member", {{"roles", {"416737094522568706"}}, {"joined_at", "2021-03-15T14:45:31.411000+00:00"}, {"deaf", false}, {"mute", false}}}
+	}}};
+}
+
+/**
+ * @brief Read a payload the way the shards did before: decode it all, then fill from json
+ */
+size_t json_path(dpp::etf_parser& etf, const std::string& payload) {
+	json j = etf.parse(payload);
+	json& d = j["d"];
+	size_t objects = 0;
+	if (j["t"] == "MESSAGE_CREATE") {
+		dpp::message m;
+		m.fill_from_json(&d, no_cache);
+		objects++;
+	} else {
+		for (auto& member : d["members"]) {
+			dpp::user u;
+			u.fill_from_json(&member["user"]);
+			dpp::guild_member gm;
+			gm.fill_from_json(&member, 825407338755653642, u.id);
+			objects++;
+		}
+		for (auto& p : d["presences"]) {
+			dpp::presence().fill_from_json(&p);
+			objects++;
+		}
+	}
+	return objects;
+}
+
+/**
+ * @brief Read a payload the way the shards do now: envelope and hot objects in place
+ */
+size_t direct_path(dpp::etf_parser& etf, const std::string& payload) {
+	json j;
+	std::string_view data;
+	dpp::etf_reader envelope(payload);
+	envelope.read_map([&](std::string_view key) {
+		if (key == "d") {
+			data = envelope.read_term();
+		} else {
+			j[std::string(key)] = envelope.read_json();
+		}
+	});
+	size_t objects = 0;
+	dpp::etf_reader r(data, false);
+	if (j["t"] == "MESSAGE_CREATE") {
+		dpp::message m;
+		m.fill_from_etf(r, no_cache);
+		objects++;
+	} else {
+		json d = json::object();
+		r.read_map([&](std::string_view key) {
+			if (key == "members") {
+				r.read_list([&]() {
+					json user;
+					dpp::guild_member gm;
+					gm.fill_from_etf(r, 825407338755653642, &user);
+					dpp::user u;
+					u.fill_from_json(&user);
+					objects++;
+				});
+			} else if (key == "presences") {
+				r.read_list([&]() {
+					dpp::presence().fill_from_etf(r);
+					objects++;
+				});
+			} else {
+				d[std::string(key)] = r.read_json();
+			}
+		});
+	}
+	return objects;
+}
+
+/**
+ * @brief Time one path over a set of payloads and print its figures
+ */
+double measure(const std::string& name, size_t (*path)(dpp::etf_parser&, const std::string&), const std::vector<std::string>& payloads, int iterations) {
+	dpp::etf_parser etf;
+	size_t bytes = 0, objects = 0;
+	std::clock_t start = std::clock();
+	for (int i = 0; i < iterations; ++i) {
+		for (const auto& payload : payloads) {
+			objects += path(etf, payload);
+			bytes += payload.size();
+		}
+	}
+	double cpu = static_cast<double>(std::clock() - start) / CLOCKS_PER_SEC;
+	double mb = static_cast<double>(bytes) / (1024.0 * 1024.0);
+	std::cout << "  " << std::left << std::setw(8) << name
+		<< " CPU ms/MB: " << std::setw(10) << std::setprecision(4) << (mb > 0 ? cpu * 1000.0 / mb : 0)
+		<< " us/object: " << std::setprecision(4) << (objects ? cpu * 1000000.0 / objects : 0) << "\n";
+	return cpu;
+}
+
+int main(int argc, char** argv) {
+	int iterations = argc > 2 ? std::max(1, std::stoi(argv[2])) : 20;
+	std::vector<json> events;
+	if (argc > 1) {
+		std::ifstream dump(argv[1]);
+		if (!dump) {
+			std::cerr << "Can't open " << argv[1] << "\n";
+			return 1;
+		}
+		for (std::string line; std::getline(dump, line);) {
+			try {
+				json j = json::parse(line);
+				if (j.value("t", json()) == "GUILD_CREATE" || j.value("t", json()) == "MESSAGE_CREATE") {
+					events.emplace_back(std::move(j));
+				}
+			}
+			catch (const json::exception&) {
+			}
+		}
+	} else {
+		std::cout << "No dump given, using generated payloads. Usage: " << argv[0] << " [gateway dump, one JSON payload per line] [iterations]\n";
+		events.emplace_back(generated_guild_create(1000));
+		for (int i = 0; i < 1000; ++i) {
+			events.emplace_back(generated_message_create());
+		}
+	}
+
+	dpp::etf_parser etf;
+	for (const std::string event : {"GUILD_CREATE", "MESSAGE_CREATE"}) {
+		std::vector<std::string> payloads;
+		size_t total = 0;
+		for (const auto& j : events) {
+			if (j["t"] == event) {
+				payloads.emplace_back(etf.build(j));
+				total += payloads.back().size();
+			}
+		}
+		std::cout << event << ": " << payloads.size() << " payloads, " << total << " bytes of ETF, " << iterations << " iterations\n";
+		if (payloads.empty()) {
+			continue;
+		}
+		double before = measure("json", json_path, payloads, iterations);
+		double after = measure("direct", direct_path, payloads, iterations);
+		std::cout << "  speedup: " << std::setprecision(3) << (after > 0 ? before / after : 0) << "x\n";
+	}
+	return 0;
+}
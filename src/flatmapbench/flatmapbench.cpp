@@ -0,0 +1,175 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+/* Compares dpp::flat_map with std::unordered_map for snowflake keys.
+ *
+ * Both maps are filled with the same snowflakes, and the benchmark reports
+ * the memory and number of blocks each allocated per entry (counted by
+ * replacing operator new), and the time taken to insert, look up keys which
+ * are present and absent, iterate, and erase half of the keys. It is run with a snowflake value, like
+ * cluster::dm_channels, and with a 64 byte value.
+ *
+ * Usage: flatmapbench [entries]
+ */
+
+#include <dpp/dpp.h>
+#include <dpp/flat_map.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <unordered_map>
+
+/**
+ * @brief Bytes currently allocated through operator new
+ */
+std::atomic<size_t> allocated{0};
+
+/**
+ * @brief Blocks currently allocated through operator new. Each costs the
+ * allocator's own overhead on top of the bytes counted above.
+ */
+std::atomic<size_t> blocks{0};
+
+void* operator new(size_t size) {
+	/* Keep the size in front of the block so operator delete can subtract it */
+	size_t* p = static_cast<size_t*>(std::malloc(size + sizeof(std::max_align_t)));
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	*p = size;
+	allocated += size;
+	blocks++;
+	return reinterpret_cast<char*>(p) + sizeof(std::max_align_t);
+}
+
+void operator delete(void* ptr) noexcept {
+	if (ptr) {
+		size_t* p = reinterpret_cast<size_t*>(static_cast<char*>(ptr) - sizeof(std::max_align_t));
+		allocated -= *p;
+		blocks--;
+		std::free(p);
+	}
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+	operator delete(ptr);
+}
+
+using bench_clock = std::chrono::steady_clock;
+
+/**
+ * @brief A value the size of a small struct
+ */
+struct payload {
+	uint64_t fields[8]{};
+};
+
+/**
+ * @brief Nanoseconds per operation since a point in time
+ */
+double ns_since(bench_clock::time_point start, size_t count) {
+	return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count() / std::max<size_t>(count, 1);
+}
+
+/**
+ * @brief Fill, search, iterate and erase one map, printing one line of results
+ */
+template<class Map> void run(const char* name, const std::vector<dpp::snowflake>& keys, const std::vector<dpp::snowflake>& absent) {
+	size_t before = allocated, blocks_before = blocks;
+	uint64_t sum = 0;
+	{
+		Map map;
+		auto start = bench_clock::now();
+		for (auto k : keys) {
+			map[k];
+		}
+		double insert_ns = ns_since(start, keys.size());
+		size_t bytes = allocated - before;
+		size_t allocations = blocks - blocks_before;
+
+		start = bench_clock::now();
+		for (auto k : keys) {
+			sum += map.find(k) != map.end();
+		}
+		double hit_ns = ns_since(start, keys.size());
+
+		start = bench_clock::now();
+		for (auto k : absent) {
+			sum += map.find(k) != map.end();
+		}
+		double miss_ns = ns_since(start, absent.size());
+
+		start = bench_clock::now();
+		for (auto& e : map) {
+			sum += e.first;
+		}
+		double iterate_ns = ns_since(start, map.size());
+
+		start = bench_clock::now();
+		for (size_t i = 0; i < keys.size(); i += 2) {
+			map.erase(keys[i]);
+		}
+		double erase_ns = ns_since(start, keys.size() / 2);
+
+		std::cout << std::left << std::setw(34) << name << std::right
+			<< std::setw(10) << static_cast<double>(bytes) / keys.size()
+			<< std::setw(10) << static_cast<double>(allocations) / keys.size()
+			<< std::setw(10) << insert_ns << std::setw(10) << hit_ns << std::setw(10) << miss_ns
+			<< std::setw(10) << iterate_ns << std::setw(10) << erase_ns << "\n";
+	}
+	if (sum == 42) {
+		std::cout << "\n";
+	}
+}
+
+int main(int argc, char const *argv[]) {
+	size_t count = argc > 1 ? std::stoul(argv[1]) : 10000000;
+	std::mt19937_64 rng(42);
+
+	/* Snowflakes spread over a few years, with a few workers and sequence numbers */
+	std::vector<dpp::snowflake> keys(count), absent(count);
+	auto snowflake = [&rng]() {
+		uint64_t timestamp = (rng() % (1000ULL * 86400 * 365 * 3)) + 1420070400000ULL;
+		return dpp::snowflake(((timestamp - 1420070400000ULL) << 22) | (rng() % 32) << 17 | (rng() % 4096));
+	};
+	for (size_t i = 0; i < count; ++i) {
+		keys[i] = snowflake();
+		absent[i] = snowflake();
+	}
+	std::shuffle(keys.begin(), keys.end(), rng);
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << count << " snowflake keys\n";
+	std::cout << std::left << std::setw(34) << "map" << std::right << std::setw(10) << "B/entry" << std::setw(10) << "allocs" << std::setw(10) << "insert"
+		<< std::setw(10) << "hit" << std::setw(10) << "miss" << std::setw(10) << "iterate" << std::setw(10) << "erase" << "  (ns/op)\n";
+	run<std::unordered_map<dpp::snowflake, dpp::snowflake>>("unordered_map<snowflake,snowflake>", keys, absent);
+	run<dpp::flat_map<dpp::snowflake, dpp::snowflake>>("flat_map<snowflake,snowflake>", keys, absent);
+	run<std::unordered_map<dpp::snowflake, payload>>("unordered_map<snowflake,64B>", keys, absent);
+	run<dpp::flat_map<dpp::snowflake, payload>>("flat_map<snowflake,64B>", keys, absent);
+	return 0;
+}
@@ -0,0 +1,159 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+/* Measures the parse throughput of each JSON parser backend compiled into this
+ * build of D++ (see dpp::set_json_parser), and checks each one builds exactly
+ * the same dpp::json tree as nlohmann::json does.
+ *
+ * The dump is a text file with one JSON document per line, such as gateway
+ * payloads or REST response bodies. Without a dump, generated payloads are used.
+ */
+
+#include <dpp/dpp.h>
+#include <dpp/jsonparser.h>
+#include <dpp/json.h>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <ctime>
+
+using json = nlohmann::json;
+
+/**
+ * @brief Generate a GUILD_CREATE with the given number of members and presences
+ */
+json generated_guild_create(size_t members) {
+	json d = {{"id", "825407338755653642"}, {"name", "D++ Benchmark"}, {"member_count", members}, {"channels", json::array()}, {"roles", json::array()}};
+	for (size_t i = 0; i < members; ++i) {
+		std::string id = std::to_string(189759562910400512ull + i);
+		d["members"].push_back({
+			{"user", {{"id", id}, {"username", "user" + std::to_string(i)}, {"discriminator", "0"}, {"global_name", nullptr}, {"avatar", "9c2b6b8ed4d7a4a11bd25a3b5bcc8bc6"}}},
+			{"nick", i % 3 ? json(nullptr) : json("nick" + std::to_string(i))}, {"roles", {"416737094522568706", "416737120858832906"}},
+			{"joined_at", "2021-03-15T14:45:31.411000+00:00"}, {"premium_since", nullptr}, {"flags", 0}, {"deaf", false}, {"mute", false}, {"pending", false}
+		});
+		d["presences"].push_back({
+			{"user", {{"id", id}}}, {"status", "online"}, {"client_status", {{"desktop", "online"}}},
+			{"activities", i % 4 ? json::array() : json::array({{{"name", "D++"}, {"type", 0}, {"created_at", 1700000000123}}})}
+		});
+	}
+	return {{"op", 0}, {"s", 1}, {"t", "GUILD_CREATE"}, {"d", d}};
+}
+
+/**
+ * @brief Generate a message object, as found in MESSAGE_CREATE and REST responses
+ */
+json generated_message(size_t i) {
+	return {
+		{"id", std::to_string(1234567890123456789ull + i)}, {"channel_id", "825411707521728511"}, {"guild_id", "825407338755653642"},
+		{"content", "The quick brown fox jumps over the lazy dog éè \U0001F600"}, {"timestamp", "2024-01-02T03:04:05.678000+00:00"},
+		{"edited_timestamp", nullptr}, {"tts", false}, {"mention_everyone", false}, {"pinned", false}, {"type", 0}, {"flags", 0},
+		{"nonce", "1234567890123456000"}, {"mentions", json::array()}, {"mention_roles", json::array()}, {"attachments", json::array()},
+		{"embeds", json::array({{{"title", "Embed"}, {"color", 16711680}, {"fields", json::array({{{"name", "a"}, {"value", "b"}, {"inline", true}}})}}})},
+		{"author", {{"id", "189759562910400512"}, {"username", "brain"}, {"discriminator", "0"}, {"avatar", nullptr}}},
+		{"member", {{"roles", {"416737094522568706"}}, {"joined_at", "2021-03-15T14:45:31.411000+00:00"}, {"deaf", false}, {"mute", false}}},
+		{"position", -1}, {"score", 0.25}
+	};
+}
+
+/**
+ * @brief Time one backend over a set of documents and print its figures
+ */
+double measure(dpp::json_parser_backend backend, const std::string& name, const std::vector<std::string>& documents, int iterations) {
+	size_t bytes = 0, values = 0;
+	std::clock_t start = std::clock();
+	for (int i = 0; i < iterations; ++i) {
+		for (const auto& document : documents) {
+			json j = dpp::parse_json(document, backend);
+			values += j.size();
+			bytes += document.size();
+		}
+	}
+	double cpu = static_cast<double>(std::clock() - start) / CLOCKS_PER_SEC;
+	double mb = static_cast<double>(bytes) / (1024.0 * 1024.0);
+	std::cout << "  " << std::left << std::setw(9) << name
+		<< " MB/s: " << std::setw(10) << std::setprecision(4) << (cpu > 0 ? mb / cpu : 0)
+		<< " CPU ms/MB: " << std::setprecision(4) << (mb > 0 ? cpu * 1000.0 / mb : 0) << "\n";
+	return cpu;
+}
+
+int main(int argc, char** argv) {
+	int iterations = argc > 2 ? std::max(1, std::stoi(argv[2])) : 20;
+	std::vector<std::string> documents;
+	if (argc > 1) {
+		std::ifstream dump(argv[1]);
+		if (!dump) {
+			std::cerr << "Can't open " << argv[1] << "\n";
+			return 1;
+		}
+		for (std::string line; std::getline(dump, line);) {
+			if (json::accept(line)) {
+				documents.emplace_back(line);
+			}
+		}
+	} else {
+		std::cout << "No dump given, using generated payloads. Usage: " << argv[0] << " [dump, one JSON document per line] [iterations]\n";
+		documents.emplace_back(generated_guild_create(1000).dump());
+		json history = json::array();
+		for (size_t i = 0; i < 1000; ++i) {
+			json m = generated_message(i);
+			documents.emplace_back(json({{"op", 0}, {"s", i + 2}, {"t", "MESSAGE_CREATE"}, {"d", m}}).dump());
+			history.push_back(m);
+			if (history.size() == 100) {
+				/* As returned by GET /channels/{channel.id}/messages */
+				documents.emplace_back(history.dump());
+				history = json::array();
+			}
+		}
+	}
+
+	size_t total = 0;
+	for (const auto& document : documents) {
+		total += document.size();
+	}
+	std::cout << documents.size() << " documents, " << total << " bytes of JSON, " << iterations << " iterations\n";
+
+	const std::pair<dpp::json_parser_backend, std::string> backends[] = {{dpp::jpb_nlohmann, "nlohmann"}, {dpp::jpb_simdjson, "simdjson"}};
+	double baseline = 0;
+	for (const auto& [backend, name] : backends) {
+		if (!dpp::json_parser_available(backend)) {
+			std::cout << "  " << name << " not available in this build\n";
+			continue;
+		}
+		size_t mismatches = 0;
+		for (const auto& document : documents) {
+			if (dpp::parse_json(document, backend) != json::parse(document)) {
+				mismatches++;
+			}
+		}
+		if (mismatches) {
+			std::cout << "  " << name << " differs from nlohmann::json on " << mismatches << " documents\n";
+		}
+		double cpu = measure(backend, name, documents, iterations);
+		if (backend == dpp::jpb_nlohmann) {
+			baseline = cpu;
+		} else {
+			std::cout << "  speedup: " << std::setprecision(3) << (cpu > 0 ? baseline / cpu : 0) << "x\n";
+		}
+	}
+	return 0;
+}
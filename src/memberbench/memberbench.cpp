@@ -0,0 +1,173 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+/* Measures the memory used per member of a large synthetic guild.
+ *
+ * Members are generated with a plausible mix of role lists and nicknames:
+ * most have no nickname and either no roles or one of a few common sets of
+ * roles. Each member is filled from JSON by guild_member::fill_from_json, as
+ * the GUILD_MEMBERS_CHUNK handler does, and stored in guild::members. The
+ * same members are also stored the way they were before, with their own
+ * std::string nickname and std::vector of roles in a std::unordered_map.
+ * Memory is counted by replacing operator new.
+ *
+ * Usage: memberbench [members]
+ */
+
+#include <dpp/dpp.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <unordered_map>
+
+/**
+ * @brief Bytes currently allocated through operator new
+ */
+std::atomic<size_t> allocated{0};
+
+void* operator new(size_t size) {
+	/* Keep the size in front of the block so operator delete can subtract it */
+	size_t* p = static_cast<size_t*>(std::malloc(size + sizeof(std::max_align_t)));
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	*p = size;
+	allocated += size;
+	return reinterpret_cast<char*>(p) + sizeof(std::max_align_t);
+}
+
+void operator delete(void* ptr) noexcept {
+	if (ptr) {
+		size_t* p = reinterpret_cast<size_t*>(static_cast<char*>(ptr) - sizeof(std::max_align_t));
+		allocated -= *p;
+		std::free(p);
+	}
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+	operator delete(ptr);
+}
+
+/**
+ * @brief A member as guild_member stored it before nicknames and roles were interned
+ */
+struct legacy_member {
+	std::string nickname;
+	std::vector<dpp::snowflake> roles;
+	uint16_t flags{0};
+	dpp::snowflake guild_id;
+	dpp::snowflake user_id;
+	dpp::utility::iconhash avatar;
+	time_t communication_disabled_until{0};
+	time_t joined_at{0};
+	time_t premium_since{0};
+};
+
+int main(int argc, char const *argv[]) {
+	size_t count = argc > 1 ? std::stoul(argv[1]) : 1000000;
+	std::mt19937_64 rng(42);
+	dpp::snowflake guild_id = 825407338755653642ULL;
+
+	/* 250 roles, of which 30 sets of one to three are common */
+	std::vector<std::string> roles;
+	for (size_t i = 0; i < 250; ++i) {
+		roles.push_back(std::to_string(825407338755653642ULL + (i + 1) * 4194304ULL));
+	}
+	std::vector<std::vector<std::string>> common_sets(30);
+	for (auto& set : common_sets) {
+		for (size_t n = rng() % 3 + 1; n; --n) {
+			set.push_back(roles[rng() % 20]);
+		}
+	}
+	std::vector<std::string> common_nicks;
+	for (size_t i = 0; i < 1000; ++i) {
+		common_nicks.push_back("Nick" + std::to_string(i));
+	}
+
+	size_t before = allocated;
+	{
+		dpp::guild g;
+		g.id = guild_id;
+		std::unordered_map<dpp::snowflake, legacy_member> legacy;
+		size_t legacy_bytes = 0, member_bytes = 0;
+
+		for (size_t i = 0; i < count; ++i) {
+			dpp::snowflake user_id = 200000000000000000ULL + i * 4194304ULL + rng() % 4096;
+			dpp::json j = {
+				{"user", {{"id", std::to_string(user_id)}}},
+				{"joined_at", "2021-03-26T12:34:56.789000+00:00"},
+				{"deaf", false},
+				{"mute", false},
+				{"flags", 0},
+			};
+			uint64_t r = rng() % 100;
+			if (r < 40) {
+				j["roles"] = dpp::json::array();
+			} else if (r < 85) {
+				j["roles"] = common_sets[rng() % common_sets.size()];
+			} else {
+				std::vector<std::string> own;
+				for (size_t n = rng() % 5 + 1; n; --n) {
+					own.push_back(roles[rng() % roles.size()]);
+				}
+				j["roles"] = own;
+			}
+			uint64_t n = rng() % 100;
+			if (n < 10) {
+				j["nick"] = common_nicks[rng() % common_nicks.size()];
+			} else if (n < 20) {
+				j["nick"] = "A rather longer nickname " + std::to_string(rng());
+			}
+
+			dpp::guild_member gm;
+			gm.fill_from_json(&j, guild_id, user_id);
+
+			size_t mark = allocated;
+			legacy_member& lm = legacy[user_id];
+			lm.nickname = gm.get_nickname();
+			lm.roles = gm.get_roles();
+			lm.guild_id = gm.guild_id;
+			lm.user_id = gm.user_id;
+			lm.avatar = gm.avatar;
+			lm.joined_at = gm.joined_at;
+			legacy_bytes += allocated - mark;
+
+			mark = allocated;
+			g.members[user_id] = gm;
+			/* The temporary member's handles still count here, and are given back as it goes */
+			member_bytes += allocated - mark;
+		}
+
+		std::cout << std::fixed << std::setprecision(1);
+		std::cout << count << " members, " << dpp::interned<std::vector<dpp::snowflake>, dpp::snowflake_list_hash>::pool_size() << " distinct role lists, "
+			<< dpp::interned<std::string>::pool_size() << " distinct nicknames\n";
+		std::cout << "sizeof(legacy member) " << sizeof(legacy_member) << ", sizeof(dpp::guild_member) " << sizeof(dpp::guild_member) << "\n";
+		std::cout << "before: std::unordered_map, std::string and std::vector  " << static_cast<double>(legacy_bytes) / count << " bytes/member\n";
+		std::cout << "after:  guild::members, interned nickname and roles      " << static_cast<double>(member_bytes) / count << " bytes/member\n";
+	}
+	std::cout << "still allocated after both are freed (pool buckets and generated roles): " << allocated - before << " bytes\n";
+	return 0;
+}
@@ -0,0 +1,298 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+/* Measures REST request latency against a local HTTP server which injects slow
+ * responses, with a stream of small requests mixed with slow requests and large
+ * uploads. Small request latency, from posting the request to its completion
+ * callback, is reported as p50/p99 for:
+ *
+ *  - dpp::request_queue, where requests are made on the queue's socket engine
+ *    and many may be in flight on each request thread, and
+ *  - a baseline of blocking http_request::run() calls, one at a time on each
+ *    thread, which is how the request threads used to make requests.
+ */
+
+#include <dpp/dpp.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+/**
+ * @brief A keep-alive HTTP/1.1 server on the loopback interface, one thread per connection.
+ * Paths starting /slow/ are answered after a delay.
+ */
+class slow_server {
+	int listener{-1};
+	std::atomic<bool> running{true};
+	std::thread acceptor;
+	std::mutex conn_mutex;
+	std::vector<std::thread> connections;
+	std::vector<int> sockets;
+	int delay_ms;
+
+	void serve(int c) {
+		std::string in;
+		char buf[65536];
+		while (running) {
+			size_t end = in.find("\r\n\r\n");
+			if (end == std::string::npos) {
+				ssize_t n = ::recv(c, buf, sizeof(buf), 0);
+				if (n <= 0) {
+					break;
+				}
+				in.append(buf, n);
+				continue;
+			}
+			size_t length = 0;
+			size_t cl = in.find("Content-Length: ");
+			if (cl != std::string::npos && cl < end) {
+				length = std::stoull(in.substr(cl + 16));
+			}
+			while (in.length() < end + 4 + length) {
+				ssize_t n = ::recv(c, buf, sizeof(buf), 0);
+				if (n <= 0) {
+					::close(c);
+					return;
+				}
+				in.append(buf, n);
+			}
+			std::string path = in.substr(in.find(' ') + 1);
+			path = path.substr(0, path.find(' '));
+			in.erase(0, end + 4 + length);
+			if (path.rfind("/slow/", 0) == 0) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+			}
+			std::string body = "{\"received\":" + std::to_string(length) + "}";
+			std::string out = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.length()) + "\r\nConnection: keep-alive\r\n\r\n" + body;
+			if (::send(c, out.data(), out.length(), MSG_NOSIGNAL) <= 0) {
+				break;
+			}
+		}
+		::close(c);
+	}
+
+public:
+	uint16_t port{0};
+
+	slow_server(int slow_ms) : delay_ms(slow_ms) {
+		listener = ::socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in addr{};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t addr_len = sizeof(addr);
+		if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(listener, 256) != 0 || ::getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &addr_len) != 0) {
+			throw std::runtime_error("Can't listen on the loopback interface");
+		}
+		port = ntohs(addr.sin_port);
+		acceptor = std::thread([this]() {
+			while (running) {
+				int c = ::accept(listener, nullptr, nullptr);
+				if (c < 0) {
+					break;
+				}
+				std::scoped_lock lock(conn_mutex);
+				sockets.push_back(c);
+				connections.emplace_back([this, c]() { serve(c); });
+			}
+		});
+	}
+
+	~slow_server() {
+		running = false;
+		::shutdown(listener, SHUT_RDWR);
+		::close(listener);
+		acceptor.join();
+		std::scoped_lock lock(conn_mutex);
+		for (int c : sockets) {
+			::shutdown(c, SHUT_RDWR);
+		}
+		for (auto& t : connections) {
+			t.join();
+		}
+	}
+};
+
+/**
+ * @brief One request in the workload
+ */
+struct job {
+	std::string url;
+	std::string body;
+	bool small;
+};
+
+/**
+ * @brief Build the workload: mostly small GETs, every 8th request slow, every 20th a large upload
+ */
+std::vector<job> make_workload(const std::string& base, size_t count, size_t upload_bytes) {
+	std::vector<job> jobs;
+	const std::string upload(upload_bytes, 'x');
+	for (size_t i = 0; i < count; ++i) {
+		if (i % 20 == 10) {
+			jobs.push_back({base + "/upload/" + std::to_string(i % 4), upload, false});
+		} else if (i % 8 == 3) {
+			jobs.push_back({base + "/slow/" + std::to_string(i % 4), "", false});
+		} else {
+			jobs.push_back({base + "/small/" + std::to_string(i % 16), "", true});
+		}
+	}
+	return jobs;
+}
+
+/**
+ * @brief Latency figures for small requests
+ */
+void report(const std::string& name, std::vector<double> latencies, size_t errors, double wall) {
+	std::sort(latencies.begin(), latencies.end());
+	auto pct = [&](double p) {
+		return latencies.empty() ? 0 : latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))] * 1000.0;
+	};
+	std::cout << "  " << std::left << std::setw(14) << name << std::fixed << std::setprecision(1)
+		<< " p50 ms: " << std::setw(8) << pct(0.50)
+		<< " p99 ms: " << std::setw(8) << pct(0.99)
+		<< " max ms: " << std::setw(8) << (latencies.empty() ? 0 : latencies.back() * 1000.0)
+		<< " errors: " << std::setw(4) << errors
+		<< " wall s: " << std::setprecision(2) << wall << "\n";
+}
+
+/**
+ * @brief Post the workload to a dpp::request_queue at a steady rate
+ */
+void run_queue(dpp::cluster& owner, const std::vector<job>& jobs, uint32_t threads, int interval_ms) {
+	std::mutex m;
+	std::vector<double> latencies;
+	size_t errors = 0, done = 0;
+	std::promise<void> all_done;
+	double start = dpp::utility::time_f();
+	{
+		dpp::request_queue queue(&owner, threads);
+		for (const auto& j : jobs) {
+			double posted = dpp::utility::time_f();
+			bool small = j.small;
+			queue.post_request(std::make_unique<dpp::http_request>(j.url, [&, posted, small](const dpp::http_request_completion_t& rv) {
+				double taken = dpp::utility::time_f() - posted;
+				std::scoped_lock lock(m);
+				if (rv.error != dpp::h_success || rv.status != 200) {
+					errors++;
+				} else if (small) {
+					latencies.push_back(taken);
+				}
+				if (++done == jobs.size()) {
+					all_done.set_value();
+				}
+			}, j.body.empty() ? dpp::m_get : dpp::m_post, j.body, "application/octet-stream"));
+			std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+		}
+		all_done.get_future().wait();
+	}
+	report("request_queue", latencies, errors, dpp::utility::time_f() - start);
+}
+
+/**
+ * @brief Run the workload as blocking requests, one at a time per thread, with
+ * requests hashed to threads by URL as the request threads used to do
+ */
+void run_blocking(dpp::cluster& owner, const std::vector<job>& jobs, uint32_t threads, int interval_ms) {
+	dpp::request_queue pool_owner(&owner, 1);
+	std::mutex m;
+	std::condition_variable cv;
+	std::vector<std::deque<std::pair<const job*, double>>> queues(threads);
+	std::vector<double> latencies;
+	size_t errors = 0;
+	bool posting = true;
+	double start = dpp::utility::time_f();
+	std::vector<std::thread> workers;
+	for (uint32_t t = 0; t < threads; ++t) {
+		workers.emplace_back([&, t]() {
+			while (true) {
+				std::pair<const job*, double> next;
+				{
+					std::unique_lock lock(m);
+					cv.wait(lock, [&]() { return !queues[t].empty() || !posting; });
+					if (queues[t].empty()) {
+						return;
+					}
+					next = queues[t].front();
+					queues[t].pop_front();
+				}
+				const job& j = *next.first;
+				dpp::http_request req(j.url, nullptr, j.body.empty() ? dpp::m_get : dpp::m_post, j.body, "application/octet-stream");
+				dpp::http_request_completion_t rv = req.run(&pool_owner, &owner);
+				double taken = dpp::utility::time_f() - next.second;
+				std::scoped_lock lock(m);
+				if (rv.error != dpp::h_success || rv.status != 200) {
+					errors++;
+				} else if (j.small) {
+					latencies.push_back(taken);
+				}
+			}
+		});
+	}
+	for (const auto& j : jobs) {
+		{
+			std::scoped_lock lock(m);
+			queues[std::hash<std::string>()(j.url) % threads].emplace_back(&j, dpp::utility::time_f());
+		}
+		cv.notify_all();
+		std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+	}
+	{
+		std::scoped_lock lock(m);
+		posting = false;
+	}
+	cv.notify_all();
+	for (auto& w : workers) {
+		w.join();
+	}
+	report("blocking run()", latencies, errors, dpp::utility::time_f() - start);
+}
+
+int main(int argc, char** argv) {
+	size_t count = argc > 1 ? std::stoull(argv[1]) : 400;
+	int slow_ms = argc > 2 ? std::stoi(argv[2]) : 250;
+	size_t upload_bytes = argc > 3 ? std::stoull(argv[3]) : 8 * 1024 * 1024;
+	uint32_t threads = 2;
+	int interval_ms = 5;
+
+	slow_server server(slow_ms);
+	dpp::cluster owner("");
+	const std::string base = "http://127.0.0.1:" + std::to_string(server.port);
+	std::vector<job> jobs = make_workload(base, count, upload_bytes);
+
+	std::cout << count << " requests, one every " << interval_ms << "ms on " << threads << " request threads: "
+		<< "every 8th delayed " << slow_ms << "ms, every 20th a " << upload_bytes / 1024 << "KB upload. "
+		<< "Usage: " << argv[0] << " [requests] [slow ms] [upload bytes]\n";
+	std::cout << "Small request latency, from posting to completion:\n";
+	run_blocking(owner, jobs, threads, interval_ms);
+	run_queue(owner, jobs, threads, interval_ms);
+	return 0;
+}
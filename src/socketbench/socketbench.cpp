@@ -0,0 +1,310 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+/* Compares the shared socket engines with the thread per connection model they replaced.
+ *
+ * Many loopback TCP connections are opened, and a writer thread sends small messages
+ * down each in turn, as a gateway sends events to shards. The receiving ends are read
+ * either by one thread per connection, each in its own poll() loop with a one second
+ * timeout as ssl_client::read_loop() used to run, or by a few dpp::socket_engine_base
+ * threads shared by all of them. For each, the number of threads, the time and CPU
+ * taken to deliver every message, and the CPU used while the connections sit idle
+ * are reported.
+ *
+ * Usage: socketbench [connections] [messages per connection] [engine threads]
+ */
+
+#include <dpp/dpp.h>
+#include <dpp/socketengine.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <future>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <algorithm>
+#ifndef _WIN32
+	#include <sys/socket.h>
+	#include <sys/resource.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <unistd.h>
+	#include <poll.h>
+#endif
+
+#ifndef _WIN32
+using bench_clock = std::chrono::steady_clock;
+
+/**
+ * @brief Size of each message, about that of a small gateway event
+ */
+constexpr size_t message_size = 256;
+
+/**
+ * @brief Loopback connections; the writer sends on one end, the code under test reads the other
+ */
+struct connection_pair {
+	int writer{-1};
+	int reader{-1};
+};
+
+/**
+ * @brief CPU time used by the whole process so far, user and system, in seconds
+ */
+double cpu_seconds() {
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+}
+
+/**
+ * @brief Number of threads in the process, from /proc
+ */
+size_t thread_count() {
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line)) {
+		if (line.rfind("Threads:", 0) == 0) {
+			return std::stoul(line.substr(8));
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Open loopback TCP connections
+ * @param count number of connections
+ * @return connections, fewer than asked for if the process ran out of descriptors
+ */
+std::vector<connection_pair> open_connections(size_t count) {
+	std::vector<connection_pair> pairs;
+	int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addr_len = sizeof(addr);
+	if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(listener, 1024) != 0 || ::getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &addr_len) != 0) {
+		return pairs;
+	}
+	const int one = 1;
+	for (size_t i = 0; i < count; ++i) {
+		connection_pair p;
+		p.writer = ::socket(AF_INET, SOCK_STREAM, 0);
+		if (p.writer < 0 || ::connect(p.writer, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+			::close(p.writer);
+			break;
+		}
+		p.reader = ::accept(listener, nullptr, nullptr);
+		if (p.reader < 0) {
+			::close(p.writer);
+			break;
+		}
+		setsockopt(p.writer, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		dpp::set_nonblocking(p.reader, true);
+		pairs.push_back(p);
+	}
+	::close(listener);
+	return pairs;
+}
+
+/**
+ * @brief Read everything waiting on a non-blocking socket
+ * @return bytes read
+ */
+size_t drain(int fd) {
+	char buf[16384];
+	size_t total = 0;
+	ssize_t n;
+	while ((n = ::recv(fd, buf, sizeof(buf), 0)) > 0) {
+		total += n;
+	}
+	return total;
+}
+
+/**
+ * @brief Readers under test
+ */
+class readers {
+public:
+	virtual ~readers() = default;
+
+	/**
+	 * @brief Name of the model
+	 */
+	virtual std::string name() const = 0;
+};
+
+/**
+ * @brief One thread per connection, each polling its own socket with a one second
+ * timeout, as shards did before the socket engine
+ */
+class thread_per_connection : public readers {
+	std::atomic<bool> running{true};
+	std::vector<std::thread> threads;
+public:
+	thread_per_connection(const std::vector<connection_pair>& pairs, std::atomic<uint64_t>& received) {
+		threads.reserve(pairs.size());
+		for (const connection_pair& p : pairs) {
+			threads.emplace_back([this, fd = p.reader, &received]() {
+				while (running) {
+					pollfd pfd{fd, POLLIN, 0};
+					if (::poll(&pfd, 1, 1000) > 0 && (pfd.revents & POLLIN)) {
+						received += drain(fd);
+					}
+				}
+			});
+		}
+	}
+
+	~thread_per_connection() override {
+		running = false;
+		for (auto& t : threads) {
+			t.join();
+		}
+	}
+
+	std::string name() const override {
+		return "thread per connection";
+	}
+};
+
+/**
+ * @brief A few socket engines, with the connections spread across them round robin
+ * as the cluster spreads its shards
+ */
+class shared_engines : public readers {
+	std::vector<std::unique_ptr<dpp::socket_engine_base>> engines;
+	std::vector<std::pair<dpp::socket_engine_base*, int>> registered;
+public:
+	shared_engines(const std::vector<connection_pair>& pairs, size_t engine_count, std::atomic<uint64_t>& received) {
+		for (size_t i = 0; i < engine_count; ++i) {
+			engines.emplace_back(dpp::create_socket_engine());
+			engines.back()->start("bench/sockets");
+		}
+		for (size_t i = 0; i < pairs.size(); ++i) {
+			dpp::socket_engine_base* e = engines[i % engines.size()].get();
+			e->register_socket(dpp::socket_events(pairs[i].reader, dpp::WANT_READ | dpp::WANT_ERROR, [&received](dpp::socket fd, const dpp::socket_events&) {
+				received += drain(fd);
+			}));
+			registered.emplace_back(e, pairs[i].reader);
+		}
+	}
+
+	~shared_engines() override {
+		for (auto& [e, fd] : registered) {
+			e->remove_socket(fd);
+		}
+		for (auto& e : engines) {
+			e->stop();
+		}
+	}
+
+	std::string name() const override {
+		return std::to_string(engines.size()) + " shared engine" + (engines.size() == 1 ? "" : "s");
+	}
+};
+
+/**
+ * @brief Deliver messages through one model and report on it
+ */
+void run(const std::vector<connection_pair>& pairs, size_t messages, size_t engine_count, bool shared) {
+	std::atomic<uint64_t> received{0};
+	size_t threads_before = thread_count();
+	std::unique_ptr<readers> under_test;
+	if (shared) {
+		under_test = std::make_unique<shared_engines>(pairs, engine_count, received);
+	} else {
+		under_test = std::make_unique<thread_per_connection>(pairs, received);
+	}
+	/* Let every reader reach its first wait */
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	size_t threads = thread_count() - threads_before;
+
+	const uint64_t expected = static_cast<uint64_t>(pairs.size()) * messages * message_size;
+	const std::string message(message_size, 'x');
+	double cpu_start = cpu_seconds();
+	auto start = bench_clock::now();
+	for (size_t m = 0; m < messages; ++m) {
+		for (const connection_pair& p : pairs) {
+			[[maybe_unused]] auto n = ::send(p.writer, message.data(), message.length(), MSG_NOSIGNAL);
+		}
+	}
+	while (received < expected && bench_clock::now() - start < std::chrono::seconds(60)) {
+		std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+	double wall = std::chrono::duration<double>(bench_clock::now() - start).count();
+	double cpu = cpu_seconds() - cpu_start;
+
+	/* Idle, as shards are between events */
+	double idle_start = cpu_seconds();
+	std::this_thread::sleep_for(std::chrono::seconds(2));
+	double idle = (cpu_seconds() - idle_start) / 2;
+
+	std::cout << std::left << std::setw(24) << under_test->name() << std::right
+		<< std::setw(9) << threads
+		<< std::setw(10) << std::fixed << std::setprecision(1) << wall * 1000.0
+		<< std::setw(10) << cpu * 1000.0
+		<< std::setw(11) << std::setprecision(2) << cpu * 1000000.0 / std::max<size_t>(pairs.size() * messages, 1)
+		<< std::setw(15) << idle * 1000.0
+		<< (received < expected ? "  (incomplete)" : "") << "\n";
+	under_test.reset();
+}
+
+int main(int argc, char const *argv[]) {
+	size_t count = argc > 1 ? std::stoul(argv[1]) : 1000;
+	size_t messages = argc > 2 ? std::stoul(argv[2]) : 100;
+	size_t engine_count = argc > 3 ? std::stoul(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+
+	/* Two descriptors per connection, plus headroom for the engines */
+	rlimit limit{};
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	std::vector<connection_pair> pairs = open_connections(count);
+	if (pairs.size() < count) {
+		std::cout << "Only " << pairs.size() << " of " << count << " connections could be opened\n";
+	}
+	std::cout << pairs.size() << " loopback connections, " << messages << " messages of " << message_size << " bytes each, "
+		<< std::thread::hardware_concurrency() << " cores\n\n";
+	std::cout << std::left << std::setw(24) << "model" << std::right << std::setw(9) << "threads" << std::setw(10) << "wall ms"
+		<< std::setw(10) << "cpu ms" << std::setw(11) << "cpu us/msg" << std::setw(15) << "idle cpu ms/s" << "\n";
+
+	run(pairs, messages, engine_count, false);
+	run(pairs, messages, engine_count, true);
+
+	for (const connection_pair& p : pairs) {
+		::close(p.writer);
+		::close(p.reader);
+	}
+	return 0;
+}
+#else
+int main() {
+	std::cout << "socketbench measures loopback TCP connections with POSIX APIs, and does not run on Windows\n";
+	return 0;
+}
+#endif
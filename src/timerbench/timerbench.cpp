@@ -0,0 +1,127 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+
+/* Measures dpp::timer_wheel with a million active timers.
+ *
+ * The first pass drives a wheel by hand, so the cost of adding, cancelling
+ * and firing timers is measured without any waiting. The second pass uses
+ * the wheel's own driver thread and reports how late timers fire compared
+ * to when they were due.
+ *
+ * Usage: timerbench [timer count]
+ */
+
+#include <dpp/dpp.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+using bench_clock = std::chrono::steady_clock;
+
+/**
+ * @brief Nanoseconds per operation between two points in time
+ */
+double ns_per(bench_clock::time_point start, bench_clock::time_point end, size_t count) {
+	return std::chrono::duration<double, std::nano>(end - start).count() / std::max<size_t>(count, 1);
+}
+
+int main(int argc, char const *argv[]) {
+	size_t count = argc > 1 ? std::stoul(argv[1]) : 1000000;
+	std::mt19937_64 rng(42);
+	std::cout << std::fixed << std::setprecision(1);
+
+	{
+		/* Timers due from 1ms to ten minutes out, a quarter of them cancelled before they fire */
+		dpp::timer_wheel wheel(false);
+		std::uniform_int_distribution<int64_t> delays(1, 600000);
+		std::vector<dpp::timer> handles;
+		handles.reserve(count);
+		size_t fired = 0;
+
+		auto start = bench_clock::now();
+		for (size_t i = 0; i < count; ++i) {
+			handles.push_back(wheel.add(std::chrono::milliseconds(delays(rng)), std::chrono::milliseconds(0), [&fired](dpp::timer) {
+				fired++;
+			}));
+		}
+		auto added = bench_clock::now();
+
+		std::shuffle(handles.begin(), handles.end(), rng);
+		size_t cancelled = 0;
+		for (size_t i = 0; i < count / 4; ++i) {
+			cancelled += wheel.cancel(handles[i]) ? 1 : 0;
+		}
+		auto cancel_done = bench_clock::now();
+
+		for (int64_t now = 0; now <= 600000; now += 10) {
+			wheel.advance(std::chrono::milliseconds(now));
+		}
+		auto fired_done = bench_clock::now();
+
+		std::cout << "Manually driven wheel, " << count << " timers over 10 minutes\n";
+		std::cout << "  add:    " << ns_per(start, added, count) << " ns/timer\n";
+		std::cout << "  cancel: " << ns_per(added, cancel_done, cancelled) << " ns/timer (" << cancelled << " cancelled)\n";
+		std::cout << "  fire:   " << ns_per(cancel_done, fired_done, fired) << " ns/timer (" << fired << " fired, " << wheel.size() << " left)\n";
+	}
+
+	{
+		/* A million timers due 5 to 15 seconds after they are added, on the driver thread, recording how late each one is */
+		dpp::timer_wheel wheel;
+		std::uniform_int_distribution<int64_t> delays(5000, 15000);
+		std::vector<double> lateness;
+		lateness.reserve(count);
+		std::mutex lateness_mutex;
+		std::atomic<size_t> fired{0};
+		auto start = bench_clock::now();
+		for (size_t i = 0; i < count; ++i) {
+			std::chrono::milliseconds delay(delays(rng));
+			auto due = bench_clock::now() + delay;
+			wheel.add(delay, std::chrono::milliseconds(0), [&, due](dpp::timer) {
+				std::lock_guard lock(lateness_mutex);
+				lateness.push_back(std::chrono::duration<double, std::milli>(bench_clock::now() - due).count());
+				fired++;
+			});
+		}
+		auto added = bench_clock::now();
+		while (fired < count && bench_clock::now() - added < std::chrono::seconds(60)) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		}
+
+		std::lock_guard lock(lateness_mutex);
+		std::sort(lateness.begin(), lateness.end());
+		auto percentile = [&lateness](double p) {
+			return lateness.empty() ? 0.0 : lateness[std::min(lateness.size() - 1, static_cast<size_t>(p * lateness.size()))];
+		};
+		std::cout << "Threaded wheel, " << count << " timers due within 15 seconds\n";
+		std::cout << "  add:    " << ns_per(start, added, count) << " ns/timer\n";
+		std::cout << "  fired:  " << fired << "\n";
+		std::cout << std::setprecision(2);
+		std::cout << "  late:   p50 " << percentile(0.5) << " ms, p99 " << percentile(0.99) << " ms, max " << percentile(1.0) << " ms\n";
+	}
+	return 0;
+}
@@ -20,11 +20,22 @@
  *
  ************************************************************************************/
 #include "test.h"
+#include "tlsserver.h"
 
 #include <dpp/dpp.h>
 #include <dpp/unicode_emoji.h>
 #include <dpp/restrequest.h>
 #include <dpp/json.h>
+#include <dpp/socketengine.h>
+#include <dpp/etf.h>
+#include <future>
+#include <random>
+#ifndef _WIN32
+	#include <sys/socket.h>
+	#include <netinet/in.h>
+	#include <unistd.h>
+	#include <poll.h>
+#endif
 
 /**
  * @brief Type trait to check if a certain type has a build_json method
@@ -339,6 +350,1348 @@ Markdown lol \\|\\|spoiler\\|\\| \\~\\~strikethrough\\~\\~ \\`small \\*code\\* b
 	fclose(fp);
 	set_test(READFILE, off == rf_test.length());
 
+	set_test(SOCKETENGINE, false);
+	{
+		std::unique_ptr<dpp::socket_engine_base> engine = dpp::create_socket_engine();
+		engine->start("test/sockets");
+		std::atomic<bool> ran_on_engine{false};
+		engine->run_sync([&]() {
+			ran_on_engine = engine->on_engine_thread();
+		});
+#ifndef _WIN32
+		int pair[2]{-1, -1};
+		std::promise<std::string> received;
+		bool registered = false;
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0) {
+			registered = engine->register_socket(dpp::socket_events(pair[0], dpp::WANT_READ | dpp::WANT_ERROR, [&](dpp::socket fd, const dpp::socket_events& e) {
+				char buf[32]{};
+				auto r = ::read(fd, buf, sizeof(buf) - 1);
+				engine->remove_socket(fd);
+				received.set_value(std::string(buf, r > 0 ? r : 0));
+			}));
+			[[maybe_unused]] auto w = ::write(pair[1], "ping", 4);
+		}
+		auto f = received.get_future();
+		bool read_ok = registered && f.wait_for(std::chrono::seconds(5)) == std::future_status::ready && f.get() == "ping";
+		engine->stop();
+		engine.reset();
+		::close(pair[0]);
+		::close(pair[1]);
+#else
+		bool read_ok = true;
+		engine->stop();
+		engine.reset();
+#endif
+		set_test(SOCKETENGINE, ran_on_engine && read_ok);
+	}
+
+	set_test(CONNECTIONPOOL, false);
+	{
+		dpp::connection_pool pool(1, 60);
+		const std::string key = dpp::connection_pool::make_key("localhost", "80", true);
+		bool miss_ok = pool.acquire(key) == nullptr;
+#ifndef _WIN32
+		int first[2]{-1, -1}, second[2]{-1, -1}, third[2]{-1, -1};
+		bool pairs_ok = socketpair(AF_UNIX, SOCK_STREAM, 0, first) == 0 && socketpair(AF_UNIX, SOCK_STREAM, 0, second) == 0 &&
+			socketpair(AF_UNIX, SOCK_STREAM, 0, third) == 0;
+		auto make_conn = [](int fd) {
+			auto c = std::make_unique<dpp::pooled_connection>();
+			c->sfd = fd;
+			c->created = time(nullptr);
+			return c;
+		};
+		/* Only one idle connection per host is kept, so the first is evicted */
+		pool.release(key, make_conn(first[0]));
+		pool.release(key, make_conn(second[0]));
+		auto reused = pool.acquire(key);
+		bool hit_ok = pairs_ok && reused && reused->sfd == second[0];
+		/* A connection closed by the other side fails its health check */
+		pool.release(key, std::move(reused));
+		::close(second[1]);
+		bool dead_ok = pool.acquire(key) == nullptr;
+		/* A healthy connection past the maximum age is closed rather than kept */
+		auto old = make_conn(third[0]);
+		old->created -= 600;
+		pool.release(key, std::move(old));
+		bool age_ok = pool.acquire(key) == nullptr;
+		::close(first[1]);
+		::close(third[1]);
+		dpp::connection_pool_stats stats = pool.get_stats();
+		set_test(CONNECTIONPOOL, miss_ok && hit_ok && dead_ok && age_ok && stats.hits == 1 && stats.misses == 3 && stats.evictions == 3 && stats.idle == 0);
+#else
+		set_test(CONNECTIONPOOL, miss_ok);
+#endif
+	}
+
+	set_test(DNSCACHE, false);
+	{
+		auto lookups = std::make_shared<std::atomic<int>>(0);
+		auto make_address = [](int family, const char* text) {
+			dpp::dns_address a;
+			a.family = family;
+			a.text = text;
+			if (family == AF_INET6) {
+				a.length = sizeof(sockaddr_in6);
+				reinterpret_cast<sockaddr_in6*>(&a.address)->sin6_family = AF_INET6;
+				inet_pton(AF_INET6, text, &reinterpret_cast<sockaddr_in6*>(&a.address)->sin6_addr);
+			} else {
+				a.length = sizeof(sockaddr_in);
+				reinterpret_cast<sockaddr_in*>(&a.address)->sin_family = AF_INET;
+				inet_pton(AF_INET, text, &reinterpret_cast<sockaddr_in*>(&a.address)->sin_addr);
+			}
+			return a;
+		};
+		auto failing = std::make_shared<std::atomic<bool>>(false);
+		dpp::set_dns_resolver([lookups, failing, make_address](const std::string& hostname, const std::string& port) {
+			(*lookups)++;
+			if (*failing) {
+				throw dpp::connection_exception(dpp::err_connect_failure, "stub lookup failure");
+			}
+			return std::vector<dpp::dns_address>{ make_address(AF_INET, "127.0.0.2"), make_address(AF_INET, "127.0.0.3"), make_address(AF_INET6, "::1") };
+		});
+		dpp::dns_cache_entry_ptr first = dpp::resolve_hostname("stub.invalid", "443");
+		bool order_ok = first->addresses.size() == 3 && first->resolved_addr == "127.0.0.2" && first->addresses.back().family == AF_INET6;
+		sockaddr_storage with_port = first->addresses.front().with_port(443);
+		bool port_ok = ntohs(reinterpret_cast<sockaddr_in*>(&with_port)->sin_port) == 443;
+		/* A failed address goes to the back, without changing entries already handed out */
+		dpp::dns_address_failed("stub.invalid", "127.0.0.2");
+		dpp::dns_cache_entry_ptr second = dpp::resolve_hostname("stub.invalid", "443");
+		bool failover_ok = second->resolved_addr == "127.0.0.3" && second->addresses.back().text == "127.0.0.2" && first->resolved_addr == "127.0.0.2";
+		/* Entries due a refresh are still returned, and refreshed in the background. With a
+		 * one second lifetime an entry is due a refresh at once and expires a second later,
+		 * so start just after a second boundary.
+		 */
+		dpp::set_dns_cache_ttl(1);
+		for (time_t start = time(nullptr); time(nullptr) == start;) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		std::promise<dpp::dns_cache_entry_ptr> async_done;
+		dpp::resolve_hostname_async("async.invalid", "443", [&async_done](dpp::dns_cache_entry_ptr entry, const std::string& error) {
+			async_done.set_value(error.empty() ? entry : nullptr);
+		});
+		dpp::dns_cache_entry_ptr async_entry = async_done.get_future().get();
+		bool async_ok = async_entry != nullptr;
+		bool stale_ok = async_ok && dpp::resolve_hostname("async.invalid", "443") == async_entry;
+		for (int i = 0; i < 100 && *lookups < 3; ++i) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		}
+		bool refresh_ok = *lookups >= 3;
+		/* Expired entries are never returned; with the resolver failing, the lookup fails */
+		dpp::set_dns_cache_ttl(0);
+		bool expired_ok = dpp::resolve_hostname("expire.invalid", "443") != nullptr;
+		*failing = true;
+		try {
+			(void)dpp::resolve_hostname("expire.invalid", "443");
+			expired_ok = false;
+		}
+		catch (const dpp::connection_exception&) {
+		}
+		dpp::set_dns_cache_ttl(3600);
+		dpp::set_dns_resolver({});
+		set_test(DNSCACHE, order_ok && port_ok && failover_ok && async_ok && stale_ok && refresh_ok && expired_ok);
+	}
+
+	set_test(ADDRFAILOVER, false);
+#ifndef _WIN32
+	{
+		/* Only 127.0.0.1 listens, so connections to 127.0.0.2 on the same port are refused */
+		mock_server mock([](const std::string&) {
+			return std::string();
+		});
+		const std::string port = std::to_string(mock.get_port());
+		auto make_address = [](const char* text) {
+			dpp::dns_address a;
+			a.text = text;
+			a.length = sizeof(sockaddr_in);
+			reinterpret_cast<sockaddr_in*>(&a.address)->sin_family = AF_INET;
+			inet_pton(AF_INET, text, &reinterpret_cast<sockaddr_in*>(&a.address)->sin_addr);
+			return a;
+		};
+		dpp::set_dns_resolver([make_address](const std::string& hostname, const std::string&) {
+			if (hostname == "dead.invalid") {
+				return std::vector<dpp::dns_address>{ make_address("127.0.0.2"), make_address("127.0.0.3") };
+			}
+			return std::vector<dpp::dns_address>{ make_address("127.0.0.2"), make_address("127.0.0.1") };
+		});
+		/* Blocking connect moves past the refused address, and the cache then prefers the live one */
+		bool blocking_ok = false;
+		try {
+			dpp::ssl_client client("blocking.invalid", port, true);
+			blocking_ok = dpp::resolve_hostname("blocking.invalid", port)->resolved_addr == "127.0.0.1";
+		}
+		catch (const dpp::connection_exception&) {
+		}
+		bool dead_ok = false;
+		try {
+			dpp::ssl_client client("dead.invalid", port, true);
+		}
+		catch (const dpp::connection_exception&) {
+			dead_ok = true;
+		}
+		/* The asynchronous connect tries the next address within the same attempt */
+		std::unique_ptr<dpp::socket_engine_base> engine = dpp::create_socket_engine();
+		engine->start("test/failover");
+		std::promise<bool> connected;
+		dpp::ssl_client async_client("async.failover.invalid", port, true, false, nullptr, false);
+		async_client.connect_async(engine.get(), [&connected](bool success, const std::string&) {
+			connected.set_value(success);
+		});
+		auto f = connected.get_future();
+		bool async_ok = f.wait_for(std::chrono::seconds(5)) == std::future_status::ready && f.get();
+		async_client.detach_engine();
+		engine->stop();
+		engine.reset();
+		dpp::set_dns_resolver({});
+		set_test(ADDRFAILOVER, mock.is_listening() && blocking_ok && dead_ok && async_ok);
+	}
+#else
+	set_test(ADDRFAILOVER, true);
+#endif
+
+	set_test(TLSRESUME, false);
+#ifndef _WIN32
+	{
+		/* The third connection is dropped before its handshake, failing it */
+		mock_server mock([](int listener, const std::atomic<bool>& listening) {
+			serve_tls(listener, listening, 3);
+		});
+		const std::string port = std::to_string(mock.get_port());
+		dpp::set_dns_resolver([](const std::string&, const std::string&) {
+			dpp::dns_address a;
+			a.text = "127.0.0.1";
+			a.length = sizeof(sockaddr_in);
+			reinterpret_cast<sockaddr_in*>(&a.address)->sin_family = AF_INET;
+			inet_pton(AF_INET, "127.0.0.1", &reinterpret_cast<sockaddr_in*>(&a.address)->sin_addr);
+			return std::vector<dpp::dns_address>{ a };
+		});
+		dpp::tls_handshake_stats before = dpp::get_tls_handshake_stats();
+		/* Any client connecting to the same host name may resume the session of an earlier one */
+		auto connect = [&port]() {
+			dpp::ssl_client client("tls.invalid", port);
+			return client.is_session_resumed() ? 1 : 0;
+		};
+		bool first_full = false, second_resumed = false, failed = false, after_failure_full = false;
+		try {
+			first_full = connect() == 0;
+			second_resumed = connect() == 1;
+			try {
+				connect();
+			}
+			catch (const dpp::connection_exception&) {
+				failed = true;
+			}
+			/* The session is forgotten after a failed handshake, so the next is a full one */
+			after_failure_full = connect() == 0;
+		}
+		catch (const std::exception& e) {
+			std::cout << "TLSRESUME: " << e.what() << "\n";
+		}
+		dpp::tls_handshake_stats after = dpp::get_tls_handshake_stats();
+		dpp::set_dns_resolver({});
+		bool stats_ok = after.full_handshakes - before.full_handshakes == 2 && after.resumed_handshakes - before.resumed_handshakes == 1 &&
+			after.resumed_handshake_time > before.resumed_handshake_time;
+		set_test(TLSRESUME, mock.is_listening() && first_full && second_resumed && failed && after_failure_full && stats_ok);
+	}
+#else
+	set_test(TLSRESUME, true);
+#endif
+
+	set_test(ZLIBSTREAM, false);
+	{
+		/* Two heartbeat ACKs from one zlib-stream, the first split over two frames */
+		const unsigned char first[] = {
+			0x78, 0x9c, 0xaa, 0x56, 0xca, 0x2f, 0x50, 0xb2, 0x32, 0x34, 0xd4, 0x51, 0x4a,
+			0x51, 0xb2, 0xca, 0x2b, 0xcd, 0xc9, 0xa9, 0x05, 0x00, 0x00, 0x00, 0xff, 0xff
+		};
+		const unsigned char second[] = { 0xaa, 0xc6, 0x10, 0x01, 0x00, 0x00, 0x00, 0xff, 0xff };
+		const std::string expected = "{\"op\":11,\"d\":null}";
+		dpp::zlibcontext z;
+		bool partial_ok = !z.feed(std::string_view((const char*)first, 10));
+		bool first_ok = z.feed(std::string_view((const char*)first + 10, sizeof(first) - 10)) && z.message() == expected;
+		bool second_ok = z.feed(std::string_view((const char*)second, sizeof(second))) && z.message() == expected;
+		dpp::decompression_stats stats = z.get_stats();
+		set_test(ZLIBSTREAM, partial_ok && first_ok && second_ok && stats.messages == 2 && stats.bytes_in == sizeof(first) + sizeof(second) && stats.bytes_out == expected.length() * 2);
+	}
+
+	set_test(ZSTDSTREAM, false);
+	if (dpp::zstdcontext::available()) {
+		/* Two heartbeat ACKs from one zstd-stream, flushed after each */
+		const unsigned char first[] = {
+			0x28, 0xb5, 0x2f, 0xfd, 0x00, 0x58, 0x90, 0x00, 0x00, 0x7b, 0x22, 0x6f, 0x70, 0x22,
+			0x3a, 0x31, 0x31, 0x2c, 0x22, 0x64, 0x22, 0x3a, 0x6e, 0x75, 0x6c, 0x6c, 0x7d
+		};
+		const unsigned char second[] = { 0x34, 0x00, 0x00, 0x00, 0x01, 0x00, 0xe5, 0x4d, 0x20 };
+		const std::string expected = "{\"op\":11,\"d\":null}";
+		dpp::zstdcontext z;
+		bool first_ok = z.feed(std::string_view((const char*)first, sizeof(first))) && z.message() == expected;
+		bool second_ok = z.feed(std::string_view((const char*)second, sizeof(second))) && z.message() == expected;
+		set_test(ZSTDSTREAM, first_ok && second_ok && z.get_stats().messages == 2);
+	} else {
+		bool refused = false;
+		try {
+			dpp::zstdcontext z;
+		}
+		catch (const dpp::logic_exception&) {
+			refused = true;
+		}
+		set_test(ZSTDSTREAM, refused);
+	}
+
+	set_test(ETFREADER, false);
+	try {
+		dpp::etf_parser etf;
+		dpp::json member = {
+			{"user", {{"id", "189759562910400512"}, {"username", "brain"}}},
+			{"nick", "Brain"}, {"roles", {"416737094522568706", "416737120858832906"}},
+			{"joined_at", "2021-03-15T14:45:31.411000+00:00"}, {"premium_since", nullptr},
+			{"flags", 2}, {"deaf", false}, {"mute", true}, {"avatar", "a_9c2b6b8ed4d7a4a11bd25a3b5bcc8bc6"}
+		};
+		dpp::json msg = {
+			{"id", "1234567890123456789"}, {"channel_id", "825411707521728511"}, {"content", "hello etf"},
+			{"timestamp", "2024-01-02T03:04:05.678000+00:00"}, {"edited_timestamp", nullptr}, {"tts", false},
+			{"mention_everyone", true}, {"pinned", false}, {"type", 19}, {"flags", 4}, {"nonce", "42"},
+			{"author", {{"id", "189759562910400512"}, {"username", "brain"}}},
+			{"embeds", {{{"title", "embedded"}}}}, {"mentions", dpp::json::array()}, {"attachments", dpp::json::array()}
+		};
+		dpp::json presence = {
+			{"user", {{"id", "189759562910400512"}}}, {"guild_id", "825407338755653642"}, {"status", "dnd"},
+			{"client_status", {{"desktop", "idle"}, {"web", "online"}}},
+			{"activities", {{{"name", "D++"}, {"type", 0}, {"created_at", 1234}}}}
+		};
+		/* Clients may send the nonce as an integer rather than a string */
+		dpp::json int_nonce_msg = msg;
+		int_nonce_msg["nonce"] = 1234567890123456789ULL;
+		dpp::json all = {{"member", member}, {"message", msg}, {"int_nonce_message", int_nonce_msg}, {"presence", presence}, {"skipped", {1, 2.5, "x", nullptr}}};
+		std::string encoded = etf.build(all);
+
+		dpp::guild_member m_etf, m_json;
+		dpp::message msg_etf, msg_json, int_nonce_etf, int_nonce_json;
+		dpp::presence p_etf, p_json;
+		dpp::cache_policy_t cp = {dpp::cp_none, dpp::cp_none, dpp::cp_none};
+		dpp::etf_reader r(encoded);
+		r.read_map([&](std::string_view key) {
+			if (key == "member") {
+				dpp::json user;
+				m_etf.fill_from_etf(r, 825407338755653642, &user);
+			} else if (key == "message") {
+				msg_etf.fill_from_etf(r, cp);
+			} else if (key == "int_nonce_message") {
+				int_nonce_etf.fill_from_etf(r, cp);
+			} else if (key == "presence") {
+				p_etf.fill_from_etf(r);
+			} else {
+				r.skip();
+			}
+		});
+		m_json.fill_from_json(&member, 825407338755653642, 189759562910400512);
+		msg_json.fill_from_json(&msg, cp);
+		int_nonce_json.fill_from_json(&int_nonce_msg, cp);
+		p_json.fill_from_json(&presence);
+
+		bool member_ok = m_etf.user_id == m_json.user_id && m_etf.get_nickname() == m_json.get_nickname() && m_etf.get_roles() == m_json.get_roles() &&
+			m_etf.joined_at == m_json.joined_at && m_etf.joined_at > 0 && m_etf.is_muted() && !m_etf.is_deaf() &&
+			m_etf.has_animated_guild_avatar() && m_etf.avatar == m_json.avatar;
+		bool message_ok = msg_etf.id == msg_json.id && msg_etf.channel_id == msg_json.channel_id && msg_etf.content == msg_json.content &&
+			msg_etf.sent == msg_json.sent && msg_etf.edited == msg_json.edited && msg_etf.mention_everyone && msg_etf.type == msg_json.type &&
+			msg_etf.flags == msg_json.flags && msg_etf.nonce == "42" && msg_etf.author.id == msg_json.author.id &&
+			msg_etf.embeds.size() == 1 && msg_etf.embeds[0].title == "embedded" &&
+			int_nonce_etf.nonce == int_nonce_json.nonce && int_nonce_etf.nonce == "1234567890123456789";
+		bool presence_ok = p_etf.user_id == p_json.user_id && p_etf.guild_id == p_json.guild_id && p_etf.flags == p_json.flags &&
+			p_etf.activities.size() == 1 && p_etf.activities[0].name == "D++" && p_etf.activities[0].created_at == p_json.activities[0].created_at;
+		/* A term read out raw decodes to the same json as the full parser produces */
+		dpp::etf_reader raw_reader(encoded);
+		dpp::json reparsed = dpp::json::object();
+		raw_reader.read_map([&](std::string_view key) {
+			reparsed[std::string(key)] = etf.parse_term(raw_reader.read_term());
+		});
+		set_test(ETFREADER, member_ok && message_ok && presence_ok && raw_reader.at_end() && reparsed == etf.parse(encoded));
+	}
+	catch (const std::exception& e) {
+		std::cout << "ETFREADER: " << e.what() << "\n";
+		set_test(ETFREADER, false);
+	}
+
+	set_test(JSONPARSER, false);
+	{
+		const std::string text = R"({"t":"MESSAGE_CREATE","s":-3,"op":0,"d":{"id":"1234","n":18446744073709551615,"f":0.5,"e":[],"o":{},"u":"\u00e9\ud83d\ude00","b":[true,false,null],"dup":1,"dup":2}})";
+		const std::string bigint = R"({"big":123456789012345678901234567890})";
+		bool same = true, invalid_throws = true;
+		for (auto backend : {dpp::jpb_nlohmann, dpp::jpb_simdjson}) {
+			if (!dpp::json_parser_available(backend)) {
+				continue;
+			}
+			json j = dpp::parse_json(text, backend);
+			same = same && j == json::parse(text) && j.dump() == json::parse(text).dump() && j["d"]["dup"] == 2;
+			same = same && dpp::parse_json(bigint, backend) == json::parse(bigint);
+			try {
+				dpp::parse_json("{\"op\":", backend);
+				invalid_throws = false;
+			}
+			catch (const json::exception&) {
+			}
+		}
+		bool unavailable_refused = dpp::json_parser_available(dpp::jpb_simdjson);
+		if (!unavailable_refused) {
+			try {
+				dpp::set_json_parser(dpp::jpb_simdjson);
+			}
+			catch (const dpp::logic_exception&) {
+				unavailable_refused = dpp::get_json_parser() == dpp::jpb_nlohmann;
+			}
+		}
+		set_test(JSONPARSER, same && invalid_throws && unavailable_refused && dpp::parse_json(text)["d"]["id"] == "1234");
+	}
+
+	set_test(RESTROUTE, false);
+	{
+		dpp::rest_route message = dpp::rest_route::from_path(dpp::m_patch, "/api/v" DISCORD_API_VERSION "/channels/81384788765712384/messages/1234567890123456789");
+		dpp::rest_route reaction = dpp::rest_route::from_path(dpp::m_put, "/api/v" DISCORD_API_VERSION "/channels/81384788765712384/messages/1234/reactions/%F0%9F%98%80/@me");
+		dpp::rest_route callback = dpp::rest_route::from_path(dpp::m_post, "/api/v" DISCORD_API_VERSION "/interactions/1234/aW50ZXJhY3Rpb24/callback");
+		dpp::rest_route me = dpp::rest_route::from_path(dpp::m_get, "/api/v" DISCORD_API_VERSION "/users/@me/guilds?limit=200");
+		set_test(RESTROUTE,
+			message.route == "PATCH /channels/:major/messages/:id" && message.major == "channels/81384788765712384" && message.global &&
+			reaction.route == "PUT /channels/:major/messages/:id/reactions/:emoji/@me" &&
+			callback.route == "POST /interactions/:major/:major/callback" && callback.major == "interactions/1234/aW50ZXJhY3Rpb24" && !callback.global &&
+			me.route == "GET /users/@me/guilds" && me.major.empty() &&
+			message.priority == dpp::hp_normal && callback.priority == dpp::hp_interaction &&
+			dpp::rest_route::from_path(dpp::m_get, "/api/v" DISCORD_API_VERSION "/guilds/825407338755653642/audit-logs?limit=100").priority == dpp::hp_bulk
+		);
+	}
+
+	set_test(RESTBUCKETS, false);
+#ifndef _WIN32
+	{
+		/* A mock of Discord's REST API. All routes under channel 1 share bucket "b1", which allows two
+		 * requests per 300ms and answers any more with a 429. Other channels are not limited.
+		 */
+		std::atomic<int> too_many{0};
+		std::mutex arrivals_mutex;
+		std::vector<std::pair<std::string, double>> arrivals;
+		auto window_end = std::chrono::steady_clock::now();
+		int used = 0;
+		mock_server mock([&](const std::string& in) {
+			std::string path = in.substr(in.find(' ') + 1);
+			path = path.substr(0, path.find(' '));
+			{
+				std::scoped_lock lock(arrivals_mutex);
+				arrivals.emplace_back(path, dpp::utility::time_f());
+			}
+			std::string status = "200 OK", headers, body = "{}";
+			if (path.find("/channels/1/") != std::string::npos) {
+				auto now = std::chrono::steady_clock::now();
+				if (now >= window_end) {
+					window_end = now + std::chrono::milliseconds(300);
+					used = 0;
+				}
+				std::string left = std::to_string(std::chrono::duration<double>(window_end - now).count());
+				if (used >= 2) {
+					status = "429 Too Many Requests";
+					body = "{\"message\":\"You are being rate limited.\",\"retry_after\":" + left + ",\"global\":false}";
+					too_many++;
+				} else {
+					used++;
+				}
+				headers = "X-RateLimit-Bucket: b1\r\nX-RateLimit-Limit: 2\r\nX-RateLimit-Remaining: " + std::to_string(2 - used) + "\r\nX-RateLimit-Reset-After: " + left + "\r\n";
+			}
+			return "HTTP/1.1 " + status + "\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.length()) + "\r\nConnection: close\r\n" + headers + "\r\n" + body;
+		});
+
+		/* Replay two routes which share a bucket, one unlimited route, then a burst against the global limit */
+		std::atomic<size_t> done{0}, errors{0};
+		std::promise<void> all_done;
+		const size_t expected = 6 + 1 + 15;
+		auto get = [&](const std::string& endpoint, const std::string& parameters) {
+			return std::make_unique<dpp::http_request>(endpoint, parameters, [&](const dpp::http_request_completion_t& rv) {
+				if (rv.status != 200) {
+					errors++;
+				}
+				if (++done == expected) {
+					all_done.set_value();
+				}
+			}, "", dpp::m_get, "", std::string());
+		};
+		{
+			dpp::request_queue bucketed(&mock.get_cluster(), 2);
+			dpp::request_queue global(&mock.get_cluster(), 2);
+			bucketed.set_base_url(mock.get_base_url());
+			global.set_base_url(bucketed.get_base_url()).set_global_rate_limit(10);
+			double start = dpp::utility::time_f();
+			for (int i = 0; i < 3; ++i) {
+				bucketed.post_request(get(API_PATH "/channels/1", "messages/" + std::to_string(i + 1)));
+				bucketed.post_request(get(API_PATH "/channels/1", "pins"));
+			}
+			bucketed.post_request(get(API_PATH "/channels/2", "messages"));
+			double global_start = dpp::utility::time_f();
+			for (int i = 0; i < 15; ++i) {
+				global.post_request(get(API_PATH "/channels/" + std::to_string(100 + i), "messages"));
+			}
+			bool finished = mock.is_listening() && all_done.get_future().wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+			/* Timed by when the server received each request */
+			std::scoped_lock lock(arrivals_mutex);
+			double last_b1 = 0, unlimited = 0, last_global = 0;
+			for (const auto& [path, when] : arrivals) {
+				if (path.find("/channels/1/") != std::string::npos) {
+					last_b1 = std::max(last_b1, when - start);
+				} else if (path.find("/channels/2/") != std::string::npos) {
+					unlimited = when - start;
+				} else {
+					last_global = std::max(last_global, when - global_start);
+				}
+			}
+			/* Six requests at two per 300ms take 600ms; whole-second timing would take two seconds */
+			set_test(RESTBUCKETS, finished && errors == 0 && too_many == 0 && last_b1 >= 0.55 && last_b1 < 1.5 && unlimited < 0.3 && last_global >= 0.45);
+		}
+	}
+#else
+	set_test(RESTBUCKETS, true);
+#endif
+
+	set_test(RESTPRIORITY, false);
+#ifndef _WIN32
+	{
+		/* Twenty bulk requests are queued ahead of one interaction response on one thread,
+		 * with a global limit of 4 per second. The interaction response must not wait its turn.
+		 */
+		std::mutex arrivals_mutex;
+		std::vector<std::string> arrivals;
+		mock_server mock([&](const std::string& in) {
+			{
+				std::scoped_lock lock(arrivals_mutex);
+				arrivals.emplace_back(in.substr(0, in.find("\r\n")));
+			}
+			return std::string("HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\n{}");
+		});
+
+		std::promise<void> responded;
+		{
+			dpp::request_queue queue(&mock.get_cluster(), 1);
+			queue.set_base_url(mock.get_base_url()).set_global_rate_limit(4);
+			for (int i = 0; i < 20; ++i) {
+				queue.post_request(std::make_unique<dpp::http_request>(API_PATH "/channels/" + std::to_string(100 + i), "messages", nullptr, "", dpp::m_get, "", std::string()));
+			}
+			/* An interaction followup, a webhook route marked as an interaction response as the cluster does */
+			auto followup = std::make_unique<dpp::http_request>(API_PATH "/webhooks/1/token", "messages/@original", [&](const dpp::http_request_completion_t&) {
+				responded.set_value();
+			}, "", dpp::m_patch, "", std::string());
+			followup->priority = dpp::hp_interaction;
+			queue.post_request(std::move(followup));
+			bool answered = mock.is_listening() && responded.get_future().wait_for(std::chrono::seconds(2)) == std::future_status::ready;
+			/* Let a few more bulk requests start as the global limit refills */
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+			dpp::queue_wait_stats interaction = queue.get_queue_wait_stats(dpp::hp_interaction);
+			dpp::queue_wait_stats bulk = queue.get_queue_wait_stats(dpp::hp_bulk);
+			size_t bulk_first;
+			{
+				std::scoped_lock lock(arrivals_mutex);
+				bulk_first = std::find_if(arrivals.begin(), arrivals.end(), [](const std::string& line) { return line.find("/webhooks/") != std::string::npos; }) - arrivals.begin();
+			}
+			/* Only the bulk requests which took the first part of the burst can have gone first */
+			set_test(RESTPRIORITY, answered && bulk_first <= 3 && interaction.requests == 1 && interaction.max_wait < 0.5 && bulk.requests >= 3 && bulk.max_wait > interaction.max_wait);
+		}
+	}
+#else
+	set_test(RESTPRIORITY, true);
+#endif
+
+	set_test(RESTASYNC, false);
+#ifndef _WIN32
+	{
+		/* A server which answers each connection on its own thread, and takes 1.5 seconds to answer any path containing "slow" */
+		mock_server mock([](const std::string& in) {
+			if (in.find("slow") != std::string::npos) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+			}
+			return std::string("HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\nok");
+		}, true);
+
+		/* All on one request thread: a slow request, a fast one, one with a deadline and one cancelled */
+		const std::string base = mock.get_base_url();
+		std::mutex results_mutex;
+		std::map<std::string, std::pair<dpp::http_error, double>> results;
+		std::promise<void> all_done;
+		double start = dpp::utility::time_f();
+		auto get = [&](const std::string& name) {
+			return std::make_unique<dpp::http_request>(base + "/" + name, [&, name](const dpp::http_request_completion_t& rv) {
+				std::scoped_lock lock(results_mutex);
+				results[name] = {rv.error, dpp::utility::time_f() - start};
+				if (results.size() == 4) {
+					all_done.set_value();
+				}
+			});
+		};
+		{
+			dpp::request_queue queue(&mock.get_cluster(), 1);
+			queue.post_request(get("slow/1"));
+			queue.post_request(get("fast"));
+			auto with_deadline = get("slow/2");
+			with_deadline->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+			queue.post_request(std::move(with_deadline));
+			auto to_cancel = get("slow/3");
+			dpp::http_request* cancelled = to_cancel.get();
+			queue.post_request(std::move(to_cancel));
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			cancelled->cancel();
+			bool finished = mock.is_listening() && all_done.get_future().wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+			std::scoped_lock lock(results_mutex);
+			set_test(RESTASYNC, finished &&
+				results["fast"].first == dpp::h_success && results["fast"].second < 0.5 &&
+				results["slow/1"].first == dpp::h_success && results["slow/1"].second >= 1.4 &&
+				results["slow/2"].first == dpp::h_deadline && results["slow/2"].second < 1.0 &&
+				results["slow/3"].first == dpp::h_cancelled && results["slow/3"].second < 1.0
+			);
+		}
+	}
+#else
+	set_test(RESTASYNC, true);
+#endif
+
+	set_test(HTTPCOMPRESSION, false);
+#ifndef _WIN32
+	{
+		/* The mock server echoes the gzipped request body back as a gzip encoded,
+		 * chunked response, so the body must survive compression both ways.
+		 */
+		std::string request_headers;
+		mock_server mock([&](const std::string& in) {
+			size_t body_start = in.find("\r\n\r\n") + 4;
+			request_headers = in.substr(0, body_start);
+			std::string body = in.substr(body_start);
+			size_t half = body.length() / 2;
+			std::stringstream out;
+			out << "HTTP/1.1 200 OK\r\nContent-Encoding: gzip\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n";
+			out << std::hex << half << "\r\n" << body.substr(0, half) << "\r\n";
+			out << std::hex << body.length() - half << "\r\n" << body.substr(half) << "\r\n0\r\n\r\n";
+			return out.str();
+		});
+
+		std::string payload = "{\"content\":\"" + std::string(8000, 'a') + "\"}";
+		std::promise<std::string> echoed;
+		{
+			dpp::request_queue queue(&mock.get_cluster(), 1);
+			queue.set_base_url(mock.get_base_url());
+			auto req = std::make_unique<dpp::http_request>(API_PATH "/channels/1", "messages", [&](const dpp::http_request_completion_t& rv) {
+				echoed.set_value(rv.body);
+			}, payload, dpp::m_post, "", std::string());
+			req->compress_request = true;
+			queue.post_request(std::move(req));
+			auto result = echoed.get_future();
+			bool answered = mock.is_listening() && result.wait_for(std::chrono::seconds(5)) == std::future_status::ready;
+			auto stats = queue.get_transfer_stats()["POST /channels/:major/messages"];
+			set_test(HTTPCOMPRESSION, answered && result.get() == payload &&
+				request_headers.find("Accept-Encoding: gzip, deflate\r\n") != std::string::npos &&
+				request_headers.find("Content-Encoding: gzip\r\n") != std::string::npos &&
+				stats.responses == 1 && stats.compressed_requests == 1 && stats.uncompressed == payload.length() &&
+				stats.sent < payload.length() / 10 && stats.received == stats.sent && stats.decoded == payload.length() &&
+				stats.bytes_saved() > static_cast<int64_t>(payload.length())
+			);
+		}
+	}
+#else
+	set_test(HTTPCOMPRESSION, true);
+#endif
+
+	set_test(HTTPSTREAMING, false);
+#ifndef _WIN32
+	{
+		/* A 1MB upload is read from a source and a 1MB chunked download is passed to a
+		 * sink, a piece at a time, without either being held whole by the client.
+		 */
+		constexpr size_t body_size = 1024 * 1024;
+		auto pattern = [](size_t i) {
+			return static_cast<char>('a' + (i * 7) % 26);
+		};
+		std::atomic<bool> upload_ok{false};
+		mock_server mock([&](const std::string& in) {
+			size_t body_start = in.find("\r\n\r\n") + 4;
+			bool ok = in.length() == body_start + body_size;
+			for (size_t i = 0; ok && i < body_size; ++i) {
+				ok = in[body_start + i] == pattern(i);
+			}
+			upload_ok = ok;
+			std::string out = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n";
+			for (size_t sent = 0; sent < body_size; sent += 65536) {
+				std::stringstream len;
+				len << std::hex << 65536 << "\r\n";
+				out += len.str();
+				for (size_t i = sent; i < sent + 65536; ++i) {
+					out += pattern(i);
+				}
+				out += "\r\n";
+			}
+			out += "0\r\n\r\n";
+			return out;
+		});
+
+		std::promise<dpp::http_request_completion_t> done;
+		size_t pieces = 0, largest_read = 0, received = 0;
+		bool download_ok = true;
+		{
+			dpp::request_queue queue(&mock.get_cluster(), 1);
+			auto req = std::make_unique<dpp::http_request>(mock.get_base_url() + "/upload", [&](const dpp::http_request_completion_t& rv) {
+				done.set_value(rv);
+			}, dpp::m_post, "", "application/octet-stream");
+			req->body_source_length = body_size;
+			req->body_source = [&, offset = size_t{0}](char* buffer, size_t max) mutable {
+				largest_read = std::max(largest_read, max);
+				size_t n = std::min(max, body_size - offset);
+				for (size_t i = 0; i < n; ++i) {
+					buffer[i] = pattern(offset + i);
+				}
+				offset += n;
+				return n;
+			};
+			req->body_sink = [&](std::string_view piece) {
+				for (size_t i = 0; download_ok && i < piece.length(); ++i) {
+					download_ok = piece[i] == pattern(received + i);
+				}
+				received += piece.length();
+				pieces++;
+			};
+			queue.post_request(std::move(req));
+			auto result = done.get_future();
+			bool answered = mock.is_listening() && result.wait_for(std::chrono::seconds(10)) == std::future_status::ready;
+			dpp::http_request_completion_t rv = answered ? result.get() : dpp::http_request_completion_t{};
+			set_test(HTTPSTREAMING, answered && rv.status == 200 && rv.body.empty() && upload_ok && largest_read <= 16 * 1024 &&
+				download_ok && received == body_size && pieces > 1
+			);
+		}
+
+		/* A streamed multipart body is the same as one built whole */
+		std::vector<std::string> names{"a.txt", "b.bin"}, contents{"hello", std::string(100000, 'x')}, types{"text/plain", ""};
+		std::string json = "{\"content\":\"files\"}";
+		dpp::multipart_content whole = dpp::https_client::build_multipart(json, names, contents, types);
+		dpp::multipart_stream streamed = dpp::https_client::stream_multipart(json, names, contents, types);
+		std::string joined(streamed.length, '\0');
+		auto source = streamed.source();
+		size_t got = 0;
+		for (size_t n; (n = source(joined.data() + got, std::min<size_t>(4096, joined.size() - got))) > 0;) {
+			got += n;
+		}
+		if (got != whole.body.length() || joined != whole.body || streamed.mimetype != whole.mimetype) {
+			set_test(HTTPSTREAMING, false);
+		}
+	}
+#else
+	set_test(HTTPSTREAMING, true);
+#endif
+
+	set_test(HPACK, false);
+	{
+		auto from_hex = [](const std::string& hex) {
+			std::string out;
+			for (size_t i = 0; i + 1 < hex.length(); i += 2) {
+				out += static_cast<char>(std::stoi(hex.substr(i, 2), nullptr, 16));
+			}
+			return out;
+		};
+		/* RFC 7541 C.4.1 and C.4.2: Huffman coded requests, the second referring to the dynamic table */
+		dpp::hpack_decoder decoder;
+		std::vector<dpp::hpack_field> first, second;
+		bool rfc_ok = decoder.decode(from_hex("828684418cf1e3c2e5f23a6ba0ab90f4ff"), first) && decoder.decode(from_hex("828684be5886a8eb10649cbf"), second);
+		rfc_ok = rfc_ok && first == std::vector<dpp::hpack_field>{{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}};
+		rfc_ok = rfc_ok && second.size() == 5 && second[3] == dpp::hpack_field{":authority", "www.example.com"} && second[4] == dpp::hpack_field{"cache-control", "no-cache"};
+		rfc_ok = rfc_ok && dpp::hpack_encoder::huffman_encode("www.example.com") == from_hex("f1e3c2e5f23a6ba0ab90f4ff");
+
+		/* Headers repeated on every request cost a byte each the second time */
+		dpp::hpack_encoder encoder;
+		dpp::hpack_decoder round_trip;
+		std::vector<dpp::hpack_field> fields{{":method", "POST"}, {":path", "/api/v10/channels/1/messages"}, {"authorization", "Bot " + std::string(72, 'x')}, {"user-agent", dpp::http_version}, {"content-type", "application/json"}};
+		std::string block1 = encoder.encode(fields), block2 = encoder.encode(fields);
+		std::vector<dpp::hpack_field> decoded1, decoded2;
+		bool trip_ok = round_trip.decode(block1, decoded1) && round_trip.decode(block2, decoded2) && decoded1 == fields && decoded2 == fields;
+		std::vector<dpp::hpack_field> bad;
+		bool rejects = !dpp::hpack_decoder().decode(from_hex("ff"), bad) && !dpp::hpack_decoder().decode(from_hex("be"), bad);
+		set_test(HPACK, rfc_ok && trip_ok && rejects && block2.length() < 40 && block2.length() * 4 < block1.length());
+	}
+
+	set_test(HTTP2, false);
+#ifndef _WIN32
+	{
+		/* Many requests to a mock h2c server, which holds back its answers until a batch
+		 * of streams is open on a connection, so the requests must share connections.
+		 */
+		constexpr size_t request_count = 200, batch = 20;
+		std::atomic<size_t> accepted{0}, most_open{0};
+		mock_server mock([&](int listener, const std::atomic<bool>& listening) {
+			struct h2_conn {
+				int fd;
+				std::string in;
+				bool preface{false};
+				dpp::hpack_decoder decoder;
+				dpp::hpack_encoder encoder;
+				std::map<uint32_t, std::string> requests;
+			};
+			auto frame = [](std::string& out, uint8_t type, uint8_t flags, uint32_t id, std::string_view payload) {
+				out += static_cast<char>(payload.length() >> 16);
+				out += static_cast<char>(payload.length() >> 8);
+				out += static_cast<char>(payload.length());
+				out += static_cast<char>(type);
+				out += static_cast<char>(flags);
+				for (int shift = 24; shift >= 0; shift -= 8) {
+					out += static_cast<char>(id >> shift);
+				}
+				out += payload;
+			};
+			auto answer = [&](h2_conn& c) {
+				std::string out;
+				for (auto& [id, path] : c.requests) {
+					frame(out, 0x1, 0x4, id, c.encoder.encode({{":status", "200"}, {"content-type", "text/plain"}}));
+					frame(out, 0x0, 0x1, id, path);
+				}
+				c.requests.clear();
+				send_all(c.fd, out);
+			};
+			std::vector<std::unique_ptr<h2_conn>> conns;
+			while (listening) {
+				std::vector<pollfd> fds{{listener, POLLIN, 0}};
+				for (auto& c : conns) {
+					fds.push_back({c->fd, POLLIN, 0});
+				}
+				if (::poll(fds.data(), fds.size(), 50) <= 0) {
+					/* Nothing more is coming for now, answer the stragglers */
+					for (auto& c : conns) {
+						answer(*c);
+					}
+					continue;
+				}
+				if (fds[0].revents & POLLIN) {
+					int fd = ::accept(listener, nullptr, nullptr);
+					if (fd >= 0) {
+						accepted++;
+						auto c = std::make_unique<h2_conn>();
+						c->fd = fd;
+						std::string settings;
+						frame(settings, 0x4, 0, 0, std::string("\x00\x03\x00\x00\x00\x64", 6));
+						send_all(fd, settings);
+						conns.emplace_back(std::move(c));
+					}
+				}
+				for (size_t i = 1; i < fds.size(); ++i) {
+					if (!(fds[i].revents & (POLLIN | POLLHUP))) {
+						continue;
+					}
+					h2_conn& c = *conns[i - 1];
+					char buf[65536];
+					ssize_t n = ::recv(c.fd, buf, sizeof(buf), 0);
+					if (n <= 0) {
+						continue;
+					}
+					c.in.append(buf, n);
+					if (!c.preface && c.in.length() >= 24) {
+						c.preface = c.in.substr(0, 24) == "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+						c.in.erase(0, 24);
+					}
+					std::string out;
+					while (c.preface && c.in.length() >= 9) {
+						size_t length = (static_cast<uint8_t>(c.in[0]) << 16) | (static_cast<uint8_t>(c.in[1]) << 8) | static_cast<uint8_t>(c.in[2]);
+						if (c.in.length() < 9 + length) {
+							break;
+						}
+						uint8_t type = c.in[3], flags = c.in[4];
+						uint32_t id = ((static_cast<uint8_t>(c.in[5]) & 0x7f) << 24) | (static_cast<uint8_t>(c.in[6]) << 16) | (static_cast<uint8_t>(c.in[7]) << 8) | static_cast<uint8_t>(c.in[8]);
+						std::string payload = c.in.substr(9, length);
+						c.in.erase(0, 9 + length);
+						if (type == 0x4 && !(flags & 0x1)) {
+							frame(out, 0x4, 0x1, 0, "");
+						} else if (type == 0x1) {
+							std::vector<dpp::hpack_field> fields;
+							c.decoder.decode(payload, fields);
+							for (auto& [name, value] : fields) {
+								if (name == ":path") {
+									c.requests[id] = value;
+								}
+							}
+						}
+					}
+					send_all(c.fd, out);
+					size_t open = c.requests.size();
+					for (size_t seen = most_open; open > seen && !most_open.compare_exchange_weak(seen, open);) {
+					}
+					if (open >= batch) {
+						answer(c);
+					}
+				}
+			}
+			for (auto& c : conns) {
+				::close(c->fd);
+			}
+		});
+
+		std::mutex results_mutex;
+		std::promise<void> all_done;
+		size_t completed = 0, correct = 0;
+		{
+			dpp::request_queue queue(&mock.get_cluster());
+			queue.get_http2_pool().set_max_connections_per_host(2);
+			for (size_t i = 0; i < request_count; ++i) {
+				std::string path = "/item/" + std::to_string(i);
+				queue.post_request(std::make_unique<dpp::http_request>(mock.get_base_url() + path, [&, path](const dpp::http_request_completion_t& rv) {
+					std::lock_guard lock(results_mutex);
+					correct += rv.status == 200 && rv.body == path ? 1 : 0;
+					if (++completed == request_count) {
+						all_done.set_value();
+					}
+				}, dpp::m_get, "", "text/plain", std::multimap<std::string, std::string>{}, "2"));
+			}
+			bool answered = mock.is_listening() && all_done.get_future().wait_for(std::chrono::seconds(20)) == std::future_status::ready;
+			dpp::http2_pool_stats stats = queue.get_http2_pool().get_stats();
+			std::lock_guard lock(results_mutex);
+			set_test(HTTP2, answered && correct == request_count && accepted <= 2 && most_open >= batch &&
+				stats.streams == request_count && stats.connections_opened == accepted && stats.peak_streams >= batch
+			);
+		}
+	}
+#else
+	set_test(HTTP2, true);
+#endif
+
+	set_test(WSLEGACYFRAME, false);
+	{
+		/* A websocket client written against the old handle_frame signature is still given frames */
+		class legacy_client : public dpp::websocket_client {
+		public:
+			std::string received;
+			legacy_client() : dpp::websocket_client("localhost", "80", "/", dpp::OP_TEXT, false) { }
+			bool handle_frame(const std::string& buffer, dpp::ws_opcode opcode) override {
+				received = buffer;
+				return opcode == dpp::OP_TEXT;
+			}
+		};
+		legacy_client legacy;
+		dpp::websocket_client* client = &legacy;
+		bool handled = client->handle_frame(std::string_view("{\"op\":11}"), dpp::OP_TEXT);
+		set_test(WSLEGACYFRAME, handled && legacy.received == "{\"op\":11}");
+	}
+
+	set_test(GATEWAYQUEUE, false);
+	{
+		/* Nothing is sent on a shard which is not connected, so everything stays queued */
+		dpp::cluster gateway_cluster("");
+		dpp::discord_client shard(&gateway_cluster, 0, 1, "");
+		for (int i = 0; i < 3; ++i) {
+			shard.queue_message("{\"op\":8,\"d\":{\"guild_id\":\"1\"}}", false, "members:1");
+		}
+		shard.queue_message("{\"op\":8,\"d\":{\"guild_id\":\"2\"}}", false, "members:2");
+		shard.queue_message("{\"op\":4,\"d\":{\"guild_id\":\"1\",\"channel_id\":\"5\"}}", false, "voice:1");
+		shard.queue_message("{\"op\":4,\"d\":{\"guild_id\":\"1\",\"channel_id\":null}}", false, "voice:1");
+		shard.queue_message("{\"op\":3}");
+		shard.queue_message("{\"op\":3}");
+		bool coalesced = shard.get_queue_size() == 5;
+		/* Nothing has been sent, so the whole gateway limit of 120 is left, less the 4 reserved sends */
+		bool budget = shard.get_send_budget() == 120 - 4;
+		shard.clear_queue();
+		set_test(GATEWAYQUEUE, coalesced && budget && shard.get_queue_size() == 0);
+	}
+
+	set_test(TIMERWHEEL, false);
+	{
+		/* Timers in every wheel, and one beyond the reach of all of them, must fire on the exact millisecond */
+		dpp::timer_wheel wheel(false);
+		std::map<dpp::timer, int64_t> due_at, fired_at;
+		int64_t now = 0;
+		for (int64_t delay : {1LL, 255LL, 256LL, 257LL, 65535LL, 65536LL, 70001LL, 16777221LL, 4294967296LL + 1000}) {
+			due_at[wheel.add(std::chrono::milliseconds(delay), std::chrono::milliseconds(0), [&](dpp::timer t) {
+				fired_at[t] = now;
+			})] = delay;
+		}
+		bool exact = true;
+		for (auto& [handle, delay] : due_at) {
+			now = delay - 1;
+			wheel.advance(std::chrono::milliseconds(now));
+			exact = exact && fired_at.count(handle) == 0;
+			now = delay;
+			wheel.advance(std::chrono::milliseconds(now));
+			exact = exact && fired_at.count(handle) == 1 && fired_at[handle] == delay;
+		}
+
+		/* A repeating timer which cancels itself on its third tick, and one cancelled before it ever ticks */
+		int ticks = 0, stops = 0;
+		dpp::timer repeating = wheel.add(std::chrono::milliseconds(50), std::chrono::milliseconds(100), [&](dpp::timer t) {
+			if (++ticks == 3) {
+				wheel.cancel(t);
+			}
+		}, [&](dpp::timer) {
+			stops++;
+		});
+		dpp::timer never = wheel.add(std::chrono::milliseconds(10), std::chrono::milliseconds(0), [&](dpp::timer) {
+			ticks += 100;
+		});
+		bool cancelled = wheel.cancel(never, false) && !wheel.cancel(never);
+		int64_t base = now;
+		for (int64_t step = 0; step <= 1000; ++step) {
+			wheel.advance(std::chrono::milliseconds(base + step));
+		}
+		bool repeats = ticks == 3 && stops == 1 && !wheel.cancel(repeating) && wheel.size() == 0;
+
+		/* Cluster timers tick on the wheel's own thread, with no shards running */
+		dpp::cluster timer_cluster("");
+		std::atomic<int> cluster_ticks{0};
+		std::promise<void> stopped;
+		dpp::timer th = timer_cluster.start_timer([&](dpp::timer) {
+			cluster_ticks++;
+		}, std::chrono::milliseconds(20), [&](dpp::timer) {
+			stopped.set_value();
+		});
+		for (int i = 0; i < 100 && cluster_ticks < 5; ++i) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		}
+		bool threaded = cluster_ticks >= 5 && timer_cluster.stop_timer(th) && stopped.get_future().wait_for(std::chrono::seconds(1)) == std::future_status::ready;
+
+		/* A wheel destroyed by one of its own timers calls no further timers, with and without a driver thread */
+		bool self_destruct = true;
+		for (bool start_thread : {false, true}) {
+			dpp::timer_wheel* doomed = new dpp::timer_wheel(start_thread);
+			std::atomic<int> after_delete{0};
+			std::promise<void> deleted;
+			dpp::timer later = doomed->add(std::chrono::milliseconds(6), std::chrono::milliseconds(0), [&](dpp::timer) {
+				after_delete++;
+			});
+			doomed->add(std::chrono::milliseconds(6), std::chrono::milliseconds(1), [&](dpp::timer) {
+				after_delete++;
+			});
+			doomed->add(std::chrono::milliseconds(5), std::chrono::milliseconds(0), [&](dpp::timer) {
+				doomed->cancel(later, false);
+				delete doomed;
+				deleted.set_value();
+			});
+			if (!start_thread) {
+				doomed->advance(std::chrono::milliseconds(10));
+			}
+			self_destruct = self_destruct && deleted.get_future().wait_for(std::chrono::seconds(1)) == std::future_status::ready;
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			self_destruct = self_destruct && after_delete == 0;
+		}
+		set_test(TIMERWHEEL, exact && cancelled && repeats && threaded && self_destruct);
+	}
+
+	set_test(CACHEGC, false);
+	{
+		/* Removed and replaced objects wait in the deletion queue, and a sparse cache gives back its buckets */
+		dpp::cache<dpp::user> gc_cache;
+		for (uint64_t i = 1; i <= 1000; ++i) {
+			dpp::user* u = new dpp::user();
+			u->id = i;
+			gc_cache.store(u);
+		}
+		dpp::user* replaced = new dpp::user();
+		replaced->id = 1;
+		gc_cache.store(replaced);
+		for (uint64_t i = 1; i <= 1000; ++i) {
+			gc_cache.remove(gc_cache.find(i));
+		}
+		dpp::gc_stats before = dpp::get_gc_stats();
+		dpp::garbage_collection();
+		dpp::gc_stats after = dpp::get_gc_stats();
+		bool queued = after.runs == before.runs + 1 && after.objects_pending >= 1001 && after.objects_freed == before.objects_freed;
+		bool shrunk = gc_cache.count() == 0 && gc_cache.shrink() && !gc_cache.shrink();
+		set_test(CACHEGC, queued && shrunk && after.last_pause_ms <= after.max_pause_ms);
+	}
+
+	set_test(CACHESTRIPES, false);
+	{
+		/* Lookups without a lock while other threads replace and remove objects, then iterate the stripes */
+		dpp::cache<dpp::user> striped;
+		for (uint64_t i = 1; i <= 10000; ++i) {
+			dpp::user* u = new dpp::user();
+			u->id = i;
+			striped.store(u);
+		}
+		std::atomic<bool> stop{false}, mismatch{false};
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 2; ++t) {
+			threads.emplace_back([&striped, &stop, &mismatch, t]() {
+				std::mt19937 rng(t);
+				while (!stop) {
+					uint64_t id = rng() % 20000 + 1;
+					dpp::user* u = striped.find(id);
+					if (u && u->id != id) {
+						mismatch = true;
+					}
+				}
+			});
+		}
+		for (int t = 0; t < 2; ++t) {
+			threads.emplace_back([&striped, t]() {
+				std::mt19937 rng(t + 2);
+				for (int n = 0; n < 20000; ++n) {
+					uint64_t id = rng() % 20000 + 1;
+					if (n % 3 == 0) {
+						striped.remove(striped.find(id));
+					} else {
+						dpp::user* u = new dpp::user();
+						u->id = id;
+						striped.store(u);
+					}
+				}
+			});
+		}
+		for (size_t t = 2; t < threads.size(); ++t) {
+			threads[t].join();
+		}
+		stop = true;
+		threads[0].join();
+		threads[1].join();
+
+		uint64_t iterated = 0;
+		bool consistent = true;
+		{
+			std::shared_lock l(striped.get_mutex());
+			auto& container = striped.get_container();
+			for (auto i = container.begin(); i != container.end(); ++i) {
+				iterated++;
+				consistent = consistent && i->second->id == i->first && striped.find(i->first) == i->second;
+			}
+			consistent = consistent && container.find(30000) == container.end() && container.size() == iterated;
+		}
+		set_test(CACHESTRIPES, !mismatch && consistent && iterated == striped.count() && iterated > 0);
+	}
+
+	set_test(FLATMAP, false);
+	{
+		/* The same random inserts and erases on a flat_map and an unordered_map, compared as they go */
+		dpp::flat_map<dpp::snowflake, uint64_t> flat;
+		std::unordered_map<dpp::snowflake, uint64_t> reference;
+		std::mt19937_64 rng(7);
+		bool same = true;
+		for (int n = 0; n < 100000 && same; ++n) {
+			dpp::snowflake id = rng() % 5000;
+			uint64_t op = rng() % 4;
+			if (op == 0) {
+				same = flat.erase(id) == reference.erase(id);
+			} else if (op == 1) {
+				flat[id] = n;
+				reference[id] = n;
+			} else if (op == 2) {
+				same = flat.try_emplace(id, n).second == reference.try_emplace(id, n).second;
+			} else {
+				auto f = flat.find(id);
+				auto r = reference.find(id);
+				same = (f == flat.end()) == (r == reference.end()) && (f == flat.end() || f->second == r->second);
+			}
+			same = same && flat.size() == reference.size();
+		}
+		for (auto& [id, value] : reference) {
+			same = same && flat.contains(id) && flat.at(id) == value;
+		}
+
+		/* Erase every odd value while iterating, using the iterator erase() returns */
+		dpp::flat_map<dpp::snowflake, uint64_t> copy(flat);
+		for (auto i = copy.begin(); i != copy.end();) {
+			i = (i->second & 1) ? copy.erase(i) : std::next(i);
+		}
+		for (auto i = reference.begin(); i != reference.end();) {
+			i = (i->second & 1) ? reference.erase(i) : std::next(i);
+		}
+		for (auto& [id, value] : reference) {
+			same = same && copy.count(id) == 1 && copy.at(id) == value;
+		}
+		bool thrown = false;
+		try {
+			copy.at(999999);
+		}
+		catch (const std::out_of_range&) {
+			thrown = true;
+		}
+
+		dpp::flat_map<dpp::snowflake, uint64_t> moved(std::move(copy));
+		set_test(FLATMAP, same && thrown && moved.size() == reference.size() && copy.empty() && flat != moved);
+	}
+
+	set_test(MEMBERINTERN, false);
+	{
+		/* Members filled with the same roles and nickname share them, and changing one member leaves the other alone */
+		using role_list = dpp::interned<std::vector<dpp::snowflake>, dpp::snowflake_list_hash>;
+		size_t lists_before = role_list::pool_size();
+		bool shared = false, separate = false, kept = false;
+		{
+			dpp::json j = {
+				{"roles", {"825407338755653642", "825407338755653643"}},
+				{"nick", "Shared nick"},
+				{"joined_at", "2021-03-26T12:34:56.789000+00:00"},
+			};
+			dpp::guild_member first, second;
+			first.fill_from_json(&j, 825407338755653641, 189759562910400512);
+			second.fill_from_json(&j, 825407338755653641, 189759562910400513);
+			shared = &first.get_roles() == &second.get_roles() && first.get_roles().size() == 2 &&
+				first.get_nickname() == "Shared nick" && role_list::pool_size() == lists_before + 1;
+
+			second.add_role(825407338755653644);
+			separate = first.get_roles().size() == 2 && second.get_roles().size() == 3 && role_list::pool_size() == lists_before + 2;
+			second.remove_role(825407338755653644);
+			kept = &first.get_roles() == &second.get_roles() && role_list::pool_size() == lists_before + 1 && second.get_nickname() == "Shared nick";
+		}
+		set_test(MEMBERINTERN, shared && separate && kept && role_list::pool_size() == lists_before);
+	}
+
+	set_test(GUILDLOCK, false);
+	{
+		/* Writers keep members and channels the same size; readers check they never see them differ */
+		dpp::guild g;
+		g.id = 825407338755653641;
+		std::atomic<bool> stop{false}, torn{false};
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 2; ++t) {
+			threads.emplace_back([&g, &stop, &torn]() {
+				while (!stop) {
+					bool ok = g.read([](const dpp::guild& g) {
+						size_t counted = 0;
+						for (auto& m : g.members) {
+							counted += m.second.user_id == m.first;
+						}
+						return counted == g.members.size() && g.members.size() == g.channels.size();
+					});
+					if (!ok) {
+						torn = true;
+					}
+				}
+			});
+		}
+		for (int t = 0; t < 2; ++t) {
+			threads.emplace_back([&g, t]() {
+				std::mt19937 rng(t);
+				for (int n = 0; n < 5000; ++n) {
+					dpp::snowflake id = rng() % 500 + 1;
+					g.write([id](dpp::guild& g) {
+						if (g.members.erase(id)) {
+							g.channels.erase(std::find(g.channels.begin(), g.channels.end(), id));
+						} else {
+							dpp::guild_member gm;
+							gm.user_id = id;
+							g.members[id] = gm;
+							g.channels.push_back(id);
+						}
+					});
+				}
+			});
+		}
+		for (size_t t = 2; t < threads.size(); ++t) {
+			threads[t].join();
+		}
+		stop = true;
+		threads[0].join();
+		threads[1].join();
+
+		/* A copy taken while the guild is locked has its own, unlocked mutex */
+		bool copy_unlocked = false;
+		dpp::guild snapshot = g.read([&copy_unlocked](const dpp::guild& g) {
+			dpp::guild copy = g;
+			copy_unlocked = copy.get_mutex().try_lock();
+			if (copy_unlocked) {
+				copy.get_mutex().unlock();
+			}
+			return copy;
+		});
+		set_test(GUILDLOCK, !torn && copy_unlocked && snapshot.members.size() == g.members.size() && snapshot.channels == g.channels);
+	}
+
+	set_test(CACHESNAPSHOT, false);
+	{
+		auto queued = [](dpp::managed* object) {
+			std::lock_guard<std::mutex> delete_lock(dpp::deletion_mutex);
+			return dpp::deletion_queue.count(object) == 1;
+		};
+		dpp::cache<dpp::user> users;
+		dpp::user* first = new dpp::user();
+		first->id = 1;
+		first->username = "first";
+		users.store(first);
+		std::shared_ptr<const dpp::user> handle = users.get(1);
+		bool same = handle.get() == first && users.get(1) == handle && !users.get(2);
+
+		/* Replacing the object leaves the handle on the old version, which is not deleted while held */
+		dpp::user* second = new dpp::user(*first);
+		second->username = "second";
+		users.store(second);
+		bool kept = handle->username == "first" && users.get(1)->username == "second" && !queued(first);
+		handle.reset();
+		bool released = queued(first);
+		users.remove(second);
+		bool removed = !users.get(1) && queued(second);
+
+		/* Handles taken while another thread keeps replacing the object */
+		std::atomic<bool> stop{false}, mismatch{false};
+		std::thread reader([&users, &stop, &mismatch]() {
+			while (!stop) {
+				auto u = users.get(5);
+				if (u && (u->id != 5 || u->username.empty())) {
+					mismatch = true;
+				}
+			}
+		});
+		for (int n = 0; n < 10000; ++n) {
+			dpp::user* u = new dpp::user();
+			u->id = 5;
+			u->username = "version " + std::to_string(n);
+			users.store(u);
+		}
+		stop = true;
+		reader.join();
+		set_test(CACHESNAPSHOT, same && kept && released && removed && !mismatch && users.get(5)->username == "version 9999");
+	}
+
+	set_test(MPMCQUEUE, false);
+	{
+		/* Four producers and four consumers; every value must come out exactly once */
+		dpp::mpmc_queue<uint64_t> queue(64);
+		constexpr uint64_t per_producer = 20000;
+		std::atomic<uint64_t> popped{0}, sum{0};
+		std::vector<std::thread> threads;
+		for (uint64_t p = 0; p < 4; ++p) {
+			threads.emplace_back([&queue, p]() {
+				for (uint64_t i = 1; i <= per_producer; ++i) {
+					uint64_t v = p * per_producer + i;
+					while (!queue.try_push(v)) {
+						std::this_thread::yield();
+					}
+				}
+			});
+		}
+		for (int c = 0; c < 4; ++c) {
+			threads.emplace_back([&]() {
+				uint64_t v;
+				while (popped.load() < 4 * per_producer) {
+					if (queue.try_pop(v)) {
+						sum += v;
+						popped++;
+					} else {
+						std::this_thread::yield();
+					}
+				}
+			});
+		}
+		for (auto& t : threads) {
+			t.join();
+		}
+		uint64_t n = 4 * per_producer;
+		uint64_t v;
+		set_test(MPMCQUEUE, queue.capacity() == 64 && popped == n && sum == n * (n + 1) / 2 && !queue.try_pop(v) && queue.size_approx() == 0);
+	}
+
+	set_test(RESTCOMPLETION, false);
+	{
+		/* Two requests which fail at once, as nothing listens on the port. The first
+		 * callback is slow, which must not hold up the second.
+		 */
+		dpp::cluster mock_cluster("");
+		std::promise<double> fast_done;
+		std::atomic<bool> slow_done{false};
+		double start = dpp::utility::time_f();
+		{
+			dpp::request_queue queue(&mock_cluster, 1, 2);
+			queue.post_request(std::make_unique<dpp::http_request>("http://127.0.0.1:1/slow", [&](const dpp::http_request_completion_t&) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+				slow_done = true;
+			}));
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			queue.post_request(std::make_unique<dpp::http_request>("http://127.0.0.1:1/fast", [&](const dpp::http_request_completion_t&) {
+				fast_done.set_value(dpp::utility::time_f() - start);
+			}));
+			auto fast = fast_done.get_future();
+			bool answered = fast.wait_for(std::chrono::seconds(5)) == std::future_status::ready;
+			set_test(RESTCOMPLETION, queue.get_completion_thread_count() == 2 && answered && fast.get() < 1.0 && !slow_done);
+		}
+	}
+
 	set_test(TIMESTAMPTOSTRING, false);
 	set_test(TIMESTAMPTOSTRING, dpp::ts_to_string(1642611864) == "2022-01-19T17:04:24Z");
 
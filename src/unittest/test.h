@@ -128,6 +128,34 @@ DPP_TEST(CUSTOMCACHE, "Instantiate a cache", tf_offline);
 DPP_TEST(MSGCOLLECT, "message_collector", tf_online);
 DPP_TEST(TS, "managed::get_creation_date()", tf_online);
 DPP_TEST(READFILE, "utility::read_file()", tf_offline);
+DPP_TEST(SOCKETENGINE, "socket_engine_base event dispatch", tf_offline);
+DPP_TEST(CONNECTIONPOOL, "connection_pool reuse and eviction", tf_offline);
+DPP_TEST(DNSCACHE, "dns cache ordering, failover, refresh and expiry", tf_offline);
+DPP_TEST(ADDRFAILOVER, "ssl_client connect() and connect_async() move past refused addresses", tf_offline);
+DPP_TEST(TLSRESUME, "ssl_client resumes TLS sessions by host name, and counts full and resumed handshakes", tf_offline);
+DPP_TEST(ZLIBSTREAM, "zlib-stream decompression across frames", tf_offline);
+DPP_TEST(ZSTDSTREAM, "zstd-stream decompression, or refusal without libzstd", tf_offline);
+DPP_TEST(ETFREADER, "etf_reader direct decoding matches the json path", tf_offline);
+DPP_TEST(JSONPARSER, "json parser backends build identical trees", tf_offline);
+DPP_TEST(RESTROUTE, "rest_route templates and major parameters", tf_offline);
+DPP_TEST(RESTBUCKETS, "request_queue rate limit buckets and global limit against a mock server", tf_offline);
+DPP_TEST(RESTPRIORITY, "request_queue starts interaction responses ahead of bulk requests", tf_offline);
+DPP_TEST(RESTASYNC, "request_queue concurrent requests, deadlines and cancellation against a slow mock server", tf_offline);
+DPP_TEST(HTTPCOMPRESSION, "https_client gzip request bodies and chunked gzip responses against a mock server", tf_offline);
+DPP_TEST(HTTPSTREAMING, "https_client streamed request and response bodies against a mock server", tf_offline);
+DPP_TEST(HPACK, "HPACK header compression against RFC 7541 examples and a round trip", tf_offline);
+DPP_TEST(HTTP2, "HTTP/2 requests multiplexed over a few connections to a mock h2c server", tf_offline);
+DPP_TEST(WSLEGACYFRAME, "websocket_client subclasses overriding the deprecated handle_frame signature", tf_offline);
+DPP_TEST(GATEWAYQUEUE, "discord_client send queue coalescing and gateway send budget", tf_offline);
+DPP_TEST(TIMERWHEEL, "timer_wheel millisecond accuracy, cancellation, destruction from a timer and cluster timers without shards", tf_offline);
+DPP_TEST(CACHEGC, "incremental cache garbage collection queueing, statistics and sparse cache shrinking", tf_offline);
+DPP_TEST(CACHESTRIPES, "striped cache lookups without locks during concurrent stores and removals, and iteration", tf_offline);
+DPP_TEST(FLATMAP, "flat_map insert, lookup, erase while iterating and copy, against std::unordered_map", tf_offline);
+DPP_TEST(MEMBERINTERN, "guild_member shares equal role lists and nicknames between members", tf_offline);
+DPP_TEST(GUILDLOCK, "guild read and write visitors with concurrent readers and writers, and copying a locked guild", tf_offline);
+DPP_TEST(CACHESNAPSHOT, "cache::get handles outliving replacement and removal of the object", tf_offline);
+DPP_TEST(MPMCQUEUE, "mpmc_queue with concurrent producers and consumers", tf_offline);
+DPP_TEST(RESTCOMPLETION, "request_queue completion threads run callbacks concurrently", tf_offline);
 DPP_TEST(TIMESTAMPTOSTRING, "ts_to_string()", tf_offline);
 DPP_TEST(TIMESTRINGTOTIMESTAMP, "ts_not_null()", tf_offline);
 DPP_TEST(OPTCHOICE_DOUBLE, "command_option_choice::fill_from_json: double", tf_offline);
@@ -517,6 +545,101 @@ double get_start_time();
  */
 double get_time();
 
+#ifndef _WIN32
+/**
+ * @brief A server on an ephemeral loopback port, for offline tests of the HTTP
+ * clients against a mock of the API. It owns a cluster for the clients under test
+ * to report to, and stops and joins its threads when destroyed.
+ */
+class mock_server {
+public:
+	/**
+	 * @brief Answer an HTTP/1.1 request. Given the whole request, its headers and any
+	 * Content-Length body, return the whole response, or an empty string to send nothing.
+	 * The connection is closed once the response is sent.
+	 */
+	using responder_t = std::function<std::string(const std::string& request)>;
+
+	/**
+	 * @brief Serve the listening socket directly, for protocols other than HTTP/1.1.
+	 * Runs on the server thread and must return once listening is cleared.
+	 */
+	using serve_t = std::function<void(int listener, const std::atomic<bool>& listening)>;
+
+	/**
+	 * @brief Start an HTTP/1.1 server
+	 * @param responder answers each request
+	 * @param thread_per_connection if true, each connection is answered on its own
+	 * thread, so that a slow response does not hold up the others
+	 */
+	mock_server(responder_t responder, bool thread_per_connection = false);
+
+	/**
+	 * @brief Start a server which serves its listening socket itself
+	 * @param serve runs on the server thread
+	 */
+	mock_server(serve_t serve);
+
+	/**
+	 * @brief Stop listening, and join the server thread and any connection threads
+	 */
+	~mock_server();
+
+	/**
+	 * @brief Check the server is listening
+	 * @return true if the listening socket was set up
+	 */
+	bool is_listening() const;
+
+	/**
+	 * @brief Get the port the server listens on
+	 * @return port number
+	 */
+	uint16_t get_port() const;
+
+	/**
+	 * @brief Get the URL of the server, e.g. http://127.0.0.1:12345
+	 * @return base URL
+	 */
+	std::string get_base_url() const;
+
+	/**
+	 * @brief Get the cluster for the clients under test
+	 * @return cluster with no token
+	 */
+	dpp::cluster& get_cluster();
+
+private:
+	/**
+	 * @brief Bind and listen on an ephemeral loopback port
+	 */
+	void listen();
+
+	/**
+	 * @brief Read one request from a connection, answer it and close it
+	 * @param fd connection
+	 */
+	void answer(int fd);
+
+	int listener{-1};
+	uint16_t port{0};
+	std::atomic<bool> listening{false};
+	responder_t responder;
+	dpp::cluster cluster{""};
+	std::mutex connections_mutex;
+	std::vector<std::thread> connections;
+	std::thread server;
+};
+
+/**
+ * @brief Send all of a buffer on a blocking socket
+ * @param fd socket
+ * @param data data to send
+ * @return true if it was all sent
+ */
+bool send_all(int fd, std::string_view data);
+#endif
+
 /**
  * @brief A test version of the message collector for use in unit tests
  */
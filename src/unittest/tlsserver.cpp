@@ -0,0 +1,84 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors 
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#include "tlsserver.h"
+
+#ifndef _WIN32
+#include <memory>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <openssl/evp.h>
+
+/**
+ * @brief Make a server context with a new EC key and a self-signed certificate for it
+ * @return context, or nullptr on failure
+ */
+static std::unique_ptr<SSL_CTX, decltype(&SSL_CTX_free)> make_server_context() {
+	std::unique_ptr<SSL_CTX, decltype(&SSL_CTX_free)> ctx(SSL_CTX_new(TLS_server_method()), SSL_CTX_free);
+	std::unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)> key_ctx(EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr), EVP_PKEY_CTX_free);
+	EVP_PKEY* generated = nullptr;
+	if (key_ctx && EVP_PKEY_keygen_init(key_ctx.get()) == 1 && EVP_PKEY_CTX_set_ec_paramgen_curve_nid(key_ctx.get(), NID_X9_62_prime256v1) == 1) {
+		EVP_PKEY_keygen(key_ctx.get(), &generated);
+	}
+	std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> key(generated, EVP_PKEY_free);
+	std::unique_ptr<X509, decltype(&X509_free)> cert(X509_new(), X509_free);
+	if (!ctx || !key || !cert) {
+		return {nullptr, SSL_CTX_free};
+	}
+	ASN1_INTEGER_set(X509_get_serialNumber(cert.get()), 1);
+	X509_gmtime_adj(X509_getm_notBefore(cert.get()), 0);
+	X509_gmtime_adj(X509_getm_notAfter(cert.get()), 3600);
+	X509_set_pubkey(cert.get(), key.get());
+	X509_NAME_add_entry_by_txt(X509_get_subject_name(cert.get()), "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+	X509_set_issuer_name(cert.get(), X509_get_subject_name(cert.get()));
+	if (X509_sign(cert.get(), key.get(), EVP_sha256()) <= 0 || SSL_CTX_use_certificate(ctx.get(), cert.get()) != 1 ||
+		SSL_CTX_use_PrivateKey(ctx.get(), key.get()) != 1 || SSL_CTX_set_max_proto_version(ctx.get(), TLS1_2_VERSION) != 1) {
+		return {nullptr, SSL_CTX_free};
+	}
+	return ctx;
+}
+
+void serve_tls(int listener, const std::atomic<bool>& listening, int drop_connection) {
+	auto ctx = make_server_context();
+	for (int count = 1; listening; ++count) {
+		int c = ::accept(listener, nullptr, nullptr);
+		if (c < 0) {
+			break;
+		}
+		if (ctx && count != drop_connection) {
+			SSL* ssl = SSL_new(ctx.get());
+			SSL_set_fd(ssl, c);
+			if (SSL_accept(ssl) == 1) {
+				/* Wait for the client to hang up */
+				char buf[256];
+				while (SSL_read(ssl, buf, sizeof(buf)) > 0) {
+				}
+				/* Answer close_notify, or OpenSSL drops the session from the server's cache */
+				SSL_shutdown(ssl);
+			}
+			SSL_free(ssl);
+		}
+		::close(c);
+	}
+}
+#endif
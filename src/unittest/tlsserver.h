@@ -0,0 +1,39 @@
+/************************************************************************************
+ *
+ * D++, A Lightweight C++ library for Discord
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright 2021 Craig Edwards and D++ contributors 
+ * (https://github.com/brainboxdotcc/DPP/graphs/contributors)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ ************************************************************************************/
+#pragma once
+
+#ifndef _WIN32
+#include <atomic>
+
+/**
+ * @brief Serve TLS 1.2 on a listening loopback socket until listening is cleared, with a
+ * throwaway self-signed certificate. Each connection is held open until the client hangs up.
+ * This is kept apart from test.h, as OpenSSL's headers clash with the names of its tests.
+ * TLS 1.2 is used so that clients are given their session at the end of the handshake,
+ * rather than in a ticket after it which they would only read later.
+ * @param listener listening socket
+ * @param listening cleared when the server should stop
+ * @param drop_connection number of a connection, counting from 1, to close before its
+ * handshake so that the client's handshake fails; 0 for none
+ */
+void serve_tls(int listener, const std::atomic<bool>& listening, int drop_connection);
+#endif
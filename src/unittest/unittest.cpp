@@ -22,6 +22,12 @@
 #include "test.h"
 #include <dpp/dpp.h>
 #include <dpp/json.h>
+#ifndef _WIN32
+	#include <sys/socket.h>
+	#include <netinet/in.h>
+	#include <arpa/inet.h>
+	#include <unistd.h>
+#endif
 
 double start = dpp::utility::time_f();
 bool offline = false;
@@ -205,3 +211,113 @@ void wait_for_tests() {
 		}
 	}
 }
+
+#ifndef _WIN32
+mock_server::mock_server(responder_t on_request, bool thread_per_connection) : responder(std::move(on_request)) {
+	listen();
+	if (!listening) {
+		return;
+	}
+	server = std::thread([this, thread_per_connection]() {
+		while (listening) {
+			int c = ::accept(listener, nullptr, nullptr);
+			if (c < 0) {
+				break;
+			}
+			if (thread_per_connection) {
+				std::scoped_lock lock(connections_mutex);
+				connections.emplace_back([this, c]() {
+					answer(c);
+				});
+			} else {
+				answer(c);
+			}
+		}
+	});
+}
+
+mock_server::mock_server(serve_t serve) {
+	listen();
+	if (!listening) {
+		return;
+	}
+	server = std::thread([this, serve]() {
+		serve(listener, listening);
+	});
+}
+
+mock_server::~mock_server() {
+	listening = false;
+	if (listener >= 0) {
+		::shutdown(listener, SHUT_RDWR);
+	}
+	if (server.joinable()) {
+		server.join();
+	}
+	if (listener >= 0) {
+		::close(listener);
+	}
+	for (auto& c : connections) {
+		c.join();
+	}
+}
+
+void mock_server::listen() {
+	listener = ::socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr{};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addr_len = sizeof(addr);
+	listening = listener >= 0 && ::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 && ::listen(listener, 64) == 0 && ::getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &addr_len) == 0;
+	port = ntohs(addr.sin_port);
+}
+
+void mock_server::answer(int fd) {
+	std::string in;
+	char buf[65536];
+	size_t body_start = std::string::npos, length = 0;
+	while (body_start == std::string::npos || in.length() < body_start + length) {
+		ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+		if (n <= 0) {
+			break;
+		}
+		in.append(buf, n);
+		if (body_start == std::string::npos && in.find("\r\n\r\n") != std::string::npos) {
+			body_start = in.find("\r\n\r\n") + 4;
+			size_t cl = in.find("Content-Length: ");
+			length = cl != std::string::npos && cl < body_start ? std::stoul(in.substr(cl + 16)) : 0;
+		}
+	}
+	if (body_start != std::string::npos) {
+		send_all(fd, responder(in));
+	}
+	::close(fd);
+}
+
+bool mock_server::is_listening() const {
+	return listening;
+}
+
+uint16_t mock_server::get_port() const {
+	return port;
+}
+
+std::string mock_server::get_base_url() const {
+	return "http://127.0.0.1:" + std::to_string(port);
+}
+
+dpp::cluster& mock_server::get_cluster() {
+	return cluster;
+}
+
+bool send_all(int fd, std::string_view data) {
+	for (size_t sent = 0; sent < data.length();) {
+		ssize_t n = ::send(fd, data.data() + sent, data.length() - sent, MSG_NOSIGNAL);
+		if (n <= 0) {
+			return false;
+		}
+		sent += n;
+	}
+	return true;
+}
+#endif